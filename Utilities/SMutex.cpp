@@ -1,10 +1,19 @@
 #include "stdafx.h"
 #include "Emu/System.h"
 #include "Emu/CPU/CPUThread.h"
+#include "Emu/CPU/CPUThreadManager.h"
 
 #include "Utilities/SMutex.h"
 
+waiter_map_t g_smutex_wm("smutex_wm");
+
 bool SM_IsAborted()
 {
 	return Emu.IsStopped();
 }
+
+void SM_Notify(u64 signal_id, u32 tid)
+{
+	// wake up only the chosen thread if it's known (mutex passed to another thread)
+	g_smutex_wm.notify(signal_id, tid ? Emu.GetCPU().GetThread(tid) : nullptr);
+}
@@ -1,7 +1,11 @@
 #pragma once
 #include "Emu/Memory/atomic_type.h"
+#include "Utilities/Thread.h"
 
 bool SM_IsAborted();
+void SM_Notify(u64 signal_id, u32 tid); // wake up threads waiting on the mutex (only tid if it's nonzero)
+
+extern waiter_map_t g_smutex_wm;
 
 enum SMutexResult
 {
@@ -76,6 +80,12 @@ public:
 			return SMR_FAILED;
 		}
 
+		// nobody has to be woken up if the caller is the new owner (see lock_for()), unless the mutex has been destroyed this way
+		if (tid == GetDeadValue())
+		{
+			notify();
+		}
+
 		return SMR_OK;
 	}
 
@@ -101,27 +111,85 @@ public:
 			return SMR_PERMITTED;
 		}
 
+		if (to == tid)
+		{
+			// nothing changed
+		}
+		else if (to == GetFreeValue() || to == GetDeadValue())
+		{
+			notify();
+		}
+		else
+		{
+			notify_owner();
+		}
+
 		return SMR_OK;
 	}
 
 	SMutexResult lock(T tid, u64 timeout = 0)
 	{
-		u64 counter = 0;
+		SMutexResult res = SMR_FAILED;
+		const auto start = std::chrono::steady_clock::now();
 
-		while (true)
+		g_smutex_wm.wait_op((u64)this, [&]() -> bool
 		{
-			switch (SMutexResult res = trylock(tid))
+			switch (res = trylock(tid))
 			{
 				case SMR_FAILED: break;
-				default: return res;
+				default: return true;
 			}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-			if (timeout && counter++ > timeout)
+			if (timeout && std::chrono::steady_clock::now() - start > std::chrono::milliseconds(timeout))
 			{
-				return SMR_TIMEOUT;
+				res = SMR_TIMEOUT;
+				return true;
 			}
+
+			return false;
+		});
+
+		return res == SMR_FAILED ? SMR_ABORT : res;
+	}
+
+	// lock the mutex on behalf of another thread and wake it up if it's sleeping in wait_for()
+	SMutexResult lock_for(T tid, u64 timeout = 0)
+	{
+		const SMutexResult res = lock(tid, timeout);
+
+		if (res == SMR_OK && g_smutex_wm.has_waiters())
+		{
+			SM_Notify((u64)this, (u32)tid);
+		}
+
+		return res;
+	}
+
+	// sleep until the mutex is passed to tid, until stop_func() returns true or until the emulator is stopped
+	template<typename F> void wait_for(T tid, const F& stop_func)
+	{
+		g_smutex_wm.wait_op((u64)this, [&]() -> bool
+		{
+			return GetOwner() == tid || stop_func();
+		});
+	}
+
+	// wake up all threads waiting on the mutex (when the state it guards has changed)
+	void notify()
+	{
+		if (g_smutex_wm.has_waiters())
+		{
+			SM_Notify((u64)this, 0);
+		}
+	}
+
+	// wake up the thread which the mutex has been passed to
+	void notify_owner()
+	{
+		if (g_smutex_wm.has_waiters())
+		{
+			const T value = GetOwner();
+			SM_Notify((u64)this, value == GetFreeValue() || value == GetDeadValue() ? 0 : (u32)value);
 		}
 	}
 };
@@ -2,117 +2,244 @@
 
 static const volatile bool sq_no_wait = true;
 
-template<typename T, u32 SQSize = 666>
+// Bounded ring buffer queue.
+// Push/Pop don't take any lock: every slot carries a sequence number which tells whether it is ready to be written or read.
+// Blocked threads are parked on a condition variable and woken up by the opposite side as soon as the queue state changes,
+// the wait is periodically interrupted to check Emu.IsStopped() and *do_exit (they are set without notification).
+// MultiProducer = false avoids the CAS on the producer side, MultiConsumer = false on the consumer side
+// (Pop, Peek and Clear must be called from the same thread then).
+template<typename T, u32 SQSize = 666, bool MultiProducer = true, bool MultiConsumer = true>
 class SQueue
 {
-	mutable std::mutex m_mutex;
-	u32 m_pos;
-	u32 m_count;
-	T m_data[SQSize];
+	struct slot_t
+	{
+		std::atomic<u64> seq;
+		T data;
+	};
 
-public:
-	SQueue()
-		: m_pos(0)
-		, m_count(0)
+	slot_t m_data[SQSize];
+	std::atomic<u64> m_push_pos;
+	std::atomic<u64> m_pop_pos;
+
+	std::mutex m_wait_mutex;
+	std::condition_variable m_push_cv; // signaled when some slot was released
+	std::condition_variable m_pop_cv; // signaled when some slot was filled
+	std::atomic<u32> m_push_waiters;
+	std::atomic<u32> m_pop_waiters;
+
+	bool is_aborted(const volatile bool* do_exit) const
 	{
+		return Emu.IsStopped() || (do_exit && *do_exit);
 	}
 
-	u32 GetSize() const
+	// the slot at the push position is free (the predicates don't use GetCount(), push position is taken before the slot is written)
+	bool can_push() const
 	{
-		return SQSize;
+		const u64 pos = m_push_pos.load();
+
+		return m_data[pos % SQSize].seq.load() == pos;
 	}
 
-	bool IsFull() const volatile
+	// the slot at the pop position (+ offset) has been written
+	bool can_pop(u32 offset = 0) const
 	{
-		return m_count == SQSize;
+		const u64 pos = m_pop_pos.load() + offset;
+
+		return m_data[pos % SQSize].seq.load() == pos + 1;
 	}
 
-	bool Push(const T& data, const volatile bool* do_exit)
+	void notify(std::atomic<u32>& waiters, std::condition_variable& cv)
 	{
-		while (true)
+		// pairs with the waiter registration in wait()
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (waiters.load(std::memory_order_relaxed))
 		{
-			if (m_count >= SQSize)
-			{
-				if (Emu.IsStopped() || (do_exit && *do_exit))
-				{
-					return false;
-				}
+			std::lock_guard<std::mutex> lock(m_wait_mutex);
+			cv.notify_all();
+		}
+	}
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				continue;
-			}
+	template<typename F> void wait(std::atomic<u32>& waiters, std::condition_variable& cv, const F& is_ready)
+	{
+		std::unique_lock<std::mutex> lock(m_wait_mutex);
 
-			{
-				std::lock_guard<std::mutex> lock(m_mutex);
+		waiters++;
 
-				if (m_count >= SQSize) continue;
+		if (!is_ready())
+		{
+			cv.wait_for(lock, std::chrono::milliseconds(1));
+		}
+
+		waiters--;
+	}
+
+	// reserve the slot for writing, returns false if the queue is full
+	bool try_push_pos(u64& pos)
+	{
+		while (true)
+		{
+			pos = m_push_pos.load(std::memory_order_relaxed);
 
-				m_data[(m_pos + m_count++) % SQSize] = data;
+			const s64 diff = (s64)(m_data[pos % SQSize].seq.load(std::memory_order_acquire) - pos);
 
+			if (diff < 0)
+			{
+				return false;
+			}
+			else if (diff > 0)
+			{
+				continue; // another producer took this position
+			}
+			else if (!MultiProducer)
+			{
+				m_push_pos.store(pos + 1, std::memory_order_relaxed);
+				return true;
+			}
+			else if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
 				return true;
 			}
 		}
 	}
 
-	bool Pop(T& data, const volatile bool* do_exit)
+	// reserve the slot for reading, returns false if the queue is empty
+	bool try_pop_pos(u64& pos)
 	{
 		while (true)
 		{
-			if (!m_count)
-			{
-				if (Emu.IsStopped() || (do_exit && *do_exit))
-				{
-					return false;
-				}
+			pos = m_pop_pos.load(std::memory_order_relaxed);
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				continue;
+			const s64 diff = (s64)(m_data[pos % SQSize].seq.load(std::memory_order_acquire) - (pos + 1));
+
+			if (diff < 0)
+			{
+				return false;
+			}
+			else if (diff > 0)
+			{
+				continue; // another consumer took this position
+			}
+			else if (!MultiConsumer)
+			{
+				m_pop_pos.store(pos + 1, std::memory_order_relaxed);
+				return true;
+			}
+			else if (m_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				return true;
 			}
+		}
+	}
 
+public:
+	SQueue()
+		: m_push_pos(0)
+		, m_pop_pos(0)
+		, m_push_waiters(0)
+		, m_pop_waiters(0)
+	{
+		for (u32 i = 0; i < SQSize; i++)
+		{
+			m_data[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	u32 GetSize() const
+	{
+		return SQSize;
+	}
+
+	u32 GetCount() const
+	{
+		const u64 pop_pos = m_pop_pos.load();
+		const u64 push_pos = m_push_pos.load();
+
+		return push_pos > pop_pos ? (u32)std::min<u64>(push_pos - pop_pos, SQSize) : 0;
+	}
+
+	bool IsFull() const
+	{
+		return GetCount() == SQSize;
+	}
+
+	bool Push(const T& data, const volatile bool* do_exit)
+	{
+		u64 pos;
+
+		while (!try_push_pos(pos))
+		{
+			if (is_aborted(do_exit))
 			{
-				std::lock_guard<std::mutex> lock(m_mutex);
+				return false;
+			}
 
-				if (!m_count) continue;
+			wait(m_push_waiters, m_push_cv, [this]() { return can_push(); });
+		}
 
-				data = m_data[m_pos];
-				m_pos = (m_pos + 1) % SQSize;
-				m_count--;
+		slot_t& slot = m_data[pos % SQSize];
+		slot.data = data;
+		slot.seq.store(pos + 1, std::memory_order_release);
 
-				return true;
+		notify(m_pop_waiters, m_pop_cv);
+		return true;
+	}
+
+	bool Pop(T& data, const volatile bool* do_exit)
+	{
+		u64 pos;
+
+		while (!try_pop_pos(pos))
+		{
+			if (is_aborted(do_exit))
+			{
+				return false;
 			}
+
+			wait(m_pop_waiters, m_pop_cv, [this]() { return can_pop(); });
 		}
+
+		slot_t& slot = m_data[pos % SQSize];
+		data = slot.data;
+		slot.seq.store(pos + SQSize, std::memory_order_release);
+
+		notify(m_push_waiters, m_push_cv);
+		return true;
 	}
 
 	void Clear()
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		m_count = 0;
+		u64 pos;
+
+		while (try_pop_pos(pos))
+		{
+			m_data[pos % SQSize].seq.store(pos + SQSize, std::memory_order_release);
+		}
+
+		notify(m_push_waiters, m_push_cv);
 	}
 
 	bool Peek(T& data, const volatile bool* do_exit, u32 pos = 0)
 	{
 		while (true)
 		{
-			if (m_count <= pos)
+			const u64 peek_pos = m_pop_pos.load(std::memory_order_relaxed) + pos;
+
+			if (pos < SQSize && m_data[peek_pos % SQSize].seq.load(std::memory_order_acquire) == peek_pos + 1)
 			{
-				if (Emu.IsStopped() || (do_exit && *do_exit))
-				{
-					return false;
-				}
-				
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				continue;
+				data = m_data[peek_pos % SQSize].data;
+				return true;
 			}
 
+			if (is_aborted(do_exit))
 			{
-				std::lock_guard<std::mutex> lock(m_mutex);
-				if (m_count > pos)
-				{
-					break;
-				}
+				return false;
 			}
+
+			wait(m_pop_waiters, m_pop_cv, [this, pos]() { return pos < SQSize && can_pop(pos); });
 		}
-		data = m_data[(m_pos + pos) % SQSize];
-		return true;
 	}
 };
+
+template<typename T, u32 SQSize = 666> using SPSCQueue = SQueue<T, SQSize, false>; // Clear() may be called by the producer
+template<typename T, u32 SQSize = 666> using MPSCQueue = SQueue<T, SQSize, true, false>;
@@ -2,6 +2,7 @@
 #include "Emu/System.h"
 #include "Log.h"
 #include "Thread.h"
+#include <deque>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -81,11 +82,21 @@ void NamedThreadBase::SetThreadName(const std::string& name)
 void NamedThreadBase::WaitForAnySignal(u64 time) // wait for Notify() signal or sleep
 {
 	std::unique_lock<std::mutex> lock(m_signal_mtx);
-	m_signal_cv.wait_for(lock, std::chrono::milliseconds(time));
+
+	// the signal isn't lost if Notify() was called before the wait
+	if (!m_signaled)
+	{
+		m_signal_cv.wait_for(lock, std::chrono::milliseconds(time));
+	}
+
+	m_signaled = false;
 }
 
 void NamedThreadBase::Notify() // wake up waiting thread or nothing
 {
+	std::lock_guard<std::mutex> lock(m_signal_mtx);
+
+	m_signaled = true;
 	m_signal_cv.notify_one();
 }
 
@@ -245,6 +256,199 @@ bool thread::joinable() const
 	return m_thr.joinable();
 }
 
+// Workers are started on the first parallel call and live until the process exits.
+// They never touch the emulator state by themselves, so they aren't counted in g_thread_count.
+class thread_pool_t
+{
+	struct job_t
+	{
+		const std::string name;
+		const u32 count;
+		const std::function<void(u32)>& func;
+		std::atomic<u32> next;
+		std::atomic<u32> done;
+
+		job_t(const std::string& name, u32 count, const std::function<void(u32)>& func)
+			: name(name)
+			, count(count)
+			, func(func)
+			, next(0)
+			, done(0)
+		{
+		}
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv; // new job queued or exit requested
+	std::condition_variable m_done_cv; // some job completed
+	std::deque<std::shared_ptr<job_t>> m_jobs;
+	std::vector<std::thread> m_workers;
+	bool m_exit;
+
+	// returns false if there is no index left in the job
+	static bool run_one(job_t& job, const std::string& thread_name)
+	{
+		const u32 i = job.next++;
+
+		if (i >= job.count)
+		{
+			return false;
+		}
+
+		try
+		{
+			job.func(i);
+		}
+		catch (const char* e)
+		{
+			LOG_ERROR(GENERAL, "%s: %s", thread_name.c_str(), e);
+		}
+		catch (const std::string& e)
+		{
+			LOG_ERROR(GENERAL, "%s: %s", thread_name.c_str(), e.c_str());
+		}
+
+		return true;
+	}
+
+	void complete(job_t& job)
+	{
+		if (++job.done == job.count)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done_cv.notify_all();
+		}
+	}
+
+	void worker(u32 index)
+	{
+		SetCurrentThreadDebugName(fmt::Format("Parallel Worker[%d]", index).c_str());
+
+		NamedThreadBase info;
+		SetCurrentNamedThread(&info);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (!m_exit)
+		{
+			if (m_jobs.empty())
+			{
+				m_cv.wait(lock);
+				continue;
+			}
+
+			const auto job = m_jobs.front();
+
+			if (job->next >= job->count)
+			{
+				// all indices are taken, the owner is waiting for the last calls to complete
+				m_jobs.pop_front();
+				continue;
+			}
+
+			lock.unlock();
+
+			info.SetThreadName(fmt::Format("%s[%d]", job->name.c_str(), index));
+
+			while (run_one(*job, info.GetThreadName()))
+			{
+				complete(*job);
+			}
+
+			lock.lock();
+		}
+
+		SetCurrentNamedThread(nullptr);
+	}
+
+public:
+	thread_pool_t()
+		: m_exit(false)
+	{
+	}
+
+	~thread_pool_t()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+			m_cv.notify_all();
+		}
+
+		for (auto& t : m_workers)
+		{
+			t.join();
+		}
+	}
+
+	void run(const std::string& name, u32 count, const std::function<void(u32)>& func)
+	{
+		const auto job = std::make_shared<job_t>(name, count, func);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_workers.empty())
+			{
+				const u32 workers_count = std::max<u32>(std::thread::hardware_concurrency(), 2) - 1;
+
+				for (u32 t = 0; t < workers_count; t++)
+				{
+					m_workers.emplace_back(&thread_pool_t::worker, this, t);
+				}
+			}
+
+			m_jobs.push_back(job);
+			m_cv.notify_all();
+		}
+
+		// help the workers, it also guarantees progress if called from a worker
+		const NamedThreadBase* const current = GetCurrentNamedThread();
+		const std::string thread_name = current ? current->GetThreadName() : name;
+
+		while (run_one(*job, thread_name))
+		{
+			complete(*job);
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (job->done < count)
+		{
+			m_done_cv.wait(lock);
+		}
+
+		// workers may have not noticed that the job is finished yet
+		for (auto it = m_jobs.begin(); it != m_jobs.end(); it++)
+		{
+			if (*it == job)
+			{
+				m_jobs.erase(it);
+				break;
+			}
+		}
+	}
+};
+
+static thread_pool_t g_thread_pool;
+
+void thread_parallel_for(const std::string& name, u32 count, const std::function<void(u32)>& func)
+{
+	const u32 threads_count = std::min<u32>(std::max<u32>(std::thread::hardware_concurrency(), 1), count);
+
+	if (threads_count <= 1)
+	{
+		for (u32 i = 0; i < count; i++)
+		{
+			func(i);
+		}
+
+		return;
+	}
+
+	g_thread_pool.run(name, count, func);
+}
+
 bool waiter_map_t::is_stopped(u64 signal_id)
 {
 	if (Emu.IsStopped())
@@ -255,16 +459,16 @@ bool waiter_map_t::is_stopped(u64 signal_id)
 	return false;
 }
 
-void waiter_map_t::waiter_reg_t::init()
+bool waiter_map_t::waiter_reg_t::init()
 {
-	if (thread) return;
-
-	thread = GetCurrentNamedThread();
+	if (thread || !(thread = GetCurrentNamedThread())) return false;
 
 	std::lock_guard<std::mutex> lock(map.m_mutex);
 
 	// add waiter
 	map.m_waiters.push_back({ signal_id, thread });
+	map.m_waiters_count++;
+	return true;
 }
 
 waiter_map_t::waiter_reg_t::~waiter_reg_t()
@@ -279,6 +483,7 @@ waiter_map_t::waiter_reg_t::~waiter_reg_t()
 		if (map.m_waiters[i].signal_id == signal_id && map.m_waiters[i].thread == thread)
 		{
 			map.m_waiters.erase(map.m_waiters.begin() + i);
+			map.m_waiters_count--;
 			return;
 		}
 	}
@@ -289,7 +494,7 @@ waiter_map_t::waiter_reg_t::~waiter_reg_t()
 
 void waiter_map_t::notify(u64 signal_id)
 {
-	if (!m_waiters.size()) return;
+	if (!has_waiters()) return;
 
 	std::lock_guard<std::mutex> lock(m_mutex);
 
@@ -302,3 +507,24 @@ void waiter_map_t::notify(u64 signal_id)
 		}
 	}
 }
+
+void waiter_map_t::notify(u64 signal_id, NamedThreadBase* thread)
+{
+	if (!thread)
+	{
+		return notify(signal_id);
+	}
+
+	if (!has_waiters()) return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// find the specified waiter and signal
+	for (auto& v : m_waiters)
+	{
+		if (v.signal_id == signal_id && v.thread == thread)
+		{
+			v.thread->Notify();
+		}
+	}
+}
@@ -7,15 +7,16 @@ class NamedThreadBase
 	std::string m_name;
 	std::condition_variable m_signal_cv;
 	std::mutex m_signal_mtx;
+	bool m_signaled; // Notify() was called and wasn't consumed by WaitForAnySignal() yet
 
 public:
 	std::atomic<bool> m_tls_assigned;
 
-	NamedThreadBase(const std::string& name) : m_name(name), m_tls_assigned(false)
+	NamedThreadBase(const std::string& name) : m_name(name), m_signaled(false), m_tls_assigned(false)
 	{
 	}
 
-	NamedThreadBase() : m_tls_assigned(false)
+	NamedThreadBase() : m_signaled(false), m_tls_assigned(false)
 	{
 	}
 
@@ -71,6 +72,9 @@ public:
 	bool joinable() const;
 };
 
+// Run func(i) for every i in [0, count) on the persistent worker pool (the calling thread takes part too), returns when all calls are done
+void thread_parallel_for(const std::string& name, u32 count, const std::function<void(u32)>& func);
+
 class s_mutex_t
 {
 
@@ -125,6 +129,7 @@ class waiter_map_t
 	};
 
 	std::vector<waiter_t> m_waiters;
+	std::atomic<u32> m_waiters_count; // m_waiters.size() readable without the lock
 
 	std::string m_name;
 
@@ -143,14 +148,15 @@ class waiter_map_t
 
 		~waiter_reg_t();
 
-		void init();
+		bool init();
 	};
 
 	bool is_stopped(u64 signal_id);
 
 public:
 	waiter_map_t(const char* name)
-		: m_name(name)
+		: m_waiters_count(0)
+		, m_name(name)
 	{
 	}
 
@@ -163,8 +169,14 @@ public:
 		// check condition or if emulator is stopped
 		while (!waiter_func() && !is_stopped(signal_id))
 		{
-			// initialize waiter (only first time)
-			waiter.init();
+			if (!waiter.thread)
+			{
+				// initialize waiter (only first time), the condition must be checked again after registration
+				if (waiter.init()) continue;
+				// can't be signaled if called from an unnamed thread
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
 			// wait for 1 ms or until signal arrived
 			waiter.thread->WaitForAnySignal(1);
 		}
@@ -172,4 +184,13 @@ public:
 
 	// signal all threads waiting on waiter_op() with the same signal_id (signaling only hints those threads that corresponding conditions are *probably* met)
 	void notify(u64 signal_id);
+
+	// signal only the specified thread if it's waiting with signal_id (or all threads if thread is nullptr)
+	void notify(u64 signal_id, NamedThreadBase* thread);
+
+	// a waiter registered after this call re-checks its condition, so a state change made before the call can't be missed
+	bool has_waiters() const
+	{
+		return m_waiters_count != 0;
+	}
 };
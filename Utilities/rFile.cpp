@@ -21,6 +21,13 @@ std::wstring ConvertUTF8ToWString(const std::string &source) {
 }
 #endif
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #ifdef _WIN32
 #define GET_API_ERROR GetLastError()
 #else
@@ -306,6 +313,76 @@ size_t  rFile::Read(void *buffer, size_t count)
 	return reinterpret_cast<wxFile*>(handle)->Read(buffer,count);
 }
 
+size_t  rFile::ReadAt(uint64_t offset, void *buffer, size_t count)
+{
+#ifdef _WIN32
+	// ReadFile moves the file pointer even if the offset is specified
+	const HANDLE h = (HANDLE)_get_osfhandle(reinterpret_cast<wxFile*>(handle)->fd());
+	LARGE_INTEGER zero = {}, old_pos;
+	SetFilePointerEx(h, zero, &old_pos, FILE_CURRENT);
+
+	OVERLAPPED ov = {};
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD nread = 0;
+	ReadFile(h, buffer, (DWORD)count, &nread, &ov);
+
+	SetFilePointerEx(h, old_pos, nullptr, FILE_BEGIN);
+	return nread;
+#else
+	const ssize_t nread = pread(reinterpret_cast<wxFile*>(handle)->fd(), buffer, count, offset);
+	return nread < 0 ? 0 : nread;
+#endif
+}
+
+size_t  rFile::WriteAt(uint64_t offset, const void *buffer, size_t count)
+{
+#ifdef _WIN32
+	const HANDLE h = (HANDLE)_get_osfhandle(reinterpret_cast<wxFile*>(handle)->fd());
+	LARGE_INTEGER zero = {}, old_pos;
+	SetFilePointerEx(h, zero, &old_pos, FILE_CURRENT);
+
+	OVERLAPPED ov = {};
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD nwritten = 0;
+	WriteFile(h, buffer, (DWORD)count, &nwritten, &ov);
+
+	SetFilePointerEx(h, old_pos, nullptr, FILE_BEGIN);
+	return nwritten;
+#else
+	const ssize_t nwritten = pwrite(reinterpret_cast<wxFile*>(handle)->fd(), buffer, count, offset);
+	return nwritten < 0 ? 0 : nwritten;
+#endif
+}
+
+const void* rFile::MapRead(size_t size)
+{
+#ifdef _WIN32
+	const HANDLE h = (HANDLE)_get_osfhandle(reinterpret_cast<wxFile*>(handle)->fd());
+	const HANDLE mapping = CreateFileMapping(h, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		return nullptr;
+
+	// the view keeps the mapping object alive
+	const void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+	CloseHandle(mapping);
+	return ptr;
+#else
+	void* ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, reinterpret_cast<wxFile*>(handle)->fd(), 0);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+}
+
+void rFile::Unmap(const void *ptr, size_t size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+#else
+	munmap(const_cast<void*>(ptr), size);
+#endif
+}
+
 size_t 	rFile::Seek(size_t ofs, rSeekMode mode)
 {
 	return reinterpret_cast<wxFile*>(handle)->Seek(ofs, convertSeekMode(mode));
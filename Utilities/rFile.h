@@ -51,6 +51,13 @@ public:
 	bool 	IsOpened() const;
 	size_t	Length() const;
 	size_t  Read(void *buffer, size_t count);
+	// Read or write at the given offset. The current position is preserved.
+	size_t  ReadAt(uint64_t offset, void *buffer, size_t count);
+	size_t  WriteAt(uint64_t offset, const void *buffer, size_t count);
+	// Map the first size bytes of the file for reading, returns nullptr on failure.
+	// The mapping stays valid after the file is closed and must be released with Unmap.
+	const void* MapRead(size_t size);
+	static void Unmap(const void *ptr, size_t size);
 	size_t 	Seek(size_t ofs, rSeekMode mode = rFromStart);
 	size_t Tell() const;
 
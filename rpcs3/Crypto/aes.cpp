@@ -31,6 +31,7 @@
 
 #include "stdafx.h"
 #include "aes.h"
+#include "aesni.h"
 
 /*
  * 32-bit integer manipulation macros (little endian)
@@ -459,6 +460,12 @@ int aes_setkey_enc( aes_context *ctx, const unsigned char *key, unsigned int key
 
     ctx->rk = RK = ctx->buf;
 
+    if( keysize == 128 && aesni_supports( POLARSSL_AESNI_AES ) )
+    {
+        aesni_setkey_enc_128( (unsigned char *) ctx->rk, key );
+        return( 0 );
+    }
+
     for( i = 0; i < (keysize >> 5); i++ )
     {
         GET_UINT32_LE( RK[i], key, i << 2 );
@@ -559,6 +566,13 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, unsigned int key
     if( ret != 0 )
         return( ret );
 
+    if( aesni_supports( POLARSSL_AESNI_AES ) )
+    {
+        aesni_inverse_key( (unsigned char *) ctx->rk, (const unsigned char *) cty.rk, ctx->nr );
+        memset( &cty, 0, sizeof( aes_context ) );
+        return( 0 );
+    }
+
     SK = cty.rk + cty.nr * 4;
 
     *RK++ = *SK++;
@@ -644,6 +658,9 @@ int aes_crypt_ecb( aes_context *ctx,
     int i;
     uint32_t *RK, X0, X1, X2, X3, Y0, Y1, Y2, Y3;
 
+    if( aesni_supports( POLARSSL_AESNI_AES ) )
+        return( aesni_crypt_ecb( ctx, mode, input, output ) );
+
     RK = ctx->rk;
 
     GET_UINT32_LE( X0, input,  0 ); X0 ^= *RK++;
@@ -744,6 +761,9 @@ int aes_crypt_cbc( aes_context *ctx,
     if( length % 16 )
         return( POLARSSL_ERR_AES_INVALID_INPUT_LENGTH );
 
+    if( aesni_supports( POLARSSL_AESNI_AES ) )
+        return( aesni_crypt_cbc( ctx, mode, length, iv, input, output ) );
+
     if( mode == AES_DECRYPT )
     {
         while( length > 0 )
@@ -840,6 +860,17 @@ int aes_crypt_ctr( aes_context *ctx,
     int c, i;
     size_t n = *nc_off;
 
+    if( n == 0 && length >= 16 && aesni_supports( POLARSSL_AESNI_AES ) )
+    {
+        size_t blocks = length >> 4;
+
+        aesni_crypt_ctr( ctx, blocks, nonce_counter, input, output );
+
+        input  += blocks << 4;
+        output += blocks << 4;
+        length &= 0x0F;
+    }
+
     while( length-- )
     {
         if( n == 0 ) {
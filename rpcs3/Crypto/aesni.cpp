@@ -0,0 +1,440 @@
+/*
+ *  AES-NI and SHA extensions support
+ *
+ *  The instructions are used through intrinsics, the functions are compiled
+ *  for the required instruction sets only (AESNI_TARGET/SHANI_TARGET) and
+ *  are called after a runtime check, so the rest of the code keeps running
+ *  on any SSE2 CPU.
+ *
+ *  References:
+ *  - Intel Advanced Encryption Standard (AES) New Instructions Set
+ *  - Intel SHA Extensions: New Instructions Supporting the Secure Hash Algorithm
+ */
+
+#include "stdafx.h"
+#include "aesni.h"
+
+#include <immintrin.h>
+
+// SHA intrinsics are missing before Visual Studio 2015
+#if !defined(_MSC_VER) || _MSC_VER >= 1900
+#define AESNI_HAVE_SHA
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AESNI_TARGET
+#define SHANI_TARGET
+#else
+#include <cpuid.h>
+#define AESNI_TARGET __attribute__((target("aes,ssse3")))
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+
+static unsigned int aesni_features( void )
+{
+    unsigned int features = 0;
+    unsigned int leaf1_ecx, leaf7_ebx = 0;
+
+#ifdef _MSC_VER
+    int regs[4];
+
+    __cpuid( regs, 0 );
+    const int max_leaf = regs[0];
+
+    __cpuid( regs, 1 );
+    leaf1_ecx = regs[2];
+
+    if( max_leaf >= 7 )
+    {
+        __cpuidex( regs, 7, 0 );
+        leaf7_ebx = regs[1];
+    }
+#else
+    unsigned int eax, ebx, ecx, edx;
+
+    const unsigned int max_leaf = __get_cpuid_max( 0, 0 );
+
+    __cpuid( 1, eax, ebx, ecx, edx );
+    leaf1_ecx = ecx;
+
+    if( max_leaf >= 7 )
+    {
+        __cpuid_count( 7, 0, eax, ebx, ecx, edx );
+        leaf7_ebx = ebx;
+    }
+#endif
+
+    // AES-NI (bit 25) is used with SSSE3 (bit 9), SHA (bit 29 of leaf 7) with SSE4.1 (bit 19) and SSSE3
+    if( ( leaf1_ecx & 0x02000200 ) == 0x02000200 )
+        features |= POLARSSL_AESNI_AES;
+
+#ifdef AESNI_HAVE_SHA
+    if( ( leaf7_ebx & 0x20000000 ) && ( leaf1_ecx & 0x00080200 ) == 0x00080200 )
+        features |= POLARSSL_AESNI_SHA;
+#endif
+
+    return( features );
+}
+
+/*
+ * AES-NI support detection routine
+ */
+static unsigned int aesni_disabled = 0;
+
+int aesni_supports( unsigned int what )
+{
+    static const unsigned int features = aesni_features();
+
+    return( ( features & ~aesni_disabled & what ) != 0 );
+}
+
+void aesni_disable( unsigned int what )
+{
+    aesni_disabled = what;
+}
+
+/*
+ * AES-128 key expansion step (rcon applied by AESKEYGENASSIST)
+ */
+static AESNI_TARGET __m128i aesni_key128_expand( __m128i key, __m128i keygen )
+{
+    keygen = _mm_shuffle_epi32( keygen, 0xFF );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+
+    return( _mm_xor_si128( key, keygen ) );
+}
+
+#define AESNI_KEY128( i, rcon )                                                 \
+{                                                                               \
+    t = aesni_key128_expand( t, _mm_aeskeygenassist_si128( t, rcon ) );         \
+    _mm_storeu_si128( rk + i, t );                                              \
+}
+
+/*
+ * AES-128 key schedule (encryption)
+ */
+AESNI_TARGET void aesni_setkey_enc_128( unsigned char *rkb, const unsigned char *key )
+{
+    __m128i *rk = (__m128i *) rkb;
+    __m128i t = _mm_loadu_si128( (const __m128i *) key );
+
+    _mm_storeu_si128( rk, t );
+
+    AESNI_KEY128( 1, 0x01 );
+    AESNI_KEY128( 2, 0x02 );
+    AESNI_KEY128( 3, 0x04 );
+    AESNI_KEY128( 4, 0x08 );
+    AESNI_KEY128( 5, 0x10 );
+    AESNI_KEY128( 6, 0x20 );
+    AESNI_KEY128( 7, 0x40 );
+    AESNI_KEY128( 8, 0x80 );
+    AESNI_KEY128( 9, 0x1B );
+    AESNI_KEY128( 10, 0x36 );
+}
+
+/*
+ * Compute decryption round keys from encryption round keys
+ * (same layout as the portable aes_setkey_dec)
+ */
+AESNI_TARGET void aesni_inverse_key( unsigned char *invkey, const unsigned char *fwdkey, int nr )
+{
+    __m128i *ik = (__m128i *) invkey;
+    const __m128i *fk = (const __m128i *) fwdkey + nr;
+
+    _mm_storeu_si128( ik, _mm_loadu_si128( fk ) );
+
+    for( fk--, ik++; fk > (const __m128i *) fwdkey; fk--, ik++ )
+        _mm_storeu_si128( ik, _mm_aesimc_si128( _mm_loadu_si128( fk ) ) );
+
+    _mm_storeu_si128( ik, _mm_loadu_si128( fk ) );
+}
+
+/*
+ * AES-ECB block en(de)cryption
+ */
+AESNI_TARGET int aesni_crypt_ecb( aes_context *ctx,
+                                  int mode,
+                                  const unsigned char input[16],
+                                  unsigned char output[16] )
+{
+    const __m128i *rk = (const __m128i *) ctx->rk;
+    __m128i b = _mm_xor_si128( _mm_loadu_si128( (const __m128i *) input ), _mm_loadu_si128( rk ) );
+    int i;
+
+    if( mode == AES_DECRYPT )
+    {
+        for( i = 1; i < ctx->nr; i++ )
+            b = _mm_aesdec_si128( b, _mm_loadu_si128( rk + i ) );
+
+        b = _mm_aesdeclast_si128( b, _mm_loadu_si128( rk + ctx->nr ) );
+    }
+    else
+    {
+        for( i = 1; i < ctx->nr; i++ )
+            b = _mm_aesenc_si128( b, _mm_loadu_si128( rk + i ) );
+
+        b = _mm_aesenclast_si128( b, _mm_loadu_si128( rk + ctx->nr ) );
+    }
+
+    _mm_storeu_si128( (__m128i *) output, b );
+
+    return( 0 );
+}
+
+/*
+ * AES-CBC buffer en(de)cryption
+ */
+AESNI_TARGET int aesni_crypt_cbc( aes_context *ctx,
+                                  int mode,
+                                  size_t length,
+                                  unsigned char iv[16],
+                                  const unsigned char *input,
+                                  unsigned char *output )
+{
+    __m128i rk[15];
+    __m128i v = _mm_loadu_si128( (const __m128i *) iv );
+    const int nr = ctx->nr;
+    int i;
+
+    for( i = 0; i <= nr; i++ )
+        rk[i] = _mm_loadu_si128( (const __m128i *) ctx->rk + i );
+
+    if( mode == AES_DECRYPT )
+    {
+        // Blocks don't depend on each other, decrypt 4 of them at once to hide the latency of AESDEC
+        while( length >= 64 )
+        {
+            const __m128i c0 = _mm_loadu_si128( (const __m128i *) input + 0 );
+            const __m128i c1 = _mm_loadu_si128( (const __m128i *) input + 1 );
+            const __m128i c2 = _mm_loadu_si128( (const __m128i *) input + 2 );
+            const __m128i c3 = _mm_loadu_si128( (const __m128i *) input + 3 );
+
+            __m128i b0 = _mm_xor_si128( c0, rk[0] );
+            __m128i b1 = _mm_xor_si128( c1, rk[0] );
+            __m128i b2 = _mm_xor_si128( c2, rk[0] );
+            __m128i b3 = _mm_xor_si128( c3, rk[0] );
+
+            for( i = 1; i < nr; i++ )
+            {
+                b0 = _mm_aesdec_si128( b0, rk[i] );
+                b1 = _mm_aesdec_si128( b1, rk[i] );
+                b2 = _mm_aesdec_si128( b2, rk[i] );
+                b3 = _mm_aesdec_si128( b3, rk[i] );
+            }
+
+            b0 = _mm_xor_si128( _mm_aesdeclast_si128( b0, rk[nr] ), v );
+            b1 = _mm_xor_si128( _mm_aesdeclast_si128( b1, rk[nr] ), c0 );
+            b2 = _mm_xor_si128( _mm_aesdeclast_si128( b2, rk[nr] ), c1 );
+            b3 = _mm_xor_si128( _mm_aesdeclast_si128( b3, rk[nr] ), c2 );
+            v = c3;
+
+            _mm_storeu_si128( (__m128i *) output + 0, b0 );
+            _mm_storeu_si128( (__m128i *) output + 1, b1 );
+            _mm_storeu_si128( (__m128i *) output + 2, b2 );
+            _mm_storeu_si128( (__m128i *) output + 3, b3 );
+
+            input  += 64;
+            output += 64;
+            length -= 64;
+        }
+
+        while( length > 0 )
+        {
+            const __m128i c = _mm_loadu_si128( (const __m128i *) input );
+            __m128i b = _mm_xor_si128( c, rk[0] );
+
+            for( i = 1; i < nr; i++ )
+                b = _mm_aesdec_si128( b, rk[i] );
+
+            _mm_storeu_si128( (__m128i *) output, _mm_xor_si128( _mm_aesdeclast_si128( b, rk[nr] ), v ) );
+            v = c;
+
+            input  += 16;
+            output += 16;
+            length -= 16;
+        }
+    }
+    else
+    {
+        while( length > 0 )
+        {
+            v = _mm_xor_si128( _mm_xor_si128( _mm_loadu_si128( (const __m128i *) input ), v ), rk[0] );
+
+            for( i = 1; i < nr; i++ )
+                v = _mm_aesenc_si128( v, rk[i] );
+
+            v = _mm_aesenclast_si128( v, rk[nr] );
+            _mm_storeu_si128( (__m128i *) output, v );
+
+            input  += 16;
+            output += 16;
+            length -= 16;
+        }
+    }
+
+    _mm_storeu_si128( (__m128i *) iv, v );
+
+    return( 0 );
+}
+
+/*
+ * AES-CTR en(de)cryption of whole blocks
+ */
+AESNI_TARGET void aesni_crypt_ctr( aes_context *ctx,
+                                   size_t blocks,
+                                   unsigned char nonce_counter[16],
+                                   const unsigned char *input,
+                                   unsigned char *output )
+{
+    // reverses the bytes of the (little-endian) 128-bit counter to get the big-endian counter block
+    const __m128i bswap = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+
+    __m128i rk[15];
+    const int nr = ctx->nr;
+    uint64_t hi = 0, lo = 0;
+    int i, j;
+
+    for( i = 0; i <= nr; i++ )
+        rk[i] = _mm_loadu_si128( (const __m128i *) ctx->rk + i );
+
+    for( i = 0; i < 8; i++ )
+    {
+        hi = ( hi << 8 ) | nonce_counter[i];
+        lo = ( lo << 8 ) | nonce_counter[i + 8];
+    }
+
+    // Counter blocks are independent, encrypt 8 of them at once to hide the latency of AESENC
+    while( blocks >= 8 )
+    {
+        __m128i b[8];
+
+        for( j = 0; j < 8; j++ )
+        {
+            b[j] = _mm_xor_si128( _mm_shuffle_epi8( _mm_set_epi64x( (long long) hi, (long long) lo ), bswap ), rk[0] );
+
+            if( ++lo == 0 )
+                hi++;
+        }
+
+        for( i = 1; i < nr; i++ )
+            for( j = 0; j < 8; j++ )
+                b[j] = _mm_aesenc_si128( b[j], rk[i] );
+
+        for( j = 0; j < 8; j++ )
+        {
+            b[j] = _mm_aesenclast_si128( b[j], rk[nr] );
+            _mm_storeu_si128( (__m128i *) output + j, _mm_xor_si128( b[j], _mm_loadu_si128( (const __m128i *) input + j ) ) );
+        }
+
+        input  += 128;
+        output += 128;
+        blocks -= 8;
+    }
+
+    while( blocks > 0 )
+    {
+        __m128i b = _mm_xor_si128( _mm_shuffle_epi8( _mm_set_epi64x( (long long) hi, (long long) lo ), bswap ), rk[0] );
+
+        if( ++lo == 0 )
+            hi++;
+
+        for( i = 1; i < nr; i++ )
+            b = _mm_aesenc_si128( b, rk[i] );
+
+        b = _mm_aesenclast_si128( b, rk[nr] );
+        _mm_storeu_si128( (__m128i *) output, _mm_xor_si128( b, _mm_loadu_si128( (const __m128i *) input ) ) );
+
+        input  += 16;
+        output += 16;
+        blocks -= 1;
+    }
+
+    for( i = 7; i >= 0; i--, hi >>= 8, lo >>= 8 )
+    {
+        nonce_counter[i] = (unsigned char) hi;
+        nonce_counter[i + 8] = (unsigned char) lo;
+    }
+}
+
+#ifdef AESNI_HAVE_SHA
+
+// W[t] = ROL(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16], 1) for the 4 words of step i
+#define SHA1_SCHED( i )                                                         \
+{                                                                               \
+    W[( i ) & 3] = _mm_sha1msg2_epu32( _mm_xor_si128( _mm_sha1msg1_epu32( W[( i ) & 3], W[( ( i ) + 1 ) & 3] ), \
+                                                      W[( ( i ) + 2 ) & 3] ), W[( ( i ) + 3 ) & 3] ); \
+}
+
+#define SHA1_STEP( i, f )                                                       \
+{                                                                               \
+    E = _mm_sha1nexte_epu32( ABCD_PREV, W[( i ) & 3] );                         \
+    ABCD_PREV = ABCD;                                                           \
+    ABCD = _mm_sha1rnds4_epu32( ABCD, E, f );                                   \
+}
+
+/*
+ * SHA-1 compression function
+ */
+SHANI_TARGET void aesni_sha1_process( uint32_t state[5], const unsigned char *data, size_t blocks )
+{
+    // message words are big-endian
+    const __m128i bswap = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+
+    // ABCD is kept with A in the highest dword, E in the highest dword of E0
+    __m128i ABCD = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) state ), 0x1B );
+    __m128i E0 = _mm_set_epi32( (int) state[4], 0, 0, 0 );
+    int i;
+
+    while( blocks-- )
+    {
+        const __m128i ABCD_SAVE = ABCD;
+        const __m128i E0_SAVE = E0;
+        __m128i W[4], E, ABCD_PREV;
+
+        for( i = 0; i < 4; i++ )
+            W[i] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) data + i ), bswap );
+
+        // 4 rounds per step, W[i & 3] holds the message words of the step
+        E = _mm_add_epi32( E0, W[0] );
+        ABCD_PREV = ABCD;
+        ABCD = _mm_sha1rnds4_epu32( ABCD, E, 0 );
+
+        SHA1_STEP( 1, 0 );  SHA1_STEP( 2, 0 );  SHA1_STEP( 3, 0 );
+        SHA1_SCHED( 4 );  SHA1_STEP( 4, 0 );
+        SHA1_SCHED( 5 );  SHA1_STEP( 5, 1 );
+        SHA1_SCHED( 6 );  SHA1_STEP( 6, 1 );
+        SHA1_SCHED( 7 );  SHA1_STEP( 7, 1 );
+        SHA1_SCHED( 8 );  SHA1_STEP( 8, 1 );
+        SHA1_SCHED( 9 );  SHA1_STEP( 9, 1 );
+        SHA1_SCHED( 10 ); SHA1_STEP( 10, 2 );
+        SHA1_SCHED( 11 ); SHA1_STEP( 11, 2 );
+        SHA1_SCHED( 12 ); SHA1_STEP( 12, 2 );
+        SHA1_SCHED( 13 ); SHA1_STEP( 13, 2 );
+        SHA1_SCHED( 14 ); SHA1_STEP( 14, 2 );
+        SHA1_SCHED( 15 ); SHA1_STEP( 15, 3 );
+        SHA1_SCHED( 16 ); SHA1_STEP( 16, 3 );
+        SHA1_SCHED( 17 ); SHA1_STEP( 17, 3 );
+        SHA1_SCHED( 18 ); SHA1_STEP( 18, 3 );
+        SHA1_SCHED( 19 ); SHA1_STEP( 19, 3 );
+
+        E0 = _mm_sha1nexte_epu32( ABCD_PREV, E0_SAVE );
+        ABCD = _mm_add_epi32( ABCD, ABCD_SAVE );
+
+        data += 64;
+    }
+
+    _mm_storeu_si128( (__m128i *) state, _mm_shuffle_epi32( ABCD, 0x1B ) );
+    state[4] = (uint32_t) _mm_extract_epi32( E0, 3 );
+}
+
+#else
+
+void aesni_sha1_process( uint32_t state[5], const unsigned char *data, size_t blocks )
+{
+    // never called, aesni_supports( POLARSSL_AESNI_SHA ) returns 0
+}
+
+#endif
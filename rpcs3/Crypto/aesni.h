@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * \file aesni.h
+ *
+ * \brief AES-NI and SHA extensions for the AES and SHA-1 implementations
+ *
+ *  The functions are called by aes.cpp and sha1.cpp when the CPU supports
+ *  the instructions (see aesni_supports), the results are identical to
+ *  the portable implementation.
+ */
+#include "aes.h"
+
+#define POLARSSL_AESNI_AES      0x00000001u   /*!< AES-NI (AESENC, AESDEC, AESKEYGENASSIST, AESIMC) */
+#define POLARSSL_AESNI_SHA      0x00000002u   /*!< SHA extensions (SHA1RNDS4, SHA1NEXTE, SHA1MSG1/2) */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          AES-NI features detection routine
+ *
+ * \param what     The feature to detect
+ *                 (POLARSSL_AESNI_AES or POLARSSL_AESNI_SHA)
+ *
+ * \return         1 if CPU has support for the feature, 0 otherwise
+ */
+int aesni_supports( unsigned int what );
+
+/**
+ * \brief          Disable the use of CPU features (for testing)
+ *
+ * \param what     Features to disable, 0 enables all supported features
+ */
+void aesni_disable( unsigned int what );
+
+/**
+ * \brief          AES-128 key schedule (encryption)
+ *
+ * \param rk       destination round keys (11 * 16 bytes)
+ * \param key      16-byte encryption key
+ */
+void aesni_setkey_enc_128( unsigned char *rk, const unsigned char *key );
+
+/**
+ * \brief          Compute decryption round keys from encryption round keys
+ *
+ * \param invkey   destination round keys
+ * \param fwdkey   source round keys
+ * \param nr       number of rounds
+ */
+void aesni_inverse_key( unsigned char *invkey, const unsigned char *fwdkey, int nr );
+
+/**
+ * \brief          AES-NI AES-ECB block en(de)cryption
+ *
+ * \param ctx      AES context
+ * \param mode     AES_ENCRYPT or AES_DECRYPT
+ * \param input    16-byte input block
+ * \param output   16-byte output block
+ *
+ * \return         0 on success (cannot fail)
+ */
+int aesni_crypt_ecb( aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] );
+
+/**
+ * \brief          AES-NI AES-CBC buffer en(de)cryption
+ *                 Decryption processes 4 blocks at once
+ *
+ * \param ctx      AES context
+ * \param mode     AES_ENCRYPT or AES_DECRYPT
+ * \param length   length of the input data (multiple of 16)
+ * \param iv       initialization vector (updated after use)
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data
+ *
+ * \return         0 on success (cannot fail)
+ */
+int aesni_crypt_cbc( aes_context *ctx,
+                     int mode,
+                     size_t length,
+                     unsigned char iv[16],
+                     const unsigned char *input,
+                     unsigned char *output );
+
+/**
+ * \brief          AES-NI AES-CTR en(de)cryption of whole blocks
+ *                 8 blocks are processed at once
+ *
+ * \param ctx           AES context (encryption key schedule)
+ * \param blocks        number of 16-byte blocks
+ * \param nonce_counter 128-bit big-endian nonce and counter (updated after use)
+ * \param input         buffer holding the input data
+ * \param output        buffer holding the output data
+ */
+void aesni_crypt_ctr( aes_context *ctx,
+                      size_t blocks,
+                      unsigned char nonce_counter[16],
+                      const unsigned char *input,
+                      unsigned char *output );
+
+/**
+ * \brief          SHA-1 compression function using the SHA extensions
+ *
+ * \param state    intermediate digest state
+ * \param data     input blocks
+ * \param blocks   number of 64-byte blocks
+ */
+void aesni_sha1_process( uint32_t state[5], const unsigned char *data, size_t blocks );
+
+#ifdef __cplusplus
+}
+#endif
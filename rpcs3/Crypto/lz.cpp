@@ -4,125 +4,140 @@
 
 #include "lz.h"
 
-void decode_range(unsigned int *range, unsigned int *code, unsigned char **src)
+#ifdef _MSC_VER
+#define LZ_INLINE static __forceinline
+#else
+#define LZ_INLINE static inline __attribute__((always_inline))
+#endif
+
+// Range decoder state. decompress() keeps it in a local variable and the helpers below are
+// always inlined, so range, code and src stay in registers instead of going through pointers.
+struct lz_state
+{
+	unsigned int range;
+	unsigned int code;
+	unsigned char *src;
+};
+
+LZ_INLINE void lz_decode_range(lz_state& s)
 {
-	if (!((*range) >> 24)) 
+	if (!(s.range >> 24))
 	{
-		(*range) <<= 8;
-		*code = ((*code) << 8) + (*src)++[5];
+		s.range <<= 8;
+		s.code = (s.code << 8) + s.src++[5];
 	}
 }
 
-int decode_bit(unsigned int *range, unsigned int *code, int *index, unsigned char **src, unsigned char *c)
+LZ_INLINE int lz_decode_bit(lz_state& s, int *index, unsigned char *c)
 {
-	decode_range(range, code, src);
-	
-	unsigned int val = ((*range) >> 8) * (*c);
+	lz_decode_range(s);
+
+	unsigned int val = (s.range >> 8) * (*c);
 
 	*c -= ((*c) >> 3);
 	if (index) (*index) <<= 1;
 
-	if (*code < val)
+	if (s.code < val)
 	{
-		*range = val;
+		s.range = val;
 		*c += 31;
 		if (index) (*index)++;
 		return 1;
 	}
 	else
 	{
-		*code -= val;
-		*range -= val;
+		s.code -= val;
+		s.range -= val;
 		return 0;
 	}
 }
 
-int decode_number(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, unsigned char **src)
+// Shared part of decode_number and decode_word (they only differ by the probability offsets).
+LZ_INLINE int lz_decode_value(lz_state& s, unsigned char *ptr, int index, int *bit_flag, int high_offset, int low_offset1, int low_offset2)
 {
 	int i = 1;
 
-	if (index >= 3) 
+	if (index >= 3)
 	{
-		decode_bit(range, code, &i, src, ptr + 0x18);
-		if (index >= 4) 
+		lz_decode_bit(s, &i, ptr + high_offset);
+		if (index >= 4)
 		{
-			decode_bit(range, code, &i, src, ptr + 0x18);
+			lz_decode_bit(s, &i, ptr + high_offset);
 			if (index >= 5)
 			{
-				decode_range(range, code, src);
+				lz_decode_range(s);
 				for (; index >= 5; index--)
 				{
 					i <<= 1;
-					(*range) >>= 1;
-					if (*code < *range) 
-						i++; 
+					s.range >>= 1;
+					if (s.code < s.range)
+						i++;
 					else
-						(*code) -= *range;
+						s.code -= s.range;
 				}
 			}
 		}
 	}
 
-	*bit_flag = decode_bit(range, code, &i, src, ptr);
+	*bit_flag = lz_decode_bit(s, &i, ptr);
 
-	if (index >= 1) 
+	if (index >= 1)
 	{
-		decode_bit(range, code, &i, src, ptr + 0x8);
-		if (index >= 2) 
+		lz_decode_bit(s, &i, ptr + low_offset1);
+		if (index >= 2)
 		{
-			decode_bit(range, code, &i, src, ptr + 0x10);
+			lz_decode_bit(s, &i, ptr + low_offset2);
 		}
-	}	
+	}
 
 	return i;
 }
 
-int decode_word(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, unsigned char **src)
+void decode_range(unsigned int *range, unsigned int *code, unsigned char **src)
 {
-	int i = 1;
-	index /= 8;
-
-	if (index >= 3) 
-	{
-		decode_bit(range, code, &i, src, ptr + 4);
-		if (index >= 4) 
-		{
-			decode_bit(range, code, &i, src, ptr + 4);
-			if (index >= 5)
-			{
-				decode_range(range, code, src);
-				for (; index >= 5; index--)
-				{
-					i <<= 1;
-					(*range) >>= 1;
-					if (*code < *range) 
-						i++; 
-					else
-						(*code) -= *range;
-				}
-			}
-		}
-	}
+	lz_state s = { *range, *code, *src };
+	lz_decode_range(s);
+	*range = s.range;
+	*code = s.code;
+	*src = s.src;
+}
 
-	*bit_flag = decode_bit(range, code, &i, src, ptr);
+int decode_bit(unsigned int *range, unsigned int *code, int *index, unsigned char **src, unsigned char *c)
+{
+	lz_state s = { *range, *code, *src };
+	int res = lz_decode_bit(s, index, c);
+	*range = s.range;
+	*code = s.code;
+	*src = s.src;
+	return res;
+}
 
-	if (index >= 1) 
-	{
-		decode_bit(range, code, &i, src, ptr + 1);
-		if (index >= 2) 
-		{
-			decode_bit(range, code, &i, src, ptr + 2);
-		}
-	}	
+int decode_number(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, unsigned char **src)
+{
+	lz_state s = { *range, *code, *src };
+	int res = lz_decode_value(s, ptr, index, bit_flag, 0x18, 0x8, 0x10);
+	*range = s.range;
+	*code = s.code;
+	*src = s.src;
+	return res;
+}
 
-	return i;
+int decode_word(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, unsigned char **src)
+{
+	lz_state s = { *range, *code, *src };
+	int res = lz_decode_value(s, ptr, index / 8, bit_flag, 4, 1, 2);
+	*range = s.range;
+	*code = s.code;
+	*src = s.src;
+	return res;
 }
 
 int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 {
 	int result;
 
-	unsigned char *tmp = new unsigned char[0xCC8];
+	// Probabilities (no need to allocate them, the table is small).
+	unsigned char tmp[0xCC8];
 
 	int offset = 0;
 	int bit_flag = 0;
@@ -137,16 +152,18 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 	unsigned char *end = (out + size);
 	unsigned char head = in[0];
 
-	unsigned int range = 0xFFFFFFFF;
-	unsigned int code = (in[1] << 24) | (in[2] << 16) | (in[3] << 8) | in[4];
+	lz_state s;
+	s.range = 0xFFFFFFFF;
+	s.code = (in[1] << 24) | (in[2] << 16) | (in[3] << 8) | in[4];
+	s.src = in;
 
 	if (head < 0) // Check if we have a valid starting byte.
 	{
 		// The dictionary header is invalid, the data is not compressed.
 		result = -1;
-		if (code <= size)
+		if (s.code <= size)
 		{
-			memcpy(out, (const void *)(in + 5), code);
+			memcpy(out, (const void *)(in + 5), s.code);
 			result = (start - out);
 		}
 	}
@@ -158,7 +175,7 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 		{
 			// Start reading at 0xB68.
 			tmp_sect1 = tmp + offset + 0xB68;
-			if (!decode_bit(&range, &code, 0, &in, tmp_sect1))  // Raw char.
+			if (!lz_decode_bit(s, 0, tmp_sect1))  // Raw char.
 			{
 				// Adjust offset and check for stream end.
 				if (offset > 0) offset--;
@@ -172,7 +189,7 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 				// Read, decode and write back.
 				do
 				{
-					decode_bit(&range, &code, &index, &in, tmp_sect1 + index);
+					lz_decode_bit(s, &index, tmp_sect1 + index);
 				} while ((index >> 8) == 0);
 
 				// Save index.
@@ -185,8 +202,8 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 				// Identify the data length bit field.
 				do
 				{
-					tmp_sect1 += 8; 
-					bit_flag = decode_bit(&range, &code, 0, &in, tmp_sect1);
+					tmp_sect1 += 8;
+					bit_flag = lz_decode_bit(s, 0, tmp_sect1);
 					index += bit_flag;
 				} while ((bit_flag != 0) && (index < 6));
 
@@ -195,17 +212,17 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 				tmp_sect2 = tmp + index + 0x7F1;
 
 				// If the data length was found, parse it as a number.
-				if ((index >= 0) || (bit_flag != 0)) 
+				if ((index >= 0) || (bit_flag != 0))
 				{
 					// Locate next section.
 					int sect = (index << 5) | (((((int)(start - out)) << index) & 3) << 3) | (offset & 7);
 					tmp_sect1 = tmp + 0xBA8 + sect;
 
 					// Decode the data length (8 bit fields).
-					data_length = decode_number(tmp_sect1, index, &bit_flag, &range, &code, &in);
-					if (data_length == 0xFF) return (start - out);  // End of stream.		
+					data_length = lz_decode_value(s, tmp_sect1, index, &bit_flag, 0x18, 0x8, 0x10);
+					if (data_length == 0xFF) return (start - out);  // End of stream.
 				}
-				else 
+				else
 				{
 					// Assume one byte of advance.
 					data_length = 1;
@@ -225,11 +242,11 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 				do
 				{
 					diff = (shift << 4) - b_size;
-					bit_flag = decode_bit(&range, &code, &shift, &in, tmp_sect2 + (shift << 3));
+					bit_flag = lz_decode_bit(s, &shift, tmp_sect2 + (shift << 3));
 				} while (diff < 0);
 
 				// If the data offset was found, parse it as a number.
-				if ((diff > 0) || (bit_flag != 0)) 
+				if ((diff > 0) || (bit_flag != 0))
 				{
 					// Adjust diff if needed.
 					if (bit_flag == 0) diff -= 8;
@@ -238,7 +255,7 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 					tmp_sect3 = tmp + 0x928 + diff;
 
 					// Decode the data offset (1 bit fields).
-					data_offset = decode_word(tmp_sect3, diff, &bit_flag, &range, &code, &in);
+					data_offset = lz_decode_value(s, tmp_sect3, diff / 8, &bit_flag, 4, 1, 2);
 				}
 				else
 				{
@@ -250,8 +267,8 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 				buf_start = start - data_offset;
 				buf_end = start + data_length + 1;
 
-				// Underflow.
-				if (buf_start < out)
+				// Underflow (or a corrupted offset).
+				if (buf_start < out || buf_start >= start)
 					return -1;
 
 				// Overflow.
@@ -261,17 +278,24 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 				// Update offset.
 				offset = ((((int)(buf_end - out)) + 1) & 1) + 6;
 
-				// Copy data.
-				do
+				// Copy data (the source can overlap the destination, copy bytes one by one in this case).
+				if (buf_end - start <= data_offset)
 				{
-					*start++ = *buf_start++;
-				} while (start < buf_end);
-
+					memcpy(start, buf_start, buf_end - start);
+					start = buf_end;
+				}
+				else
+				{
+					do
+					{
+						*start++ = *buf_start++;
+					} while (start < buf_end);
+				}
 			}
 			prev = *(start - 1);
 		}
 		result = (start - out);
 	}
-	delete[] tmp;
+
 	return result;
 }
\ No newline at end of file
@@ -30,6 +30,7 @@
  
 #include "stdafx.h"
 #include "sha1.h"
+#include "aesni.h"
 
 /*
  * 32-bit integer manipulation macros (big endian)
@@ -73,6 +74,12 @@ void sha1_process( sha1_context *ctx, const unsigned char data[64] )
 {
     uint32_t temp, W[16], A, B, C, D, E;
 
+    if( aesni_supports( POLARSSL_AESNI_SHA ) )
+    {
+        aesni_sha1_process( ctx->state, data, 1 );
+        return;
+    }
+
     GET_UINT32_BE( W[ 0], data,  0 );
     GET_UINT32_BE( W[ 1], data,  4 );
     GET_UINT32_BE( W[ 2], data,  8 );
@@ -254,6 +261,13 @@ void sha1_update( sha1_context *ctx, const unsigned char *input, size_t ilen )
         left = 0;
     }
 
+    if( ilen >= 64 && aesni_supports( POLARSSL_AESNI_SHA ) )
+    {
+        aesni_sha1_process( ctx->state, input, ilen >> 6 );
+        input += ilen & ~(size_t) 0x3F;
+        ilen  &= 0x3F;
+    }
+
     while( ilen >= 64 )
     {
         sha1_process( ctx, input );
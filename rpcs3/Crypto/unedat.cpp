@@ -3,6 +3,8 @@
 #include "unedat.h"
 #include "Utilities/Log.h"
 #include "Utilities/rFile.h"
+#include "Utilities/Thread.h"
+#include "Emu/FS/vfsLocalFile.h"
 
 void generate_key(int crypto_mode, int version, unsigned char *key_final, unsigned char *iv_final, unsigned char *key, unsigned char *iv)
 {
@@ -136,211 +138,252 @@ unsigned char* get_block_key(int block, NPD_HEADER *npd)
 }
 
 // EDAT/SDAT decryption.
-int decrypt_data(rFile *in, rFile *out, EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, bool verbose)
+struct EDATBlock
+{
+	int index;
+	unsigned long long offset; // Offset of the encrypted data in the file.
+	int pad_length;            // Length of the data (the encrypted data is padded to 16 bytes).
+	int compression_end;
+	unsigned char hash_result[0x14];
+	std::vector<u8> data;      // Encrypted data.
+};
+
+// Read the metadata and the encrypted data of one block, returns false if the file is truncated.
+bool read_block(vfsStream *in, EDAT_HEADER *edat, NPD_HEADER *npd, int i, EDATBlock& block)
 {
-	// Get metadata info and setup buffers.
 	int block_num = (int)((edat->file_size + edat->block_size - 1) / edat->block_size);
 	int metadata_section_size = ((edat->flags & EDAT_COMPRESSED_FLAG) != 0 || (edat->flags & EDAT_FLAG_0x20) != 0) ? 0x20 : 0x10;
 	int metadata_offset = 0x100;
 
-	unsigned char *enc_data;
-	unsigned char *dec_data;
-	unsigned char *b_key;
-	unsigned char *iv;
-
-	unsigned char hash[0x10];
-	unsigned char key_result[0x10];
-	unsigned char hash_result[0x14];
-	memset(hash, 0, 0x10);
-	memset(key_result, 0, 0x10);
-	memset(hash_result, 0, 0x14);
-
-	unsigned long long offset = 0;
 	unsigned long long metadata_sec_offset = 0;
 	int length = 0;
-	int compression_end = 0;
-	unsigned char empty_iv[0x10] = {};
 
-	// Decrypt the metadata.
-	int i;
-	for (i = 0; i < block_num; i++)
-	{
-		memset(hash_result, 0, 0x14);
+	block.index = i;
+	block.compression_end = 0;
+	memset(block.hash_result, 0, 0x14);
 
-		if ((edat->flags & EDAT_COMPRESSED_FLAG) != 0)
-		{
-			metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
-			in->Seek(metadata_sec_offset);
+	if ((edat->flags & EDAT_COMPRESSED_FLAG) != 0)
+	{
+		metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
+		in->Seek(metadata_sec_offset);
 
-			unsigned char metadata[0x20];
-			memset(metadata, 0, 0x20);
-			in->Read(metadata, 0x20);
+		unsigned char metadata[0x20];
+		memset(metadata, 0, 0x20);
+		if (in->Read(metadata, 0x20) != 0x20)
+			return false;
 
-			// If the data is compressed, decrypt the metadata.
-			// NOTE: For NPD version 1 the metadata is not encrypted.
-			if (npd->version <= 1)
-			{
-				offset = swap64(*(unsigned long long*)&metadata[0x10]);
-				length = swap32(*(int*)&metadata[0x18]);
-				compression_end = swap32(*(int*)&metadata[0x1C]);
-			}
-			else
-			{
-				unsigned char *result = dec_section(metadata);
-				offset = swap64(*(unsigned long long*)&result[0]);
-				length = swap32(*(int*)&result[8]);
-				compression_end = swap32(*(int*)&result[12]);
-				delete[] result;
-			}
-			
-			memcpy(hash_result, metadata, 0x10);
+		// If the data is compressed, decrypt the metadata.
+		// NOTE: For NPD version 1 the metadata is not encrypted.
+		if (npd->version <= 1)
+		{
+			block.offset = swap64(*(unsigned long long*)&metadata[0x10]);
+			length = swap32(*(int*)&metadata[0x18]);
+			block.compression_end = swap32(*(int*)&metadata[0x1C]);
 		}
-		else if ((edat->flags & EDAT_FLAG_0x20) != 0)
+		else
 		{
-			// If FLAG 0x20, the metadata precedes each data block.
-			metadata_sec_offset = metadata_offset + (unsigned long long) i * (metadata_section_size + length);
-			in->Seek(metadata_sec_offset);
+			unsigned char *result = dec_section(metadata);
+			block.offset = swap64(*(unsigned long long*)&result[0]);
+			length = swap32(*(int*)&result[8]);
+			block.compression_end = swap32(*(int*)&result[12]);
+			delete[] result;
+		}
 
-			unsigned char metadata[0x20];
-			memset(metadata, 0, 0x20);
-			in->Read(metadata, 0x20);
-			memcpy(hash_result, metadata, 0x14);
+		memcpy(block.hash_result, metadata, 0x10);
+	}
+	else if ((edat->flags & EDAT_FLAG_0x20) != 0)
+	{
+		// If FLAG 0x20, the metadata precedes each data block.
+		metadata_sec_offset = metadata_offset + (unsigned long long) i * (metadata_section_size + edat->block_size);
+		in->Seek(metadata_sec_offset);
+
+		unsigned char metadata[0x20];
+		memset(metadata, 0, 0x20);
+		if (in->Read(metadata, 0x20) != 0x20)
+			return false;
+		memcpy(block.hash_result, metadata, 0x14);
+
+		// If FLAG 0x20 is set, apply custom xor.
+		int j;
+		for (j = 0; j < 0x10; j++)
+			block.hash_result[j] = (unsigned char)(metadata[j] ^ metadata[j + 0x10]);
+
+		block.offset = metadata_sec_offset + 0x20;
+		length = edat->block_size;
+
+		if ((i == (block_num - 1)) && (edat->file_size % edat->block_size))
+			length = (int)(edat->file_size % edat->block_size);
+	}
+	else
+	{
+		metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
+		in->Seek(metadata_sec_offset);
 
-			// If FLAG 0x20 is set, apply custom xor.
-			int j;
-			for (j = 0; j < 0x10; j++)
-				hash_result[j] = (unsigned char)(metadata[j] ^ metadata[j + 0x10]);
+		if (in->Read(block.hash_result, 0x10) != 0x10)
+			return false;
+		block.offset = metadata_offset + (unsigned long long) i * edat->block_size + (unsigned long long) block_num * metadata_section_size;
+		length = edat->block_size;
 
-			offset = metadata_sec_offset + 0x20;
-			length = edat->block_size;
+		if ((i == (block_num - 1)) && (edat->file_size % edat->block_size))
+			length = (int)(edat->file_size % edat->block_size);
+	}
 
-			if ((i == (block_num - 1)) && (edat->file_size % edat->block_size))
-				length = (int)(edat->file_size % edat->block_size);
-		}
-		else
-		{
-			metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
-			in->Seek(metadata_sec_offset);
+	// Locate the real data.
+	block.pad_length = length;
+	length = (int)((length + 0xF) & 0xFFFFFFF0);
 
-			in->Read(hash_result, 0x10);
-			offset = metadata_offset + (unsigned long long) i * edat->block_size + (unsigned long long) block_num * metadata_section_size;
-			length = edat->block_size;
+	// Read the data.
+	block.data.assign(length, 0);
+	in->Seek(block.offset);
+	return in->Read(block.data.data(), length) == length;
+}
 
-			if ((i == (block_num - 1)) && (edat->file_size % edat->block_size))
-				length = (int)(edat->file_size % edat->block_size);
-		}
+// Decrypt (and decompress) a block returned by read_block.
+// Doesn't access the file, so different blocks can be decrypted concurrently.
+int decrypt_block(EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, EDATBlock& block, std::vector<u8>& out, bool verbose)
+{
+	int length = (int)block.data.size();
 
-		// Locate the real data.
-		int pad_length = length;
-		length = (int)((pad_length + 0xF) & 0xFFFFFFF0);
+	unsigned char hash[0x10];
+	unsigned char key_result[0x10];
+	unsigned char empty_iv[0x10] = {};
+	memset(hash, 0, 0x10);
+	memset(key_result, 0, 0x10);
 
-		// Setup buffers for decryption and read the data.
-		enc_data = new unsigned char[length];
-		dec_data = new unsigned char[length];
-		memset(enc_data, 0, length);
-		memset(dec_data, 0, length);
-		memset(hash, 0, 0x10);
-		memset(key_result, 0, 0x10);
+	std::vector<u8> dec_data(length);
 
-		in->Seek(offset);
-		in->Read(enc_data, length);
+	// Generate a key for the current block.
+	unsigned char *b_key = get_block_key(block.index, npd);
 
-		// Generate a key for the current block.
-		b_key = get_block_key(i, npd);
+	// Encrypt the block key with the crypto key.
+	aesecb128_encrypt(crypt_key, b_key, key_result);
+	if ((edat->flags & EDAT_FLAG_0x10) != 0)
+		aesecb128_encrypt(crypt_key, key_result, hash);  // If FLAG 0x10 is set, encrypt again to get the final hash.
+	else
+		memcpy(hash, key_result, 0x10);
 
-		// Encrypt the block key with the crypto key.
-		aesecb128_encrypt(crypt_key, b_key, key_result);
-		if ((edat->flags & EDAT_FLAG_0x10) != 0)
-			aesecb128_encrypt(crypt_key, key_result, hash);  // If FLAG 0x10 is set, encrypt again to get the final hash.
-		else
-			memcpy(hash, key_result, 0x10);
+	delete[] b_key;
 
-		// Setup the crypto and hashing mode based on the extra flags.
-		int crypto_mode = ((edat->flags & EDAT_FLAG_0x02) == 0) ? 0x2 : 0x1;
-		int hash_mode;
+	// Setup the crypto and hashing mode based on the extra flags.
+	int crypto_mode = ((edat->flags & EDAT_FLAG_0x02) == 0) ? 0x2 : 0x1;
+	int hash_mode;
 
-		if ((edat->flags  & EDAT_FLAG_0x10) == 0)
-			hash_mode = 0x02;
-		else if ((edat->flags & EDAT_FLAG_0x20) == 0)
-			hash_mode = 0x04;
-		else
-			hash_mode = 0x01;
+	if ((edat->flags  & EDAT_FLAG_0x10) == 0)
+		hash_mode = 0x02;
+	else if ((edat->flags & EDAT_FLAG_0x20) == 0)
+		hash_mode = 0x04;
+	else
+		hash_mode = 0x01;
+
+	if ((edat->flags  & EDAT_ENCRYPTED_KEY_FLAG) != 0)
+	{
+		crypto_mode |= 0x10000000;
+		hash_mode |= 0x10000000;
+	}
 
-		if ((edat->flags  & EDAT_ENCRYPTED_KEY_FLAG) != 0)
+	if ((edat->flags  & EDAT_DEBUG_DATA_FLAG) != 0)
+	{
+		// Reset the flags.
+		crypto_mode |= 0x01000000;
+		hash_mode |= 0x01000000;
+		// Simply copy the data without the header or the footer.
+		memcpy(dec_data.data(), block.data.data(), length);
+	}
+	else
+	{
+		// IV is null if NPD version is 1 or 0.
+		unsigned char *iv = (npd->version <= 1) ? empty_iv : npd->digest;
+		// Call main crypto routine on this data block.
+		if (!decrypt(hash_mode, crypto_mode, (npd->version == 4), block.data.data(), dec_data.data(), length, key_result, iv, hash, block.hash_result))
 		{
-			crypto_mode |= 0x10000000;
-			hash_mode |= 0x10000000;
+			if (verbose)
+				LOG_WARNING(LOADER, "EDAT: Block at offset 0x%llx has invalid hash!", block.offset);
+
+			return 1;
 		}
+	}
 
-		if ((edat->flags  & EDAT_DEBUG_DATA_FLAG) != 0)
+	// Apply additional compression if needed.
+	// Every block except the last one holds block_size bytes of the file.
+	if (((edat->flags & EDAT_COMPRESSED_FLAG) != 0) && block.compression_end)
+	{
+		int decomp_size = (int)std::min<unsigned long long>(edat->block_size, edat->file_size - (unsigned long long) block.index * edat->block_size);
+		out.assign(decomp_size, 0);
+
+		if (verbose)
+			LOG_NOTICE(LOADER, "EDAT: Decompressing data...");
+
+		int res = decompress(out.data(), dec_data.data(), decomp_size);
+
+		if (verbose)
 		{
-			// Reset the flags.
-			crypto_mode |= 0x01000000;
-			hash_mode |= 0x01000000;
-			// Simply copy the data without the header or the footer.
-			memcpy(dec_data, enc_data, length);
+			LOG_NOTICE(LOADER, "EDAT: Compressed block size: %d", block.pad_length);
+			LOG_NOTICE(LOADER, "EDAT: Decompressed block size: %d", res);
 		}
-		else
+
+		if (res < 0)
 		{
-			// IV is null if NPD version is 1 or 0.
-			iv = (npd->version <= 1) ? empty_iv : npd->digest;
-			// Call main crypto routine on this data block.
-			if (!decrypt(hash_mode, crypto_mode, (npd->version == 4), enc_data, dec_data, length, key_result, iv, hash, hash_result))
-			{
-				if (verbose)
-					LOG_WARNING(LOADER, "EDAT: Block at offset 0x%llx has invalid hash!", offset);
-					
-				return 1;
-			}
+			LOG_ERROR(LOADER, "EDAT: Decompression failed!");
+			return 1;
 		}
 
-		// Apply additional compression if needed and write the decrypted data.
-		if (((edat->flags & EDAT_COMPRESSED_FLAG) != 0) && compression_end)
-		{
-			int decomp_size = (int)edat->file_size;
-			unsigned char *decomp_data = new unsigned char[decomp_size];
-			memset(decomp_data, 0, decomp_size);
+		out.resize(res);
+	}
+	else
+	{
+		dec_data.resize(block.pad_length);
+		out.swap(dec_data);
+	}
 
-			if (verbose)
-				LOG_NOTICE(LOADER, "EDAT: Decompressing data...");
+	return 0;
+}
 
-			int res = decompress(decomp_data, dec_data, decomp_size);
-			out->Write(decomp_data, res);
+int decrypt_data(vfsStream *in, vfsStream *out, EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, bool verbose)
+{
+	int block_num = (int)((edat->file_size + edat->block_size - 1) / edat->block_size);
 
-			if (verbose)
+	// Blocks are independent: read a batch serially, decrypt and decompress it on all cores, then write it in order.
+	const int batch_size = 64;
+
+	std::vector<EDATBlock> blocks(batch_size);
+	std::vector<std::vector<u8>> dec_data(batch_size);
+
+	for (int first = 0; first < block_num; first += batch_size)
+	{
+		const int count = std::min(batch_size, block_num - first);
+
+		for (int i = 0; i < count; i++)
+		{
+			if (!read_block(in, edat, npd, first + i, blocks[i]))
 			{
-				LOG_NOTICE(LOADER, "EDAT: Compressed block size: %d", pad_length);
-				LOG_NOTICE(LOADER, "EDAT: Decompressed block size: %d", res);
+				LOG_ERROR(LOADER, "EDAT: Block %d is truncated", first + i);
+				return 1;
 			}
+		}
 
-			edat->file_size -= res;
+		std::atomic<u32> errors(0);
 
-			if (edat->file_size == 0)
+		thread_parallel_for("EDAT Decrypter", (u32)count, [&](u32 i)
+		{
+			if (decrypt_block(edat, npd, crypt_key, blocks[i], dec_data[i], verbose))
 			{
-				if (res < 0)
-				{
-					LOG_ERROR(LOADER, "EDAT: Decompression failed!");
-					return 1;
-				}
-				else
-					LOG_NOTICE(LOADER, "EDAT: Successfully decompressed!");
+				errors++;
 			}
+		});
 
-			delete[] decomp_data;
-		}
-		else
+		if (errors)
+			return 1;
+
+		for (int i = 0; i < count; i++)
 		{
-			out->Write(dec_data, pad_length);
+			out->Write(dec_data[i].data(), dec_data[i].size());
 		}
-
-		delete[] enc_data;
-		delete[] dec_data;
 	}
 
 	return 0;
 }
 
-int check_data(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, rFile *f, bool verbose)
+int check_data(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, vfsStream *f, bool verbose)
 {
 	f->Seek(0);
 	unsigned char header[0xA0];
@@ -639,12 +682,9 @@ int validate_npd_hashes(const char* file_name, unsigned char *klicensee, NPD_HEA
 	return (title_hash_result && dev_hash_result);
 }
 
-bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, bool verbose)
+// Read and check the NPD and EDAT/SDAT headers and select the decryption key.
+int load_headers(vfsStream *input, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, NPD_HEADER *NPD, EDAT_HEADER *EDAT, unsigned char* key, bool verbose)
 {
-	// Setup NPD and EDAT/SDAT structs.
-	NPD_HEADER *NPD = new NPD_HEADER();
-	EDAT_HEADER *EDAT = new EDAT_HEADER();
-
 	// Read in the NPD and EDAT/SDAT headers.
 	char npd_header[0x80];
 	char edat_header[0x10];
@@ -666,8 +706,6 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 	if (memcmp(NPD->magic, npd_magic, 4))
 	{
 		LOG_ERROR(LOADER, "EDAT: %s has invalid NPD header or already decrypted.", input_file_name);
-		delete NPD;
-		delete EDAT;
 		return 1;
 	}
 
@@ -684,7 +722,6 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 	}
 
 	// Set decryption key.
-	unsigned char key[0x10];
 	memset(key, 0, 0x10);
 
 	// Check EDAT/SDAT flag.
@@ -720,8 +757,6 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 			if ((EDAT->flags & EDAT_DEBUG_DATA_FLAG) != EDAT_DEBUG_DATA_FLAG)
 			{
 				LOG_ERROR(LOADER, "EDAT: NPD hash validation failed!");
-				delete NPD;
-				delete EDAT;
 				return 1;
 			}
 		}
@@ -747,16 +782,12 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 			if (!test)
 			{
 				LOG_ERROR(LOADER, "EDAT: A valid RAP file is needed for this EDAT file!");
-				delete NPD;
-				delete EDAT;
 				return 1;
 			}
 		}
 		else if ((NPD->license & 0x1) == 0x1)      // Type 1: Use network activation.
 		{
 			LOG_ERROR(LOADER, "EDAT: Network license not supported!");
-			delete NPD;
-			delete EDAT;
 			return 1;
 		}
 
@@ -785,36 +816,44 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 	if (check_data(key, EDAT, NPD, input, verbose))
 	{
 		LOG_ERROR(LOADER, "EDAT: Data parsing failed!");
-		delete NPD;
-		delete EDAT;
 		return 1;
 	}
 	else
 		LOG_NOTICE(LOADER, "EDAT: Data successfully parsed!");
 
+	return 0;
+}
+
+bool extract_data(vfsStream *input, vfsStream *output, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, bool verbose)
+{
+	// Setup NPD and EDAT/SDAT structs.
+	NPD_HEADER NPD;
+	EDAT_HEADER EDAT;
+	unsigned char key[0x10];
+
+	if (load_headers(input, input_file_name, devklic, rifkey, &NPD, &EDAT, key, verbose))
+		return 1;
+
 	LOG_NOTICE(LOADER, "EDAT: Decrypting data...");
-	if (decrypt_data(input, output, EDAT, NPD, key, verbose))
+	if (decrypt_data(input, output, &EDAT, &NPD, key, verbose))
 	{
 		LOG_ERROR(LOADER, "EDAT: Data decryption failed!");
-		delete NPD;
-		delete EDAT;
 		return 1;
 	}
 	else
 		LOG_NOTICE(LOADER, "EDAT: Data successfully decrypted!");
 
-	delete NPD;
-	delete EDAT;
-
 	return 0;
 }
 
 int DecryptEDAT(const std::string& input_file_name, const std::string& output_file_name, int mode, const std::string& rap_file_name, unsigned char *custom_klic, bool verbose)
 {
 	// Prepare the files.
-	rFile input(input_file_name.c_str());
-	rFile output(output_file_name.c_str(), rFile::write);
+	vfsLocalFile input(nullptr);
+	vfsLocalFile output(nullptr);
 	rFile rap(rap_file_name.c_str());
+	input.Open(input_file_name, vfsRead);
+	output.Open(output_file_name, vfsWrite);
 
 	// Set keys (RIF and DEVKLIC).
 	unsigned char rifkey[0x10];
@@ -898,4 +937,176 @@ int DecryptEDAT(const std::string& input_file_name, const std::string& output_fi
 	input.Close();
 	output.Close();
 	return 0;
-}
\ No newline at end of file
+}
+
+EDATDecrypter::EDATDecrypter(std::shared_ptr<vfsFileBase> input)
+	: vfsFileBase(nullptr)
+	, m_input(input)
+	, m_initialized(false)
+{
+}
+
+EDATDecrypter::~EDATDecrypter()
+{
+	Close();
+}
+
+bool EDATDecrypter::Init(const std::string& file_name, unsigned char* devklic, unsigned char* rifkey)
+{
+	unsigned char empty_key[0x10] = {};
+
+	if (!m_input || !m_input->IsOpened())
+	{
+		return false;
+	}
+
+	m_input->Seek(0);
+
+	if (load_headers(m_input.get(), file_name.c_str(), devklic ? devklic : empty_key, rifkey ? rifkey : empty_key, &m_npd, &m_edat, m_key, false))
+	{
+		return false;
+	}
+
+	m_initialized = vfsFileBase::Open(m_input->GetPath(), vfsRead);
+
+	return m_initialized;
+}
+
+bool EDATDecrypter::IsSdata() const
+{
+	return m_initialized && (m_edat.flags & SDAT_FLAG) == SDAT_FLAG;
+}
+
+bool EDATDecrypter::Close()
+{
+	m_initialized = false;
+	m_cache.clear();
+
+	if (m_input)
+	{
+		m_input->Close();
+	}
+
+	return vfsFileBase::Close();
+}
+
+u64 EDATDecrypter::GetSize()
+{
+	return m_initialized ? m_edat.file_size : 0;
+}
+
+u64 EDATDecrypter::Write(const void* src, u64 size)
+{
+	return 0;
+}
+
+u64 EDATDecrypter::Read(void* dst, u64 size)
+{
+	const u64 res = ReadAt(m_pos, dst, size);
+	m_pos += res;
+
+	return res;
+}
+
+u64 EDATDecrypter::ReadAt(u64 offset, void* dst, u64 size)
+{
+	if (!m_initialized || offset >= m_edat.file_size || !size)
+	{
+		return 0;
+	}
+
+	size = std::min<u64>(size, m_edat.file_size - offset);
+
+	const u32 first = (u32)(offset / m_edat.block_size);
+	const u32 count = (u32)((offset + size - 1) / m_edat.block_size) - first + 1;
+
+	std::vector<std::shared_ptr<std::vector<u8>>> blocks(count);
+	std::vector<EDATBlock> missing;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (u32 i = 0; i < count; i++)
+		{
+			auto found = std::find_if(m_cache.begin(), m_cache.end(), [&](const cache_entry& e) { return e.first == first + i; });
+
+			if (found != m_cache.end())
+			{
+				blocks[i] = found->second;
+				m_cache.splice(m_cache.begin(), m_cache, found);
+				continue;
+			}
+
+			// the input stream isn't required to support concurrent reads
+			missing.emplace_back();
+			if (!read_block(m_input.get(), &m_edat, &m_npd, first + i, missing.back()))
+			{
+				LOG_ERROR(LOADER, "EDAT: Failed to read block %d of %s", first + i, GetPath().c_str());
+				return 0;
+			}
+		}
+	}
+
+	std::vector<std::shared_ptr<std::vector<u8>>> decrypted(missing.size());
+	std::atomic<u32> errors(0);
+
+	thread_parallel_for("EDAT Decrypter", (u32)missing.size(), [&](u32 i)
+	{
+		decrypted[i].reset(new std::vector<u8>());
+
+		if (decrypt_block(&m_edat, &m_npd, m_key, missing[i], *decrypted[i], false))
+		{
+			errors++;
+		}
+	});
+
+	if (errors)
+	{
+		LOG_ERROR(LOADER, "EDAT: Failed to decrypt %s (offset=0x%llx, size=0x%llx)", GetPath().c_str(), offset, size);
+		return 0;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (u32 i = 0; i < missing.size(); i++)
+		{
+			blocks[missing[i].index - first] = decrypted[i];
+			m_cache.emplace_front(missing[i].index, decrypted[i]);
+		}
+
+		while (m_cache.size() > cache_size)
+		{
+			m_cache.pop_back();
+		}
+	}
+
+	u64 done = 0;
+
+	for (u32 i = 0; i < count && done < size; i++)
+	{
+		const u64 block_offset = (u64)(first + i) * m_edat.block_size;
+		const u64 from = offset + done - block_offset;
+
+		if (from >= blocks[i]->size())
+		{
+			break;
+		}
+
+		const u64 copy = std::min<u64>(blocks[i]->size() - from, size - done);
+		memcpy((u8*)dst + done, blocks[i]->data() + from, (size_t)copy);
+		done += copy;
+	}
+
+	return done;
+}
+
+bool EDATDecrypter::SupportsConcurrentIo() const
+{
+	return true;
+}
+
+bool EDATDecrypter::IsOpened() const
+{
+	return m_initialized;
+}
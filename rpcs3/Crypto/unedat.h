@@ -2,7 +2,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <list>
 #include "utils.h"
+#include "Emu/FS/vfsFileBase.h"
 
 #define SDAT_FLAG 0x01000000
 #define EDAT_COMPRESSED_FLAG 0x00000001
@@ -33,4 +35,42 @@ typedef struct
 	unsigned long long file_size;
 } EDAT_HEADER;
 
-int DecryptEDAT(const std::string& input_file_name, const std::string& output_file_name, int mode, const std::string& rap_file_name, unsigned char *custom_klic, bool verbose);
\ No newline at end of file
+int DecryptEDAT(const std::string& input_file_name, const std::string& output_file_name, int mode, const std::string& rap_file_name, unsigned char *custom_klic, bool verbose);
+
+// Random-access view of an EDAT/SDAT file, only the blocks covering a read are decrypted (and decompressed).
+// Recently used blocks are cached, the missing blocks of a read spanning several blocks are decrypted in parallel.
+class EDATDecrypter : public vfsFileBase
+{
+	typedef std::pair<u32, std::shared_ptr<std::vector<u8>>> cache_entry;
+
+	std::shared_ptr<vfsFileBase> m_input;
+	NPD_HEADER m_npd;
+	EDAT_HEADER m_edat;
+	unsigned char m_key[0x10];
+	bool m_initialized;
+
+	std::mutex m_mutex;
+	std::list<cache_entry> m_cache; // most recently used blocks first
+
+public:
+	static const u32 cache_size = 32;
+
+	EDATDecrypter(std::shared_ptr<vfsFileBase> input);
+	virtual ~EDATDecrypter();
+
+	// Read the headers and select the key, devklic and rifkey are only used for EDAT files (nullptr means no key)
+	bool Init(const std::string& file_name, unsigned char* devklic, unsigned char* rifkey);
+	bool IsSdata() const;
+
+	virtual bool Close() override;
+
+	virtual u64 GetSize() override;
+
+	virtual u64 Write(const void* src, u64 size) override;
+	virtual u64 Read(void* dst, u64 size) override;
+
+	virtual u64 ReadAt(u64 offset, void* dst, u64 size) override;
+	virtual bool SupportsConcurrentIo() const override;
+
+	virtual bool IsOpened() const override;
+};
\ No newline at end of file
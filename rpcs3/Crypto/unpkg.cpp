@@ -10,6 +10,7 @@
 
 #include "Utilities/Log.h"
 #include "Utilities/rFile.h"
+#include "Utilities/Thread.h"
 
 // Decryption.
 bool CheckHeader(rFile& pkg_f, PKGHeader* m_header)
@@ -70,83 +71,98 @@ bool LoadHeader(rFile& pkg_f, PKGHeader* m_header)
 	return true;
 }
 
-int Decrypt(rFile& pkg_f, rFile& dec_pkg_f, PKGHeader* m_header)
+// Decrypt size bytes of the data area at offset (must be a multiple of HASH_LEN) in place.
+// Each HASH_LEN block is decrypted with a keystream derived from its index, so any part of the package can be decrypted independently.
+void DecryptData(const PKGHeader* m_header, aes_context* c, u64 offset, u8* buf, u64 size)
 {
-	if (!LoadHeader(pkg_f, m_header))
-		return -1;
-
-	aes_context c;
-	u8 iv[HASH_LEN];
-	u8 buf[BUF_SIZE];
-	u8 ctr[BUF_SIZE];
-	
-	// Debug key
-	u8 key[0x40];
-	memset(key, 0, 0x40);
-	memcpy(key+0x00, &m_header->qa_digest[0], 8); // &data[0x60]
-	memcpy(key+0x08, &m_header->qa_digest[0], 8); // &data[0x60]
-	memcpy(key+0x10, &m_header->qa_digest[8], 8); // &data[0x68]
-	memcpy(key+0x18, &m_header->qa_digest[8], 8); // &data[0x68]
+	const u64 first = offset / HASH_LEN;
+	const u64 bits = (size + HASH_LEN - 1) / HASH_LEN;
 
-	pkg_f.Seek(m_header->data_offset);
-	u32 parts = (m_header->data_size + BUF_SIZE - 1) / BUF_SIZE;
-
-	wxProgressDialog pdlg("PKG Decrypter / Installer", "Please wait, decrypting...", parts, 0, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
-
-	memcpy(iv, m_header->klicensee, sizeof(iv));
-	aes_setkey_enc(&c, PKG_AES_KEY, 128);
-	
-	for (u32 i=0; i<parts; i++)
+	if (m_header->pkg_type == PKG_RELEASE_TYPE_DEBUG)
 	{
-		memset(buf, 0, sizeof(buf));
-		u32 length = pkg_f.Read(buf, BUF_SIZE);
-		u32 bits = (length + HASH_LEN - 1) / HASH_LEN;
-		
-		if (m_header->pkg_type == PKG_RELEASE_TYPE_DEBUG)
+		// Debug key
+		u8 key[0x40];
+		memset(key, 0, 0x40);
+		memcpy(key+0x00, &m_header->qa_digest[0], 8); // &data[0x60]
+		memcpy(key+0x08, &m_header->qa_digest[0], 8); // &data[0x60]
+		memcpy(key+0x10, &m_header->qa_digest[8], 8); // &data[0x68]
+		memcpy(key+0x18, &m_header->qa_digest[8], 8); // &data[0x68]
+		*(be_t<u64>*)&key[0x38] = first;
+
+		for (u64 j = 0; j < bits; j++)
 		{
-			for (u32 j=0; j<bits; j++)
+			u8 hash[0x14];
+			sha1(key, 0x40, hash);
+
+			const u64 length = std::min<u64>(HASH_LEN, size - j * HASH_LEN);
+			for (u64 k = 0; k < length; k++)
 			{
-				u8 hash[0x14];
-				sha1(key, 0x40, hash);
-				*(u64*)&buf[j*HASH_LEN + 0] ^= *(u64*)&hash[0];
-				*(u64*)&buf[j*HASH_LEN + 8] ^= *(u64*)&hash[8];
-				*(be_t<u64>*)&key[0x38] += 1;
+				buf[j*HASH_LEN + k] ^= hash[k];
 			}
+
+			*(be_t<u64>*)&key[0x38] += 1;
 		}
+	}
+
+	if (m_header->pkg_type == PKG_RELEASE_TYPE_RELEASE)
+	{
+		// 128-bit counter: klicensee + block index
+		u64 hi = *(be_t<u64>*)&m_header->klicensee[0];
+		u64 lo = *(be_t<u64>*)&m_header->klicensee[8];
 
-		if (m_header->pkg_type == PKG_RELEASE_TYPE_RELEASE)
+		if (lo + first < lo)
+			hi += 1;
+
+		lo += first;
+
+		for (u64 j = 0; j < bits; j++)
 		{
-			for (u32 j=0; j<bits; j++)
+			u8 iv[HASH_LEN];
+			u8 ctr[HASH_LEN];
+			*(be_t<u64>*)&iv[0] = hi;
+			*(be_t<u64>*)&iv[8] = lo;
+
+			aes_crypt_ecb(c, AES_ENCRYPT, iv, ctr);
+
+			const u64 length = std::min<u64>(HASH_LEN, size - j * HASH_LEN);
+			for (u64 k = 0; k < length; k++)
 			{
-				aes_crypt_ecb(&c, AES_ENCRYPT, iv, ctr+j*HASH_LEN);
+				buf[j*HASH_LEN + k] ^= ctr[k];
+			}
 
-				be_t<u64> hi = *(be_t<u64>*)&iv[0];
-				be_t<u64> lo = *(be_t<u64>*)&iv[8];
-				lo++;
+			if (++lo == 0)
+				hi += 1;
+		}
+	}
+}
 
-				if (lo == 0)
-					hi += 1;
+// Read and decrypt size bytes of the data area at any offset.
+bool ReadDecrypted(rFile& pkg_f, const PKGHeader* m_header, aes_context* c, u64 offset, void* dst, u64 size, std::vector<u8>& buf)
+{
+	const u64 start = offset & ~(u64)(HASH_LEN - 1);
+	const u64 skip = offset - start;
 
-				*(be_t<u64>*)&iv[0] = hi;
-				*(be_t<u64>*)&iv[8] = lo;
-			}
-		
-			for (u32 j=0; j<length; j++) {
-				buf[j] ^= ctr[j];
-			}
-		}		
-		dec_pkg_f.Write(buf, length);
-		pdlg.Update(i);
+	buf.resize(skip + size);
+
+	if (pkg_f.ReadAt(m_header->data_offset + start, buf.data(), buf.size()) != buf.size())
+	{
+		LOG_ERROR(LOADER, "PKG: Package file is too short!");
+		return false;
 	}
-	pdlg.Update(parts);
-	return 0;
+
+	DecryptData(m_header, c, start, buf.data(), buf.size());
+	memcpy(dst, buf.data() + skip, size);
+
+	return true;
 }
 
 // Unpacking.
-bool LoadEntries(rFile& dec_pkg_f, PKGHeader* m_header, PKGEntry *m_entries)
+bool LoadEntries(rFile& pkg_f, PKGHeader* m_header, aes_context* c, PKGEntry *m_entries)
 {
-	dec_pkg_f.Seek(0);
-	dec_pkg_f.Read(m_entries, sizeof(PKGEntry) * m_header->file_count);
+	std::vector<u8> buf;
+
+	if (!ReadDecrypted(pkg_f, m_header, c, 0, m_entries, sizeof(PKGEntry) * m_header->file_count, buf))
+		return false;
 	
 	if (m_entries->name_offset / sizeof(PKGEntry) != m_header->file_count) {
 		LOG_ERROR(LOADER, "PKG: Entries are damaged!");
@@ -156,13 +172,24 @@ bool LoadEntries(rFile& dec_pkg_f, PKGHeader* m_header, PKGEntry *m_entries)
 	return true;
 }
 
-bool UnpackEntry(rFile& dec_pkg_f, const PKGEntry& entry, std::string dir)
+// Part of some file entry, decrypted by one of the workers and written directly to its destination
+struct PKGUnpackJob
+{
+	std::string path;
+	u64 offset; // offset in the data area
+	u64 file_offset; // offset in the output file
+	u64 size;
+};
+
+static const u64 PKG_JOB_SIZE = 4 * 1024 * 1024;
+
+bool PrepareEntry(rFile& pkg_f, PKGHeader* m_header, aes_context* c, const PKGEntry& entry, std::string dir, std::vector<PKGUnpackJob>& jobs)
 {
-	u8 buf[BUF_SIZE];
+	std::vector<u8> buf;
+	std::string name(entry.name_size, '\0');
 
-	dec_pkg_f.Seek(entry.name_offset);
-	dec_pkg_f.Read(buf, entry.name_size);
-	buf[entry.name_size] = 0;
+	if (entry.name_size && !ReadDecrypted(pkg_f, m_header, c, entry.name_offset, &name[0], entry.name_size, buf))
+		return false;
 	
 	switch (entry.type & (0xff))
 	{
@@ -171,23 +198,28 @@ bool UnpackEntry(rFile& dec_pkg_f, const PKGEntry& entry, std::string dir)
 		case PKG_FILE_ENTRY_SDAT:
 		case PKG_FILE_ENTRY_REGULAR:
 		{
+			// the file is created here so that the workers can write its parts in any order
 			rFile out;
-			out.Create(dir + std::string(reinterpret_cast<char *>(buf), entry.name_size));
-			dec_pkg_f.Seek(entry.file_offset);
-
-			for (u64 size = 0; size < entry.file_size; ) {
-				size += dec_pkg_f.Read(buf, BUF_SIZE);
-				if (size > entry.file_size)
-					out.Write(buf, BUF_SIZE - (size - entry.file_size));
-				else
-					out.Write(buf, BUF_SIZE);
+			if (!out.Create(dir + name, true)) {
+				LOG_ERROR(LOADER, "PKG: Could not create %s", (dir + name).c_str());
+				return false;
 			}
 			out.Close();
+
+			for (u64 pos = 0; pos < entry.file_size; pos += PKG_JOB_SIZE)
+			{
+				PKGUnpackJob job;
+				job.path = dir + name;
+				job.offset = entry.file_offset + pos;
+				job.file_offset = pos;
+				job.size = std::min<u64>(PKG_JOB_SIZE, entry.file_size - pos);
+				jobs.push_back(job);
+			}
 		}
 		break;
 			
 		case PKG_FILE_ENTRY_FOLDER:
-			rMkdir(dir + std::string(reinterpret_cast<char *>(buf), entry.name_size));
+			rMkdir(dir + name);
 		break;
 	}
 	return true;
@@ -197,37 +229,102 @@ int Unpack(rFile& pkg_f, std::string src, std::string dst)
 {
 	PKGHeader* m_header = (PKGHeader*) malloc (sizeof(PKGHeader));
 
-	rFile dec_pkg_f;
-	// TODO: This shouldn't use current dir
-	std::string decryptedFile = "./dev_hdd1/" + src + ".dec";
-
-	dec_pkg_f.Create(decryptedFile, true);
-	
-	if (Decrypt(pkg_f, dec_pkg_f, m_header) < 0)
+	if (!LoadHeader(pkg_f, m_header))
 		return -1;
-	
-	dec_pkg_f.Close();
 
-	rFile n_dec_pkg_f(decryptedFile, rFile::read);
+	aes_context c;
+	aes_setkey_enc(&c, PKG_AES_KEY, 128);
 
 	std::vector<PKGEntry> m_entries;
 	m_entries.resize(m_header->file_count);
 
 	PKGEntry *m_entries_ptr = &m_entries[0];
-	if (!LoadEntries(n_dec_pkg_f, m_header, m_entries_ptr))
+	if (!LoadEntries(pkg_f, m_header, &c, m_entries_ptr))
 		return -1;
 
-	wxProgressDialog pdlg("PKG Decrypter / Installer", "Please wait, unpacking...", m_entries.size(), 0, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+	// create the directory tree and split the files into jobs
+	std::vector<PKGUnpackJob> jobs;
+	u64 total_size = 0;
 
 	for (const PKGEntry& entry : m_entries)
 	{
-		UnpackEntry(n_dec_pkg_f, entry, dst + src + "/");
-		pdlg.Update(pdlg.GetValue() + 1);
+		if (!PrepareEntry(pkg_f, m_header, &c, entry, dst + src + "/", jobs))
+			return -1;
+	}
+
+	for (auto& job : jobs)
+	{
+		total_size += job.size;
+	}
+
+	// decrypt and write the jobs in parallel, the keystream of each part doesn't depend on the others
+	std::atomic<size_t> next_job(0);
+	std::atomic<size_t> finished_jobs(0);
+	std::atomic<u64> finished_size(0);
+	std::atomic<bool> failed(false);
+
+	const u32 workers_count = std::max<u32>(std::min<u32>(std::thread::hardware_concurrency(), 8), 1);
+	std::vector<std::unique_ptr<thread>> workers;
+
+	const auto start_time = std::chrono::steady_clock::now();
+
+	for (u32 i = 0; i < workers_count; i++)
+	{
+		workers.emplace_back(new thread(fmt::Format("PKG Decrypter[%d]", i), [&]()
+		{
+			std::vector<u8> data(PKG_JOB_SIZE);
+			std::vector<u8> buf;
+
+			for (size_t j; (j = next_job++) < jobs.size(); finished_jobs++)
+			{
+				const PKGUnpackJob& job = jobs[j];
+
+				if (failed)
+					continue;
+
+				if (!ReadDecrypted(pkg_f, m_header, &c, job.offset, data.data(), job.size, buf))
+				{
+					failed = true;
+					continue;
+				}
+
+				rFile out(job.path, rFile::read_write);
+				if (out.WriteAt(job.file_offset, data.data(), job.size) != job.size)
+				{
+					LOG_ERROR(LOADER, "PKG: Could not write %s", job.path.c_str());
+					failed = true;
+					continue;
+				}
+
+				finished_size += job.size;
+			}
+		}));
+	}
+
+	const int range = std::max<int>((int)(total_size >> 20), 1);
+	wxProgressDialog pdlg("PKG Decrypter / Installer", "Please wait, unpacking...", range, 0, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+
+	while (finished_jobs < jobs.size())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		const u64 size = finished_size;
+		pdlg.Update(std::min<int>((int)(size >> 20), range), fmt::FromUTF8(fmt::Format("Please wait, unpacking... (%.1f MB/s)", seconds > 0 ? size / seconds / (1024 * 1024) : 0.0)));
 	}
-	pdlg.Update(m_entries.size());
 
-	n_dec_pkg_f.Close();
-	wxRemoveFile(decryptedFile);
+	for (auto& worker : workers)
+	{
+		worker->join();
+	}
+
+	pdlg.Update(range);
+
+	if (failed)
+		return -1;
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	LOG_NOTICE(LOADER, "PKG: Unpacked %lld MB in %.2f s (%.1f MB/s, %d threads)", total_size >> 20, seconds, seconds > 0 ? total_size / seconds / (1024 * 1024) : 0.0, workers_count);
 
 	return 0;
 }
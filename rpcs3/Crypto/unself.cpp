@@ -4,14 +4,16 @@
 #include "aes.h"
 #include "sha1.h"
 #include "utils.h"
+#include "Utilities/Thread.h"
 #include "Emu/FS/vfsLocalFile.h"
+#include "Emu/FS/vfsStreamBuffer.h"
+#include "Ini.h"
 #include "unself.h"
 
 #include <wx/mstream.h>
 #include <wx/zstream.h>
 
-
-void WriteEhdr(rFile& f, Elf64_Ehdr& ehdr)
+void WriteEhdr(vfsStream& f, Elf64_Ehdr& ehdr)
 {
 Write32(f, ehdr.e_magic);
 Write8(f, ehdr.e_class);
@@ -33,7 +35,7 @@ Write16(f, ehdr.e_shentsize);
 Write16(f, ehdr.e_shnum);
 Write16(f, ehdr.e_shstrndx);
 }
-void WritePhdr(rFile& f, Elf64_Phdr& phdr)
+void WritePhdr(vfsStream& f, Elf64_Phdr& phdr)
 {
 Write32(f, phdr.p_type);
 Write32(f, phdr.p_flags);
@@ -44,7 +46,7 @@ Write64(f, phdr.p_filesz);
 Write64(f, phdr.p_memsz);
 Write64(f, phdr.p_align);
 }
-void WriteShdr(rFile& f, Elf64_Shdr& shdr)
+void WriteShdr(vfsStream& f, Elf64_Shdr& shdr)
 {
 Write32(f, shdr.sh_name);
 Write32(f, shdr.sh_type);
@@ -57,7 +59,7 @@ Write32(f, shdr.sh_info);
 Write64(f, shdr.sh_addralign);
 Write64(f, shdr.sh_entsize);
 }
-void WriteEhdr(rFile& f, Elf32_Ehdr& ehdr)
+void WriteEhdr(vfsStream& f, Elf32_Ehdr& ehdr)
 {
 	Write32(f, ehdr.e_magic);
 	Write8(f, ehdr.e_class);
@@ -79,7 +81,7 @@ void WriteEhdr(rFile& f, Elf32_Ehdr& ehdr)
 	Write16(f, ehdr.e_shnum);
 	Write16(f, ehdr.e_shstrndx);
 }
-void WritePhdr(rFile& f, Elf32_Phdr& phdr)
+void WritePhdr(vfsStream& f, Elf32_Phdr& phdr)
 {
 	Write32(f, phdr.p_type);
 	Write32(f, phdr.p_offset);
@@ -90,7 +92,7 @@ void WritePhdr(rFile& f, Elf32_Phdr& phdr)
 	Write32(f, phdr.p_flags);
 	Write32(f, phdr.p_align);
 }
-void WriteShdr(rFile& f, Elf32_Shdr& shdr)
+void WriteShdr(vfsStream& f, Elf32_Shdr& shdr)
 {
 	Write32(f, shdr.sh_name);
 	Write32(f, shdr.sh_type);
@@ -726,11 +728,13 @@ bool SELFDecrypter::LoadMetadata()
 
 bool SELFDecrypter::DecryptData()
 {
-	aes_context aes;
+	// Calculate the total data size and the offset of each section in the data buffer.
+	std::vector<u32> data_buf_offsets(meta_hdr.section_count);
 
-	// Calculate the total data size.
 	for (unsigned int i = 0; i < meta_hdr.section_count; i++)
 	{
+		data_buf_offsets[i] = data_buf_length;
+
 		if (meta_shdr[i].encrypted == 3)
 		{
 			if ((meta_shdr[i].key_idx <= meta_hdr.key_count - 1) && (meta_shdr[i].iv_idx <= meta_hdr.key_count))
@@ -741,12 +745,13 @@ bool SELFDecrypter::DecryptData()
 	// Allocate a buffer to store decrypted data.
 	data_buf = (u8*)malloc(data_buf_length);
 
-	// Set initial offset.
-	u32 data_buf_offset = 0;
+	std::atomic<u32> errors(0);
 
 	// Parse the metadata section headers to find the offsets of encrypted data.
-	for (unsigned int i = 0; i < meta_hdr.section_count; i++)
+	// Every section has its own key and iv, so they are decrypted in parallel.
+	thread_parallel_for("SELF Decrypter", meta_hdr.section_count, [&](u32 i)
 	{
+		aes_context aes;
 		size_t ctr_nc_off = 0;
 		u8 ctr_stream_block[0x10];
 		u8 data_key[0x10];
@@ -762,12 +767,9 @@ bool SELFDecrypter::DecryptData()
 				memcpy(data_key, data_keys + meta_shdr[i].key_idx * 0x10, 0x10);
 				memcpy(data_iv, data_keys + meta_shdr[i].iv_idx * 0x10, 0x10);
 
-				// Allocate a buffer to hold the data.
-				u8 *buf = (u8 *)malloc(meta_shdr[i].data_size);
-
-				// Seek to the section data offset and read the encrypted data.
-				self_f.Seek(meta_shdr[i].data_offset);
-				self_f.Read(buf, meta_shdr[i].data_size);
+				// Read the encrypted data directly into its place in the data buffer.
+				u8 *buf = data_buf + data_buf_offsets[i];
+				self_f.ReadAt(meta_shdr[i].data_offset, buf, meta_shdr[i].data_size);
 
 				// Zero out our ctr nonce.
 				memset(ctr_stream_block, 0, sizeof(ctr_stream_block));
@@ -776,31 +778,37 @@ bool SELFDecrypter::DecryptData()
 				aes_setkey_enc(&aes, data_key, 128);
 				aes_crypt_ctr(&aes, meta_shdr[i].data_size, &ctr_nc_off, data_iv, ctr_stream_block, buf, buf);
 
-				// Copy the decrypted data.
-				memcpy(data_buf + data_buf_offset, buf, meta_shdr[i].data_size);
-
-				// Advance the buffer's offset.
-				data_buf_offset += meta_shdr[i].data_size;
-
-				// Release the temporary buffer.
-				free(buf);
+				// Verify the decrypted (still compressed) data with the SHA1-HMAC stored in the key buffer.
+				if (meta_shdr[i].hashed == 2)
+				{
+					u8 hash[20];
+
+					if (meta_shdr[i].sha1_idx * 0x10 + sizeof(SectionHash) > data_keys_length)
+					{
+						LOG_ERROR(LOADER, "SELF: Section %d has an invalid hash index (0x%x)", i, meta_shdr[i].sha1_idx);
+						errors++;
+					}
+					else
+					{
+						const SectionHash* section_hash = (const SectionHash*)(data_keys + meta_shdr[i].sha1_idx * 0x10);
+						sha1_hmac(section_hash->hmac_key, sizeof(section_hash->hmac_key), buf, meta_shdr[i].data_size, hash);
+
+						if (memcmp(hash, section_hash->sha1, sizeof(hash)))
+						{
+							LOG_ERROR(LOADER, "SELF: Section %d is corrupted (hash mismatch)", i);
+							errors++;
+						}
+					}
+				}
 			}
 		}
-	}
+	});
 
-	return true;
+	return errors == 0;
 }
 
-bool SELFDecrypter::MakeElf(const std::string& elf, bool isElf32)
+bool SELFDecrypter::MakeElf(vfsStream& e, bool isElf32)
 {
-	// Create a new ELF file.
-	rFile e(elf.c_str(), rFile::write);
-	if(!e.IsOpened())
-	{
-		LOG_ERROR(LOADER, "Could not create ELF file! (%s)", elf.c_str());
-		return false;
-	}
-
 	// Set initial offset.
 	u32 data_buf_offset = 0;
 
@@ -845,46 +853,62 @@ bool SELFDecrypter::MakeElf(const std::string& elf, bool isElf32)
 		for(u32 i = 0; i < elf64_hdr.e_phnum; ++i)
 			WritePhdr(e, phdr64_arr[i]);
 
-		// Write data.
+		// Find the data of each section and decompress the compressed ones in parallel.
+		std::vector<u32> data_buf_offsets(meta_hdr.section_count);
+		std::vector<std::vector<u8>> decomp_bufs(meta_hdr.section_count);
+
 		for (unsigned int i = 0; i < meta_hdr.section_count; i++)
 		{
+			data_buf_offsets[i] = data_buf_offset;
+
 			// PHDR type.
 			if (meta_shdr[i].type == 2)
 			{
-				// Decompress if necessary.
-				if (meta_shdr[i].compressed == 2)
-				{
-					// Allocate a buffer for decompression.
-					u8 *decomp_buf = (u8 *)malloc(phdr64_arr[meta_shdr[i].program_idx].p_filesz);
+				// Advance the data buffer offset by data size.
+				data_buf_offset += meta_shdr[i].data_size;
+			}
+		}
 
-					// Set up memory streams for input/output.
-					wxMemoryInputStream decomp_stream_in(data_buf + data_buf_offset, meta_shdr[i].data_size);
-					wxMemoryOutputStream decomp_stream_out;
+		thread_parallel_for("SELF Decrypter", meta_hdr.section_count, [&](u32 i)
+		{
+			// Decompress if necessary.
+			if (meta_shdr[i].type == 2 && meta_shdr[i].compressed == 2)
+			{
+				// Allocate a buffer for decompression.
+				std::vector<u8>& decomp_buf = decomp_bufs[i];
+				decomp_buf.resize(phdr64_arr[meta_shdr[i].program_idx].p_filesz);
 
-					// Create a Zlib stream, read the data and flush the stream.
-					wxZlibInputStream* z_stream = new wxZlibInputStream(decomp_stream_in);
-					z_stream->Read(decomp_stream_out);
-					delete z_stream;
+				// Set up memory streams for input/output.
+				wxMemoryInputStream decomp_stream_in(data_buf + data_buf_offsets[i], meta_shdr[i].data_size);
+				wxMemoryOutputStream decomp_stream_out;
 
-					// Copy the decompressed result from the stream.
-					decomp_stream_out.CopyTo(decomp_buf, phdr64_arr[meta_shdr[i].program_idx].p_filesz);
+				// Create a Zlib stream, read the data and flush the stream.
+				wxZlibInputStream* z_stream = new wxZlibInputStream(decomp_stream_in);
+				z_stream->Read(decomp_stream_out);
+				delete z_stream;
 
-					// Seek to the program header data offset and write the data.
-					e.Seek(phdr64_arr[meta_shdr[i].program_idx].p_offset);
-					e.Write(decomp_buf, phdr64_arr[meta_shdr[i].program_idx].p_filesz);
+				// Copy the decompressed result from the stream.
+				decomp_stream_out.CopyTo(decomp_buf.data(), decomp_buf.size());
+			}
+		});
 
-					// Release the decompression buffer.
-					free(decomp_buf);
+		// Write data.
+		for (unsigned int i = 0; i < meta_hdr.section_count; i++)
+		{
+			// PHDR type.
+			if (meta_shdr[i].type == 2)
+			{
+				// Seek to the program header data offset and write the data.
+				e.Seek(phdr64_arr[meta_shdr[i].program_idx].p_offset);
+
+				if (meta_shdr[i].compressed == 2)
+				{
+					e.Write(decomp_bufs[i].data(), decomp_bufs[i].size());
 				}
 				else
 				{
-					// Seek to the program header data offset and write the data.
-					e.Seek(phdr64_arr[meta_shdr[i].program_idx].p_offset);
-					e.Write(data_buf + data_buf_offset, meta_shdr[i].data_size);
+					e.Write(data_buf + data_buf_offsets[i], meta_shdr[i].data_size);
 				}
-
-				// Advance the data buffer offset by data size.
-				data_buf_offset += meta_shdr[i].data_size;
 			}
 		}
 
@@ -898,7 +922,6 @@ bool SELFDecrypter::MakeElf(const std::string& elf, bool isElf32)
 		}
 	}
 
-	e.Close();
 	return true;
 }
 
@@ -952,15 +975,11 @@ bool IsSelf(const std::string& path)
 	return hdr.CheckMagic();
 }
 
-bool IsSelfElf32(const std::string& path)
+bool IsSelfElf32(vfsStream& f)
 {
-	vfsLocalFile f(nullptr);
-
-	if(!f.Open(path))
-		return false;
-
 	SceHeader hdr;
 	SelfHeader sh;
+	f.Seek(0);
 	hdr.Load(f);
 	sh.Load(f);
 	
@@ -972,17 +991,18 @@ bool IsSelfElf32(const std::string& path)
 	return (elf_class[4] == 1);
 }
 
-bool CheckDebugSelf(const std::string& self, const std::string& elf)
+bool IsSelfElf32(const std::string& path)
 {
-	// Open the SELF file.
-	rFile s(self);
+	vfsLocalFile f(nullptr);
 
-	if(!s.IsOpened())
-	{
-		LOG_ERROR(LOADER, "Could not open SELF file! (%s)", self.c_str());
+	if(!f.Open(path))
 		return false;
-	}
 
+	return IsSelfElf32(f);
+}
+
+bool CheckDebugSelf(vfsStream& s, vfsStream& e)
+{
 	// Get the key version.
 	s.Seek(0x08);
 	u16 key_version;
@@ -1002,20 +1022,11 @@ bool CheckDebugSelf(const std::string& self, const std::string& elf)
 		elf_offset = swap64(elf_offset);
 		s.Seek(elf_offset);
 
-		// Write the real ELF file back.
-		rFile e(elf, rFile::write);
-		if(!e.IsOpened())
-		{
-			LOG_ERROR(LOADER, "Could not create ELF file! (%s)", elf.c_str());
-			return false;
-		}
-
 		// Copy the data.
 		char buf[2048];
-		while (ssize_t size = s.Read(buf, 2048))
+		while (u64 size = s.Read(buf, 2048))
 			e.Write(buf, size);
 
-		e.Close();
 		return true;
 	}
 	else
@@ -1026,19 +1037,111 @@ bool CheckDebugSelf(const std::string& self, const std::string& elf)
 	}
 }
 
-bool DecryptSelf(const std::string& elf, const std::string& self)
+// Decrypted ELF files are cached by the hash of the SELF file
+std::string GetElfCachePath(const std::vector<u8>& self_data)
 {
-	// Check for a debug SELF first.
-	if (!CheckDebugSelf(self, elf))
+	u8 hash[20];
+	sha1(self_data.data(), self_data.size(), hash);
+
+	std::string path = "elf_cache/";
+
+	for (u32 i = 0; i < sizeof(hash); i++)
+	{
+		path += fmt::Format("%02x", hash[i]);
+	}
+
+	return path + ".elf";
+}
+
+// Check that the cached file is a complete ELF file (the program data may be cut off if the file is damaged)
+static bool CheckElfCache(const std::vector<u8>& data)
+{
+	if (data.size() < 0x34 || memcmp(data.data(), "\x7f" "ELF", 4))
+	{
+		return false;
+	}
+
+	const bool is_elf64 = data[4] == 2;
+	const u64 size = data.size();
+	u64 phoff, phentsize, phnum;
+
+	if (is_elf64)
+	{
+		if (size < 0x40) return false;
+		phoff = swap64(*(u64*)&data[0x20]);
+		phentsize = swap16(*(u16*)&data[0x36]);
+		phnum = swap16(*(u16*)&data[0x38]);
+	}
+	else
+	{
+		phoff = swap32(*(u32*)&data[0x1c]);
+		phentsize = swap16(*(u16*)&data[0x2a]);
+		phnum = swap16(*(u16*)&data[0x2c]);
+	}
+
+	if (phentsize < (is_elf64 ? 0x38u : 0x20u) || phoff > size || phentsize * phnum > size - phoff)
+	{
+		return false;
+	}
+
+	for (u64 i = 0; i < phnum; i++)
 	{
-		// Set a virtual pointer to the SELF file.
-		vfsLocalFile self_vf(nullptr);
+		const u8* phdr = &data[phoff + i * phentsize];
+		const u64 offset = is_elf64 ? swap64(*(u64*)&phdr[0x08]) : swap32(*(u32*)&phdr[0x04]);
+		const u64 filesz = is_elf64 ? swap64(*(u64*)&phdr[0x20]) : swap32(*(u32*)&phdr[0x10]);
 
-		if (!self_vf.Open(self))
+		if (offset > size || filesz > size - offset)
+		{
 			return false;
+		}
+	}
 
+	return true;
+}
+
+bool DecryptSelf(vfsStreamBuffer& elf, const std::string& self)
+{
+	// Read the whole SELF file, it's decrypted from memory.
+	rFile s(self);
+
+	if(!s.IsOpened())
+	{
+		LOG_ERROR(LOADER, "Could not open SELF file! (%s)", self.c_str());
+		return false;
+	}
+
+	std::vector<u8> self_data(s.Length());
+	self_data.resize(s.Read(self_data.data(), self_data.size()));
+	s.Close();
+
+	// Try to load the ELF file decrypted on some previous boot.
+	const std::string cache_path = Ini.HLESelfCache.GetValue() ? GetElfCachePath(self_data) : "";
+
+	if (cache_path.size() && rExists(cache_path))
+	{
+		rFile c(cache_path);
+		std::vector<u8> elf_data(c.Length());
+
+		if (c.IsOpened() && c.Read(elf_data.data(), elf_data.size()) == elf_data.size() && CheckElfCache(elf_data))
+		{
+			LOG_NOTICE(LOADER, "SELF: Using the decrypted ELF file from cache (%s)", cache_path.c_str());
+			elf.WriteAt(0, elf_data.data(), elf_data.size());
+			elf.Seek(0);
+			return true;
+		}
+
+		LOG_WARNING(LOADER, "SELF: The ELF cache file is damaged (%s)", cache_path.c_str());
+		c.Close();
+		rRemoveFile(cache_path);
+	}
+
+	vfsStreamBuffer self_vf(std::move(self_data));
+
+	// Check for a debug SELF first.
+	if (!CheckDebugSelf(self_vf, elf))
+	{
 		// Check the ELF file class (32 or 64 bit).
-		bool isElf32 = IsSelfElf32(self);
+		bool isElf32 = IsSelfElf32(self_vf);
 
 		// Start the decrypter on this SELF file.
 		SELFDecrypter self_dec(self_vf);
@@ -1070,7 +1173,29 @@ bool DecryptSelf(const std::string& elf, const std::string& self)
 			LOG_ERROR(LOADER, "SELF: Failed to make ELF file from SELF!");
 			return false;
 		}
+
+		if (cache_path.size())
+		{
+			if (!rExists("elf_cache")) rMkdir("elf_cache");
+
+			// write a temporary file first, so an interrupted write never leaves a damaged file under the final name
+			const std::string temp_path = cache_path + ".tmp";
+			bool written;
+
+			{
+				rFile c(temp_path, rFile::write);
+				written = c.IsOpened() && c.Write(elf.m_data.data(), elf.m_data.size()) == elf.m_data.size();
+			}
+
+			// rRename() doesn't replace an existing file on Windows
+			if (!written || (rExists(cache_path) && !rRemoveFile(cache_path)) || !rRename(temp_path, cache_path))
+			{
+				LOG_WARNING(LOADER, "SELF: Could not write the ELF cache file (%s)", cache_path.c_str());
+				rRemoveFile(temp_path);
+			}
+		}
 	}
 
+	elf.Seek(0);
 	return true;
 }
@@ -4,6 +4,8 @@
 #include "Loader/ELF32.h"
 #include "key_vault.h"
 
+struct vfsStreamBuffer;
+
 struct AppInfo 
 {
   u64 authid;
@@ -509,7 +511,7 @@ class SELFDecrypter
 
 public:
 	SELFDecrypter(vfsStream& s);
-	bool MakeElf(const std::string& elf, bool isElf32);
+	bool MakeElf(vfsStream& elf, bool isElf32);
 	bool LoadHeaders(bool isElf32);
 	void ShowHeaders(bool isElf32);
 	bool LoadMetadata();
@@ -519,6 +521,8 @@ public:
 };
 
 extern bool IsSelf(const std::string& path);
+extern bool IsSelfElf32(vfsStream& f);
 extern bool IsSelfElf32(const std::string& path);
-extern bool CheckDebugSelf(const std::string& self, const std::string& elf);
-extern bool DecryptSelf(const std::string& elf, const std::string& self);
+extern bool CheckDebugSelf(vfsStream& self, vfsStream& elf);
+// Decrypt the SELF file into elf (positioned at the beginning)
+extern bool DecryptSelf(vfsStreamBuffer& elf, const std::string& self);
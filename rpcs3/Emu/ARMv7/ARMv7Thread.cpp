@@ -122,6 +122,7 @@ void ARMv7Thread::FastCall(u32 addr)
 	CPUThread::Task();
 
 	m_status = old_status;
+	AddEvent(CPU_EVENT_STATE);
 	PC = old_PC;
 	SP = old_stack;
 	LR = old_LR;
@@ -131,6 +132,7 @@ void ARMv7Thread::FastCall(u32 addr)
 void ARMv7Thread::FastStop()
 {
 	m_status = Stopped;
+	AddEvent(CPU_EVENT_STATE);
 }
 
 arm7_thread::arm7_thread(u32 entry, const std::string& name, u32 stack_size, u32 prio)
@@ -22,6 +22,24 @@ public:
 	{
 		return 0;
 	}
+
+	// get the caller which will handle the code (for decoding once and calling many times)
+	virtual const InstrCaller<TO>* resolve(u32 code) const
+	{
+		return this;
+	}
+
+	// extract the operands for call() (up to 6)
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = code;
+	}
+
+	// call the handler with the operands extracted by extract()
+	virtual void call(TO* op, const u32* args) const
+	{
+		(*this)(op, args[0]);
+	}
 };
 
 template<typename TO>
@@ -41,6 +59,15 @@ public:
 	{
 		(op->*m_func)();
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)();
+	}
 };
 
 template<typename TO, typename T1>
@@ -62,6 +89,16 @@ public:
 	{
 		(op->*m_func)((T1)m_arg_func_1(code));
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = m_arg_func_1(code);
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)((T1)args[0]);
+	}
 };
 
 template<typename TO, typename T1, typename T2>
@@ -88,6 +125,20 @@ public:
 			(T2)m_arg_func_2(code)
 		);
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = m_arg_func_1(code);
+		args[1] = m_arg_func_2(code);
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)(
+			(T1)args[0],
+			(T2)args[1]
+		);
+	}
 };
 
 template<typename TO, typename T1, typename T2, typename T3>
@@ -120,6 +171,22 @@ public:
 			(T3)m_arg_func_3(code)
 		);
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = m_arg_func_1(code);
+		args[1] = m_arg_func_2(code);
+		args[2] = m_arg_func_3(code);
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)(
+			(T1)args[0],
+			(T2)args[1],
+			(T3)args[2]
+		);
+	}
 };
 
 template<typename TO, typename T1, typename T2, typename T3, typename T4>
@@ -156,6 +223,24 @@ public:
 			(T4)m_arg_func_4(code)
 		);
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = m_arg_func_1(code);
+		args[1] = m_arg_func_2(code);
+		args[2] = m_arg_func_3(code);
+		args[3] = m_arg_func_4(code);
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)(
+			(T1)args[0],
+			(T2)args[1],
+			(T3)args[2],
+			(T4)args[3]
+		);
+	}
 };
 
 template<typename TO, typename T1, typename T2, typename T3, typename T4, typename T5>
@@ -196,6 +281,26 @@ public:
 			(T5)m_arg_func_5(code)
 		);
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = m_arg_func_1(code);
+		args[1] = m_arg_func_2(code);
+		args[2] = m_arg_func_3(code);
+		args[3] = m_arg_func_4(code);
+		args[4] = m_arg_func_5(code);
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)(
+			(T1)args[0],
+			(T2)args[1],
+			(T3)args[2],
+			(T4)args[3],
+			(T5)args[4]
+		);
+	}
 };
 
 template<typename TO, typename T1, typename T2, typename T3, typename T4, typename T5, typename T6>
@@ -240,6 +345,28 @@ public:
 			(T6)m_arg_func_6(code)
 		);
 	}
+
+	virtual void extract(u32 code, u32* args) const
+	{
+		args[0] = m_arg_func_1(code);
+		args[1] = m_arg_func_2(code);
+		args[2] = m_arg_func_3(code);
+		args[3] = m_arg_func_4(code);
+		args[4] = m_arg_func_5(code);
+		args[5] = m_arg_func_6(code);
+	}
+
+	virtual void call(TO* op, const u32* args) const
+	{
+		(op->*m_func)(
+			(T1)args[0],
+			(T2)args[1],
+			(T3)args[2],
+			(T4)args[3],
+			(T5)args[4],
+			(T6)args[5]
+		);
+	}
 };
 
 template<typename TO>
@@ -530,6 +657,11 @@ public:
 		decode(op, m_func(code) & (count - 1), code);
 	}
 
+	virtual const InstrCaller<TO>* resolve(u32 code) const
+	{
+		return m_instrs[m_func(code) & (count - 1)]->resolve(code);
+	}
+
 	virtual u32 operator [](u32 entry) const
 	{
 		return encode(entry);
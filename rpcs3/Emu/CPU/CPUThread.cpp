@@ -16,26 +16,34 @@ CPUThread* GetCurrentCPUThread()
 
 CPUThread::CPUThread(CPUThreadType type)
 	: ThreadBase("CPUThread")
+	, m_status(Stopped)
+	, m_prio(0)
+	, m_offset(0)
 	, m_type(type)
-	, m_stack_size(0)
+	, m_is_step(false)
 	, m_stack_addr(0)
-	, m_offset(0)
-	, m_prio(0)
-	, m_sync_wait(false)
-	, m_wait_thread_id(-1)
+	, m_stack_size(0)
+	, m_var_arena(nullptr)
 	, m_dec(nullptr)
-	, m_is_step(false)
+	, m_trace_call_stack(true)
+	, m_events(0)
 	, m_is_branch(false)
-	, m_status(Stopped)
-	, m_last_syscall(0)
 	, m_trace_enabled(false)
-	, m_trace_call_stack(true)
+	, m_last_syscall(0)
+	, m_wait_thread_id(-1)
+	, m_sync_wait(false)
 {
 }
 
 CPUThread::~CPUThread()
 {
 	safe_delete(m_dec);
+
+	if (m_var_arena)
+	{
+		// vars created by this thread may still be alive
+		m_var_arena->destroy();
+	}
 }
 
 bool CPUThread::IsRunning() const { return m_status == Running; }
@@ -44,6 +52,10 @@ bool CPUThread::IsStopped() const { return m_status == Stopped; }
 
 void CPUThread::Close()
 {
+	// the destroy flag must be visible before the event is consumed, otherwise the thread could check
+	// its status too early and then never look at it again
+	m_destroy = true;
+	AddEvent(CPU_EVENT_STATE);
 	ThreadBase::Stop(m_sync_wait);
 	DoStop();
 
@@ -64,6 +76,7 @@ void CPUThread::Reset()
 
 	m_status = Stopped;
 	m_error = 0;
+	AddEvent(CPU_EVENT_STATE);
 	
 	DoReset();
 }
@@ -77,6 +90,21 @@ void CPUThread::CloseStack()
 	}
 
 	m_stack_size = 0;
+
+	if (m_var_arena)
+	{
+		m_var_arena->close();
+	}
+}
+
+vm::var_arena& CPUThread::GetVarArena()
+{
+	if (!m_var_arena)
+	{
+		m_var_arena = new vm::var_arena();
+	}
+
+	return *m_var_arena;
 }
 
 void CPUThread::SetId(const u32 id)
@@ -93,6 +121,7 @@ void CPUThread::Wait(bool wait)
 {
 	std::lock_guard<std::mutex> lock(m_cs_sync);
 	m_sync_wait = wait;
+	AddEvent(CPU_EVENT_STATE);
 }
 
 void CPUThread::Wait(const CPUThread& thr)
@@ -100,6 +129,7 @@ void CPUThread::Wait(const CPUThread& thr)
 	std::lock_guard<std::mutex> lock(m_cs_sync);
 	m_wait_thread_id = thr.GetId();
 	m_sync_wait = true;
+	AddEvent(CPU_EVENT_STATE);
 }
 
 bool CPUThread::Sync()
@@ -198,6 +228,7 @@ void CPUThread::Run()
 	SendDbgCommand(DID_START_THREAD, this);
 
 	m_status = Running;
+	AddEvent(CPU_EVENT_STATE);
 
 	SetPc(entry);
 	InitStack();
@@ -215,6 +246,7 @@ void CPUThread::Resume()
 	SendDbgCommand(DID_RESUME_THREAD, this);
 
 	m_status = Running;
+	AddEvent(CPU_EVENT_STATE);
 	DoResume();
 	Emu.CheckStatus();
 
@@ -230,6 +262,7 @@ void CPUThread::Pause()
 	SendDbgCommand(DID_PAUSE_THREAD, this);
 
 	m_status = Paused;
+	AddEvent(CPU_EVENT_STATE);
 	DoPause();
 	Emu.CheckStatus();
 
@@ -244,6 +277,7 @@ void CPUThread::Stop()
 	SendDbgCommand(DID_STOP_THREAD, this);
 
 	m_status = Stopped;
+	AddEvent(CPU_EVENT_STATE);
 
 	if(static_cast<NamedThreadBase*>(this) != GetCurrentNamedThread())
 	{
@@ -258,6 +292,7 @@ void CPUThread::Stop()
 void CPUThread::Exec()
 {
 	m_is_step = false;
+	AddEvent(CPU_EVENT_STATE);
 	SendDbgCommand(DID_EXEC_THREAD, this);
 
 	if(IsRunning())
@@ -270,9 +305,11 @@ void CPUThread::ExecOnce()
 	SendDbgCommand(DID_EXEC_THREAD, this);
 
 	m_status = Running;
+	AddEvent(CPU_EVENT_STATE);
 	ThreadBase::Start();
 	ThreadBase::Stop(true,false);
 	m_status = Paused;
+	AddEvent(CPU_EVENT_STATE);
 	SendDbgCommand(DID_PAUSE_THREAD, this);
 	SendDbgCommand(DID_PAUSED_THREAD, this);
 }
@@ -302,17 +339,16 @@ void CPUThread::Task()
 {
 	if (Ini.HLELogging.GetValue()) LOG_NOTICE(GENERAL, "%s enter", CPUThread::GetFName().c_str());
 
-	const std::vector<u64>& bp = Emu.GetBreakPoints();
+	m_break_points = Emu.GetBreakPoints();
 
-	for (uint i = 0; i<bp.size(); ++i)
+	if (m_break_points && m_break_points->count(m_offset + PC))
 	{
-		if (bp[i] == m_offset + PC)
-		{
-			Emu.Pause();
-			break;
-		}
+		Emu.Pause();
 	}
 
+	// check the status before the first instruction
+	AddEvent(CPU_EVENT_STATE);
+
 	std::vector<u32> trace;
 
 #ifdef _WIN32
@@ -325,36 +361,48 @@ void CPUThread::Task()
 	{
 		while (true)
 		{
-			int status = ThreadStatus();
+			bool is_step = false;
 
-			if (status == CPUThread_Stopped || status == CPUThread_Break)
+			if (m_events.load(std::memory_order_relaxed))
 			{
-				break;
-			}
+				// events set after this point will be handled on the next iteration
+				const u32 events = m_events.exchange(0);
 
-			if (status == CPUThread_Sleeping)
-			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				continue;
+				if (events & CPU_EVENT_BREAKPOINT)
+				{
+					m_break_points = Emu.GetBreakPoints();
+				}
+
+				int status = ThreadStatus();
+
+				if (status == CPUThread_Stopped || status == CPUThread_Break)
+				{
+					break;
+				}
+
+				if (status == CPUThread_Sleeping)
+				{
+					AddEvent(CPU_EVENT_STATE);
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					continue;
+				}
+
+				is_step = status == CPUThread_Step;
 			}
 
 			Step();
 			//if (m_trace_enabled) trace.push_back(PC);
 			NextPc(m_dec->DecodeMemory(PC + m_offset));
 
-			if (status == CPUThread_Step)
+			if (is_step)
 			{
 				m_is_step = false;
 				break;
 			}
 
-			for (uint i = 0; i < bp.size(); ++i)
+			if (m_break_points && m_break_points->count(PC))
 			{
-				if (bp[i] == PC)
-				{
-					Emu.Pause();
-					break;
-				}
+				Emu.Pause();
 			}
 		}
 	}
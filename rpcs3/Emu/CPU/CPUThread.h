@@ -21,8 +21,19 @@ enum CPUThreadStatus
 	CPUThread_Step,
 };
 
+enum CPUThreadEvent : u32
+{
+	CPU_EVENT_STATE = 1 << 0, // thread or emulator status, sync or step request changed
+	CPU_EVENT_BREAKPOINT = 1 << 1, // breakpoint list changed
+};
+
 class CPUDecoder;
 
+namespace vm
+{
+	class var_arena;
+}
+
 class CPUThread : public ThreadBase
 {
 protected:
@@ -39,18 +50,27 @@ protected:
 	u32 m_stack_addr;
 	u32 m_stack_size;
 
+	vm::var_arena* m_var_arena; // created on the first vm::var allocated by this thread
+
 	u64 m_exit_status;
 
 	CPUDecoder* m_dec;
 
 	bool m_trace_call_stack;
 
+	std::atomic<u32> m_events; // CPUThreadEvent flags, the status is checked only when some of them is set
+
+	// the breakpoints checked by the thread loop (nullptr if there are none), reloaded on CPU_EVENT_BREAKPOINT
+	std::shared_ptr<const std::unordered_set<u64>> m_break_points;
+
 public:
 	virtual void InitRegs()=0;
 
 	virtual void InitStack()=0;
 	virtual void CloseStack();
 
+	vm::var_arena& GetVarArena();
+
 	u32 GetStackAddr() const { return m_stack_addr; }
 	u32 GetStackSize() const { return m_stack_size; }
 
@@ -155,6 +175,12 @@ public:
 
 	int ThreadStatus();
 
+	// request the status check from the thread loop (can be called from any thread)
+	void AddEvent(u32 event) { m_events |= event; }
+	bool HasEvents() const { return m_events.load(std::memory_order_relaxed) != 0; }
+	const std::atomic<u32>& GetEvents() const { return m_events; } // polled by the SPU recompiler's dispatcher
+	bool HasBreakPoints() const { return m_break_points != nullptr; } // only valid on the thread itself
+
 	void NextPc(u8 instr_size);
 	void SetBranch(const u32 pc, bool record_branch = false);
 	void SetPc(const u32 pc);
@@ -169,6 +195,7 @@ public:
 	bool IsRunning() const;
 	bool IsPaused() const;
 	bool IsStopped() const;
+	bool IsStep() const { return m_is_step; }
 
 	bool IsJoinable() const { return m_joinable; }
 	bool IsJoining() const { return m_joining; }
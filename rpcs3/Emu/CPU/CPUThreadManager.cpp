@@ -26,7 +26,7 @@ void CPUThreadManager::Close()
 
 CPUThread& CPUThreadManager::AddThread(CPUThreadType type)
 {
-	std::lock_guard<std::mutex> lock(m_mtx_thread);
+	std::lock_guard<std::recursive_mutex> lock(m_mtx_thread);
 
 	CPUThread* new_thread;
 
@@ -65,7 +65,7 @@ CPUThread& CPUThreadManager::AddThread(CPUThreadType type)
 
 void CPUThreadManager::RemoveThread(const u32 id)
 {
-	std::lock_guard<std::mutex> lock(m_mtx_thread);
+	std::lock_guard<std::recursive_mutex> lock(m_mtx_thread);
 
 	CPUThread* thr = nullptr;
 	u32 thread_index = 0;
@@ -99,7 +99,7 @@ void CPUThreadManager::RemoveThread(const u32 id)
 
 s32 CPUThreadManager::GetThreadNumById(CPUThreadType type, u32 id)
 {
-	std::lock_guard<std::mutex> lock(m_mtx_thread);
+	std::lock_guard<std::recursive_mutex> lock(m_mtx_thread);
 
 	s32 num = 0;
 
@@ -135,9 +135,19 @@ RawSPUThread* CPUThreadManager::GetRawSPUThread(u32 num)
 	}
 }
 
+void CPUThreadManager::SendEvent(u32 event)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mtx_thread);
+
+	for (u32 i = 0; i < m_threads.size(); ++i)
+	{
+		m_threads[i]->AddEvent(event);
+	}
+}
+
 void CPUThreadManager::Exec()
 {
-	std::lock_guard<std::mutex> lock(m_mtx_thread);
+	std::lock_guard<std::recursive_mutex> lock(m_mtx_thread);
 
 	for(u32 i = 0; i < m_threads.size(); ++i)
 	{
@@ -7,7 +7,7 @@ enum CPUThreadType : unsigned char;
 class CPUThreadManager
 {
 	std::vector<CPUThread*> m_threads;
-	std::mutex m_mtx_thread;
+	std::recursive_mutex m_mtx_thread; // recursive: RemoveThread() may reach SendEvent() through Emu.CheckStatus()
 
 public:
 	CPUThreadManager();
@@ -23,6 +23,8 @@ public:
 	CPUThread* GetThread(u32 id);
 	RawSPUThread* GetRawSPUThread(u32 num);
 
+	void SendEvent(u32 event);
+
 	void Exec();
 	void Task();
 };
@@ -5,7 +5,7 @@
 u8 PPCDecoder::DecodeMemory(const u32 address)
 {
 	u32 instr = vm::read32(address);
-	Decode(instr);
+	DecodeAt(address, instr);
 
 	return sizeof(u32);
 }
\ No newline at end of file
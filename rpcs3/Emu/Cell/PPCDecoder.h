@@ -1,17 +1,81 @@
 #pragma once
 #include "Emu/CPU/CPUDecoder.h"
 #include "PPCInstrTable.h"
+#include <unordered_map>
 
 class PPCDecoder : public CPUDecoder
 {
 public:
 	virtual void Decode(const u32 code)=0;
 
+	// decode the instruction read from the address (can use the results of previous decoding)
+	virtual void DecodeAt(const u32 address, const u32 code)
+	{
+		Decode(code);
+	}
+
 	virtual u8 DecodeMemory(const u32 address);
 
 	virtual ~PPCDecoder() = default;
 };
 
+// Cache of decoded instructions for the interpreters.
+// Each executed 4 KB page gets the array of records containing the handler and the extracted operands of every instruction.
+// The record is used only if the opcode matches the current one, so modified code is decoded again.
+template<typename TO>
+class PPCDecoderCache
+{
+	struct Entry
+	{
+		u32 code;
+		const InstrCaller<TO>* func; // nullptr if not decoded
+		u32 args[6];
+	};
+
+	struct Page
+	{
+		Entry entries[0x1000 / sizeof(u32)];
+	};
+
+	std::unordered_map<u32, std::unique_ptr<Page>> m_pages;
+	u32 m_last_addr; // address of the last used page
+	Page* m_last_page;
+
+public:
+	PPCDecoderCache()
+		: m_last_addr(0)
+		, m_last_page(nullptr)
+	{
+	}
+
+	void Execute(TO* op, const InstrCaller<TO>* list, const u32 address, const u32 code)
+	{
+		if (!m_last_page || (address & ~0xfff) != m_last_addr)
+		{
+			std::unique_ptr<Page>& page = m_pages[address & ~0xfff];
+
+			if (!page)
+			{
+				page.reset(new Page());
+			}
+
+			m_last_addr = address & ~0xfff;
+			m_last_page = page.get();
+		}
+
+		Entry& entry = m_last_page->entries[(address & 0xfff) / sizeof(u32)];
+
+		if (!entry.func || entry.code != code)
+		{
+			entry.code = code;
+			entry.func = list->resolve(code);
+			entry.func->extract(code, entry.args);
+		}
+
+		entry.func->call(op, entry.args);
+	}
+};
+
 
 template<typename TO, uint from, uint to>
 static InstrList<(1 << (CodeField<from, to>::size)), TO>* new_list(const CodeField<from, to>& func, InstrCaller<TO>* error_func = nullptr)
@@ -7,14 +7,18 @@
 class PPUDecoder : public PPCDecoder
 {
 	PPUOpcodes* m_op;
+	PPCDecoderCache<PPUOpcodes>* m_cache;
 
 public:
-	PPUDecoder(PPUOpcodes* op) : m_op(op)
+	PPUDecoder(PPUOpcodes* op, bool use_cache = false)
+		: m_op(op)
+		, m_cache(use_cache ? new PPCDecoderCache<PPUOpcodes>() : nullptr)
 	{
 	}
 
 	virtual ~PPUDecoder()
 	{
+		delete m_cache;
 		delete m_op;
 	}
 
@@ -22,4 +26,16 @@ public:
 	{
 		(*PPU_instr::main_list)(m_op, code);
 	}
+
+	virtual void DecodeAt(const u32 address, const u32 code)
+	{
+		if (m_cache)
+		{
+			m_cache->Execute(m_op, PPU_instr::main_list, address, code);
+		}
+		else
+		{
+			Decode(code);
+		}
+	}
 };
\ No newline at end of file
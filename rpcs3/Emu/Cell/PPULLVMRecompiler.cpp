@@ -1,7 +1,10 @@
 #include "stdafx.h"
+#include "rpcs3/Ini.h"
 #include "Utilities/Log.h"
+#include "Utilities/rFile.h"
 #include "Emu/Cell/PPULLVMRecompiler.h"
 #include "Emu/Memory/Memory.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
@@ -47,6 +50,7 @@ Compiler::Compiler(RecompilationEngine & recompilation_engine, const Executable
     m_fpm->add(createNoAAPass());
     m_fpm->add(createBasicAliasAnalysisPass());
     m_fpm->add(createNoTargetTransformInfoPass());
+    m_fpm->add(createPromoteMemoryToRegisterPass());
     m_fpm->add(createEarlyCSEPass());
     m_fpm->add(createTailCallEliminationPass());
     m_fpm->add(createReassociatePass());
@@ -106,6 +110,7 @@ Executable Compiler::Compile(const std::string & name, const ControlFlowGraph &
     m_state.args[CompileTaskState::Args::State] = arg_i;
     (++arg_i)->setName("context");
     m_state.args[CompileTaskState::Args::Context] = arg_i;
+    ResetRegisterCache();
 
     // Create the entry block and add code to branch to the first instruction
     m_ir_builder->SetInsertPoint(GetBasicBlockFromAddress(0));
@@ -121,8 +126,7 @@ Executable Compiler::Compile(const std::string & name, const ControlFlowGraph &
 
         if (!inline_all && *instr_i != cfg.start_address) {
             // Use an already compiled implementation of this block if available
-            auto ordinal = m_recompilation_engine.GetOrdinal(*instr_i);
-            if (ordinal != 0xFFFFFFFF) {
+            if (m_recompilation_engine.GetExecutable(*instr_i)) {
                 auto exit_instr_i32 = m_ir_builder->CreatePHI(m_ir_builder->getInt32Ty(), 0);
                 exit_instr_list.push_back(exit_instr_i32);
 
@@ -221,6 +225,8 @@ Executable Compiler::Compile(const std::string & name, const ControlFlowGraph &
         }
     }
 
+    WriteBackRegisterCache();
+
 #ifdef _DEBUG
     m_recompilation_engine.Log() << *m_state.function;
 
@@ -5018,8 +5024,159 @@ BasicBlock * Compiler::GetBasicBlockFromAddress(u32 address, const std::string &
     return block;
 }
 
+void Compiler::ResetRegisterCache() {
+    for (auto & reg : m_state.cached_registers) {
+        reg.ptr        = nullptr;
+        reg.is_written = false;
+    }
+}
+
+void Compiler::WriteBackRegisterCache() {
+    // Collect the sync points first so that the basic blocks are not modified while iterating over them
+    std::vector<Instruction *> sync_points;
+    for (auto bb_i = m_state.function->begin(); bb_i != m_state.function->end(); bb_i++) {
+        for (auto instr_i = bb_i->begin(); instr_i != bb_i->end(); instr_i++) {
+            auto instr = &(*instr_i);
+            if (isa<ReturnInst>(instr)) {
+                sync_points.push_back(instr);
+            } else if (auto call = dyn_cast<CallInst>(instr)) {
+                // Only calls that get the PPU state can access the registers
+                for (unsigned i = 0; i < call->getNumArgOperands(); i++) {
+                    if (call->getArgOperand(i) == m_state.args[CompileTaskState::Args::State]) {
+                        sync_points.push_back(call);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto instr : sync_points) {
+        IRBuilder<> builder(instr);
+        StoreRegistersToState(builder);
+
+        if (isa<CallInst>(instr)) {
+            // The callee may have modified any register
+            builder.SetInsertPoint(instr->getParent(), std::next(BasicBlock::iterator(instr)));
+            for (u32 slot = 0; slot < RCS_MAX; slot++) {
+                if (m_state.cached_registers[slot].ptr) {
+                    builder.CreateStore(LoadRegisterFromState(builder, slot), m_state.cached_registers[slot].ptr);
+                }
+            }
+        }
+    }
+}
+
+Type * Compiler::GetCachedRegisterType(u32 slot) {
+    if (slot < RCS_FPR0) {
+        return m_ir_builder->getInt64Ty();
+    } else if (slot < RCS_VR0) {
+        return m_ir_builder->getDoubleTy();
+    } else if (slot < RCS_CR0) {
+        return m_ir_builder->getIntNTy(128);
+    } else if (slot < RCS_XER) {
+        return m_ir_builder->getIntNTy(4);
+    } else {
+        return m_ir_builder->getInt64Ty();
+    }
+}
+
+AllocaInst * Compiler::GetCachedRegister(u32 slot) {
+    auto & reg = m_state.cached_registers[slot];
+    if (!reg.ptr) {
+        auto &      entry_bb = m_state.function->getEntryBlock();
+        IRBuilder<> builder(&entry_bb, entry_bb.begin());
+        reg.ptr = builder.CreateAlloca(GetCachedRegisterType(slot));
+        builder.CreateStore(LoadRegisterFromState(builder, slot), reg.ptr);
+    }
+
+    return reg.ptr;
+}
+
+Value * Compiler::GetRegisterStatePtr(IRBuilder<> & builder, u32 slot) {
+    unsigned int offset;
+    Type *       type;
+    if (slot < RCS_FPR0) {
+        offset = (unsigned int)offsetof(PPUThread, GPR[slot - RCS_GPR0]);
+        type   = builder.getInt64Ty();
+    } else if (slot < RCS_VR0) {
+        offset = (unsigned int)offsetof(PPUThread, FPR[slot - RCS_FPR0]);
+        type   = builder.getDoubleTy();
+    } else if (slot < RCS_CR0) {
+        offset = (unsigned int)offsetof(PPUThread, VPR[slot - RCS_VR0]);
+        type   = builder.getIntNTy(128);
+    } else if (slot < RCS_XER) {
+        offset = (unsigned int)offsetof(PPUThread, CR);
+        type   = builder.getInt32Ty();
+    } else if (slot == RCS_XER) {
+        offset = (unsigned int)offsetof(PPUThread, XER);
+        type   = builder.getInt64Ty();
+    } else if (slot == RCS_LR) {
+        offset = (unsigned int)offsetof(PPUThread, LR);
+        type   = builder.getInt64Ty();
+    } else {
+        offset = (unsigned int)offsetof(PPUThread, CTR);
+        type   = builder.getInt64Ty();
+    }
+
+    auto reg_i8_ptr = builder.CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], offset);
+    return builder.CreateBitCast(reg_i8_ptr, type->getPointerTo());
+}
+
+Value * Compiler::LoadRegisterFromState(IRBuilder<> & builder, u32 slot) {
+    auto reg_ptr = GetRegisterStatePtr(builder, slot);
+    if (slot >= RCS_CR0 && slot < RCS_XER) {
+        auto cr_i32    = builder.CreateAlignedLoad(reg_ptr, 4);
+        auto field_i32 = builder.CreateLShr(cr_i32, (7 - (slot - RCS_CR0)) * 4);
+        return builder.CreateTrunc(field_i32, builder.getIntNTy(4));
+    }
+
+    return builder.CreateAlignedLoad(reg_ptr, slot >= RCS_VR0 && slot < RCS_CR0 ? 16 : 8);
+}
+
+void Compiler::StoreRegistersToState(IRBuilder<> & builder) {
+    Value * cr_i32_ptr = nullptr;
+    Value * cr_i32     = nullptr;
+    for (u32 slot = 0; slot < RCS_MAX; slot++) {
+        auto & reg = m_state.cached_registers[slot];
+        if (!reg.is_written) {
+            continue;
+        }
+
+        auto val = builder.CreateLoad(reg.ptr);
+        if (slot >= RCS_CR0 && slot < RCS_XER) {
+            // Merge the modified fields into CR
+            if (!cr_i32) {
+                cr_i32_ptr = GetRegisterStatePtr(builder, slot);
+                cr_i32     = builder.CreateAlignedLoad(cr_i32_ptr, 4);
+            }
+
+            auto shift     = (7 - (slot - RCS_CR0)) * 4;
+            auto field_i32 = builder.CreateShl(builder.CreateZExt(val, builder.getInt32Ty()), shift);
+            cr_i32         = builder.CreateAnd(cr_i32, ~(0xFu << shift));
+            cr_i32         = builder.CreateOr(cr_i32, field_i32);
+        } else {
+            builder.CreateAlignedStore(val, GetRegisterStatePtr(builder, slot), slot >= RCS_VR0 && slot < RCS_CR0 ? 16 : 8);
+        }
+    }
+
+    if (cr_i32) {
+        builder.CreateAlignedStore(cr_i32, cr_i32_ptr, 4);
+    }
+}
+
+Value * Compiler::LoadRegister(u32 slot) {
+    return m_ir_builder->CreateLoad(GetCachedRegister(slot));
+}
+
+void Compiler::StoreRegister(u32 slot, Value * val) {
+    auto ptr = GetCachedRegister(slot);
+    m_state.cached_registers[slot].is_written = true;
+    m_ir_builder->CreateStore(val, ptr);
+}
+
 Value * Compiler::GetBit(Value * val, u32 n) {
-    Value * bit;
+    Value * bit = val;
 
 #ifdef PPU_LLVM_RECOMPILER_USE_BMI
     if (val->getType()->isIntegerTy(32)) {
@@ -5144,59 +5301,55 @@ void Compiler::SetPc(Value * val_ix) {
 }
 
 Value * Compiler::GetGpr(u32 r, u32 num_bits) {
-    auto r_i8_ptr = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, GPR[r]));
-    auto r_ix_ptr = m_ir_builder->CreateBitCast(r_i8_ptr, m_ir_builder->getIntNTy(num_bits)->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(r_ix_ptr, 8);
+    auto r_i64 = LoadRegister(RCS_GPR0 + r);
+    return num_bits == 64 ? r_i64 : m_ir_builder->CreateTrunc(r_i64, m_ir_builder->getIntNTy(num_bits));
 }
 
 void Compiler::SetGpr(u32 r, Value * val_x64) {
-    auto r_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, GPR[r]));
-    auto r_i64_ptr = m_ir_builder->CreateBitCast(r_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    auto val_i64   = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
-    m_ir_builder->CreateAlignedStore(val_i64, r_i64_ptr, 8);
+    auto val_i64 = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
+    StoreRegister(RCS_GPR0 + r, val_i64);
 }
 
 Value * Compiler::GetCr() {
-    auto cr_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, CR));
-    auto cr_i32_ptr = m_ir_builder->CreateBitCast(cr_i8_ptr, m_ir_builder->getInt32Ty()->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(cr_i32_ptr, 4);
+    Value * cr_i32 = m_ir_builder->getInt32(0);
+    for (u32 n = 0; n < 8; n++) {
+        cr_i32 = SetNibble(cr_i32, n, GetCrField(n), false);
+    }
+
+    return cr_i32;
 }
 
 Value * Compiler::GetCrField(u32 n) {
-    return GetNibble(GetCr(), n);
+    return m_ir_builder->CreateZExt(LoadRegister(RCS_CR0 + n), m_ir_builder->getInt32Ty());
 }
 
 void Compiler::SetCr(Value * val_x32) {
-    auto val_i32    = m_ir_builder->CreateBitCast(val_x32, m_ir_builder->getInt32Ty());
-    auto cr_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, CR));
-    auto cr_i32_ptr = m_ir_builder->CreateBitCast(cr_i8_ptr, m_ir_builder->getInt32Ty()->getPointerTo());
-    m_ir_builder->CreateAlignedStore(val_i32, cr_i32_ptr, 4);
+    auto val_i32 = m_ir_builder->CreateBitCast(val_x32, m_ir_builder->getInt32Ty());
+    for (u32 n = 0; n < 8; n++) {
+        SetCrField(n, GetNibble(val_i32, n));
+    }
 }
 
 void Compiler::SetCrField(u32 n, Value * field) {
-    SetCr(SetNibble(GetCr(), n, field));
+    StoreRegister(RCS_CR0 + n, m_ir_builder->CreateZExtOrTrunc(field, m_ir_builder->getIntNTy(4)));
 }
 
 void Compiler::SetCrField(u32 n, Value * b0, Value * b1, Value * b2, Value * b3) {
-    SetCr(SetNibble(GetCr(), n, b0, b1, b2, b3));
+    SetCrField(n, SetNibble(m_ir_builder->getInt32(0), 7, b0, b1, b2, b3, false));
 }
 
 void Compiler::SetCrFieldSignedCmp(u32 n, Value * a, Value * b) {
-    auto lt_i1  = m_ir_builder->CreateICmpSLT(a, b);
-    auto gt_i1  = m_ir_builder->CreateICmpSGT(a, b);
-    auto eq_i1  = m_ir_builder->CreateICmpEQ(a, b);
-    auto cr_i32 = GetCr();
-    cr_i32      = SetNibble(cr_i32, n, lt_i1, gt_i1, eq_i1, GetXerSo());
-    SetCr(cr_i32);
+    auto lt_i1 = m_ir_builder->CreateICmpSLT(a, b);
+    auto gt_i1 = m_ir_builder->CreateICmpSGT(a, b);
+    auto eq_i1 = m_ir_builder->CreateICmpEQ(a, b);
+    SetCrField(n, lt_i1, gt_i1, eq_i1, GetXerSo());
 }
 
 void Compiler::SetCrFieldUnsignedCmp(u32 n, Value * a, Value * b) {
-    auto lt_i1  = m_ir_builder->CreateICmpULT(a, b);
-    auto gt_i1  = m_ir_builder->CreateICmpUGT(a, b);
-    auto eq_i1  = m_ir_builder->CreateICmpEQ(a, b);
-    auto cr_i32 = GetCr();
-    cr_i32      = SetNibble(cr_i32, n, lt_i1, gt_i1, eq_i1, GetXerSo());
-    SetCr(cr_i32);
+    auto lt_i1 = m_ir_builder->CreateICmpULT(a, b);
+    auto gt_i1 = m_ir_builder->CreateICmpUGT(a, b);
+    auto eq_i1 = m_ir_builder->CreateICmpEQ(a, b);
+    SetCrField(n, lt_i1, gt_i1, eq_i1, GetXerSo());
 }
 
 void Compiler::SetCr6AfterVectorCompare(u32 vr) {
@@ -5204,41 +5357,29 @@ void Compiler::SetCr6AfterVectorCompare(u32 vr) {
     auto vr_mask_i32 = m_ir_builder->CreateCall(Intrinsic::getDeclaration(m_module, Intrinsic::x86_sse2_pmovmskb_128), vr_v16i8);
     auto cmp0_i1     = m_ir_builder->CreateICmpEQ(vr_mask_i32, m_ir_builder->getInt32(0));
     auto cmp1_i1     = m_ir_builder->CreateICmpEQ(vr_mask_i32, m_ir_builder->getInt32(0xFFFF));
-    auto cr_i32      = GetCr();
-    cr_i32           = SetNibble(cr_i32, 6, cmp1_i1, nullptr, cmp0_i1, nullptr);
-    SetCr(cr_i32);
+    SetCrField(6, cmp1_i1, nullptr, cmp0_i1, nullptr);
 }
 
 Value * Compiler::GetLr() {
-    auto lr_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, LR));
-    auto lr_i64_ptr = m_ir_builder->CreateBitCast(lr_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(lr_i64_ptr, 8);
+    return LoadRegister(RCS_LR);
 }
 
 void Compiler::SetLr(Value * val_x64) {
-    auto val_i64     = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
-    auto lr_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, LR));
-    auto lr_i64_ptr = m_ir_builder->CreateBitCast(lr_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    m_ir_builder->CreateAlignedStore(val_i64, lr_i64_ptr, 8);
+    auto val_i64 = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
+    StoreRegister(RCS_LR, val_i64);
 }
 
 Value * Compiler::GetCtr() {
-    auto ctr_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, CTR));
-    auto ctr_i64_ptr = m_ir_builder->CreateBitCast(ctr_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(ctr_i64_ptr, 8);
+    return LoadRegister(RCS_CTR);
 }
 
 void Compiler::SetCtr(Value * val_x64) {
-    auto val_i64     = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
-    auto ctr_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, CTR));
-    auto ctr_i64_ptr = m_ir_builder->CreateBitCast(ctr_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    m_ir_builder->CreateAlignedStore(val_i64, ctr_i64_ptr, 8);
+    auto val_i64 = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
+    StoreRegister(RCS_CTR, val_i64);
 }
 
 Value * Compiler::GetXer() {
-    auto xer_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, XER));
-    auto xer_i64_ptr = m_ir_builder->CreateBitCast(xer_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(xer_i64_ptr, 8);
+    return LoadRegister(RCS_XER);
 }
 
 Value * Compiler::GetXerCa() {
@@ -5250,10 +5391,8 @@ Value * Compiler::GetXerSo() {
 }
 
 void Compiler::SetXer(Value * val_x64) {
-    auto val_i64     = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
-    auto xer_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, XER));
-    auto xer_i64_ptr = m_ir_builder->CreateBitCast(xer_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-    m_ir_builder->CreateAlignedStore(val_i64, xer_i64_ptr, 8);
+    auto val_i64 = m_ir_builder->CreateBitCast(val_x64, m_ir_builder->getInt64Ty());
+    StoreRegister(RCS_XER, val_i64);
 }
 
 void Compiler::SetXerCa(Value * ca) {
@@ -5295,18 +5434,15 @@ void Compiler::SetFpscr(Value * val_x32) {
 }
 
 Value * Compiler::GetFpr(u32 r, u32 bits, bool as_int) {
-    auto r_i8_ptr = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, FPR[r]));
+    auto r_f64 = LoadRegister(RCS_FPR0 + r);
     if (!as_int) {
-        auto r_f64_ptr = m_ir_builder->CreateBitCast(r_i8_ptr, m_ir_builder->getDoubleTy()->getPointerTo());
-        auto r_f64     = m_ir_builder->CreateAlignedLoad(r_f64_ptr, 8);
         if (bits == 32) {
             return m_ir_builder->CreateFPTrunc(r_f64, m_ir_builder->getFloatTy());
         } else {
             return r_f64;
         }
     } else {
-        auto r_i64_ptr = m_ir_builder->CreateBitCast(r_i8_ptr, m_ir_builder->getInt64Ty()->getPointerTo());
-        auto r_i64     = m_ir_builder->CreateAlignedLoad(r_i64_ptr, 8);
+        auto r_i64 = m_ir_builder->CreateBitCast(r_f64, m_ir_builder->getInt64Ty());
         if (bits == 32) {
             return m_ir_builder->CreateTrunc(r_i64, m_ir_builder->getInt32Ty());
         } else {
@@ -5316,9 +5452,6 @@ Value * Compiler::GetFpr(u32 r, u32 bits, bool as_int) {
 }
 
 void Compiler::SetFpr(u32 r, Value * val) {
-    auto r_i8_ptr  = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, FPR[r]));
-    auto r_f64_ptr = m_ir_builder->CreateBitCast(r_i8_ptr, m_ir_builder->getDoubleTy()->getPointerTo());
-
     Value* val_f64;
     if (val->getType()->isDoubleTy() || val->getType()->isIntegerTy(64)) {
         val_f64 = m_ir_builder->CreateBitCast(val, m_ir_builder->getDoubleTy());
@@ -5329,7 +5462,7 @@ void Compiler::SetFpr(u32 r, Value * val) {
         assert(0);
     }
 
-    m_ir_builder->CreateAlignedStore(val_f64, r_f64_ptr, 8);
+    StoreRegister(RCS_FPR0 + r, val_f64);
 }
 
 Value * Compiler::GetVscr() {
@@ -5346,37 +5479,24 @@ void Compiler::SetVscr(Value * val_x32) {
 }
 
 Value * Compiler::GetVr(u32 vr) {
-    auto vr_i8_ptr   = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, VPR[vr]));
-    auto vr_i128_ptr = m_ir_builder->CreateBitCast(vr_i8_ptr, m_ir_builder->getIntNTy(128)->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(vr_i128_ptr, 16);
+    return LoadRegister(RCS_VR0 + vr);
 }
 
 Value * Compiler::GetVrAsIntVec(u32 vr, u32 vec_elt_num_bits) {
-    auto vr_i8_ptr   = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, VPR[vr]));
-    auto vr_i128_ptr = m_ir_builder->CreateBitCast(vr_i8_ptr, m_ir_builder->getIntNTy(128)->getPointerTo());
-    auto vr_vec_ptr  = m_ir_builder->CreateBitCast(vr_i128_ptr, VectorType::get(m_ir_builder->getIntNTy(vec_elt_num_bits), 128 / vec_elt_num_bits)->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(vr_vec_ptr, 16);
+    return m_ir_builder->CreateBitCast(GetVr(vr), VectorType::get(m_ir_builder->getIntNTy(vec_elt_num_bits), 128 / vec_elt_num_bits));
 }
 
 Value * Compiler::GetVrAsFloatVec(u32 vr) {
-    auto vr_i8_ptr    = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, VPR[vr]));
-    auto vr_i128_ptr  = m_ir_builder->CreateBitCast(vr_i8_ptr, m_ir_builder->getIntNTy(128)->getPointerTo());
-    auto vr_v4f32_ptr = m_ir_builder->CreateBitCast(vr_i128_ptr, VectorType::get(m_ir_builder->getFloatTy(), 4)->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(vr_v4f32_ptr, 16);
+    return m_ir_builder->CreateBitCast(GetVr(vr), VectorType::get(m_ir_builder->getFloatTy(), 4));
 }
 
 Value * Compiler::GetVrAsDoubleVec(u32 vr) {
-    auto vr_i8_ptr    = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, VPR[vr]));
-    auto vr_i128_ptr  = m_ir_builder->CreateBitCast(vr_i8_ptr, m_ir_builder->getIntNTy(128)->getPointerTo());
-    auto vr_v2f64_ptr = m_ir_builder->CreateBitCast(vr_i128_ptr, VectorType::get(m_ir_builder->getDoubleTy(), 2)->getPointerTo());
-    return m_ir_builder->CreateAlignedLoad(vr_v2f64_ptr, 16);
+    return m_ir_builder->CreateBitCast(GetVr(vr), VectorType::get(m_ir_builder->getDoubleTy(), 2));
 }
 
 void Compiler::SetVr(u32 vr, Value * val_x128) {
-    auto vr_i8_ptr   = m_ir_builder->CreateConstGEP1_32(m_state.args[CompileTaskState::Args::State], (unsigned int)offsetof(PPUThread, VPR[vr]));
-    auto vr_i128_ptr = m_ir_builder->CreateBitCast(vr_i8_ptr, m_ir_builder->getIntNTy(128)->getPointerTo());
-    auto val_i128    = m_ir_builder->CreateBitCast(val_x128, m_ir_builder->getIntNTy(128));
-    m_ir_builder->CreateAlignedStore(val_i128, vr_i128_ptr, 16);
+    auto val_i128 = m_ir_builder->CreateBitCast(val_x128, m_ir_builder->getIntNTy(128));
+    StoreRegister(RCS_VR0 + vr, val_i128);
 }
 
 Value * Compiler::CheckBranchCondition(u32 bo, u32 bi) {
@@ -5402,7 +5522,7 @@ Value * Compiler::CheckBranchCondition(u32 bo, u32 bi) {
 
     Value * cond_ok_i1 = nullptr;
     if (!bo0) {
-        auto cr_bi_i32  = GetBit(GetCr(), bi);
+        auto cr_bi_i32  = GetBit(GetCrField(bi / 4), 28 + bi % 4);
         cond_ok_i1      = m_ir_builder->CreateTrunc(cr_bi_i32, m_ir_builder->getInt1Ty());
         if (!bo1) {
             cond_ok_i1 = m_ir_builder->CreateXor(cond_ok_i1, m_ir_builder->getInt1(!bo1));
@@ -5514,7 +5634,7 @@ Value * Compiler::ReadMemory(Value * addr_i64, u32 bits, u32 alignment, bool bsw
 
         return val_ix;
     } else {
-        static u32 next_basic_block_id = 0;
+        static thread_local u32 next_basic_block_id = 0;
 
         next_basic_block_id++;
         auto cmp_i1   = m_ir_builder->CreateICmpULT(addr_i64, m_ir_builder->getInt64(RAW_SPU_BASE_ADDR));
@@ -5559,7 +5679,7 @@ void Compiler::WriteMemory(Value * addr_i64, Value * val_ix, u32 alignment, bool
         auto eaddr_ix_ptr = m_ir_builder->CreateIntToPtr(eaddr_i64, val_ix->getType()->getPointerTo());
         m_ir_builder->CreateAlignedStore(val_ix, eaddr_ix_ptr, alignment);
     } else {
-        static u32 next_basic_block_id;
+        static thread_local u32 next_basic_block_id = 0;
 
         next_basic_block_id++;
         auto cmp_i1   = m_ir_builder->CreateICmpULT(addr_i64, m_ir_builder->getInt64(RAW_SPU_BASE_ADDR));
@@ -5633,8 +5753,7 @@ Value * Compiler::Call(const char * name, Func function, Args... args) {
 }
 
 llvm::Value * Compiler::IndirectCall(u32 address, Value * context_i64, bool is_function) {
-    auto ordinal          = m_recompilation_engine.AllocateOrdinal(address, is_function);
-    auto location_i64     = m_ir_builder->getInt64(m_recompilation_engine.GetAddressOfExecutableLookup() + (ordinal * sizeof(u64)));
+    auto location_i64     = m_ir_builder->getInt64((u64)m_recompilation_engine.GetExecutableLocation(address, is_function));
     auto location_i64_ptr = m_ir_builder->CreateIntToPtr(location_i64, m_ir_builder->getInt64Ty()->getPointerTo());
     auto executable_i64   = m_ir_builder->CreateLoad(location_i64_ptr);
     auto executable_ptr   = m_ir_builder->CreateIntToPtr(executable_i64, m_compiled_function_type->getPointerTo());
@@ -5655,60 +5774,82 @@ void Compiler::InitRotateMask() {
     }
 }
 
+/// Magic and versions of the block cache file. Change s_cache_version when the format of the file changes and
+/// s_cache_compiler_version when the tracer or the compiler change the way the CFGs are built or compiled. The cache is also
+/// rejected when the emulator is built with another version of LLVM.
+static const u32 s_cache_magic            = 0x43555050; // "PPUC"
+static const u32 s_cache_version          = 1;
+static const u32 s_cache_compiler_version = 1;
+static const u32 s_cache_llvm_version     = LLVM_VERSION_MAJOR * 100 + LLVM_VERSION_MINOR;
+
 std::mutex                           RecompilationEngine::s_mutex;
 std::shared_ptr<RecompilationEngine> RecompilationEngine::s_the_instance = nullptr;
 
 RecompilationEngine::RecompilationEngine()
     : ThreadBase("PPU Recompilation Engine")
     , m_log(nullptr)
-    , m_next_ordinal(0)
+    , m_cache_hits(0)
+    , m_cache_misses(0)
+    , m_cache_invalidated(0)
+    , m_dropped_execution_traces(0)
+    , m_compile_workers_exit(false)
+    , m_executable_lookup_pages(0)
     , m_compiler(*this, ExecutionEngine::ExecuteFunction, ExecutionEngine::ExecuteTillReturn) {
+    for (auto & page : m_executable_lookup) {
+        page.store(nullptr, std::memory_order_relaxed);
+    }
+
     m_compiler.RunAllTests();
 }
 
 RecompilationEngine::~RecompilationEngine() {
     Stop();
+
+    for (auto & page : m_executable_lookup) {
+        delete[] page.load();
+    }
 }
 
-u32 RecompilationEngine::AllocateOrdinal(u32 address, bool is_function) {
-    std::lock_guard<std::mutex> lock(m_address_to_ordinal_lock);
+// The compiled code loads the executables from the lookup table as plain pointers (see Compiler::IndirectCall)
+static_assert(sizeof(std::atomic<Executable>) == sizeof(Executable), "std::atomic<Executable> must have the layout of Executable");
 
-    auto i = m_address_to_ordinal.find(address);
-    if (i == m_address_to_ordinal.end()) {
-        assert(m_next_ordinal < (sizeof(m_executable_lookup) / sizeof(m_executable_lookup[0])));
+std::atomic<Executable> * RecompilationEngine::GetExecutableLocation(u32 address, bool is_function) {
+    auto & page_ptr = m_executable_lookup[address >> 16];
+    auto   page     = page_ptr.load(std::memory_order_acquire);
+    if (!page) {
+        auto new_page = new std::atomic<Executable>[0x10000 / sizeof(u32)]();
+        if (page_ptr.compare_exchange_strong(page, new_page)) {
+            page = new_page;
+            m_executable_lookup_pages++;
+        } else {
+            delete[] new_page;
+        }
+    }
 
-        m_executable_lookup[m_next_ordinal] = is_function ? ExecutionEngine::ExecuteFunction : ExecutionEngine::ExecuteTillReturn;
-        std::atomic_thread_fence(std::memory_order_release);
-        i = m_address_to_ordinal.insert(m_address_to_ordinal.end(), std::make_pair(address, m_next_ordinal++));
+    // Another thread can initialise the location or store a compiled executable in it at the same time
+    auto & executable = page[(address & 0xFFFF) / sizeof(u32)];
+    if (!executable.load(std::memory_order_acquire)) {
+        Executable empty = nullptr;
+        executable.compare_exchange_strong(empty, is_function ? ExecutionEngine::ExecuteFunction : ExecutionEngine::ExecuteTillReturn);
     }
 
-    return i->second;
+    return &executable;
 }
 
-u32 RecompilationEngine::GetOrdinal(u32 address) const {
-    std::lock_guard<std::mutex> lock(m_address_to_ordinal_lock);
-
-    auto i = m_address_to_ordinal.find(address);
-    if (i != m_address_to_ordinal.end()) {
-        return i->second;
-    } else {
-        return 0xFFFFFFFF;
+Executable RecompilationEngine::GetExecutable(u32 address) const {
+    auto page = m_executable_lookup[address >> 16].load(std::memory_order_acquire);
+    if (!page) {
+        return nullptr;
     }
-}
 
-const Executable RecompilationEngine::GetExecutable(u32 ordinal) const {
-    std::atomic_thread_fence(std::memory_order_acquire);
-    return m_executable_lookup[ordinal];
-}
-
-u64 RecompilationEngine::GetAddressOfExecutableLookup() const {
-    return (u64)m_executable_lookup;
+    return page[(address & 0xFFFF) / sizeof(u32)].load(std::memory_order_acquire);
 }
 
 void RecompilationEngine::NotifyTrace(ExecutionTrace * execution_trace) {
-    {
-        std::lock_guard<std::mutex> lock(m_pending_execution_traces_lock);
-        m_pending_execution_traces.push_back(execution_trace);
+    // Never block the PPU thread. Dropping a trace only delays the compilation of its blocks.
+    if (!m_pending_execution_traces.Push(execution_trace, &sq_no_wait)) {
+        delete execution_trace;
+        m_dropped_execution_traces++;
     }
 
     if (!IsAlive()) {
@@ -5735,23 +5876,32 @@ void RecompilationEngine::Task() {
     std::chrono::nanoseconds recompiling_time(0);
 
     auto start = std::chrono::high_resolution_clock::now();
+    Log(); // Create the log before the compiler workers can use it
+    StartCompileWorkers();
+    LoadCache();
+
     while (!TestDestroy() && !Emu.IsStopped()) {
         bool             work_done_this_iteration = false;
         ExecutionTrace * execution_trace          = nullptr;
 
-        {
-            std::lock_guard<std::mutex> lock(m_pending_execution_traces_lock);
+        // Drain the pending traces. The compile queue is ordered by hit count so the hottest blocks are still compiled first.
+        while (m_pending_execution_traces.Pop(execution_trace, &sq_no_wait)) {
+            ProcessExecutionTrace(*execution_trace);
+            delete execution_trace;
+            work_done_this_iteration = true;
+        }
+
+        ProcessCompiledJobs();
+
+        // Compile the blocks loaded from the cache one at a time, the traces processed meanwhile are not delayed
+        if (!work_done_this_iteration && !m_cached_blocks.empty()) {
+            auto block = m_cached_blocks.back();
+            m_cached_blocks.pop_back();
 
-            auto i = m_pending_execution_traces.begin();
-            if (i != m_pending_execution_traces.end()) {
-                execution_trace = *i;
-                m_pending_execution_traces.erase(i);
+            if (!block->is_compiled) {
+                CompileBlock(*block);
             }
-        }
 
-        if (execution_trace) {
-            ProcessExecutionTrace(*execution_trace);
-            delete execution_trace;
             work_done_this_iteration = true;
         }
 
@@ -5768,7 +5918,7 @@ void RecompilationEngine::Task() {
             auto   candidate = (BlockEntry *)nullptr;
             size_t max_diff  = 0;
             for (auto block : m_block_table) {
-                if (block->IsFunction() && block->is_compiled) {
+                if (block->IsFunction() && block->is_compiled && !block->is_compiling) {
                     auto diff = block->cfg.GetSize() - block->last_compiled_cfg_size;
                     if (diff > max_diff) {
                         candidate = block;
@@ -5798,9 +5948,21 @@ void RecompilationEngine::Task() {
         }
     }
 
+    StopCompileWorkers();
+    ProcessCompiledJobs();
+    SaveCache();
+
     std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
     auto total_time     = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
     auto compiler_stats = m_compiler.GetStats();
+    auto cache_lookups  = m_cache_hits + m_cache_misses + m_cache_invalidated;
+    for (auto & compiler : m_worker_compilers) {
+        auto stats                        = compiler->GetStats();
+        compiler_stats.total_time        += stats.total_time;
+        compiler_stats.ir_build_time     += stats.ir_build_time;
+        compiler_stats.optimization_time += stats.optimization_time;
+        compiler_stats.translation_time  += stats.translation_time;
+    }
 
     Log() << "Total time                      = " << total_time.count() / 1000000 << "ms\n";
     Log() << "    Time spent compiling        = " << compiler_stats.total_time.count() / 1000000 << "ms\n";
@@ -5810,7 +5972,12 @@ void RecompilationEngine::Task() {
     Log() << "    Time spent recompiling      = " << recompiling_time.count() / 1000000 << "ms\n";
     Log() << "    Time spent idling           = " << idling_time.count() / 1000000 << "ms\n";
     Log() << "    Time spent doing misc tasks = " << (total_time.count() - idling_time.count() - compiler_stats.total_time.count()) / 1000000 << "ms\n";
-    Log() << "Ordinals allocated              = " << m_next_ordinal << "\n";
+    Log() << "Lookup table pages allocated    = " << m_executable_lookup_pages.load() << "\n";
+    Log() << "Cache hits                      = " << m_cache_hits << " (" << (cache_lookups ? m_cache_hits * 100 / cache_lookups : 0) << "%)\n";
+    Log() << "Cache misses                    = " << m_cache_misses << "\n";
+    Log() << "Cache entries invalidated       = " << m_cache_invalidated << "\n";
+    Log() << "Compiler workers                = " << m_worker_compilers.size() << "\n";
+    Log() << "Execution traces dropped        = " << m_dropped_execution_traces.load() << "\n";
 
     LOG_NOTICE(PPU, "PPU LLVM Recompilation thread exiting.");
     s_the_instance = nullptr; // Can cause deadlock if this is the last instance. Need to fix this.
@@ -5866,10 +6033,11 @@ void RecompilationEngine::ProcessExecutionTrace(const ExecutionTrace & execution
         processed_execution_trace_i = m_processed_execution_traces.insert(m_processed_execution_traces.end(), std::make_pair(execution_trace_id, std::move(tmp_block_list)));
     }
 
+    auto hit_threshold = (u32)std::max(Ini.PPULLVMHitThreshold.GetValue(), 1);
     for (auto i = processed_execution_trace_i->second.begin(); i != processed_execution_trace_i->second.end(); i++) {
         if (!(*i)->is_compiled) {
             (*i)->num_hits++;
-            if ((*i)->num_hits >= 1000) { // TODO: Make this configurable
+            if ((*i)->num_hits >= hit_threshold) {
                 CompileBlock(*(*i));
             }
         }
@@ -5908,12 +6076,304 @@ void RecompilationEngine::CompileBlock(BlockEntry & block_entry) {
     Log() << "CFG: " << block_entry.cfg.ToString() << "\n";
 #endif
 
-    auto ordinal    = AllocateOrdinal(block_entry.cfg.start_address, block_entry.IsFunction());
-    auto executable = m_compiler.Compile(fmt::Format("fn_0x%08X_%u", block_entry.cfg.start_address, block_entry.revision++), block_entry.cfg, true,
-                                         block_entry.IsFunction() ? true : false /*generate_linkable_exits*/);
-    m_executable_lookup[ordinal]       = executable;
+    auto location = GetExecutableLocation(block_entry.cfg.start_address, block_entry.IsFunction());
+    auto name     = fmt::Format("fn_0x%08X_%u", block_entry.cfg.start_address, block_entry.revision++);
+    auto job      = new CompileJob(block_entry, name, location);
+
     block_entry.last_compiled_cfg_size = block_entry.cfg.GetSize();
     block_entry.is_compiled            = true;
+    block_entry.is_compiling           = true;
+
+    if (m_compile_workers.empty()) {
+        RunCompileJob(m_compiler, *job);
+        FinishCompileJob(job);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_compile_lock);
+    m_compile_queue.push(job);
+    m_compile_cv.notify_one();
+}
+
+void RecompilationEngine::RunCompileJob(Compiler & compiler, CompileJob & job) {
+    auto executable = compiler.Compile(job.name, job.cfg, true, job.is_function /*generate_linkable_exits*/);
+    job.location->store(executable, std::memory_order_release);
+}
+
+void RecompilationEngine::FinishCompileJob(CompileJob * job) {
+    auto & block_entry       = *job->block;
+    block_entry.is_compiling = false;
+
+    // Remember the latest CFG of the block
+    u64 hash;
+    if (GetCfgHash(job->cfg, hash)) {
+        auto cache_i = m_cache.find(job->cfg.start_address);
+        if (cache_i == m_cache.end()) {
+            m_cache.insert(std::make_pair(job->cfg.start_address, CacheEntry(job->cfg, hash)));
+            m_cache_misses++;
+        } else {
+            cache_i->second = CacheEntry(job->cfg, hash);
+        }
+    }
+
+    delete job;
+}
+
+void RecompilationEngine::ProcessCompiledJobs() {
+    std::vector<CompileJob *> compiled_jobs;
+    {
+        std::lock_guard<std::mutex> lock(m_compile_lock);
+        compiled_jobs.swap(m_compiled_jobs);
+    }
+
+    for (auto job : compiled_jobs) {
+        FinishCompileJob(job);
+    }
+}
+
+void RecompilationEngine::StartCompileWorkers() {
+    m_compile_workers_exit = false;
+
+    // The compilers are created on this thread because the LLVM target initialisation is not thread safe
+    for (auto i = m_worker_compilers.size(); i < Ini.PPULLVMCompilerThreads.GetValue(); i++) {
+        m_worker_compilers.push_back(std::unique_ptr<Compiler>(new Compiler(*this, ExecutionEngine::ExecuteFunction, ExecutionEngine::ExecuteTillReturn)));
+    }
+
+    for (size_t i = 0; i < m_worker_compilers.size(); i++) {
+        auto & compiler = *m_worker_compilers[i];
+        m_compile_workers.push_back(std::unique_ptr<thread>(new thread(fmt::Format("PPU LLVM Compiler[%u]", (u32)i), [this, &compiler]() {
+            CompileWorker(compiler);
+        })));
+    }
+}
+
+void RecompilationEngine::StopCompileWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(m_compile_lock);
+        m_compile_workers_exit = true;
+        m_compile_cv.notify_all();
+    }
+
+    for (auto & worker : m_compile_workers) {
+        worker->join();
+    }
+
+    m_compile_workers.clear();
+
+    // The blocks of the discarded jobs haven't been compiled, restore their state from before the jobs were created
+    while (!m_compile_queue.empty()) {
+        auto   job         = m_compile_queue.top();
+        auto & block_entry = *job->block;
+        m_compile_queue.pop();
+
+        block_entry.last_compiled_cfg_size = job->last_compiled_cfg_size;
+        block_entry.is_compiled            = job->was_compiled;
+        block_entry.is_compiling           = false;
+        delete job;
+    }
+}
+
+void RecompilationEngine::CompileWorker(Compiler & compiler) {
+    std::unique_lock<std::mutex> lock(m_compile_lock);
+
+    while (!m_compile_workers_exit) {
+        if (m_compile_queue.empty()) {
+            m_compile_cv.wait(lock);
+            continue;
+        }
+
+        auto job = m_compile_queue.top();
+        m_compile_queue.pop();
+        lock.unlock();
+
+        RunCompileJob(compiler, *job);
+
+        lock.lock();
+        m_compiled_jobs.push_back(job);
+        Notify();
+    }
+}
+
+bool RecompilationEngine::GetCfgHash(const ControlFlowGraph & cfg, u64 & hash) {
+    // FNV-1a
+    hash = 0xcbf29ce484222325ull;
+    for (auto i = cfg.instruction_addresses.begin(); i != cfg.instruction_addresses.end(); i++) {
+        if (!Memory.IsGoodAddr(*i, 4)) {
+            return false;
+        }
+
+        hash = (hash ^ *i) * 0x100000001b3ull;
+        hash = (hash ^ vm::read32(*i)) * 0x100000001b3ull;
+    }
+
+    return true;
+}
+
+void RecompilationEngine::LoadCache() {
+    auto title_id = Emu.GetTitleID();
+    m_cache_path  = fmt::Format("ppu_cache/%s.bin", title_id.length() ? title_id.c_str() : "unknown");
+
+    rFile f;
+    if (!rExists(m_cache_path) || !f.Open(m_cache_path, rFile::read)) {
+        return;
+    }
+
+    std::vector<u32> buf((size_t)f.Length() / sizeof(u32));
+    buf.resize(f.Read(buf.data(), buf.size() * sizeof(u32)) / sizeof(u32));
+    f.Close();
+
+    size_t pos  = 0;
+    auto   read = [&](u32 & data) -> bool {
+        if (pos >= buf.size()) {
+            return false;
+        }
+
+        data = buf[pos++];
+        return true;
+    };
+
+    auto read_edges = [&](std::map<u32, std::set<u32>> & edges) -> bool {
+        u32 count, from, num_targets, target;
+        if (!read(count)) {
+            return false;
+        }
+
+        for (u32 i = 0; i < count; i++) {
+            if (!read(from) || !read(num_targets)) {
+                return false;
+            }
+
+            auto & targets = edges[from];
+            for (u32 j = 0; j < num_targets; j++) {
+                if (!read(target)) {
+                    return false;
+                }
+
+                targets.insert(target);
+            }
+        }
+
+        return true;
+    };
+
+    u32 magic, version, compiler_version, llvm_version, num_entries;
+    if (!read(magic) || magic != s_cache_magic || !read(version) || version != s_cache_version || !read(compiler_version) ||
+        compiler_version != s_cache_compiler_version || !read(llvm_version) || llvm_version != s_cache_llvm_version) {
+        LOG_NOTICE(PPU, "PPU LLVM cache '%s' is outdated", m_cache_path.c_str());
+        return;
+    }
+
+    // Parse the whole file before using any entry. A truncated file (e.g. the emulator crashed while it was written) is rejected.
+    std::vector<CacheEntry> entries;
+    bool                    valid = read(num_entries);
+    for (u32 i = 0; valid && i < num_entries; i++) {
+        u32 start_address, function_address, hash_lo, hash_hi, num_instructions, address;
+        if (!read(start_address) || !read(function_address) || !read(hash_lo) || !read(hash_hi) || !read(num_instructions)) {
+            valid = false;
+            break;
+        }
+
+        ControlFlowGraph cfg(start_address, function_address);
+        for (u32 j = 0; j < num_instructions; j++) {
+            if (!read(address)) {
+                valid = false;
+                break;
+            }
+
+            cfg.instruction_addresses.insert(address);
+        }
+
+        if (!valid || !read_edges(cfg.branches) || !read_edges(cfg.calls)) {
+            valid = false;
+            break;
+        }
+
+        entries.push_back(CacheEntry(cfg, (u64)hash_hi << 32 | hash_lo));
+    }
+
+    if (!valid || pos != buf.size()) {
+        LOG_ERROR(PPU, "PPU LLVM cache '%s' is corrupted", m_cache_path.c_str());
+        return;
+    }
+
+    for (auto & entry : entries) {
+        // Drop the blocks whose code has changed
+        u64 hash;
+        if (!GetCfgHash(entry.cfg, hash) || hash != entry.hash) {
+            m_cache_invalidated++;
+            continue;
+        }
+
+        BlockEntry key(entry.cfg.start_address, entry.cfg.function_address);
+        if (m_block_table.find(&key) != m_block_table.end()) {
+            continue;
+        }
+
+        auto block = *m_block_table.insert(m_block_table.end(), new BlockEntry(entry.cfg.start_address, entry.cfg.function_address));
+        block->cfg = entry.cfg;
+        m_cache.insert(std::make_pair(entry.cfg.start_address, entry));
+        m_cached_blocks.push_back(block);
+        m_cache_hits++;
+    }
+
+    // The blocks are compiled from the back of the list
+    std::reverse(m_cached_blocks.begin(), m_cached_blocks.end());
+
+    LOG_NOTICE(PPU, "PPU LLVM cache '%s': %u blocks loaded, %u blocks invalidated", m_cache_path.c_str(), m_cache_hits, m_cache_invalidated);
+}
+
+void RecompilationEngine::SaveCache() {
+    if (m_cache.empty()) {
+        return;
+    }
+
+    std::vector<u32> buf;
+    buf.push_back(s_cache_magic);
+    buf.push_back(s_cache_version);
+    buf.push_back(s_cache_compiler_version);
+    buf.push_back(s_cache_llvm_version);
+    buf.push_back((u32)m_cache.size());
+
+    auto write_edges = [&](const std::map<u32, std::set<u32>> & edges) {
+        buf.push_back((u32)edges.size());
+        for (auto i = edges.begin(); i != edges.end(); i++) {
+            buf.push_back(i->first);
+            buf.push_back((u32)i->second.size());
+            buf.insert(buf.end(), i->second.begin(), i->second.end());
+        }
+    };
+
+    for (auto i = m_cache.begin(); i != m_cache.end(); i++) {
+        auto & entry = i->second;
+
+        buf.push_back(entry.cfg.start_address);
+        buf.push_back(entry.cfg.function_address);
+        buf.push_back((u32)entry.hash);
+        buf.push_back((u32)(entry.hash >> 32));
+        buf.push_back((u32)entry.cfg.instruction_addresses.size());
+        buf.insert(buf.end(), entry.cfg.instruction_addresses.begin(), entry.cfg.instruction_addresses.end());
+        write_edges(entry.cfg.branches);
+        write_edges(entry.cfg.calls);
+    }
+
+    if (!rExists("ppu_cache")) {
+        rMkdir("ppu_cache");
+    }
+
+    // Write a temporary file first, so an interrupted write never leaves a damaged file under the final name
+    auto temp_path = m_cache_path + ".tmp";
+    bool written;
+
+    {
+        rFile f;
+        written = f.Open(temp_path, rFile::write) && f.Write(buf.data(), buf.size() * sizeof(u32)) == buf.size() * sizeof(u32);
+    }
+
+    // rRename() doesn't replace an existing file on Windows
+    if (!written || (rExists(m_cache_path) && !rRemoveFile(m_cache_path)) || !rRename(temp_path, m_cache_path)) {
+        LOG_ERROR(PPU, "PPU LLVM cache: failed to write '%s'", m_cache_path.c_str());
+        rRemoveFile(temp_path);
+    }
 }
 
 std::shared_ptr<RecompilationEngine> RecompilationEngine::GetInstance() {
@@ -6010,7 +6470,6 @@ ppu_recompiler_llvm::ExecutionEngine::ExecutionEngine(PPUThread & ppu)
     : m_ppu(ppu)
     , m_interpreter(new PPUInterpreter(ppu))
     , m_decoder(m_interpreter)
-    , m_last_cache_clear_time(std::chrono::high_resolution_clock::now())
     , m_recompilation_engine(RecompilationEngine::GetInstance()) {
 }
 
@@ -6023,41 +6482,9 @@ u8 ppu_recompiler_llvm::ExecutionEngine::DecodeMemory(const u32 address) {
     return 0;
 }
 
-void ppu_recompiler_llvm::ExecutionEngine::RemoveUnusedEntriesFromCache() const {
-    auto now = std::chrono::high_resolution_clock::now();
-    if (std::chrono::duration_cast<std::chrono::milliseconds>(now - m_last_cache_clear_time).count() > 10000) {
-        for (auto i = m_address_to_ordinal.begin(); i != m_address_to_ordinal.end();) {
-            auto tmp = i;
-            i++;
-            if (tmp->second.second == 0) {
-                m_address_to_ordinal.erase(tmp);
-            } else {
-                tmp->second.second = 0;
-            }
-        }
-
-        m_last_cache_clear_time = now;
-    }
-}
-
 Executable ppu_recompiler_llvm::ExecutionEngine::GetExecutable(u32 address, Executable default_executable) const {
-    // Find the ordinal for the specified address and insert it to the cache
-    auto i = m_address_to_ordinal.find(address);
-    if (i == m_address_to_ordinal.end()) {
-        auto ordinal = m_recompilation_engine->GetOrdinal(address);
-        if (ordinal != 0xFFFFFFFF) {
-            i = m_address_to_ordinal.insert(m_address_to_ordinal.end(), std::make_pair(address, std::make_pair(ordinal, 0)));
-        }
-    }
-
-    Executable executable = default_executable;
-    if (i != m_address_to_ordinal.end()) {
-        i->second.second++;
-        executable = m_recompilation_engine->GetExecutable(i->second.first);
-    }
-
-    RemoveUnusedEntriesFromCache();
-    return executable;
+    auto executable = m_recompilation_engine->GetExecutable(address);
+    return executable ? executable : default_executable;
 }
 
 u32 ppu_recompiler_llvm::ExecutionEngine::ExecuteFunction(PPUThread * ppu_state, u64 context) {
@@ -7,6 +7,7 @@
 #include "Emu/Cell/PPUDecoder.h"
 #include "Emu/Cell/PPUThread.h"
 #include "Emu/Cell/PPUInterpreter.h"
+#include "Utilities/SQueue.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/IRBuilder.h"
@@ -14,6 +15,7 @@
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/ExecutionEngine/JIT.h"
 #include "llvm/PassManager.h"
+#include <queue>
 
 namespace ppu_recompiler_llvm {
     class Compiler;
@@ -698,6 +700,27 @@ namespace ppu_recompiler_llvm {
         void UNK(const u32 code, const u32 opcode, const u32 gcode) override;
 
     private:
+        /// Slots of the register cache. Each CR field has its own slot.
+        enum RegisterCacheSlot : u32 {
+            RCS_GPR0 = 0,
+            RCS_FPR0 = RCS_GPR0 + 32,
+            RCS_VR0  = RCS_FPR0 + 32,
+            RCS_CR0  = RCS_VR0 + 32,
+            RCS_XER  = RCS_CR0 + 8,
+            RCS_LR,
+            RCS_CTR,
+            RCS_MAX,
+        };
+
+        /// A guest register cached by the compiled function
+        struct CachedRegister {
+            /// Stack slot holding the value of the register. mem2reg turns it into SSA values. nullptr if the register is not used.
+            llvm::AllocaInst * ptr;
+
+            /// Indicates whether the function writes to the register
+            bool is_written;
+        };
+
         /// State of a compilation task
         struct CompileTaskState {
             enum Args {
@@ -728,6 +751,10 @@ namespace ppu_recompiler_llvm {
 
             /// Create code such that exit points can be linked to other blocks
             bool generate_linkable_exits;
+
+            /// Register cache. The registers used by the function are loaded from the PPU state at entry and the PPU state is
+            /// updated only at exits and around calls that get the PPU state.
+            CachedRegister cached_registers[RCS_MAX];
         };
 
         /// Recompilation engine
@@ -772,6 +799,35 @@ namespace ppu_recompiler_llvm {
         /// Get the basic block in for the specified address.
         llvm::BasicBlock * GetBasicBlockFromAddress(u32 address, const std::string & suffix = "", bool create_if_not_exist = true);
 
+        /// Clear the register cache. Must be called after the function is created.
+        void ResetRegisterCache();
+
+        /// Write the dirty cached registers to the PPU state before all exits and calls that get the PPU state, and reload the
+        /// cached registers after the calls. Must be called after the IR of the function is complete.
+        void WriteBackRegisterCache();
+
+        /// Get the LLVM type of a register cache slot
+        llvm::Type * GetCachedRegisterType(u32 slot);
+
+        /// Get the stack slot of a cached register. The register is loaded from the PPU state at the entry of the function
+        /// when it is first used.
+        llvm::AllocaInst * GetCachedRegister(u32 slot);
+
+        /// Get a pointer to a register in the PPU state. Returns a pointer to CR for the CR field slots.
+        llvm::Value * GetRegisterStatePtr(llvm::IRBuilder<> & builder, u32 slot);
+
+        /// Load a register from the PPU state
+        llvm::Value * LoadRegisterFromState(llvm::IRBuilder<> & builder, u32 slot);
+
+        /// Store the dirty cached registers to the PPU state
+        void StoreRegistersToState(llvm::IRBuilder<> & builder);
+
+        /// Load a register from the register cache
+        llvm::Value * LoadRegister(u32 slot);
+
+        /// Store a register to the register cache
+        void StoreRegister(u32 slot, llvm::Value * val);
+
         /// Get a bit
         llvm::Value * GetBit(llvm::Value * val, u32 n);
 
@@ -945,17 +1001,12 @@ namespace ppu_recompiler_llvm {
     public:
         virtual ~RecompilationEngine();
 
-        /// Allocate an ordinal
-        u32 AllocateOrdinal(u32 address, bool is_function);
-
-        /// Get the ordinal for the specified address
-        u32 GetOrdinal(u32 address) const;
-
-        /// Get the executable specified by the ordinal
-        const Executable GetExecutable(u32 ordinal) const;
+        /// Get the location of the executable for the specified address in the executable lookup table.
+        /// If the location is empty, it is initialised to the executable that runs the interpreter.
+        std::atomic<Executable> * GetExecutableLocation(u32 address, bool is_function);
 
-        /// Get the address of the executable lookup
-        u64 GetAddressOfExecutableLookup() const;
+        /// Get the executable for the specified address. Returns nullptr if the address has no executable. Doesn't lock.
+        Executable GetExecutable(u32 address) const;
 
         /// Notify the recompilation engine about a newly detected trace. It takes ownership of the trace.
         void NotifyTrace(ExecutionTrace * execution_trace);
@@ -986,11 +1037,15 @@ namespace ppu_recompiler_llvm {
             /// Indicates whether the block has been compiled or not
             bool is_compiled;
 
+            /// Indicates whether the block is waiting to be compiled or being compiled by a compiler worker
+            bool is_compiling;
+
             BlockEntry(u32 start_address, u32 function_address)
                 : num_hits(0)
                 , revision(0)
                 , last_compiled_cfg_size(0)
                 , is_compiled(false)
+                , is_compiling(false)
                 , cfg(start_address, function_address) {
             }
 
@@ -1020,14 +1075,111 @@ namespace ppu_recompiler_llvm {
             };
         };
 
+        /// An entry in the on-disk block cache
+        struct CacheEntry {
+            /// Hash of the addresses and the instructions of the CFG
+            u64 hash;
+
+            /// The CFG of the block
+            ControlFlowGraph cfg;
+
+            CacheEntry(const ControlFlowGraph & cfg, u64 hash)
+                : hash(hash)
+                , cfg(cfg) {
+            }
+        };
+
+        /// A request to compile a block. The CFG is copied so that the block can be updated while it is being compiled.
+        struct CompileJob {
+            /// The block to compile. Only accessed by the recompilation engine thread.
+            BlockEntry * block;
+
+            /// The CFG to compile
+            ControlFlowGraph cfg;
+
+            /// Name of the generated function
+            std::string name;
+
+            /// Indicates whether the block is a function
+            bool is_function;
+
+            /// Jobs with a higher priority are compiled first
+            u32 priority;
+
+            /// Location of the executable in the executable lookup table
+            std::atomic<Executable> * location;
+
+            /// State of the block before the job was created. Restored if the job is discarded.
+            bool   was_compiled;
+            size_t last_compiled_cfg_size;
+
+            CompileJob(BlockEntry & block_entry, const std::string & name, std::atomic<Executable> * location)
+                : block(&block_entry)
+                , cfg(block_entry.cfg)
+                , name(name)
+                , is_function(block_entry.IsFunction())
+                , priority(block_entry.num_hits)
+                , location(location)
+                , was_compiled(block_entry.is_compiled)
+                , last_compiled_cfg_size(block_entry.last_compiled_cfg_size) {
+            }
+
+            struct less {
+                bool operator()(const CompileJob * lhs, const CompileJob * rhs) const {
+                    return lhs->priority < rhs->priority;
+                }
+            };
+        };
+
         /// Log
         llvm::raw_fd_ostream * m_log;
 
-        /// Lock for accessing m_pending_execution_traces. TODO: Eliminate this and use a lock-free queue.
-        std::mutex m_pending_execution_traces_lock;
+        /// Path of the block cache file
+        std::string m_cache_path;
+
+        /// Block cache. Key is the start address of the block.
+        std::map<u32, CacheEntry> m_cache;
+
+        /// Blocks loaded from the cache and not compiled yet. They are compiled one at a time by the recompilation engine thread
+        /// so that the execution traces are still processed at boot.
+        std::vector<BlockEntry *> m_cached_blocks;
+
+        /// Number of blocks loaded from the cache
+        u32 m_cache_hits;
+
+        /// Number of compiled blocks not found in the cache
+        u32 m_cache_misses;
+
+        /// Number of cache entries whose code has changed
+        u32 m_cache_invalidated;
+
+        /// Queue of execution traces pending processing. PPU threads push to it without locking.
+        MPSCQueue<ExecutionTrace *, 0x1000> m_pending_execution_traces;
+
+        /// Number of execution traces dropped because m_pending_execution_traces was full
+        std::atomic<u32> m_dropped_execution_traces;
+
+        /// Lock for accessing m_compile_queue, m_compiled_jobs and m_compile_workers_exit
+        std::mutex m_compile_lock;
+
+        /// Signaled when a job is added to m_compile_queue or when the compiler workers must exit
+        std::condition_variable m_compile_cv;
+
+        /// Jobs waiting for a compiler worker
+        std::priority_queue<CompileJob *, std::vector<CompileJob *>, CompileJob::less> m_compile_queue;
+
+        /// Jobs compiled by the compiler workers and not yet processed by the recompilation engine thread
+        std::vector<CompileJob *> m_compiled_jobs;
+
+        /// Indicates whether the compiler workers must exit
+        bool m_compile_workers_exit;
 
-        /// Queue of execution traces pending processing
-        std::list<ExecutionTrace *> m_pending_execution_traces;
+        /// Compilers of the compiler workers. Each worker has its own LLVM context. The compilers are kept alive till the engine is
+        /// destroyed because they own the generated code.
+        std::vector<std::unique_ptr<Compiler>> m_worker_compilers;
+
+        /// Compiler worker threads
+        std::vector<std::unique_ptr<thread>> m_compile_workers;
 
         /// Block table
         std::unordered_set<BlockEntry *, BlockEntry::hash, BlockEntry::equal_to> m_block_table;
@@ -1035,21 +1187,16 @@ namespace ppu_recompiler_llvm {
         /// Execution traces that have been already encountered. Data is the list of all blocks that this trace includes.
         std::unordered_map<ExecutionTrace::Id, std::vector<BlockEntry *>> m_processed_execution_traces;
 
-        /// Lock for accessing m_address_to_ordinal.
-        // TODO: Make this a RW lock
-        mutable std::mutex m_address_to_ordinal_lock;
-
-        /// Mapping from address to ordinal
-        std::unordered_map<u32, u32> m_address_to_ordinal;
-
-        /// Next ordinal to allocate
-        u32 m_next_ordinal;
-
-        /// PPU Compiler
+        /// PPU Compiler. Used when there are no compiler workers.
         Compiler m_compiler;
 
-        /// Executable lookup table
-        Executable m_executable_lookup[10000]; // TODO: Adjust size
+        /// Executable lookup table. The first level is indexed by address >> 16 and the second level by (address & 0xFFFF) / 4.
+        /// Pages of the second level are allocated on demand and never freed while the engine exists, so the table is read without
+        /// locking. The compiled code reads the locations of the executables directly.
+        std::atomic<std::atomic<Executable> *> m_executable_lookup[0x10000];
+
+        /// Number of allocated pages of the executable lookup table
+        std::atomic<u32> m_executable_lookup_pages;
 
         RecompilationEngine();
 
@@ -1065,9 +1212,37 @@ namespace ppu_recompiler_llvm {
         /// Update a CFG
         void UpdateControlFlowGraph(ControlFlowGraph & cfg, const ExecutionTraceEntry & this_entry, const ExecutionTraceEntry * next_entry);
 
-        /// Compile a block
+        /// Compile a block. The block is queued for the compiler workers if there are any, otherwise it is compiled immediately.
         void CompileBlock(BlockEntry & block_entry);
 
+        /// Compile a job and install the executable. Can be called from any thread as long as the compiler isn't shared.
+        void RunCompileJob(Compiler & compiler, CompileJob & job);
+
+        /// Update the block table and the block cache with the result of a compile job. Takes ownership of the job.
+        void FinishCompileJob(CompileJob * job);
+
+        /// Process the jobs finished by the compiler workers
+        void ProcessCompiledJobs();
+
+        /// Start the compiler workers
+        void StartCompileWorkers();
+
+        /// Stop the compiler workers and discard the jobs that haven't been compiled
+        void StopCompileWorkers();
+
+        /// Main loop of a compiler worker
+        void CompileWorker(Compiler & compiler);
+
+        /// Get the hash of the instructions of a CFG. Returns false if some instruction is not in valid memory.
+        static bool GetCfgHash(const ControlFlowGraph & cfg, u64 & hash);
+
+        /// Load the block cache. The blocks whose code hasn't changed are added to m_cached_blocks. The whole file is rejected if
+        /// it was created by another version of the recompiler or if it's truncated.
+        void LoadCache();
+
+        /// Save the block cache
+        void SaveCache();
+
         /// Mutex used to prevent multiple creation
         static std::mutex s_mutex;
 
@@ -1142,18 +1317,9 @@ namespace ppu_recompiler_llvm {
         /// Execution tracer
         Tracer m_tracer;
 
-        /// The time at which the m_address_to_ordinal cache was last cleared
-        mutable std::chrono::high_resolution_clock::time_point m_last_cache_clear_time;
-
-        /// Address to ordinal cahce. Key is address. Data is the pair (ordinal, times hit).
-        mutable std::unordered_map<u32, std::pair<u32, u32>> m_address_to_ordinal;
-
         /// Recompilation engine
         std::shared_ptr<RecompilationEngine> m_recompilation_engine;
 
-        /// Remove unused entries from the m_address_to_ordinal cache
-        void RemoveUnusedEntriesFromCache() const;
-
         /// Get the executable for the specified address
         Executable GetExecutable(u32 address, Executable default_executable) const;
 
@@ -246,6 +246,7 @@ void Compiler::RunTest(const char * name, std::function<void()> test_case, std::
     (++arg_i)->setName("context");
     m_state.args[CompileTaskState::Args::Context] = arg_i;
     m_state.current_instruction_address = s_ppu_state->PC;
+    ResetRegisterCache();
 
     auto block = BasicBlock::Create(*m_llvm_context, "start", m_state.function);
     m_ir_builder->SetInsertPoint(block);
@@ -253,6 +254,7 @@ void Compiler::RunTest(const char * name, std::function<void()> test_case, std::
     test_case();
 
     m_ir_builder->CreateRet(m_ir_builder->getInt32(0));
+    WriteBackRegisterCache();
 
     // Print the IR
     std::string        ir;
@@ -110,7 +110,7 @@ void PPUThread::DoRun()
 	case 1:
 	{
 		auto ppui = new PPUInterpreter(*this);
-		m_dec = new PPUDecoder(ppui);
+		m_dec = new PPUDecoder(ppui, true);
 	}
 	break;
 
@@ -208,6 +208,7 @@ u64 PPUThread::FastCall2(u32 addr, u32 rtoc)
 	CPUThread::Task();
 
 	m_status = old_status;
+	AddEvent(CPU_EVENT_STATE);
 	PC = old_PC;
 	GPR[1] = old_stack;
 	GPR[2] = old_rtoc;
@@ -220,6 +221,7 @@ u64 PPUThread::FastCall2(u32 addr, u32 rtoc)
 void PPUThread::FastStop()
 {
 	m_status = Stopped;
+	AddEvent(CPU_EVENT_STATE);
 }
 
 void PPUThread::Task()
@@ -137,6 +137,9 @@ bool RawSPUThread::Write32(const u64 addr, const u32 value)
 	{
 		if (value == SPU_RUNCNTL_RUNNABLE)
 		{
+			// the PPU may have written the code directly to LS
+			for (auto& v : ls_dirty) v = ~0ull;
+
 			SPU.Status.SetValue(SPU_STATUS_RUNNING);
 			Exec();
 		}
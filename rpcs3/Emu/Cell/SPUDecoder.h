@@ -7,14 +7,18 @@
 class SPUDecoder : public PPCDecoder
 {
 	SPUOpcodes* m_op;
+	PPCDecoderCache<SPUOpcodes>* m_cache;
 	
 public:
-	SPUDecoder(SPUOpcodes& op) : m_op(&op)
+	SPUDecoder(SPUOpcodes& op, bool use_cache = false)
+		: m_op(&op)
+		, m_cache(use_cache ? new PPCDecoderCache<SPUOpcodes>() : nullptr)
 	{
 	}
 
 	~SPUDecoder()
 	{
+		delete m_cache;
 		delete m_op;
 	}
 
@@ -22,4 +26,16 @@ public:
 	{
 		(*SPU_instr::rrr_list)(m_op, code);
 	}
+
+	virtual void DecodeAt(const u32 address, const u32 code)
+	{
+		if (m_cache)
+		{
+			m_cache->Execute(m_op, SPU_instr::rrr_list, address, code);
+		}
+		else
+		{
+			Decode(code);
+		}
+	}
 };
@@ -11,23 +11,36 @@ using namespace asmjit::host;
 
 class SPURecompiler;
 
+// Result of compilation of a single SPU block
+struct SPUCompiledBlock
+{
+	u16 pos; // LS position of the block (in words)
+	u16 count; // count of compiled instructions
+	void* pointer; // pointer to executable memory object (nullptr if failed)
+	std::vector<u32> code; // raw LS words the block was compiled from
+	std::vector<__m128i> imm; // constants used by the block
+};
+
 class SPURecompilerCore : public CPUDecoder
 {
-	SPURecompiler* m_enc;
 	SPUThread& CPU;
 
 public:
 	SPUInterpreter* inter;
 	JitRuntime runtime;
 	bool first;
-	bool need_check;
+	bool use_cache; // JIT cache enabled (never for Raw SPU, its code differs, see SPURecompiler::CheckIndirectBranch)
+	std::mutex m_log_mutex;
 
 	struct SPURecEntry
 	{
 		//u16 host; // absolute position of first instruction of current block (not used now)
 		u16 count; // count of instructions compiled from current point (and to be checked)
+		u16 size; // count of LS words covered by the block compiled from current point
 		u32 valid; // copy of valid opcode for validation
 		void* pointer; // pointer to executable memory object
+		__m128i* imm; // constants used by the block compiled from current point
+		bool pending; // compilation has been requested from the compiler pool
 #ifdef _WIN32
 		//_IMAGE_RUNTIME_FUNCTION_ENTRY info;
 #endif
@@ -35,14 +48,58 @@ public:
 
 	SPURecEntry entry[0x10000];
 
-	std::vector<__m128i> imm_table;
+	// JIT cache statistics
+	u32 cache_hits;
+	std::atomic<u32> cache_misses;
+	s64 cache_time_saved; // microseconds
+
+	std::vector<u16> page_blocks[256]; // positions of compiled blocks covering each 1 KB page of LS
+
+	// invalidation statistics
+	u32 inv_runs; // number of times dirty pages were checked
+	u64 inv_checked; // number of blocks compared with LS
+	u32 inv_released; // number of blocks released
+	u64 inv_time; // microseconds
+
+	// asynchronous compilation
+	std::mutex m_done_mutex;
+	std::vector<SPUCompiledBlock*> m_done; // blocks compiled by the pool, installed by the SPU thread
+	std::atomic<u32> queue_depth; // compile requests of this thread in the pool queue
+	u32 queue_depth_max;
+	u32 pending_count; // blocks requested from the pool and not installed yet
+	u64 interpreter_fallbacks; // instructions executed by the interpreter while the code was being compiled
+	u32 interp_next; // position inside a block where the interpreter was interrupted (it's not queued as a block entry)
+
+	// block linking
+	void* dispatcher; // compiled loop which enters the next block through entry[] (see BuildDispatcher())
+	u64 chain_calls; // number of dispatcher calls
+	u64 chain_blocks; // number of blocks executed by the dispatcher (incremented by the compiled code)
+	u64 chain_time; // microseconds spent in the dispatcher
 
 	SPURecompilerCore(SPUThread& cpu);
 
 	~SPURecompilerCore();
 
+	SPUCompiledBlock* CompileBlock(u16 pos); // can be called from any thread
+
 	void Compile(u16 pos);
 
+	bool LoadCached(u16 pos);
+
+	void InstallBlock(SPUCompiledBlock& block);
+
+	void InstallCompiled();
+
+	void RegisterBlock(u16 pos);
+
+	void ReleaseBlock(u16 pos);
+
+	void InvalidateDirty();
+
+	void BuildDispatcher();
+
+	u8 Interpret();
+
 	virtual void Decode(const u32 code);
 
 	virtual u8 DecodeMemory(const u32 address);
@@ -107,6 +164,8 @@ private:
 public:
 	X86Compiler* compiler;
 	bool do_finalize;
+	u32 pc; // LS address of the instruction being compiled
+	std::vector<__m128i> imm_table; // constants used by the block being compiled
 	// input:
 	X86GpVar* cpu_var;
 	X86GpVar* ls_var;
@@ -157,7 +216,18 @@ public:
 		: CPU(cpu)
 		, rec(rec)
 		, compiler(nullptr)
+		, pc(0)
+	{
+	}
+
+	// PPU stores into the LS of Raw SPU aren't tracked in ls_dirty (it's plain guest memory),
+	// so their code is checked on every indirect branch except returns (call before pos_var is shifted)
+	void CheckIndirectBranch(u32 ra)
 	{
+		if (ra && CPU.GetType() == CPU_THREAD_RAW_SPU)
+		{
+			c.or_(*pos_var, 0x2000000 << 2);
+		}
 	}
 
 	const XmmLink& XmmAlloc(s8 pref = -1) // get empty xmm register
@@ -354,15 +424,15 @@ public:
 
 	Mem XmmConst(const __m128i& data)
 	{
-		for (u32 i = 0; i < rec.imm_table.size(); i++)
+		for (u32 i = 0; i < imm_table.size(); i++)
 		{
-			if (mmToU64Ptr(rec.imm_table[i])[0] == mmToU64Ptr(data)[0] && mmToU64Ptr(rec.imm_table[i])[1] == mmToU64Ptr(data)[1])
+			if (mmToU64Ptr(imm_table[i])[0] == mmToU64Ptr(data)[0] && mmToU64Ptr(imm_table[i])[1] == mmToU64Ptr(data)[1])
 			{
 				return oword_ptr(*imm_var, i * sizeof(__m128i));
 			}
 		}
-		const size_t shift = rec.imm_table.size() * sizeof(__m128i);
-		rec.imm_table.push_back(data);
+		const size_t shift = imm_table.size() * sizeof(__m128i);
+		imm_table.push_back(data);
 		return oword_ptr(*imm_var, (s32)shift);
 	}
 
@@ -384,10 +454,10 @@ private:
 				LOG2_OPCODE();
 			}
 		};
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		X86CallNode* call = c.call(imm_ptr(reinterpret_cast<void*>(&STOP_wrapper::STOP)), kFuncConvHost, FuncBuilder1<void, u32>());
 		call->setArg(0, imm_u(code));
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		do_finalize = true;
 		LOG_OPCODE();
 	}
@@ -397,10 +467,10 @@ private:
 	}
 	void SYNC(u32 Cbit)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		// This instruction must be used following a store instruction that modifies the instruction stream.
 		c.mfence();
-		c.mov(*pos_var, (CPU.PC >> 2) + 1 + 0x2000000);
+		c.mov(*pos_var, (pc >> 2) + 1 + 0x2000000);
 		do_finalize = true;
 		LOG_OPCODE();
 	}
@@ -416,7 +486,7 @@ private:
 	}
 	void RDCH(u32 rt, u32 ra)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		WRAPPER_BEGIN(rt, ra, yy, zz);
 		CPU.ReadChannel(CPU.GPR[rt], ra);
 		WRAPPER_END(rt, ra, 0, 0);
@@ -424,7 +494,7 @@ private:
 	}
 	void RCHCNT(u32 rt, u32 ra)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		WRAPPER_BEGIN(rt, ra, yy, zz);
 		CPU.GPR[rt].clear();
 		CPU.GPR[rt]._u32[3] = CPU.GetChannelCount(ra);
@@ -1032,7 +1102,7 @@ private:
 	}
 	void WRCH(u32 ra, u32 rt)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		WRAPPER_BEGIN(ra, rt, yy, zz);
 		CPU.WriteChannel(ra, CPU.GPR[rt]);
 		WRAPPER_END(ra, rt, 0, 0);
@@ -1082,14 +1152,14 @@ private:
 		default: UNIMPLEMENTED(); return;
 		}
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, CPU.PC + 4);
+		c.mov(*addr, pc + 4);
 		c.mov(*pos_var, cpu_dword(GPR[ra]._u32[3]));
-		if (ra) c.or_(*pos_var, 0x2000000 << 2); // rude (check if not LR)
 		c.cmp(cpu_dword(GPR[rt]._u32[3]), 0);
 		c.cmovne(*pos_var, *addr);
+		CheckIndirectBranch(ra);
 		c.shr(*pos_var, 2);
 		LOG_OPCODE();
 	}
@@ -1103,14 +1173,14 @@ private:
 		default: UNIMPLEMENTED(); return;
 		}
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, CPU.PC + 4);
+		c.mov(*addr, pc + 4);
 		c.mov(*pos_var, cpu_dword(GPR[ra]._u32[3]));
-		if (ra) c.or_(*pos_var, 0x2000000 << 2); // rude (check if not LR)
 		c.cmp(cpu_dword(GPR[rt]._u32[3]), 0);
 		c.cmove(*pos_var, *addr);
+		CheckIndirectBranch(ra);
 		c.shr(*pos_var, 2);
 		LOG_OPCODE();
 	}
@@ -1124,14 +1194,14 @@ private:
 		default: UNIMPLEMENTED(); return;
 		}
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, CPU.PC + 4);
+		c.mov(*addr, pc + 4);
 		c.mov(*pos_var, cpu_dword(GPR[ra]._u32[3]));
-		if (ra) c.or_(*pos_var, 0x2000000 << 2); // rude (check if not LR)
 		c.cmp(cpu_word(GPR[rt]._u16[6]), 0);
 		c.cmovne(*pos_var, *addr);
+		CheckIndirectBranch(ra);
 		c.shr(*pos_var, 2);
 		LOG_OPCODE();
 	}
@@ -1145,14 +1215,14 @@ private:
 		default: UNIMPLEMENTED(); return;
 		}
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, CPU.PC + 4);
+		c.mov(*addr, pc + 4);
 		c.mov(*pos_var, cpu_dword(GPR[ra]._u32[3]));
-		if (ra) c.or_(*pos_var, 0x2000000 << 2); // rude (check if not LR)
 		c.cmp(cpu_word(GPR[rt]._u16[6]), 0);
 		c.cmove(*pos_var, *addr);
+		CheckIndirectBranch(ra);
 		c.shr(*pos_var, 2);
 		LOG_OPCODE();
 	}
@@ -1197,11 +1267,11 @@ private:
 		default: UNIMPLEMENTED(); return;
 		}
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
 		c.mov(*pos_var, cpu_dword(GPR[ra]._u32[3]));
-		if (ra) c.or_(*pos_var, 0x2000000 << 2); // rude (check if not LR)
+		CheckIndirectBranch(ra);
 		c.shr(*pos_var, 2);
 		LOG_OPCODE();
 	}
@@ -1217,7 +1287,7 @@ private:
 
 		XmmInvalidate(rt);
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
 		c.xor_(*pos_var, *pos_var);
@@ -1225,9 +1295,9 @@ private:
 		c.mov(cpu_dword(GPR[rt]._u32[1]), *pos_var);
 		c.mov(cpu_dword(GPR[rt]._u32[2]), *pos_var);
 		c.mov(*pos_var, cpu_dword(GPR[ra]._u32[3]));
-		c.mov(cpu_dword(GPR[rt]._u32[3]), CPU.PC + 4);
+		c.mov(cpu_dword(GPR[rt]._u32[3]), pc + 4);
+		CheckIndirectBranch(ra);
 		c.shr(*pos_var, 2);
-		c.or_(*pos_var, 0x2000000);
 		LOG_OPCODE();
 	}
 	void IRET(u32 ra)
@@ -1963,7 +2033,7 @@ private:
 		c.cmp(*addr, cpu_dword(GPR[rb]._s32[3]));
 		c.setg(addr->r8());
 		c.shl(*addr, 24);
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		c.or_(*pos_var, *addr);
 		do_finalize = true;
 		LOG_OPCODE();
@@ -2323,7 +2393,7 @@ private:
 		c.cmp(*addr, cpu_dword(GPR[rb]._u32[3]));
 		c.seta(addr->r8());
 		c.shl(*addr, 24);
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		c.or_(*pos_var, *addr);
 		do_finalize = true;
 		LOG_OPCODE();
@@ -2676,7 +2746,7 @@ private:
 		c.cmp(*addr, cpu_dword(GPR[rb]._s32[3]));
 		c.sete(addr->r8());
 		c.shl(*addr, 24);
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		c.or_(*pos_var, *addr);
 		do_finalize = true;
 		LOG_OPCODE();
@@ -2745,11 +2815,11 @@ private:
 	//0 - 8
 	void BRZ(u32 rt, s32 i16)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, (CPU.PC >> 2) + 1);
-		c.mov(*pos_var, branchTarget(CPU.PC, i16) >> 2);
+		c.mov(*addr, (pc >> 2) + 1);
+		c.mov(*pos_var, branchTarget(pc, i16) >> 2);
 		c.cmp(cpu_dword(GPR[rt]._u32[3]), 0);
 		c.cmovne(*pos_var, *addr);
 		LOG_OPCODE();
@@ -2774,40 +2844,40 @@ private:
 	}
 	void BRNZ(u32 rt, s32 i16)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, (CPU.PC >> 2) + 1);
-		c.mov(*pos_var, branchTarget(CPU.PC, i16) >> 2);
+		c.mov(*addr, (pc >> 2) + 1);
+		c.mov(*pos_var, branchTarget(pc, i16) >> 2);
 		c.cmp(cpu_dword(GPR[rt]._u32[3]), 0);
 		c.cmove(*pos_var, *addr);
 		LOG_OPCODE();
 	}
 	void BRHZ(u32 rt, s32 i16)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, (CPU.PC >> 2) + 1);
-		c.mov(*pos_var, branchTarget(CPU.PC, i16) >> 2);
+		c.mov(*addr, (pc >> 2) + 1);
+		c.mov(*pos_var, branchTarget(pc, i16) >> 2);
 		c.cmp(cpu_word(GPR[rt]._u16[6]), 0);
 		c.cmovnz(*pos_var, *addr);
 		LOG_OPCODE();
 	}
 	void BRHNZ(u32 rt, s32 i16)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*addr, (CPU.PC >> 2) + 1);
-		c.mov(*pos_var, branchTarget(CPU.PC, i16) >> 2);
+		c.mov(*addr, (pc >> 2) + 1);
+		c.mov(*pos_var, branchTarget(pc, i16) >> 2);
 		c.cmp(cpu_word(GPR[rt]._u16[6]), 0);
 		c.cmovz(*pos_var, *addr);
 		LOG_OPCODE();
 	}
 	void STQR(u32 rt, s32 i16)
 	{
-		const u32 lsa = branchTarget(CPU.PC, i16) & 0x3fff0;
+		const u32 lsa = branchTarget(pc, i16) & 0x3fff0;
 
 		/*const XmmLink& vt = XmmGet(rt);
 		c.pshufb(vt.get(), XmmConst(_mm_set_epi32(0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f)));
@@ -2825,7 +2895,7 @@ private:
 	}
 	void BRA(s32 i16)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
 		c.mov(*pos_var, branchTarget(0, i16) >> 2);
@@ -2855,23 +2925,23 @@ private:
 	{
 		XmmInvalidate(rt);
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
 		c.xor_(*addr, *addr); // zero
 		c.mov(cpu_dword(GPR[rt]._u32[0]), *addr);
 		c.mov(cpu_dword(GPR[rt]._u32[1]), *addr);
 		c.mov(cpu_dword(GPR[rt]._u32[2]), *addr);
-		c.mov(cpu_dword(GPR[rt]._u32[3]), CPU.PC + 4);
+		c.mov(cpu_dword(GPR[rt]._u32[3]), pc + 4);
 		c.mov(*pos_var, branchTarget(0, i16) >> 2);
 		LOG_OPCODE();
 	}
 	void BR(s32 i16)
 	{
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
-		c.mov(*pos_var, branchTarget(CPU.PC, i16) >> 2);
+		c.mov(*pos_var, branchTarget(pc, i16) >> 2);
 		LOG_OPCODE();
 	}
 	void FSMBI(u32 rt, s32 i16)
@@ -2895,22 +2965,22 @@ private:
 	{
 		XmmInvalidate(rt);
 
-		c.mov(cpu_dword(PC), CPU.PC);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 
 		c.xor_(*addr, *addr); // zero
 		c.mov(cpu_dword(GPR[rt]._u32[0]), *addr);
 		c.mov(cpu_dword(GPR[rt]._u32[1]), *addr);
 		c.mov(cpu_dword(GPR[rt]._u32[2]), *addr);
-		c.mov(cpu_dword(GPR[rt]._u32[3]), CPU.PC + 4);
-		c.mov(*pos_var, branchTarget(CPU.PC, i16) >> 2);
+		c.mov(cpu_dword(GPR[rt]._u32[3]), pc + 4);
+		c.mov(*pos_var, branchTarget(pc, i16) >> 2);
 		LOG_OPCODE();
 	}
 	void LQR(u32 rt, s32 i16)
 	{
 		XmmInvalidate(rt);
 
-		const u32 lsa = branchTarget(CPU.PC, i16) & 0x3fff0;
+		const u32 lsa = branchTarget(pc, i16) & 0x3fff0;
 
 		/*const XmmLink& vt = XmmAlloc(rt);
 		c.movdqa(vt.get(), oword_ptr(*ls_var, lsa));
@@ -3337,7 +3407,7 @@ private:
 		c.cmp(*addr, i10);
 		c.setg(addr->r8());
 		c.shl(*addr, 24);
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		c.or_(*pos_var, *addr);
 		do_finalize = true;
 		LOG_OPCODE();
@@ -3402,7 +3472,7 @@ private:
 		c.cmp(*addr, i10);
 		c.seta(addr->r8());
 		c.shl(*addr, 24);
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		c.or_(*pos_var, *addr);
 		do_finalize = true;
 		LOG_OPCODE();
@@ -3452,7 +3522,7 @@ private:
 		c.cmp(*addr, i10);
 		c.sete(addr->r8());
 		c.shl(*addr, 24);
-		c.mov(*pos_var, (CPU.PC >> 2) + 1);
+		c.mov(*pos_var, (pc >> 2) + 1);
 		c.or_(*pos_var, *addr);
 		do_finalize = true;
 		LOG_OPCODE();
@@ -3797,8 +3867,8 @@ private:
 
 	void UNK(const std::string& err)
 	{
-		LOG_ERROR(Log::SPU, "%s #pc: 0x%x", err.c_str(), CPU.PC);
-		c.mov(cpu_dword(PC), CPU.PC);
+		LOG_ERROR(Log::SPU, "%s #pc: 0x%x", err.c_str(), pc);
+		c.mov(cpu_dword(PC), pc);
 		do_finalize = true;
 		Emu.Pause();
 	}
@@ -1,4 +1,7 @@
 #include "stdafx.h"
+#include <map>
+#include <deque>
+#include "rpcs3/Ini.h"
 #include "Utilities/Log.h"
 #include "Emu/Memory/Memory.h"
 #include "Emu/System.h"
@@ -15,12 +18,412 @@
 
 const g_imm_table_struct g_imm_table;
 
+// X86Assembler with access to the relocation data (required to store the code before it's relocated and to restore it later)
+class SPUCacheAssembler : public X86Assembler
+{
+public:
+	SPUCacheAssembler(Runtime* runtime)
+		: X86Assembler(runtime)
+	{
+	}
+
+	const PodVector<RelocData>& GetRelocs() const
+	{
+		return _relocList;
+	}
+
+	void AddReloc(const RelocData& rd)
+	{
+		_relocList.append(rd);
+	}
+
+	size_t GetTrampolineSize() const
+	{
+		return _trampolineSize;
+	}
+
+	void SetTrampolineSize(size_t size)
+	{
+		_trampolineSize = size;
+	}
+};
+
+struct SPUCacheReloc
+{
+	u32 type;
+	u32 size;
+	u64 from;
+	u64 data; // absolute addresses are stored relative to GetModuleBase()
+};
+
+struct SPUCacheImm
+{
+	u32 index;
+	u64 data[2];
+};
+
+struct SPUCacheRecord
+{
+	u16 pos; // LS position of the block (in words)
+	u16 count; // number of compiled instructions (SPURecEntry::count)
+	u64 hash; // hash of the opcodes
+	u64 time; // compilation time (microseconds)
+	u64 trampoline_size;
+	std::vector<u32> code; // raw LS words covered by the block
+	std::vector<u8> bin; // machine code before relocation
+	std::vector<SPUCacheReloc> relocs;
+	std::vector<SPUCacheImm> imm; // constants used by the block
+};
+
+static const u32 spu_cache_magic = 0x43555053; // "SPUC"
+
+// Must be incremented on every change of the file format, of the generated code or of the SPUThread layout
+// (compiled code contains absolute offsets of SPUThread members and calls the wrappers directly)
+static const u32 spu_cache_version = 1;
+
+// On-disk storage of compiled SPU blocks (one append-only file per title)
+class SPUJitCache
+{
+	std::mutex m_mutex;
+	std::string m_path;
+	std::multimap<u16, SPUCacheRecord> m_records;
+
+	static std::string GetBuildId()
+	{
+		// the size only catches a forgotten version bump, it isn't a replacement for it
+		return fmt::Format("v%d %d-bit %d", spu_cache_version, (u32)sizeof(void*) * 8, (u32)sizeof(SPUThread));
+	}
+
+	template<typename T> static bool Read(const std::vector<u8>& buf, size_t& pos, T* data, size_t count = 1)
+	{
+		if (buf.size() - pos < sizeof(T) * count)
+		{
+			return false;
+		}
+
+		memcpy(data, &buf[pos], sizeof(T) * count);
+		pos += sizeof(T) * count;
+		return true;
+	}
+
+	template<typename T> static void Write(std::vector<u8>& buf, const T* data, size_t count = 1)
+	{
+		buf.insert(buf.end(), (const u8*)data, (const u8*)(data + count));
+	}
+
+	void Load()
+	{
+		m_records.clear();
+
+		rFile f;
+		if (!rExists(m_path) || !f.Open(m_path, rFile::read))
+		{
+			return;
+		}
+
+		std::vector<u8> buf(f.Length());
+		buf.resize(f.Read(buf.data(), buf.size()));
+		f.Close();
+
+		const std::string build = GetBuildId();
+		std::string file_build(build.size(), '\0');
+		u32 file_magic, build_size;
+		size_t pos = 0;
+
+		if (!Read(buf, pos, &file_magic) || file_magic != spu_cache_magic || !Read(buf, pos, &build_size) || build_size != build.size() ||
+			!Read(buf, pos, &file_build[0], build_size) || file_build != build)
+		{
+			LOG_NOTICE(SPU, "SPU JIT cache '%s' is outdated", m_path.c_str());
+			rRemoveFile(m_path);
+			return;
+		}
+
+		while (pos < buf.size())
+		{
+			SPUCacheRecord rec;
+			u32 code_size, bin_size, reloc_count, imm_count;
+
+			if (!Read(buf, pos, &rec.pos) || !Read(buf, pos, &rec.count) || !Read(buf, pos, &rec.hash) || !Read(buf, pos, &rec.time) ||
+				!Read(buf, pos, &rec.trampoline_size) || !Read(buf, pos, &code_size) || !Read(buf, pos, &bin_size) ||
+				!Read(buf, pos, &reloc_count) || !Read(buf, pos, &imm_count))
+			{
+				break;
+			}
+
+			rec.code.resize(code_size);
+			rec.bin.resize(bin_size);
+			rec.relocs.resize(reloc_count);
+			rec.imm.resize(imm_count);
+
+			if (!Read(buf, pos, rec.code.data(), code_size) || !Read(buf, pos, rec.bin.data(), bin_size) ||
+				!Read(buf, pos, rec.relocs.data(), reloc_count) || !Read(buf, pos, rec.imm.data(), imm_count))
+			{
+				break;
+			}
+
+			m_records.insert(std::make_pair(rec.pos, std::move(rec)));
+		}
+
+		LOG_NOTICE(SPU, "SPU JIT cache '%s': %d blocks loaded", m_path.c_str(), (u32)m_records.size());
+	}
+
+public:
+	static u64 GetModuleBase()
+	{
+		return (u64)&g_imm_table;
+	}
+
+	static u64 Hash(const u32* code, u32 size)
+	{
+		// FNV-1a
+		u64 hash = 0xcbf29ce484222325ull;
+		for (u32 i = 0; i < size; i++)
+		{
+			hash = (hash ^ code[i]) * 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	void Open(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_path != path)
+		{
+			m_path = path;
+			Load();
+		}
+	}
+
+	// find the block compiled from the same code
+	bool Find(u16 pos, const u32* ls, SPUCacheRecord& result)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (auto it = m_records.lower_bound(pos); it != m_records.end() && it->first == pos; it++)
+		{
+			const SPUCacheRecord& rec = it->second;
+
+			if (pos + rec.code.size() > 0x10000 || Hash(ls + pos, (u32)rec.code.size()) != rec.hash ||
+				memcmp(ls + pos, rec.code.data(), rec.code.size() * sizeof(u32)))
+			{
+				continue;
+			}
+
+			result = rec;
+			return true;
+		}
+
+		return false;
+	}
+
+	void Add(const SPUCacheRecord& rec)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		std::vector<u8> buf;
+
+		if (!rExists(m_path))
+		{
+			const std::string build = GetBuildId();
+			const u32 build_size = (u32)build.size();
+
+			if (!rExists("spu_cache")) rMkdir("spu_cache");
+
+			Write(buf, &spu_cache_magic);
+			Write(buf, &build_size);
+			Write(buf, build.data(), build.size());
+		}
+
+		const u32 code_size = (u32)rec.code.size();
+		const u32 bin_size = (u32)rec.bin.size();
+		const u32 reloc_count = (u32)rec.relocs.size();
+		const u32 imm_count = (u32)rec.imm.size();
+
+		Write(buf, &rec.pos);
+		Write(buf, &rec.count);
+		Write(buf, &rec.hash);
+		Write(buf, &rec.time);
+		Write(buf, &rec.trampoline_size);
+		Write(buf, &code_size);
+		Write(buf, &bin_size);
+		Write(buf, &reloc_count);
+		Write(buf, &imm_count);
+		Write(buf, rec.code.data(), code_size);
+		Write(buf, rec.bin.data(), bin_size);
+		Write(buf, rec.relocs.data(), reloc_count);
+		Write(buf, rec.imm.data(), imm_count);
+
+		rFile f;
+		if (!f.Open(m_path, rFile::write_append) || f.Write(buf.data(), buf.size()) != buf.size())
+		{
+			LOG_ERROR(SPU, "SPUJitCache::Add(): failed to write '%s'", m_path.c_str());
+		}
+
+		m_records.insert(std::make_pair(rec.pos, rec));
+	}
+};
+
+SPUJitCache g_spu_jit_cache;
+
+// Background compilation of SPU blocks (shared by all SPU threads)
+class SPUCompilerPool
+{
+	struct SPUCompileJob
+	{
+		SPURecompilerCore* core;
+		u16 pos;
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv; // signaled when some job was queued
+	std::condition_variable m_done_cv; // signaled when some job was finished
+	std::deque<SPUCompileJob> m_queue;
+	std::vector<SPURecompilerCore*> m_busy; // owners of the jobs being compiled
+	std::vector<std::unique_ptr<thread>> m_threads;
+	u32 m_exited; // number of workers which returned
+	bool m_exit;
+
+	void Worker()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// Emu.Stop() waits for all threads, so the workers exit on their own (the wait is interrupted to check the status)
+		while (!m_exit && !Emu.IsStopped())
+		{
+			if (m_queue.empty())
+			{
+				m_cv.wait_for(lock, std::chrono::milliseconds(100));
+				continue;
+			}
+
+			const SPUCompileJob job = m_queue.front();
+			m_queue.pop_front();
+			job.core->queue_depth--;
+			m_busy.push_back(job.core);
+			lock.unlock();
+
+			SPUCompiledBlock* block = job.core->CompileBlock(job.pos);
+
+			{
+				std::lock_guard<std::mutex> done_lock(job.core->m_done_mutex);
+				job.core->m_done.push_back(block);
+			}
+
+			lock.lock();
+			m_busy.erase(std::find(m_busy.begin(), m_busy.end(), job.core));
+			m_done_cv.notify_all();
+		}
+
+		m_exited++;
+	}
+
+	void Join()
+	{
+		for (auto& t : m_threads)
+		{
+			t->join();
+		}
+
+		m_threads.clear();
+		m_exited = 0;
+	}
+
+public:
+	SPUCompilerPool()
+		: m_exited(0)
+		, m_exit(false)
+	{
+	}
+
+	~SPUCompilerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+			m_cv.notify_all();
+		}
+
+		Join();
+	}
+
+	void Push(SPURecompilerCore* core, u16 pos)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// the workers of the previous emulation have exited already (Emu.Stop() waits for them)
+		if (m_exited && m_exited == m_threads.size())
+		{
+			Join();
+		}
+
+		// threads are started on demand
+		for (u32 i = (u32)m_threads.size(), count = Ini.SPUCompilerThreads.GetValue(); i < count; i++)
+		{
+			m_threads.push_back(std::unique_ptr<thread>(new thread(fmt::Format("SPU Compiler[%d]", i), [this]()
+			{
+				Worker();
+			})));
+		}
+
+		m_queue.push_back({ core, pos });
+
+		if (++core->queue_depth > core->queue_depth_max)
+		{
+			core->queue_depth_max = core->queue_depth;
+		}
+
+		m_cv.notify_one();
+	}
+
+	// remove queued jobs of the core and wait for the jobs being compiled
+	void Cancel(SPURecompilerCore* core)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		for (auto it = m_queue.begin(); it != m_queue.end();)
+		{
+			if (it->core == core)
+			{
+				it = m_queue.erase(it);
+				core->queue_depth--;
+			}
+			else
+			{
+				it++;
+			}
+		}
+
+		while (std::find(m_busy.begin(), m_busy.end(), core) != m_busy.end())
+		{
+			m_done_cv.wait(lock);
+		}
+	}
+};
+
+SPUCompilerPool g_spu_compiler_pool;
+
 SPURecompilerCore::SPURecompilerCore(SPUThread& cpu)
-	: m_enc(new SPURecompiler(cpu, *this))
-	, inter(new SPUInterpreter(cpu))
+	: inter(new SPUInterpreter(cpu))
 	, CPU(cpu)
 	, first(true)
-	, need_check(false)
+	, use_cache(Ini.SPUJitCache.GetValue() && cpu.GetType() != CPU_THREAD_RAW_SPU)
+	, cache_hits(0)
+	, cache_misses(0)
+	, cache_time_saved(0)
+	, inv_runs(0)
+	, inv_checked(0)
+	, inv_released(0)
+	, inv_time(0)
+	, queue_depth(0)
+	, queue_depth_max(0)
+	, pending_count(0)
+	, interpreter_fallbacks(0)
+	, interp_next(~0)
+	, dispatcher(nullptr)
+	, chain_calls(0)
+	, chain_blocks(0)
+	, chain_time(0)
 {
 	memset(entry, 0, sizeof(entry));
 	X86CpuInfo inf;
@@ -30,11 +433,52 @@ SPURecompilerCore::SPURecompilerCore(SPUThread& cpu)
 		LOG_ERROR(SPU, "SPU JIT requires SSE4.1 instruction set support");
 		Emu.Pause();
 	}
+
+	BuildDispatcher();
+
+	if (use_cache)
+	{
+		const std::string title_id = Emu.GetTitleID();
+		g_spu_jit_cache.Open(fmt::Format("spu_cache/%s.bin", title_id.length() ? title_id.c_str() : "unknown"));
+	}
 }
 
 SPURecompilerCore::~SPURecompilerCore()
 {
-	delete m_enc;
+	g_spu_compiler_pool.Cancel(this);
+
+	for (auto block : m_done)
+	{
+		if (block->pointer) runtime.release(block->pointer);
+		delete block;
+	}
+
+	for (auto& e : entry)
+	{
+		delete[] e.imm;
+	}
+
+	if (cache_hits || cache_misses)
+	{
+		LOG_NOTICE(SPU, "SPU JIT cache (thread %d): %d hits, %d misses, %lld us of compilation saved", CPU.GetId(), cache_hits, cache_misses.load(), cache_time_saved);
+	}
+
+	if (interpreter_fallbacks || queue_depth_max)
+	{
+		LOG_NOTICE(SPU, "SPU JIT (thread %d): %lld instructions interpreted while compiling, max compile queue depth %d", CPU.GetId(), interpreter_fallbacks, queue_depth_max);
+	}
+
+	if (chain_calls)
+	{
+		LOG_NOTICE(SPU, "SPU JIT dispatcher (thread %d): %lld blocks in %lld calls, %lld blocks/s", CPU.GetId(), chain_blocks, chain_calls,
+			chain_blocks * 1000000 / std::max<u64>(chain_time, 1));
+	}
+
+	if (inv_runs)
+	{
+		LOG_NOTICE(SPU, "SPU JIT invalidation (thread %d): %d checks, %lld blocks compared, %d blocks released, %lld us", CPU.GetId(), inv_runs, inv_checked, inv_released, inv_time);
+	}
+
 	delete inter;
 }
 
@@ -43,10 +487,65 @@ void SPURecompilerCore::Decode(const u32 code) // decode instruction and run wit
 	(*SPU_instr::rrr_list)(inter, code);
 }
 
-void SPURecompilerCore::Compile(u16 pos)
+bool SPURecompilerCore::LoadCached(u16 pos)
+{
+	const u64 stamp0 = get_system_time();
+
+	SPUCacheRecord rec;
+	if (!g_spu_jit_cache.Find(pos, vm::get_ptr<u32>(CPU.ls_offset), rec))
+	{
+		return false;
+	}
+
+	SPUCacheAssembler assembler(&runtime);
+	assembler.embed(rec.bin.data(), (u32)rec.bin.size());
+
+	for (auto& r : rec.relocs)
+	{
+		RelocData rd;
+		rd.type = r.type;
+		rd.size = r.size;
+		rd.from = (Ptr)r.from;
+		rd.data = (Ptr)(r.type == kRelocRelToAbs ? r.data : r.data + SPUJitCache::GetModuleBase());
+		assembler.AddReloc(rd);
+	}
+
+	assembler.SetTrampolineSize((size_t)rec.trampoline_size);
+
+	SPUCompiledBlock block;
+	block.pointer = assembler.make();
+	if (!block.pointer)
+	{
+		return false;
+	}
+
+	block.pos = pos;
+	block.count = rec.count;
+	block.code = std::move(rec.code);
+	block.imm.resize(rec.imm.size());
+
+	for (auto& imm : rec.imm)
+	{
+		if (imm.index >= block.imm.size())
+		{
+			block.imm.resize(imm.index + 1, _mm_setzero_si128());
+		}
+
+		memcpy(&block.imm[imm.index], imm.data, sizeof(__m128i));
+	}
+
+	InstallBlock(block);
+
+	cache_hits++;
+	cache_time_saved += (s64)rec.time - (s64)(get_system_time() - stamp0);
+	return true;
+}
+
+SPUCompiledBlock* SPURecompilerCore::CompileBlock(u16 pos)
 {
 	const u64 stamp0 = get_system_time();
 	u64 time0 = 0;
+	const bool logging = Ini.SPUJitLogging.GetValue();
 
 	SPUDisAsm dis_asm(CPUDisAsm_InterpreterMode);
 	dis_asm.offset = vm::get_ptr<u8>(CPU.ls_offset);
@@ -54,195 +553,541 @@ void SPURecompilerCore::Compile(u16 pos)
 	StringLogger stringLogger;
 	stringLogger.setOption(kLoggerOptionBinaryForm, true);
 
+	// every block has its own encoder, so blocks can be compiled concurrently
+	SPURecompiler enc(CPU, *this);
 	X86Compiler compiler(&runtime);
-	m_enc->compiler = &compiler;
-	compiler.setLogger(&stringLogger);
+	enc.compiler = &compiler;
+	if (logging) compiler.setLogger(&stringLogger);
 
 	compiler.addFunc(kFuncConvHost, FuncBuilder4<u32, void*, void*, void*, u32>());
 	const u16 start = pos;
-	u32 excess = 0;
-	entry[start].count = 0;
+
+	SPUCompiledBlock* block = new SPUCompiledBlock;
+	block->pos = start;
+	block->count = 0;
 
 	X86GpVar cpu_var(compiler, kVarTypeIntPtr, "cpu");
 	compiler.setArg(0, cpu_var);
 	compiler.alloc(cpu_var);
-	m_enc->cpu_var = &cpu_var;
+	enc.cpu_var = &cpu_var;
 
 	X86GpVar ls_var(compiler, kVarTypeIntPtr, "ls");
 	compiler.setArg(1, ls_var);
 	compiler.alloc(ls_var);
-	m_enc->ls_var = &ls_var;
+	enc.ls_var = &ls_var;
 
 	X86GpVar imm_var(compiler, kVarTypeIntPtr, "imm");
 	compiler.setArg(2, imm_var);
 	compiler.alloc(imm_var);
-	m_enc->imm_var = &imm_var;
+	enc.imm_var = &imm_var;
 
 	X86GpVar g_imm_var(compiler, kVarTypeIntPtr, "g_imm");
 	compiler.setArg(3, g_imm_var);
 	compiler.alloc(g_imm_var);
-	m_enc->g_imm_var = &g_imm_var;
+	enc.g_imm_var = &g_imm_var;
 
 	X86GpVar pos_var(compiler, kVarTypeUInt32, "pos");
-	m_enc->pos_var = &pos_var;
+	enc.pos_var = &pos_var;
 	X86GpVar addr_var(compiler, kVarTypeUInt32, "addr");
-	m_enc->addr = &addr_var;
+	enc.addr = &addr_var;
 	X86GpVar qw0_var(compiler, kVarTypeUInt64, "qw0");
-	m_enc->qw0 = &qw0_var;
+	enc.qw0 = &qw0_var;
 	X86GpVar qw1_var(compiler, kVarTypeUInt64, "qw1");
-	m_enc->qw1 = &qw1_var;
+	enc.qw1 = &qw1_var;
 	X86GpVar qw2_var(compiler, kVarTypeUInt64, "qw2");
-	m_enc->qw2 = &qw2_var;
+	enc.qw2 = &qw2_var;
 
 	for (u32 i = 0; i < 16; i++)
 	{
-		m_enc->xmm_var[i].data = new X86XmmVar(compiler, kX86VarTypeXmm, fmt::Format("reg_%d", i).c_str());
+		enc.xmm_var[i].data = new X86XmmVar(compiler, kX86VarTypeXmm, fmt::Format("reg_%d", i).c_str());
 	}
 
 	compiler.xor_(pos_var, pos_var);
 
 	while (true)
 	{
+		// every word is read once: LS can be modified by the SPU thread while the block is compiled
 		const u32 opcode = vm::read32(CPU.ls_offset + pos * 4);
-		m_enc->do_finalize = false;
+		enc.pc = pos * 4;
+		enc.do_finalize = false;
 		if (opcode)
 		{
 			const u64 stamp1 = get_system_time();
-			// disasm for logging:
-			dis_asm.dump_pc = pos * 4;
-			(*SPU_instr::rrr_list)(&dis_asm, opcode);
-			compiler.addComment(fmt::Format("SPU data: PC=0x%05x %s", pos * 4, dis_asm.last_opcode.c_str()).c_str());
+			if (logging)
+			{
+				// disasm for logging:
+				dis_asm.dump_pc = pos * 4;
+				(*SPU_instr::rrr_list)(&dis_asm, opcode);
+				compiler.addComment(fmt::Format("SPU data: PC=0x%05x %s", pos * 4, dis_asm.last_opcode.c_str()).c_str());
+			}
 			// compile single opcode:
-			(*SPU_instr::rrr_list)(m_enc, opcode);
+			(*SPU_instr::rrr_list)(&enc, opcode);
 			// force finalization between every slice using absolute alignment
-			/*if ((pos % 128 == 127) && !m_enc->do_finalize)
+			/*if ((pos % 128 == 127) && !enc.do_finalize)
 			{
 				compiler.mov(pos_var, pos + 1);
-				m_enc->do_finalize = true;
+				enc.do_finalize = true;
 			}*/
-			entry[start].count++;
+			block->count++;
 			time0 += get_system_time() - stamp1;
 		}
 		else
 		{
-			m_enc->do_finalize = true;
-		}
-		bool fin = m_enc->do_finalize;
-		if (entry[pos].valid == re32(opcode))
-		{
-			excess++;
+			enc.do_finalize = true;
 		}
-		entry[pos].valid = re32(opcode);
+		bool fin = enc.do_finalize;
+		block->code.push_back(re32(opcode));
 
 		if (fin) break;
-		CPU.PC += 4;
 		pos++;
 	}
 
-	m_enc->XmmRelease();
+	enc.XmmRelease();
 
 	for (u32 i = 0; i < 16; i++)
 	{
-		assert(!m_enc->xmm_var[i].taken);
-		delete m_enc->xmm_var[i].data;
-		m_enc->xmm_var[i].data = nullptr;
+		assert(!enc.xmm_var[i].taken);
+		delete enc.xmm_var[i].data;
+		enc.xmm_var[i].data = nullptr;
 	}
 
 	const u64 stamp1 = get_system_time();
 	compiler.ret(pos_var);
 	compiler.endFunc();
-	entry[start].pointer = compiler.make();
+
+	SPUCacheAssembler assembler(&runtime);
+	if (logging) assembler.setLogger(&stringLogger);
+	block->pointer = compiler.serialize(assembler) == kErrorOk ? assembler.make() : nullptr;
 	compiler.setLogger(nullptr); // crashes without it
+	block->imm = std::move(enc.imm_table);
+
+#ifdef _WIN32
+	//if (block->pointer && !RtlAddFunctionTable(&info, 1, (u64)block->pointer))
+	//{
+	//	LOG_ERROR(Log::SPU, "RtlAddFunctionTable() failed");
+	//}
+#endif
+
+	if (block->pointer && block->count && use_cache)
+	{
+		// store the block before relocation
+		SPUCacheRecord rec;
+
+		rec.pos = start;
+		rec.count = block->count;
+		rec.code = block->code;
+		rec.hash = SPUJitCache::Hash(rec.code.data(), (u32)rec.code.size());
+		rec.time = get_system_time() - stamp0;
+		rec.trampoline_size = assembler.GetTrampolineSize();
+		rec.bin.assign(assembler.getBuffer(), assembler.getBuffer() + assembler.getOffset());
+
+		const PodVector<RelocData>& relocs = assembler.GetRelocs();
+		for (size_t i = 0; i < relocs.getLength(); i++)
+		{
+			const RelocData& rd = relocs.getData()[i];
+			SPUCacheReloc r;
+			r.type = rd.type;
+			r.size = rd.size;
+			r.from = (u64)rd.from;
+			r.data = rd.type == kRelocRelToAbs ? (u64)rd.data : (u64)rd.data - SPUJitCache::GetModuleBase();
+			rec.relocs.push_back(r);
+		}
+
+		for (u32 i = 0; i < block->imm.size(); i++)
+		{
+			SPUCacheImm imm;
+			imm.index = i;
+			memcpy(imm.data, &block->imm[i], sizeof(__m128i));
+			rec.imm.push_back(imm);
+		}
+
+		g_spu_jit_cache.Add(rec);
+		cache_misses++;
+	}
+
+	if (logging)
+	{
+		std::lock_guard<std::mutex> lock(m_log_mutex);
+
+		rFile log;
+		log.Open(fmt::Format("SPUjit_%d.log", CPU.GetId()), first ? rFile::write : rFile::write_append);
+		log.Write(fmt::Format("========== START POSITION 0x%x ==========\n\n", start * 4));
+		log.Write(std::string(stringLogger.getString()));
+		if (!block->pointer)
+		{
+			log.Write("========== FAILED ============\n\n");
+		}
+		else
+		{
+			log.Write(fmt::Format("========== COMPILED %d, time: [start=%lld (decoding=%lld), finalize=%lld]\n\n",
+				block->count, stamp1 - stamp0, time0, get_system_time() - stamp1));
+		}
+		log.Close();
+		first = false;
+	}
+
+	return block;
+}
+
+void SPURecompilerCore::Compile(u16 pos)
+{
+	if (use_cache && LoadCached(pos))
+	{
+		return;
+	}
+
+	SPUCompiledBlock* block = CompileBlock(pos);
+	InstallBlock(*block);
+	delete block;
+}
+
+void SPURecompilerCore::InstallBlock(SPUCompiledBlock& block)
+{
+	const u16 pos = block.pos;
+
+	if (entry[pos].pending)
+	{
+		entry[pos].pending = false;
+		pending_count--;
+	}
 
-	rFile log;
-	log.Open(fmt::Format("SPUjit_%d.log", GetCurrentSPUThread().GetId()), first ? rFile::write : rFile::write_append);
-	log.Write(fmt::Format("========== START POSITION 0x%x ==========\n\n", start * 4));
-	log.Write(std::string(stringLogger.getString()));
-	if (!entry[start].pointer)
+	if (!block.pointer)
 	{
-		LOG_ERROR(Log::SPU, "SPURecompilerCore::Compile(pos=0x%x) failed", start * sizeof(u32));
-		log.Write("========== FAILED ============\n\n");
+		LOG_ERROR(Log::SPU, "SPURecompilerCore::Compile(pos=0x%x) failed", pos * sizeof(u32));
 		Emu.Pause();
+		return;
 	}
-	else
+
+	// the block compiled in background could be outdated already
+	const u32* ls = vm::get_ptr<u32>(CPU.ls_offset);
+
+	if (entry[pos].pointer || memcmp(ls + pos, block.code.data(), block.code.size() * sizeof(u32)))
+	{
+		runtime.release(block.pointer);
+		return;
+	}
+
+	delete[] entry[pos].imm;
+	entry[pos].imm = nullptr;
+
+	if (block.imm.size())
+	{
+		entry[pos].imm = new __m128i[block.imm.size()];
+		memcpy(entry[pos].imm, block.imm.data(), block.imm.size() * sizeof(__m128i));
+	}
+
+	entry[pos].pointer = block.pointer;
+	entry[pos].count = block.count;
+	entry[pos].size = (u16)block.code.size();
+
+	for (u32 i = 0; i < block.code.size(); i++)
+	{
+		entry[pos + i].valid = block.code[i];
+	}
+
+	RegisterBlock(pos);
+}
+
+void SPURecompilerCore::InstallCompiled()
+{
+	std::vector<SPUCompiledBlock*> done;
+
 	{
-		log.Write(fmt::Format("========== COMPILED %d (excess %d), time: [start=%lld (decoding=%lld), finalize=%lld]\n\n",
-			entry[start].count, excess, stamp1 - stamp0, time0, get_system_time() - stamp1));
+		std::lock_guard<std::mutex> lock(m_done_mutex);
+		done.swap(m_done);
+	}
+
+	for (auto block : done)
+	{
+		InstallBlock(*block);
+		delete block;
+	}
+}
+
+void SPURecompilerCore::RegisterBlock(u16 pos)
+{
+	const u32 first = pos >> 8;
+	const u32 last = (pos + entry[pos].size - 1) >> 8;
+
+	for (u32 page = first; page <= last && page < 256; page++)
+	{
+		auto& list = page_blocks[page];
+
+		if (std::find(list.begin(), list.end(), pos) == list.end())
+		{
+			list.push_back(pos);
+		}
+	}
+}
+
+void SPURecompilerCore::ReleaseBlock(u16 pos)
+{
+	runtime.release(entry[pos].pointer);
 #ifdef _WIN32
-		//if (!RtlAddFunctionTable(&info, 1, (u64)entry[start].pointer))
-		//{
-		//	LOG_ERROR(Log::SPU, "RtlAddFunctionTable() failed");
-		//}
+	//RtlDeleteFunctionTable(&entry[pos].info);
 #endif
+	entry[pos].pointer = nullptr;
+	delete[] entry[pos].imm;
+	entry[pos].imm = nullptr;
+
+	for (u32 i = pos; i < pos + (u32)entry[pos].size && i < 0x10000; i++)
+	{
+		entry[i].valid = 0;
 	}
-	log.Close();
-	m_enc->compiler = nullptr;
-	first = false;
+
+	// positions in page_blocks are removed lazily
+	inv_released++;
 }
 
-u8 SPURecompilerCore::DecodeMemory(const u32 address)
+void SPURecompilerCore::InvalidateDirty()
 {
-	assert(CPU.ls_offset == address - CPU.PC);
-	const u32 m_offset = CPU.ls_offset;
-	const u16 pos = (u16)(CPU.PC >> 2);
-
-	//ConLog.Write("DecodeMemory: pos=%d", pos);
-	u32* ls = vm::get_ptr<u32>(m_offset);
+	const u64 stamp0 = get_system_time();
+	const u32* ls = vm::get_ptr<u32>(CPU.ls_offset);
 
-	if (entry[pos].pointer)
+	for (u32 i = 0; i < 4; i++)
 	{
-		// check data (hard way)
-		bool is_valid = true;
-		if (need_check)
+		u64 bits = CPU.ls_dirty[i].exchange(0);
+
+		for (u32 page = i * 64; bits; page++, bits >>= 1)
 		{
-			for (u32 i = 0; i < 0x10000; i++)
+			if (!(bits & 1)) continue;
+
+			auto& list = page_blocks[page];
+
+			for (u32 j = 0; j < list.size();)
 			{
-				if (entry[i].valid && entry[i].valid != ls[i])
+				const u16 pos = list[j];
+				SPURecEntry& block = entry[pos];
+
+				// remove released or recompiled blocks which don't cover this page anymore
+				if (!block.pointer || (pos >> 8) > page || ((pos + block.size - 1) >> 8) < page)
 				{
-					is_valid = false;
-					break;
+					list[j] = list.back();
+					list.pop_back();
+					continue;
 				}
-			}
-			need_check = false;
-		}
-		// invalidate if necessary
-		if (!is_valid)
-		{
-			for (u32 i = 0; i < 0x10000; i++)
-			{
-				if (!entry[i].pointer) continue;
 
-				if (!entry[i].valid || entry[i].valid != ls[i] ||
-					i + (u32)entry[i].count > (u32)pos &&
-					i < (u32)pos + (u32)entry[pos].count)
+				inv_checked++;
+
+				for (u32 k = pos; k < pos + (u32)block.size && k < 0x10000; k++)
 				{
-					runtime.release(entry[i].pointer);
-#ifdef _WIN32
-					//RtlDeleteFunctionTable(&entry[i].info);
-#endif
-					entry[i].pointer = nullptr;
-					for (u32 j = i; j < i + (u32)entry[i].count; j++)
+					if (entry[k].valid != ls[k])
 					{
-						entry[j].valid = 0;
+						ReleaseBlock(pos);
+						break;
 					}
-					//need_check = true;
 				}
+
+				if (!block.pointer)
+				{
+					list[j] = list.back();
+					list.pop_back();
+					continue;
+				}
+
+				j++;
 			}
-			//LOG_ERROR(Log::SPU, "SPURecompilerCore::DecodeMemory(ls_addr=0x%x): code has changed", pos * sizeof(u32));
 		}
 	}
 
+	inv_runs++;
+	inv_time += get_system_time() - stamp0;
+}
+
+// Compile the loop which runs the blocks of this thread one after another without returning to CPUThread::Task().
+// The next block is looked up in entry[] after each block, so direct branches, BI/BISL and fall-through are linked alike.
+// It returns the position like a block when flags are set (HALT, SYNC), when the next block isn't compiled yet,
+// when LS was written (blocks must be checked) or when the thread status must be checked.
+void SPURecompilerCore::BuildDispatcher()
+{
+	X86Compiler compiler(&runtime);
+
+	compiler.addFunc(kFuncConvHost, FuncBuilder3<u32, void*, void*, u32>());
+
+	X86GpVar cpu_var(compiler, kVarTypeIntPtr, "cpu");
+	compiler.setArg(0, cpu_var);
+	X86GpVar ls_var(compiler, kVarTypeIntPtr, "ls");
+	compiler.setArg(1, ls_var);
+	X86GpVar pos_var(compiler, kVarTypeUInt32, "pos");
+	compiler.setArg(2, pos_var);
+
+	X86GpVar table_var(compiler, kVarTypeIntPtr, "table");
+	X86GpVar g_imm_var(compiler, kVarTypeIntPtr, "g_imm");
+	X86GpVar index_var(compiler, kVarTypeIntPtr, "index");
+	X86GpVar func_var(compiler, kVarTypeIntPtr, "func");
+	X86GpVar imm_var(compiler, kVarTypeIntPtr, "imm");
+	X86GpVar ptr_var(compiler, kVarTypeIntPtr, "ptr");
+	X86GpVar dirty_var(compiler, kVarTypeUInt64, "dirty");
+
+	Label loop = compiler.newLabel();
+	Label exit = compiler.newLabel();
+
+	compiler.mov(table_var, imm_ptr(entry));
+	compiler.mov(g_imm_var, imm_ptr((void*)&g_imm_table));
+
+	// the caller doesn't enter the dispatcher if the first block isn't compiled
+	compiler.bind(loop);
+	compiler.mov(index_var.r32(), pos_var);
+	compiler.imul(index_var, index_var, imm_u(sizeof(SPURecEntry)));
+	compiler.mov(func_var, qword_ptr(table_var, index_var, 0, (s32)offsetof(SPURecEntry, pointer)));
+	compiler.test(func_var, func_var);
+	compiler.jz(exit);
+	compiler.mov(imm_var, qword_ptr(table_var, index_var, 0, (s32)offsetof(SPURecEntry, imm)));
+
+	X86CallNode* call = compiler.call(func_var, kFuncConvHost, FuncBuilder4<u32, void*, void*, void*, void*>());
+	call->setArg(0, cpu_var);
+	call->setArg(1, ls_var);
+	call->setArg(2, imm_var);
+	call->setArg(3, g_imm_var);
+	call->setRet(0, pos_var);
+
+	compiler.mov(ptr_var, imm_ptr(&chain_blocks));
+	compiler.add(qword_ptr(ptr_var), 1);
+
+	// HALT and SYNC are processed by the caller
+	compiler.cmp(pos_var, 0x10000);
+	compiler.jae(exit);
+
+	// CPUThread events (status change, step request, breakpoint list change)
+	compiler.mov(ptr_var, imm_ptr((void*)&CPU.GetEvents()));
+	compiler.cmp(dword_ptr(ptr_var), 0);
+	compiler.jnz(exit);
+
+	// LS written by DMA or by HLE code (SPUThread::IsLSDirty())
+	compiler.mov(ptr_var, imm_ptr(&CPU.ls_dirty[0]));
+	compiler.mov(dirty_var, qword_ptr(ptr_var, 0));
+	compiler.or_(dirty_var, qword_ptr(ptr_var, 8));
+	compiler.or_(dirty_var, qword_ptr(ptr_var, 16));
+	compiler.or_(dirty_var, qword_ptr(ptr_var, 24));
+	compiler.jz(loop);
+
+	compiler.bind(exit);
+	compiler.ret(pos_var);
+	compiler.endFunc();
+
+	X86Assembler assembler(&runtime);
+	dispatcher = compiler.serialize(assembler) == kErrorOk ? assembler.make() : nullptr;
+
+	if (!dispatcher)
+	{
+		LOG_ERROR(SPU, "SPURecompilerCore::BuildDispatcher() failed, blocks are not linked");
+	}
+}
+
+// the recompiler ends a block after these instructions (do_finalize)
+static bool is_block_end(const u32 opcode)
+{
+	using namespace SPU_opcodes;
+
+	switch (opcode >> 23)
+	{
+	case BRZ: case BRNZ: case BRHZ: case BRHNZ: case BRA: case BRASL: case BR: case BRSL:
+		return true;
+	}
+
+	switch (opcode >> 21)
+	{
+	case STOP: case SYNC: case STOPD: case BIZ: case BINZ: case BIHZ: case BIHNZ: case BI: case BISL: case IRET: case BISLED:
+	case HGT: case HLGT: case HEQ:
+		return true;
+	}
+
+	switch (opcode >> 24)
+	{
+	case HGTI: case HLGTI: case HEQI:
+		return true;
+	}
+
+	return false;
+}
+
+// Execute the block at CPU.PC with the interpreter (up to its end, i.e. the instruction which would finalize the compiled block).
+// Only the block entry is queued for compilation, the positions inside the block are never looked up.
+u8 SPURecompilerCore::Interpret()
+{
+	const bool check_bp = CPU.HasBreakPoints();
+	u32 pos = CPU.PC >> 2;
+
+	interp_next = ~0;
+
+	while (true)
+	{
+		const u32 opcode = vm::read32(CPU.ls_offset + pos * 4);
+
+		Decode(opcode);
+		interpreter_fallbacks++;
+
+		if (CPU.m_is_branch || is_block_end(opcode) || pos + 1 >= 0x10000 || entry[pos + 1].pointer || !vm::read32(CPU.ls_offset + pos * 4 + 4))
+		{
+			break;
+		}
+
+		if (CPU.HasEvents() || check_bp)
+		{
+			// the thread status or breakpoints must be checked before the next instruction
+			interp_next = pos + 1;
+			break;
+		}
+
+		CPU.SetPc(++pos * 4);
+	}
+
+	return 4;
+}
+
+u8 SPURecompilerCore::DecodeMemory(const u32 address)
+{
+	assert(CPU.ls_offset == address - CPU.PC);
+	const u32 m_offset = CPU.ls_offset;
+	const u16 pos = (u16)(CPU.PC >> 2);
+
+	//ConLog.Write("DecodeMemory: pos=%d", pos);
+
+	// install blocks compiled in background
+	if (pending_count)
+	{
+		InstallCompiled();
+	}
+
+	// release blocks overwritten since the last call
+	if (CPU.IsLSDirty())
+	{
+		InvalidateDirty();
+	}
+
 	bool did_compile = false;
 	if (!entry[pos].pointer)
 	{
-		Compile(pos);
-		did_compile = true;
-		if (entry[pos].valid == 0)
+		const u32 opcode = vm::read32(address);
+		if (!opcode)
 		{
 			LOG_ERROR(Log::SPU, "SPURecompilerCore::Compile(ls_addr=0x%x): branch to 0x0 opcode", pos * sizeof(u32));
 			Emu.Pause();
 			return 0;
 		}
+
+		if (!Ini.SPUCompilerThreads.GetValue())
+		{
+			Compile(pos);
+			did_compile = true;
+		}
+		else if (pos == interp_next)
+		{
+			// continue the block interrupted in the interpreter
+			return Interpret();
+		}
+		else if (!use_cache || !LoadCached(pos))
+		{
+			// run the interpreter until the block is compiled in background
+			if (!entry[pos].pending)
+			{
+				entry[pos].pending = true;
+				pending_count++;
+				g_spu_compiler_pool.Push(this, pos);
+			}
+
+			return Interpret();
+		}
 	}
 
 	if (!entry[pos].pointer) return 0;
@@ -264,7 +1109,21 @@ u8 SPURecompilerCore::DecodeMemory(const u32 address)
 	}
 
 	u32 res = pos;
-	res = func(cpu, vm::get_ptr<void>(m_offset), imm_table.data(), &g_imm_table);
+
+	// breakpoints and steps are checked between DecodeMemory() calls, the blocks can't be linked then
+	if (dispatcher && !CPU.IsStep() && !CPU.HasBreakPoints())
+	{
+		typedef u32(*Dispatcher)(const void* _cpu, const void* _ls, u32 _pos);
+
+		const u64 stamp0 = get_system_time();
+		res = asmjit_cast<Dispatcher>(dispatcher)(cpu, vm::get_ptr<void>(m_offset), pos);
+		chain_time += get_system_time() - stamp0;
+		chain_calls++;
+	}
+	else
+	{
+		res = func(cpu, vm::get_ptr<void>(m_offset), entry[pos].imm, &g_imm_table);
+	}
 
 	if (res & 0x1000000)
 	{
@@ -275,7 +1134,8 @@ u8 SPURecompilerCore::DecodeMemory(const u32 address)
 
 	if (res & 0x2000000)
 	{
-		need_check = true;
+		// SYNC: the code could be modified by SPU stores, check everything on the next call
+		for (auto& v : CPU.ls_dirty) v = ~0ull;
 		res &= ~0x2000000;
 	}
 
@@ -38,6 +38,8 @@ SPUThread::SPUThread(CPUThreadType type) : PPCThread(type)
 
 	group = nullptr;
 
+	for (auto& v : ls_dirty) v = 0;
+
 	Reset();
 }
 
@@ -98,10 +100,12 @@ void SPUThread::InitRegs()
 
 void SPUThread::DoRun()
 {
+	for (auto& v : ls_dirty) v = 0;
+
 	switch(Ini.SPUDecoderMode.GetValue())
 	{
 	case 1:
-		m_dec = new SPUDecoder(*new SPUInterpreter(*this));
+		m_dec = new SPUDecoder(*new SPUInterpreter(*this), true);
 	break;
 	case 2:
 		m_dec = new SPURecompilerCore(*this);
@@ -161,6 +165,7 @@ void SPUThread::FastCall(u32 ls_addr)
 
 	CPUThread::Task();
 
+	AddEvent(CPU_EVENT_STATE);
 	PC = old_PC;
 	GPR[0]._u32[3] = old_LR;
 	GPR[1]._u32[3] = old_stack;
@@ -169,6 +174,7 @@ void SPUThread::FastCall(u32 ls_addr)
 void SPUThread::FastStop()
 {
 	m_status = Stopped;
+	AddEvent(CPU_EVENT_STATE);
 }
 
 void SPUThread::WriteSNR(bool number, u32 value)
@@ -215,6 +221,11 @@ void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
 			{
 				// LS access
 				ea = spu->ls_offset + addr;
+
+				if (cmd & MFC_PUT_CMD)
+				{
+					spu->MarkLSDirty(addr, size);
+				}
 			}
 			else if ((cmd & MFC_PUT_CMD) && size == 4 && (addr == SYS_SPU_THREAD_SNR1 || addr == SYS_SPU_THREAD_SNR2))
 			{
@@ -271,6 +282,7 @@ void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
 	case MFC_GET_CMD:
 	{
 		memcpy(vm::get_ptr<void>(ls_offset + lsa), vm::get_ptr<void>((u32)ea), size);
+		MarkLSDirty(lsa, size);
 		return;
 	}
 
@@ -426,6 +438,7 @@ void SPUThread::EnqMfcCmd(MFCReg& MFCArgs)
 				R_DATA[i] = vm::get_ptr<u64>((u32)R_ADDR)[i];
 				vm::get_ptr<u64>(ls_offset + lsa)[i] = R_DATA[i];
 			}
+			MarkLSDirty(lsa, 128);
 			MFCArgs.AtomicStat.PushUncond(MFC_GETLLAR_SUCCESS);
 		}
 		else if (op == MFC_PUTLLC_CMD) // store conditional
@@ -643,7 +656,7 @@ void SPUThread::WriteChannel(u32 ch, const u128& r)
 					return;
 				}
 
-				if (!port.eq->events.push(SYS_SPU_THREAD_EVENT_USER_KEY, GetId(), ((u64)spup << 32) | (v & 0x00ffffff), data))
+				if (!port.eq->push(SYS_SPU_THREAD_EVENT_USER_KEY, GetId(), ((u64)spup << 32) | (v & 0x00ffffff), data))
 				{
 					SPU.In_MBox.PushUncond(CELL_EBUSY);
 					return;
@@ -681,7 +694,7 @@ void SPUThread::WriteChannel(u32 ch, const u128& r)
 				}
 
 				// TODO: check passing spup value
-				if (!port.eq->events.push(SYS_SPU_THREAD_EVENT_USER_KEY, GetId(), ((u64)spup << 32) | (v & 0x00ffffff), data))
+				if (!port.eq->push(SYS_SPU_THREAD_EVENT_USER_KEY, GetId(), ((u64)spup << 32) | (v & 0x00ffffff), data))
 				{
 					LOG_WARNING(Log::SPU, "sys_spu_thread_throw_event(spup=%d, data0=0x%x, data1=0x%x) failed (queue is full)", spup, (v & 0x00ffffff), data);
 					return;
@@ -1102,7 +1115,9 @@ void SPUThread::StopAndSignal(u32 code)
 			default: eq->sq.invalidate(tid); SPU.In_MBox.PushUncond(CELL_ECANCELED); return;
 			}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			// sleep until the queue is passed to this thread or new events arrive
+			eq->owner.wait_for(tid, [eq]() { return eq->is_ready(); });
+
 			if (Emu.IsStopped())
 			{
 				LOG_WARNING(Log::SPU, "sys_spu_thread_receive_event(spuq=0x%x) aborted", spuq);
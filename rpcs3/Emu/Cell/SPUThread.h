@@ -482,6 +482,36 @@ public:
 
 	u32 ls_offset;
 
+	// LS pages (1 KB) written by DMA or by HLE code since the last check (used by the recompiler to invalidate code)
+	mutable std::atomic<u64> ls_dirty[4];
+
+	void MarkLSDirty(const u32 lsa, const u32 size) const
+	{
+		if (!size) return;
+
+		const u32 first = (lsa & 0x3ffff) >> 10;
+		const u32 last = ((lsa + size - 1) & 0x3ffff) >> 10;
+
+		for (u32 page = first; ; page = (page + 1) % 256)
+		{
+			const u64 bit = 1ull << (page % 64);
+
+			// avoid locked operation if already set
+			if (!(ls_dirty[page / 64].load(std::memory_order_relaxed) & bit))
+			{
+				ls_dirty[page / 64].fetch_or(bit);
+			}
+
+			if (page == last) break;
+		}
+	}
+
+	bool IsLSDirty() const
+	{
+		return (ls_dirty[0].load(std::memory_order_relaxed) | ls_dirty[1].load(std::memory_order_relaxed) |
+			ls_dirty[2].load(std::memory_order_relaxed) | ls_dirty[3].load(std::memory_order_relaxed)) != 0;
+	}
+
 	void ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size);
 
 	void ListCmd(u32 lsa, u64 ea, u16 tag, u16 size, u32 cmd, MFCReg& MFCArgs);
@@ -504,11 +534,11 @@ public:
 	u64  ReadLS64 (const u32 lsa) const { return vm::read64 (lsa + m_offset); }
 	u128 ReadLS128(const u32 lsa) const { return vm::read128(lsa + m_offset); }
 
-	void WriteLS8  (const u32 lsa, const u8&   data) const { vm::write8  (lsa + m_offset, data); }
-	void WriteLS16 (const u32 lsa, const u16&  data) const { vm::write16 (lsa + m_offset, data); }
-	void WriteLS32 (const u32 lsa, const u32&  data) const { vm::write32 (lsa + m_offset, data); }
-	void WriteLS64 (const u32 lsa, const u64&  data) const { vm::write64 (lsa + m_offset, data); }
-	void WriteLS128(const u32 lsa, const u128& data) const { vm::write128(lsa + m_offset, data); }
+	void WriteLS8  (const u32 lsa, const u8&   data) const { vm::write8  (lsa + m_offset, data); MarkLSDirty(lsa, 1); }
+	void WriteLS16 (const u32 lsa, const u16&  data) const { vm::write16 (lsa + m_offset, data); MarkLSDirty(lsa, 2); }
+	void WriteLS32 (const u32 lsa, const u32&  data) const { vm::write32 (lsa + m_offset, data); MarkLSDirty(lsa, 4); }
+	void WriteLS64 (const u32 lsa, const u64&  data) const { vm::write64 (lsa + m_offset, data); MarkLSDirty(lsa, 8); }
+	void WriteLS128(const u32 lsa, const u128& data) const { vm::write128(lsa + m_offset, data); MarkLSDirty(lsa, 16); }
 
 	std::function<void(SPUThread& SPU)> m_custom_task;
 	std::function<u64(SPUThread& SPU)> m_code3_func;
@@ -78,6 +78,5 @@ bool EventManager::SendEvent(u64 key, u64 source, u64 d1, u64 d2, u64 d3)
 	}
 	EventQueue* eq = f->second;
 
-	eq->events.push(source, d1, d2, d3);
-	return true;
+	return eq->push(source, d1, d2, d3);
 }
@@ -40,6 +40,63 @@ std::string simplify_path(const std::string& path, bool is_dir)
 	return is_dir ? result + "/" : result;
 }
 
+void vfsDeviceTrie::Clear()
+{
+	m_root.children.clear();
+	m_root.device = nullptr;
+}
+
+void vfsDeviceTrie::Insert(const std::vector<std::string>& path_blocks, vfsDevice* device)
+{
+	// the root is never matched
+	if (path_blocks.empty())
+		return;
+
+	node* cur = &m_root;
+
+	for (auto& block : path_blocks)
+	{
+		auto& child = cur->children[block];
+
+		if (!child)
+		{
+			child.reset(new node());
+		}
+
+		cur = child.get();
+	}
+
+	// keep the first device if several ones share the same path
+	if (!cur->device)
+	{
+		cur->device = device;
+	}
+}
+
+vfsDevice* vfsDeviceTrie::Find(const std::vector<std::string>& path_blocks, size_t& depth) const
+{
+	const node* cur = &m_root;
+	vfsDevice* res = nullptr;
+
+	for (size_t i = 0; i < path_blocks.size(); ++i)
+	{
+		auto found = cur->children.find(path_blocks[i]);
+
+		if (found == cur->children.end())
+			break;
+
+		cur = found->second.get();
+
+		if (cur->device)
+		{
+			res = cur->device;
+			depth = i + 1;
+		}
+	}
+
+	return res;
+}
+
 VFS::~VFS()
 {
 	UnMountAll();
@@ -58,16 +115,24 @@ void VFS::Mount(const std::string& ps3_path, const std::string& local_path, vfsD
 	{
 		std::sort(m_devices.begin(), m_devices.end(), [](vfsDevice *a, vfsDevice *b) { return b->GetPs3Path().length() < a->GetPs3Path().length(); });
 	}
+
+	UpdateDevices();
 }
 
 void VFS::Link(const std::string& mount_point, const std::string& ps3_path)
 {
 	links[simplify_path_blocks(mount_point)] = simplify_path_blocks(ps3_path);
+
+	ClearPathCache();
 }
 
 std::string VFS::GetLinked(std::string ps3_path) const
 {
 	ps3_path = fmt::tolower(ps3_path);
+
+	if (links.empty())
+		return ps3_path;
+
 	auto path_blocks = fmt::split(ps3_path, { "/", "\\" });
 
 	for (auto link : links)
@@ -105,6 +170,8 @@ void VFS::UnMount(const std::string& ps3_path)
 
 			m_devices.erase(m_devices.begin() +i);
 
+			UpdateDevices();
+
 			return;
 		}
 	}
@@ -118,6 +185,34 @@ void VFS::UnMountAll()
 	}
 
 	m_devices.clear();
+
+	UpdateDevices();
+}
+
+void VFS::UpdateDevices()
+{
+	std::lock_guard<std::mutex> lock(m_path_cache_mutex);
+
+	m_ps3_trie.Clear();
+	m_local_trie.Clear();
+
+	// m_devices is sorted by the ps3 path length, so the longest mount point wins for shared local paths
+	for (auto dev : m_devices)
+	{
+		m_ps3_trie.Insert(simplify_path_blocks(dev->GetPs3Path()), dev);
+		m_local_trie.Insert(simplify_path_blocks(dev->GetLocalPath()), dev);
+	}
+
+	m_path_cache.clear();
+	m_path_cache_lru.clear();
+}
+
+void VFS::ClearPathCache()
+{
+	std::lock_guard<std::mutex> lock(m_path_cache_mutex);
+
+	m_path_cache.clear();
+	m_path_cache_lru.clear();
 }
 
 vfsFileBase* VFS::OpenFile(const std::string& ps3_path, vfsOpenMode mode) const
@@ -279,50 +374,28 @@ bool VFS::RenameDir(const std::string& ps3_path_from, const std::string& ps3_pat
 	return false;
 }
 
-vfsDevice* VFS::GetDevice(const std::string& ps3_path, std::string& path) const
+vfsDevice* VFS::FindDevice(const std::string& ps3_path, std::string& path) const
 {
 	auto try_get_device = [this, &path](const std::string& ps3_path) -> vfsDevice*
 	{
 		std::vector<std::string> ps3_path_blocks = simplify_path_blocks(ps3_path);
-		size_t max_eq = 0;
-		int max_i = -1;
-
-		for (u32 i = 0; i < m_devices.size(); ++i)
-		{
-			std::vector<std::string> dev_ps3_path_blocks = simplify_path_blocks(m_devices[i]->GetPs3Path());
-
-			if (ps3_path_blocks.size() < dev_ps3_path_blocks.size())
-				continue;
-
-			size_t eq = 0;
-			for (; eq < dev_ps3_path_blocks.size(); ++eq)
-			{
-				if (strcmp(ps3_path_blocks[eq].c_str(), dev_ps3_path_blocks[eq].c_str()))
-				{
-					break;
-				}
-			}
+		size_t depth = 0;
 
-			if (eq > max_eq)
-			{
-				max_eq = eq;
-				max_i = i;
-			}
-		}
+		vfsDevice* dev = m_ps3_trie.Find(ps3_path_blocks, depth);
 
-		if (max_i < 0)
+		if (!dev)
 			return nullptr;
 
-		path = m_devices[max_i]->GetLocalPath();
+		path = dev->GetLocalPath();
 
-		for (u32 i = max_eq; i < ps3_path_blocks.size(); i++)
+		for (size_t i = depth; i < ps3_path_blocks.size(); i++)
 		{
 			path += "/" + ps3_path_blocks[i];
 		}
 
 		path = simplify_path(path, false);
 
-		return m_devices[max_i];
+		return dev;
 	};
 
 	if (auto res = try_get_device(GetLinked(ps3_path)))
@@ -334,49 +407,71 @@ vfsDevice* VFS::GetDevice(const std::string& ps3_path, std::string& path) const
 	return nullptr;
 }
 
-vfsDevice* VFS::GetDeviceLocal(const std::string& local_path, std::string& path) const
+vfsDevice* VFS::GetDevice(const std::string& ps3_path, std::string& path) const
 {
-	size_t max_eq = 0;
-	int max_i = -1;
+	std::lock_guard<std::mutex> lock(m_path_cache_mutex);
 
-	std::vector<std::string> local_path_blocks = simplify_path_blocks(local_path);
+	auto found = m_path_cache.find(ps3_path);
 
-	for (u32 i = 0; i < m_devices.size(); ++i)
+	if (found != m_path_cache.end() && found->second->cwd == cwd)
 	{
-		std::vector<std::string> dev_local_path_blocks_blocks = simplify_path_blocks(m_devices[i]->GetLocalPath());
+		m_path_cache_lru.splice(m_path_cache_lru.begin(), m_path_cache_lru, found->second);
 
-		if (local_path_blocks.size() < dev_local_path_blocks_blocks.size())
-			continue;
+		path = found->second->path;
+		return found->second->device;
+	}
 
-		size_t eq = 0;
-		for (; eq < dev_local_path_blocks_blocks.size(); ++eq)
-		{
-			if (strcmp(local_path_blocks[eq].c_str(), dev_local_path_blocks_blocks[eq].c_str()))
-			{
-				break;
-			}
-		}
+	vfsDevice* res = FindDevice(ps3_path, path);
 
-		if (eq > max_eq)
-		{
-			max_eq = eq;
-			max_i = i;
-		}
+	if (found != m_path_cache.end())
+	{
+		// cwd has changed since the entry was cached
+		m_path_cache_lru.erase(found->second);
+		m_path_cache.erase(found);
+	}
+	else if (m_path_cache_lru.size() >= path_cache_size)
+	{
+		m_path_cache.erase(m_path_cache_lru.back().ps3_path);
+		m_path_cache_lru.pop_back();
+	}
+
+	path_cache_entry entry;
+	entry.ps3_path = ps3_path;
+	entry.cwd = cwd;
+	entry.device = res;
+	entry.path = res ? path : "";
+
+	m_path_cache_lru.push_front(entry);
+	m_path_cache[ps3_path] = m_path_cache_lru.begin();
+
+	return res;
+}
+
+vfsDevice* VFS::GetDeviceLocal(const std::string& local_path, std::string& path) const
+{
+	std::vector<std::string> local_path_blocks = simplify_path_blocks(local_path);
+	size_t depth = 0;
+
+	vfsDevice* dev;
+	{
+		std::lock_guard<std::mutex> lock(m_path_cache_mutex);
+
+		dev = m_local_trie.Find(local_path_blocks, depth);
 	}
 
-	if (max_i < 0)
+	if (!dev)
 		return nullptr;
 
-	path = m_devices[max_i]->GetPs3Path();
+	path = dev->GetPs3Path();
 
-	for (u32 i = max_eq; i < local_path_blocks.size(); i++)
+	for (size_t i = depth; i < local_path_blocks.size(); i++)
 	{
 		path += "/" + local_path_blocks[i];
 	}
 
 	path = simplify_path(path, false);
 
-	return m_devices[max_i];
+	return dev;
 }
 
 void VFS::Init(const std::string& path)
@@ -1,5 +1,7 @@
 #pragma once
 #include <map>
+#include <list>
+#include <unordered_map>
 
 class vfsDevice;
 struct vfsFileBase;
@@ -46,6 +48,27 @@ struct VFSManagerEntry
 std::vector<std::string> simplify_path_blocks(const std::string& path);
 std::string simplify_path(const std::string& path, bool is_dir);
 
+// Mount point lookup by path blocks, the deepest mounted device wins
+class vfsDeviceTrie
+{
+	struct node
+	{
+		std::map<std::string, std::unique_ptr<node>> children;
+		vfsDevice* device;
+
+		node() : device(nullptr)
+		{
+		}
+	};
+
+	node m_root;
+
+public:
+	void Clear();
+	void Insert(const std::vector<std::string>& path_blocks, vfsDevice* device);
+	vfsDevice* Find(const std::vector<std::string>& path_blocks, size_t& depth) const;
+};
+
 struct VFS
 {
 	~VFS();
@@ -69,6 +92,31 @@ struct VFS
 
 	std::map<std::vector<std::string>, std::vector<std::string>, links_sorter> links;
 
+private:
+	struct path_cache_entry
+	{
+		std::string ps3_path;
+		std::string cwd;
+		vfsDevice* device;
+		std::string path;
+	};
+
+	static const size_t path_cache_size = 0x400;
+
+	vfsDeviceTrie m_ps3_trie;
+	vfsDeviceTrie m_local_trie;
+
+	// LRU cache of GetDevice results, cleared on every Mount/UnMount/Link
+	mutable std::mutex m_path_cache_mutex;
+	mutable std::list<path_cache_entry> m_path_cache_lru;
+	mutable std::unordered_map<std::string, std::list<path_cache_entry>::iterator> m_path_cache;
+
+	void UpdateDevices();
+	void ClearPathCache();
+	vfsDevice* FindDevice(const std::string& ps3_path, std::string& path) const;
+
+public:
+
 	void Mount(const std::string& ps3_path, const std::string& local_path, vfsDevice* device);
 	void Link(const std::string& mount_point, const std::string& ps3_path);
 	void UnMount(const std::string& ps3_path);
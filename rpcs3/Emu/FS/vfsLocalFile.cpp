@@ -1,7 +1,11 @@
 #include "stdafx.h"
 #include "Utilities/Log.h"
+#include "Ini.h"
 #include "vfsLocalFile.h"
 
+// smaller files are read with syscalls, mapping them costs more than it saves
+static const u64 min_mapped_file_size = 0x10000;
+
 static const rFile::OpenMode vfs2wx_mode(vfsOpenMode mode)
 {
 	switch(mode)
@@ -28,8 +32,17 @@ static const rSeekMode vfs2wx_seek(vfsSeekMode mode)
 	return rFromStart;
 }
 
-vfsLocalFile::vfsLocalFile(vfsDevice* device) : vfsFileBase(device)
+vfsLocalFile::vfsLocalFile(vfsDevice* device)
+	: vfsFileBase(device)
+	, m_map(nullptr)
+	, m_map_size(0)
+	, m_map_pos(0)
+{
+}
+
+vfsLocalFile::~vfsLocalFile()
 {
+	Close();
 }
 
 bool vfsLocalFile::Open(const std::string& path, vfsOpenMode mode)
@@ -47,8 +60,23 @@ bool vfsLocalFile::Open(const std::string& path, vfsOpenMode mode)
 	// {
 		if(!m_file.Access(path, vfs2wx_mode(mode))) return false;
 
-		return m_file.Open(path, vfs2wx_mode(mode)) && vfsFileBase::Open(path, mode);
+		if (!m_file.Open(path, vfs2wx_mode(mode)) || !vfsFileBase::Open(path, mode))
+			return false;
 	// }
+
+	if (mode == vfsRead && Ini.HLEMappedFileReads.GetValue())
+	{
+		const u64 size = m_file.Length();
+
+		if (size >= min_mapped_file_size && size == (size_t)size)
+		{
+			m_map = (const u8*)m_file.MapRead((size_t)size);
+			m_map_size = m_map ? size : 0;
+			m_map_pos = m_file.Tell();
+		}
+	}
+
+	return true;
 }
 
 bool vfsLocalFile::Create(const std::string& path)
@@ -88,6 +116,13 @@ bool vfsLocalFile::Create(const std::string& path)
 
 bool vfsLocalFile::Close()
 {
+	if (m_map)
+	{
+		rFile::Unmap(m_map, (size_t)m_map_size);
+		m_map = nullptr;
+		m_map_size = 0;
+	}
+
 	return m_file.Close() && vfsFileBase::Close();
 }
 
@@ -103,17 +138,67 @@ u64 vfsLocalFile::Write(const void* src, u64 size)
 
 u64 vfsLocalFile::Read(void* dst, u64 size)
 {
+	if (m_map)
+	{
+		const u64 res = ReadAt(m_map_pos, dst, size);
+		m_map_pos += res;
+		return res;
+	}
+
 	return m_file.Read(dst, size);
 }
 
+u64 vfsLocalFile::WriteAt(u64 offset, const void* src, u64 size)
+{
+	return m_file.WriteAt(offset, src, size);
+}
+
+u64 vfsLocalFile::ReadAt(u64 offset, void* dst, u64 size)
+{
+	if (m_map && offset < m_map_size)
+	{
+		const u64 res = std::min(size, m_map_size - offset);
+		memcpy(dst, m_map + offset, res);
+
+		// the file could have grown after it was mapped, read the rest with rFile
+		return res < size ? res + m_file.ReadAt(offset + res, (u8*)dst + res, size - res) : res;
+	}
+
+	return m_file.ReadAt(offset, dst, size);
+}
+
+bool vfsLocalFile::SupportsConcurrentIo() const
+{
+	if (m_map)
+		return true;
+
+#ifdef _WIN32
+	return false; // rFile restores the file pointer moved by ReadFile/WriteFile
+#else
+	return true;
+#endif
+}
+
 u64 vfsLocalFile::Seek(s64 offset, vfsSeekMode mode)
 {
+	if (m_map)
+	{
+		switch (mode)
+		{
+		case vfsSeekSet: m_map_pos = offset; break;
+		case vfsSeekCur: m_map_pos += offset; break;
+		case vfsSeekEnd: m_map_pos = m_file.Length() + offset; break;
+		}
+
+		return m_map_pos;
+	}
+
 	return m_file.Seek(offset, vfs2wx_seek(mode));
 }
 
 u64 vfsLocalFile::Tell() const
 {
-	return m_file.Tell();
+	return m_map ? m_map_pos : m_file.Tell();
 }
 
 bool vfsLocalFile::IsOpened() const
@@ -7,8 +7,14 @@ class vfsLocalFile : public vfsFileBase
 private:
 	rFile m_file;
 
+	// files opened for reading are mapped to memory, reads are copied from the page cache without syscalls
+	const u8* m_map;
+	u64 m_map_size;
+	u64 m_map_pos;
+
 public:
 	vfsLocalFile(vfsDevice* device);
+	virtual ~vfsLocalFile();
 
 	virtual bool Open(const std::string& path, vfsOpenMode mode = vfsRead) override;
 	virtual bool Create(const std::string& path) override;
@@ -20,6 +26,10 @@ public:
 	virtual u64 Write(const void* src, u64 size) override;
 	virtual u64 Read(void* dst, u64 size) override;
 
+	virtual u64 WriteAt(u64 offset, const void* src, u64 size) override;
+	virtual u64 ReadAt(u64 offset, void* dst, u64 size) override;
+	virtual bool SupportsConcurrentIo() const override;
+
 	virtual u64 Seek(s64 offset, vfsSeekMode mode = vfsSeekSet) override;
 	virtual u64 Tell() const override;
 
@@ -25,6 +25,14 @@ public:
 	virtual u64 Write(const void* src, u64 size);
 	virtual u64 Read(void* dst, u64 size);
 
+	// Read or write at the given offset without changing the current position.
+	// The default implementation seeks, so it can't run concurrently with other operations on the stream.
+	virtual u64 WriteAt(u64 offset, const void* src, u64 size);
+	virtual u64 ReadAt(u64 offset, void* dst, u64 size);
+
+	// Returns true if ReadAt/WriteAt can run concurrently with other operations on the stream
+	virtual bool SupportsConcurrentIo() const;
+
 	virtual u64 Seek(s64 offset, vfsSeekMode mode = vfsSeekSet);
 	virtual u64 Tell() const;
 	virtual bool Eof();
@@ -0,0 +1,52 @@
+#include "stdafx.h"
+#include "vfsStreamBuffer.h"
+
+vfsStreamBuffer::vfsStreamBuffer() : vfsStream()
+{
+	vfsStream::Reset();
+}
+
+vfsStreamBuffer::vfsStreamBuffer(std::vector<u8>&& data) : vfsStream(), m_data(std::move(data))
+{
+	vfsStream::Reset();
+}
+
+u64 vfsStreamBuffer::GetSize()
+{
+	return m_data.size();
+}
+
+u64 vfsStreamBuffer::Write(const void* src, u64 size)
+{
+	return vfsStream::Write(src, WriteAt(Tell(), src, size));
+}
+
+u64 vfsStreamBuffer::Read(void* dst, u64 size)
+{
+	return vfsStream::Read(dst, ReadAt(Tell(), dst, size));
+}
+
+u64 vfsStreamBuffer::WriteAt(u64 offset, const void* src, u64 size)
+{
+	if (offset + size > m_data.size())
+	{
+		m_data.resize(offset + size);
+	}
+
+	memcpy(m_data.data() + offset, src, size);
+
+	return size;
+}
+
+u64 vfsStreamBuffer::ReadAt(u64 offset, void* dst, u64 size)
+{
+	if (offset >= m_data.size())
+	{
+		return 0;
+	}
+
+	size = std::min<u64>(size, m_data.size() - offset);
+	memcpy(dst, m_data.data() + offset, size);
+
+	return size;
+}
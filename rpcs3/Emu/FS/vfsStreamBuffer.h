@@ -0,0 +1,20 @@
+#pragma once
+#include "vfsStream.h"
+
+// Stream over a buffer in host memory, grows on writes past the end
+struct vfsStreamBuffer : public vfsStream
+{
+	std::vector<u8> m_data;
+
+public:
+	vfsStreamBuffer();
+	vfsStreamBuffer(std::vector<u8>&& data);
+
+	virtual u64 GetSize() override;
+
+	virtual u64 Write(const void* src, u64 size) override;
+	virtual u64 Read(void* dst, u64 size) override;
+
+	virtual u64 WriteAt(u64 offset, const void* src, u64 size) override;
+	virtual u64 ReadAt(u64 offset, void* dst, u64 size) override;
+};
\ No newline at end of file
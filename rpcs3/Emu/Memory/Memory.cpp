@@ -22,10 +22,10 @@ void MemoryBase::InvalidAddress(const char* func, const u64 addr)
 	LOG_ERROR(MEMORY, "%s(): invalid address (0x%llx)", func, addr);
 }
 
+// Page registration doesn't lock anything: the caller owns the range (DynamicMemoryBlockBase reserves it under its m_lock,
+// other blocks are set up under LV2_LOCK), so no other thread can write the same entries.
 void MemoryBase::RegisterPages(u64 addr, u32 size)
 {
-	LV2_LOCK(0);
-
 	//LOG_NOTICE(MEMORY, "RegisterPages(addr=0x%llx, size=0x%x)", addr, size);
 	for (u64 i = addr / 4096; i < (addr + size) / 4096; i++)
 	{
@@ -45,8 +45,6 @@ void MemoryBase::RegisterPages(u64 addr, u32 size)
 
 void MemoryBase::UnregisterPages(u64 addr, u32 size)
 {
-	LV2_LOCK(0);
-
 	//LOG_NOTICE(MEMORY, "UnregisterPages(addr=0x%llx, size=0x%x)", addr, size);
 	for (u64 i = addr / 4096; i < (addr + size) / 4096; i++)
 	{
@@ -357,21 +355,15 @@ bool MemoryBlock::IsMyAddress(const u64 addr)
 DynamicMemoryBlockBase::DynamicMemoryBlockBase()
 	: MemoryBlock()
 	, m_max_size(0)
+	, m_used_size(0)
 {
 }
 
 const u32 DynamicMemoryBlockBase::GetUsedSize() const
 {
-	LV2_LOCK(0);
-
-	u32 size = 0;
-
-	for (u32 i = 0; i<m_allocated.size(); ++i)
-	{
-		size += m_allocated[i].size;
-	}
+	std::lock_guard<std::mutex> lock(m_lock);
 
-	return size;
+	return m_used_size;
 }
 
 bool DynamicMemoryBlockBase::IsInMyRange(const u64 addr)
@@ -391,7 +383,7 @@ bool DynamicMemoryBlockBase::IsMyAddress(const u64 addr)
 
 MemoryBlock* DynamicMemoryBlockBase::SetRange(const u64 start, const u32 size)
 {
-	LV2_LOCK(0);
+	std::lock_guard<std::mutex> lock(m_lock);
 
 	m_max_size = PAGE_4K(size);
 	if (!MemoryBlock::SetRange(start, 0))
@@ -400,19 +392,111 @@ MemoryBlock* DynamicMemoryBlockBase::SetRange(const u64 start, const u32 size)
 		return nullptr;
 	}
 
+	m_free.clear();
+	m_free_by_size.clear();
+	m_used_size = 0;
+
+	if (m_max_size)
+	{
+		InsertFreeRange(start, m_max_size);
+	}
+
 	return this;
 }
 
 void DynamicMemoryBlockBase::Delete()
 {
-	LV2_LOCK(0);
+	std::map<u64, MemBlockInfo> allocated;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		allocated.swap(m_allocated);
+		m_free.clear();
+		m_free_by_size.clear();
+		m_max_size = 0;
+		m_used_size = 0;
+	}
 
-	m_allocated.clear();
-	m_max_size = 0;
+	// pages are decommitted outside of m_lock
+	allocated.clear();
 
 	MemoryBlock::Delete();
 }
 
+void DynamicMemoryBlockBase::InsertFreeRange(u64 addr, u32 size) /* private */
+{
+	m_free.emplace(addr, size);
+	m_free_by_size.emplace(size, addr);
+}
+
+void DynamicMemoryBlockBase::EraseFreeRange(std::map<u64, u32>::iterator it) /* private */
+{
+	m_free_by_size.erase(std::make_pair(it->second, it->first));
+	m_free.erase(it);
+}
+
+void DynamicMemoryBlockBase::ReleaseRange(u64 addr, u32 size) /* private */
+{
+	auto next = m_free.lower_bound(addr);
+
+	// merge with the following free range
+	if (next != m_free.end() && next->first == addr + size)
+	{
+		size += next->second;
+		auto it = next++;
+		EraseFreeRange(it);
+	}
+
+	// merge with the preceding free range
+	if (next != m_free.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == addr)
+		{
+			addr = prev->first;
+			size += prev->second;
+			EraseFreeRange(prev);
+		}
+	}
+
+	InsertFreeRange(addr, size);
+}
+
+bool DynamicMemoryBlockBase::ReserveRange(u64 addr, u32 size) /* private */
+{
+	// find the free range containing addr
+	auto it = m_free.upper_bound(addr);
+	if (it == m_free.begin())
+	{
+		return false;
+	}
+
+	--it;
+
+	const u64 range_addr = it->first;
+	const u32 range_size = it->second;
+
+	if (addr + size > range_addr + range_size)
+	{
+		return false;
+	}
+
+	EraseFreeRange(it);
+
+	if (addr > range_addr)
+	{
+		InsertFreeRange(range_addr, (u32)(addr - range_addr));
+	}
+
+	if (addr + size < range_addr + range_size)
+	{
+		InsertFreeRange(addr + size, (u32)(range_addr + range_size - (addr + size)));
+	}
+
+	m_used_size += size;
+	return true;
+}
+
 bool DynamicMemoryBlockBase::AllocFixed(u64 addr, u32 size)
 {
 	size = PAGE_4K(size + (addr & 4095)); // align size
@@ -425,11 +509,10 @@ bool DynamicMemoryBlockBase::AllocFixed(u64 addr, u32 size)
 		return false;
 	}
 
-	LV2_LOCK(0);
-
-	for (u32 i = 0; i<m_allocated.size(); ++i)
 	{
-		if (addr >= m_allocated[i].addr && addr < m_allocated[i].addr + m_allocated[i].size) return false;
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		if (!ReserveRange(addr, size)) return false;
 	}
 
 	AppendMem(addr, size);
@@ -439,7 +522,12 @@ bool DynamicMemoryBlockBase::AllocFixed(u64 addr, u32 size)
 
 void DynamicMemoryBlockBase::AppendMem(u64 addr, u32 size) /* private */
 {
-	m_allocated.emplace_back(addr, size);
+	// the range is already reserved, so pages can be committed without holding m_lock
+	MemBlockInfo block(addr, size);
+
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	m_allocated.emplace(addr, std::move(block));
 }
 
 u64 DynamicMemoryBlockBase::AllocAlign(u32 size, u32 align)
@@ -464,38 +552,36 @@ u64 DynamicMemoryBlockBase::AllocAlign(u32 size, u32 align)
 		exsize = size + align - 1;
 	}
 
-	LV2_LOCK(0);
-
-	for (u64 addr = MemoryBlock::GetStartAddr(); addr <= MemoryBlock::GetEndAddr() - exsize;)
+	u64 addr;
 	{
-		bool is_good_addr = true;
+		std::lock_guard<std::mutex> lock(m_lock);
 
-		for (u32 i = 0; i<m_allocated.size(); ++i)
+		// best fit: the smallest free range which can hold exsize bytes
+		auto it = m_free_by_size.lower_bound(std::make_pair(exsize, (u64)0));
+		if (it == m_free_by_size.end())
 		{
-			if ((addr >= m_allocated[i].addr && addr < m_allocated[i].addr + m_allocated[i].size) ||
-				(m_allocated[i].addr >= addr && m_allocated[i].addr < addr + exsize))
-			{
-				is_good_addr = false;
-				addr = m_allocated[i].addr + m_allocated[i].size;
-				break;
-			}
+			return 0;
 		}
 
-		if (!is_good_addr) continue;
+		addr = it->second;
 
 		if (align)
 		{
-			addr = (addr + (align - 1)) & ~(align - 1);
+			addr = (addr + (align - 1)) & ~(u64)(align - 1);
 		}
 
-		//LOG_NOTICE(MEMORY, "AllocAlign(size=0x%x) -> 0x%llx", size, addr);
+		if (!ReserveRange(addr, size))
+		{
+			assert(0);
+			return 0;
+		}
+	}
 
-		AppendMem(addr, size);
+	//LOG_NOTICE(MEMORY, "AllocAlign(size=0x%x) -> 0x%llx", size, addr);
 
-		return addr;
-	}
+	AppendMem(addr, size);
 
-	return 0;
+	return addr;
 }
 
 bool DynamicMemoryBlockBase::Alloc()
@@ -505,25 +591,37 @@ bool DynamicMemoryBlockBase::Alloc()
 
 bool DynamicMemoryBlockBase::Free(u64 addr)
 {
-	LV2_LOCK(0);
-
-	for (u32 num = 0; num < m_allocated.size(); num++)
+	std::map<u64, MemBlockInfo> released;
 	{
-		if (addr == m_allocated[num].addr)
-		{
-			//LOG_NOTICE(MEMORY, "Free(0x%llx)", addr);
+		std::lock_guard<std::mutex> lock(m_lock);
 
-			m_allocated.erase(m_allocated.begin() + num);
-			return true;
+		auto it = m_allocated.find(addr);
+		if (it == m_allocated.end())
+		{
+			LOG_ERROR(MEMORY, "DynamicMemoryBlock::Free(addr=0x%llx): failed", addr);
+			for (auto& info : m_allocated)
+			{
+				LOG_NOTICE(MEMORY, "*** Memory Block: addr = 0x%llx, size = 0x%x", info.second.addr, info.second.size);
+			}
+			return false;
 		}
-	}
 
-	LOG_ERROR(MEMORY, "DynamicMemoryBlock::Free(addr=0x%llx): failed", addr);
-	for (u32 i = 0; i < m_allocated.size(); i++)
-	{
-		LOG_NOTICE(MEMORY, "*** Memory Block: addr = 0x%llx, size = 0x%x", m_allocated[i].addr, m_allocated[i].size);
+		//LOG_NOTICE(MEMORY, "Free(0x%llx)", addr);
+
+		released.emplace(addr, std::move(it->second));
+		m_allocated.erase(it);
 	}
-	return false;
+
+	const u32 size = released.begin()->second.size;
+
+	// decommit pages outside of m_lock, but before the range can be handed out again
+	released.clear();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	ReleaseRange(addr, size);
+	m_used_size -= size;
+	return true;
 }
 
 u8* DynamicMemoryBlockBase::GetMem(u64 addr) const
@@ -552,8 +650,10 @@ bool DynamicMemoryBlockBase::Unlock(u64 addr, u32 size)
 	return false;
 }
 
-VirtualMemoryBlock::VirtualMemoryBlock() : MemoryBlock(), m_reserve_size(0)
+VirtualMemoryBlock::VirtualMemoryBlock() : MemoryBlock(), m_unaligned_count(0), m_reserve_size(0)
 {
+	m_page_real.fill(page_invalid);
+	m_page_mapped.fill(page_invalid);
 }
 
 MemoryBlock* VirtualMemoryBlock::SetRange(const u64 start, const u32 size)
@@ -576,15 +676,84 @@ bool VirtualMemoryBlock::IsInMyRange(const u64 addr, const u32 size)
 
 bool VirtualMemoryBlock::IsMyAddress(const u64 addr)
 {
-	for (u32 i = 0; i<m_mapped_memory.size(); ++i)
+	u64 realAddr;
+	return getRealAddr(addr, realAddr);
+}
+
+bool VirtualMemoryBlock::IsPageMappable(const VirtualMemInfo& info) /* private */
+{
+	return !((info.addr | info.realAddress | info.size) & page_mask) && info.addr + info.size <= 0x100000000ull && info.realAddress + info.size <= 0x100000000ull;
+}
+
+bool VirtualMemoryBlock::FillPages(const VirtualMemInfo& info) /* private */
+{
+	if (!IsPageMappable(info))
 	{
-		if (addr >= m_mapped_memory[i].addr && addr < m_mapped_memory[i].addr + m_mapped_memory[i].size)
+		return false;
+	}
+
+	for (u32 i = 0; i < (info.size >> page_shift); i++)
+	{
+		const u32 addr_page = (u32)(info.addr >> page_shift) + i;
+		const u32 real_page = (u32)(info.realAddress >> page_shift) + i;
+
+		// the first mapping wins, as with a linear scan of m_mapped_memory
+		if (m_page_real[addr_page] == page_invalid)
 		{
-			return true;
+			m_page_real[addr_page] = real_page << page_shift;
+		}
+
+		if (m_page_mapped[real_page] == page_invalid)
+		{
+			m_page_mapped[real_page] = addr_page << page_shift;
 		}
 	}
 
-	return false;
+	return true;
+}
+
+void VirtualMemoryBlock::MapPages(const VirtualMemInfo& info) /* private */
+{
+	if (!FillPages(info))
+	{
+		// lookups will fall back to scanning m_mapped_memory
+		m_unaligned_count++;
+	}
+}
+
+void VirtualMemoryBlock::UnmapPages(const VirtualMemInfo& info) /* private */
+{
+	if (!IsPageMappable(info))
+	{
+		m_unaligned_count--;
+		return;
+	}
+
+	for (u32 i = 0; i < (info.size >> page_shift); i++)
+	{
+		const u32 addr_page = (u32)(info.addr >> page_shift) + i;
+		const u32 real_page = (u32)(info.realAddress >> page_shift) + i;
+
+		if (m_page_real[addr_page] == real_page << page_shift)
+		{
+			m_page_real[addr_page] = page_invalid;
+		}
+
+		if (m_page_mapped[real_page] == addr_page << page_shift)
+		{
+			m_page_mapped[real_page] = page_invalid;
+		}
+	}
+
+	// restore entries still covered by other (overlapping) mappings
+	for (auto& other : m_mapped_memory)
+	{
+		if ((other.addr < info.addr + info.size && info.addr < other.addr + other.size) ||
+			(other.realAddress < info.realAddress + info.size && info.realAddress < other.realAddress + other.size))
+		{
+			FillPages(other);
+		}
+	}
 }
 
 u64 VirtualMemoryBlock::Map(u64 realaddr, u32 size)
@@ -608,6 +777,7 @@ u64 VirtualMemoryBlock::Map(u64 realaddr, u32 size)
 		if (!is_good_addr) continue;
 
 		m_mapped_memory.emplace_back(addr, realaddr, size);
+		MapPages(m_mapped_memory.back());
 
 		return addr;
 	}
@@ -621,6 +791,7 @@ bool VirtualMemoryBlock::Map(u64 realaddr, u32 size, u64 addr)
 		return false;
 
 	m_mapped_memory.emplace_back(addr, realaddr, size);
+	MapPages(m_mapped_memory.back());
 	return true;
 }
 
@@ -630,8 +801,10 @@ bool VirtualMemoryBlock::UnmapRealAddress(u64 realaddr, u32& size)
 	{
 		if (m_mapped_memory[i].realAddress == realaddr && IsInMyRange(m_mapped_memory[i].addr, m_mapped_memory[i].size))
 		{
-			size = m_mapped_memory[i].size;
+			const VirtualMemInfo info = m_mapped_memory[i];
+			size = info.size;
 			m_mapped_memory.erase(m_mapped_memory.begin() + i);
+			UnmapPages(info);
 			return true;
 		}
 	}
@@ -645,8 +818,10 @@ bool VirtualMemoryBlock::UnmapAddress(u64 addr, u32& size)
 	{
 		if (m_mapped_memory[i].addr == addr && IsInMyRange(m_mapped_memory[i].addr, m_mapped_memory[i].size))
 		{
-			size = m_mapped_memory[i].size;
+			const VirtualMemInfo info = m_mapped_memory[i];
+			size = info.size;
 			m_mapped_memory.erase(m_mapped_memory.begin() + i);
+			UnmapPages(info);
 			return true;
 		}
 	}
@@ -672,7 +847,7 @@ bool VirtualMemoryBlock::Write32(const u64 addr, const u32 value)
 	return true;
 }
 
-bool VirtualMemoryBlock::getRealAddr(u64 addr, u64& result)
+bool VirtualMemoryBlock::getRealAddrSlow(u64 addr, u64& result) /* private */
 {
 	for (u32 i = 0; i<m_mapped_memory.size(); ++i)
 	{
@@ -686,7 +861,7 @@ bool VirtualMemoryBlock::getRealAddr(u64 addr, u64& result)
 	return false;
 }
 
-u64 VirtualMemoryBlock::getMappedAddress(u64 realAddress)
+u64 VirtualMemoryBlock::getMappedAddressSlow(u64 realAddress) /* private */
 {
 	for (u32 i = 0; i<m_mapped_memory.size(); ++i)
 	{
@@ -702,6 +877,9 @@ u64 VirtualMemoryBlock::getMappedAddress(u64 realAddress)
 void VirtualMemoryBlock::Delete()
 {
 	m_mapped_memory.clear();
+	m_page_real.fill(page_invalid);
+	m_page_mapped.fill(page_invalid);
+	m_unaligned_count = 0;
 
 	MemoryBlock::Delete();
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <set>
+
 #define PAGE_4K(x) (x + 4095) & ~(4095)
 
 //#include <emmintrin.h>
@@ -116,8 +119,12 @@ public:
 
 class DynamicMemoryBlockBase : public MemoryBlock
 {
-	std::vector<MemBlockInfo> m_allocated; // allocation info
+	std::map<u64, MemBlockInfo> m_allocated; // allocation info, ordered by address
+	std::map<u64, u32> m_free; // free ranges (addr -> size), ordered by address
+	std::set<std::pair<u32, u64>> m_free_by_size; // the same free ranges, ordered by (size, addr) for best-fit lookup
+	mutable std::mutex m_lock; // protects the maps above, taken instead of the core mutex
 	u32 m_max_size;
+	u32 m_used_size;
 
 public:
 	DynamicMemoryBlockBase();
@@ -145,13 +152,35 @@ public:
 
 private:
 	void AppendMem(u64 addr, u32 size);
+
+	// free range bookkeeping, m_lock must be held
+	void InsertFreeRange(u64 addr, u32 size);
+	void EraseFreeRange(std::map<u64, u32>::iterator it);
+	void ReleaseRange(u64 addr, u32 size);
+	bool ReserveRange(u64 addr, u32 size);
 };
 
 class VirtualMemoryBlock : public MemoryBlock
 {
+	static const u32 page_shift = 20; // 1 MB translation granularity (RSX IO page size)
+	static const u32 page_mask = (1 << page_shift) - 1;
+	static const u32 page_count = 0x100000000ull >> page_shift;
+	static const u32 page_invalid = 0xFFFFFFFF;
+
 	std::vector<VirtualMemInfo> m_mapped_memory;
+	std::array<u32, page_count> m_page_real; // mapped page -> real page address (or page_invalid)
+	std::array<u32, page_count> m_page_mapped; // real page -> mapped page address (or page_invalid)
+	u32 m_unaligned_count; // mappings which couldn't be entered into the page tables
 	u32 m_reserve_size;
 
+	static bool IsPageMappable(const VirtualMemInfo& info);
+	bool FillPages(const VirtualMemInfo& info);
+	void MapPages(const VirtualMemInfo& info);
+	void UnmapPages(const VirtualMemInfo& info);
+
+	bool getRealAddrSlow(u64 addr, u64& result);
+	u64 getMappedAddressSlow(u64 realAddress);
+
 public:
 	VirtualMemoryBlock();
 
@@ -187,7 +216,18 @@ public:
 
 	// try to get the real address given a mapped address
 	// return true for success
-	bool getRealAddr(u64 addr, u64& result);
+	__forceinline bool getRealAddr(u64 addr, u64& result)
+	{
+		const u32 page = addr < 0x100000000ull ? m_page_real[addr >> page_shift] : page_invalid;
+
+		if (page != page_invalid)
+		{
+			result = page | (addr & page_mask);
+			return true;
+		}
+
+		return m_unaligned_count && getRealAddrSlow(addr, result);
+	}
 
 	u64 RealAddr(u64 addr)
 	{
@@ -197,7 +237,17 @@ public:
 	}
 
 	// return the mapped address given a real address, if not mapped return 0
-	u64 getMappedAddress(u64 realAddress);
+	__forceinline u64 getMappedAddress(u64 realAddress)
+	{
+		const u32 page = realAddress < 0x100000000ull ? m_page_mapped[realAddress >> page_shift] : page_invalid;
+
+		if (page != page_invalid)
+		{
+			return page | (realAddress & page_mask);
+		}
+
+		return m_unaligned_count ? getMappedAddressSlow(realAddress) : 0;
+	}
 };
 
 typedef DynamicMemoryBlockBase DynamicMemoryBlock;
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "Memory.h"
+#include "Emu/CPU/CPUThread.h"
 
 namespace vm
 {
@@ -143,4 +144,168 @@ namespace vm
 	{
 		Memory.Close();
 	}
+
+	var_arena::var_arena()
+		: m_addr(0)
+		, m_pos(0)
+		, m_close_pending(false)
+		, m_destroy_pending(false)
+	{
+	}
+
+	var_arena::~var_arena()
+	{
+		free_memory();
+	}
+
+	void var_arena::free_memory()
+	{
+		if (m_addr)
+		{
+			Memory.StackMem.Free(m_addr);
+			m_addr = 0;
+		}
+
+		m_pos = 0;
+		m_close_pending = false;
+	}
+
+	u32 var_arena::alloc(u32 size, u32 align)
+	{
+		// non power of two alignments (sizeof(T) by default) are rounded to 16
+		align = align > 16 && !(align & (align - 1)) ? align : 16;
+
+		if (align > 4096)
+		{
+			return 0;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// the owner thread is alive again (reset after close()), the memory still in use can be reused
+		m_close_pending = false;
+
+		if (!m_addr)
+		{
+			m_addr = (u32)Memory.StackMem.AllocAlign(var_arena::size, 4096);
+			m_pos = 0;
+
+			if (!m_addr)
+			{
+				return 0;
+			}
+		}
+
+		const u32 pos = (m_pos + (align - 1)) & ~(align - 1);
+
+		if (pos + std::max<u32>(size, 1) > var_arena::size || pos + std::max<u32>(size, 1) < pos)
+		{
+			return 0;
+		}
+
+		block_t block;
+		block.addr = m_addr + pos;
+		block.prev_pos = m_pos;
+		block.released = false;
+		m_blocks.push_back(block);
+
+		m_pos = pos + std::max<u32>(size, 1);
+		return block.addr;
+	}
+
+	void var_arena::dealloc(u32 addr)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			for (auto it = m_blocks.rbegin(); it != m_blocks.rend(); it++)
+			{
+				if (it->addr == addr && !it->released)
+				{
+					it->released = true;
+					break;
+				}
+			}
+
+			while (m_blocks.size() && m_blocks.back().released)
+			{
+				m_pos = m_blocks.back().prev_pos;
+				m_blocks.pop_back();
+			}
+
+			if (m_blocks.size() || !m_close_pending)
+			{
+				return;
+			}
+
+			free_memory();
+
+			if (!m_destroy_pending)
+			{
+				return;
+			}
+		}
+
+		// the owner thread is gone and this was the last var
+		delete this;
+	}
+
+	void var_arena::close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_blocks.size())
+		{
+			m_close_pending = true;
+			return;
+		}
+
+		free_memory();
+	}
+
+	void var_arena::destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (m_blocks.size())
+			{
+				m_close_pending = true;
+				m_destroy_pending = true;
+				return;
+			}
+		}
+
+		delete this;
+	}
+
+	u32 alloc_var(u32 size, u32 align, var_arena*& arena)
+	{
+		CPUThread* thread = GetCurrentCPUThread();
+
+		if (thread && thread->GetType() == CPU_THREAD_PPU)
+		{
+			arena = &thread->GetVarArena();
+
+			if (const u32 addr = arena->alloc(size, align))
+			{
+				return addr;
+			}
+		}
+
+		arena = nullptr;
+		return (u32)Memory.Alloc(size, align);
+	}
+
+	void dealloc_var(u32 addr, var_arena* arena)
+	{
+		if (arena)
+		{
+			arena->dealloc(addr);
+		}
+		else
+		{
+			Memory.Free(addr);
+		}
+	}
 }
\ No newline at end of file
@@ -2,6 +2,48 @@
 
 namespace vm
 {
+	// Guest scratch memory for vm::var temporaries created by one PPU thread.
+	// Allocations are bump allocated and released in LIFO order, out of order releases are deferred until the blocks above are released.
+	class var_arena
+	{
+		struct block_t
+		{
+			u32 addr;
+			u32 prev_pos; // m_pos before the block was allocated
+			bool released;
+		};
+
+		std::mutex m_mutex; // vars are normally released by the owner thread, the lock is never contended
+		u32 m_addr;
+		u32 m_pos;
+		std::vector<block_t> m_blocks;
+		bool m_close_pending; // close() was called while some vars were alive, the memory is released with the last block
+		bool m_destroy_pending; // destroy() was called while some vars were alive, the arena is deleted with the last block
+
+		~var_arena();
+
+		void free_memory();
+
+	public:
+		static const u32 size = 0x10000;
+
+		var_arena();
+
+		// returns 0 if the arena is full
+		u32 alloc(u32 size, u32 align);
+		void dealloc(u32 addr);
+
+		// release the guest memory (when the last var is released if some of them outlive the call)
+		void close();
+
+		// close and delete the arena (when the last var is released if some of them outlive the owner thread)
+		void destroy();
+	};
+
+	// allocate from the arena of the current PPU thread, falls back to Memory.Alloc (arena is set to nullptr in this case)
+	u32 alloc_var(u32 size, u32 align, var_arena*& arena);
+	void dealloc_var(u32 addr, var_arena* arena);
+
 	template<typename T>
 	class var
 	{
@@ -9,6 +51,7 @@ namespace vm
 		u32 m_size;
 		u32 m_align;
 		T* m_ptr;
+		var_arena* m_arena;
 
 	public:
 		var(u32 size = sizeof(T), u32 align = sizeof(T))
@@ -33,7 +76,7 @@ namespace vm
 
 		void alloc()
 		{
-			m_addr = (u32)Memory.Alloc(size(), m_align);
+			m_addr = alloc_var(size(), m_align, m_arena);
 			m_ptr = vm::get_ptr<T>(m_addr);
 		}
 
@@ -41,7 +84,7 @@ namespace vm
 		{
 			if (m_addr)
 			{
-				Memory.Free(m_addr);
+				dealloc_var(m_addr, m_arena);
 				m_addr = 0;
 				m_ptr = vm::get_ptr<T>(0u);
 			}
@@ -50,7 +93,9 @@ namespace vm
 		static var make(u32 addr, u32 size = sizeof(T), u32 align = sizeof(T))
 		{
 			var res;
+			res.dealloc();
 
+			res.m_arena = nullptr;
 			res.m_addr = addr;
 			res.m_size = size;
 			res.m_align = align;
@@ -135,6 +180,7 @@ namespace vm
 		u32 m_size;
 		u32 m_align;
 		T* m_ptr;
+		var_arena* m_arena;
 
 	public:
 		var(u32 count, u32 size = sizeof(T), u32 align = sizeof(T))
@@ -160,7 +206,7 @@ namespace vm
 
 		void alloc()
 		{
-			m_addr = (u32)Memory.Alloc(size(), m_align);
+			m_addr = alloc_var(size(), m_align, m_arena);
 			m_ptr = vm::get_ptr<T>(m_addr);
 		}
 
@@ -168,7 +214,7 @@ namespace vm
 		{
 			if (m_addr)
 			{
-				Memory.Free(m_addr);
+				dealloc_var(m_addr, m_arena);
 				m_addr = 0;
 				m_ptr = nullptr;
 			}
@@ -177,7 +223,9 @@ namespace vm
 		static var make(u32 addr, u32 count, u32 size = sizeof(T), u32 align = sizeof(T))
 		{
 			var res;
+			res.dealloc();
 
+			res.m_arena = nullptr;
 			res.m_addr = addr;
 			res.m_count = count;
 			res.m_size = size;
@@ -330,6 +378,7 @@ namespace vm
 		u32 m_size;
 		u32 m_align;
 		T* m_ptr;
+		var_arena* m_arena;
 
 	public:
 		var(u32 size = sizeof(T), u32 align = sizeof(T))
@@ -354,7 +403,7 @@ namespace vm
 
 		void alloc()
 		{
-			m_addr = (u32)Memory.Alloc(size(), m_align);
+			m_addr = alloc_var(size(), m_align, m_arena);
 			m_ptr = vm::get_ptr<T>(m_addr);
 		}
 
@@ -362,7 +411,7 @@ namespace vm
 		{
 			if (m_addr)
 			{
-				Memory.Free(m_addr);
+				dealloc_var(m_addr, m_arena);
 				m_addr = 0;
 				m_ptr = vm::get_ptr<T>(0u);
 			}
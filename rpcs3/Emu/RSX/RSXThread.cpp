@@ -2243,9 +2243,131 @@ void RSXThread::End()
 	OnReset();
 }
 
+u32 RSXThread::ExecuteBatch(const u32 get, const u32 put)
+{
+	// translate the IO span once: process every packet up to put or up to the end of the current 1 MB IO page
+	u64 real_get;
+	if (!Memory.RSXIOMem.getRealAddr(get, real_get))
+	{
+		throw fmt::Format("%s(rsxio_addr=0x%x): RSXIO memory not mapped", __FUNCTION__, get);
+	}
+
+	const u32 page_end = (get & ~0xfffff) + 0x100000;
+	const u32 end = put > get && put < page_end ? put : page_end;
+	const u32 io_to_real = (u32)real_get - get;
+
+	u32 pos = get;
+
+	while (pos < end)
+	{
+		//ConLog.Write("addr = 0x%x", m_ioAddress + pos);
+		const u32 cmd = vm::read32(io_to_real + pos);
+		const u32 count = (cmd >> 18) & 0x7ff;
+		//if(cmd == 0) continue;
+
+		if (Ini.RSXLogging.GetValue())
+			LOG_NOTICE(Log::RSX, "%s (cmd=0x%x)", GetMethodName(cmd & 0xffff).c_str(), cmd);
+
+		//LOG_NOTICE(Log::RSX, "put=0x%x, get=0x%x, cmd=0x%x (%s)", put, pos, cmd, GetMethodName(cmd & 0xffff).c_str());
+
+		if(cmd & CELL_GCM_METHOD_FLAG_JUMP)
+		{
+			u32 offs = cmd & 0x1fffffff;
+			//LOG_WARNING(RSX, "rsx jump(0x%x) #addr=0x%x, cmd=0x%x, get=0x%x, put=0x%x", offs, m_ioAddress + pos, cmd, pos, put);
+			pos = offs;
+			break;
+		}
+		if(cmd & CELL_GCM_METHOD_FLAG_CALL)
+		{
+			m_call_stack.push(pos + 4);
+			u32 offs = cmd & ~3;
+			//LOG_WARNING(RSX, "rsx call(0x%x) #0x%x - 0x%x", offs, cmd, pos);
+			pos = offs;
+			break;
+		}
+		if(cmd == CELL_GCM_METHOD_FLAG_RETURN)
+		{
+			//LOG_WARNING(RSX, "rsx return!");
+			pos = m_call_stack.top();
+			m_call_stack.pop();
+			//LOG_WARNING(RSX, "rsx return(0x%x)", pos);
+			break;
+		}
+
+		if(cmd == 0) //nop
+		{
+			pos += 4;
+			continue;
+		}
+
+		if (pos + (count + 1) * 4 > page_end)
+		{
+			if (pos != get)
+			{
+				// the arguments continue on the next IO page, end the batch before the packet
+				break;
+			}
+
+			// the batch starts with the packet, gather its arguments from both IO pages
+			vm::var<be_t<u32>[]> args(count);
+
+			for (u32 i = 0; i < count; i++)
+			{
+				u64 real_arg;
+				if (!Memory.RSXIOMem.getRealAddr(pos + 4 + i * 4, real_arg))
+				{
+					throw fmt::Format("%s(rsxio_addr=0x%x): RSXIO memory not mapped", __FUNCTION__, pos + 4 + i * 4);
+				}
+
+				args[i] = vm::read32((u32)real_arg);
+			}
+
+			ExecutePacket(pos, cmd, count, args.addr());
+
+			return pos + (count + 1) * 4;
+		}
+
+		ExecutePacket(pos, cmd, count, io_to_real + pos + 4);
+
+		pos += (count + 1) * 4;
+	}
+
+	return pos;
+}
+
+void RSXThread::ExecutePacket(const u32 pos, const u32 cmd, const u32 count, const u32 args_addr)
+{
+	// the method run is passed to DoCmd as a span of arguments
+	const be_t<u32>* args = vm::get_ptr<be_t<u32>>(args_addr);
+	const u32 method = cmd & 0xffff;
+
+	if(cmd & CELL_GCM_METHOD_FLAG_NON_INCREMENT)
+	{
+		//LOG_WARNING(RSX, "non increment cmd! 0x%x", cmd);
+		if (count)
+		{
+			methodRegisters[method] = args[count - 1].ToLE();
+		}
+	}
+	else
+	{
+		for (u32 i = 0; i < count; i++)
+		{
+			methodRegisters[method + i * 4] = args[i].ToLE();
+		}
+	}
+
+	if ((cmd & 0x3ffff) == 0x3fead)
+	{
+		// flip may block on the frame limiter, so make the progress visible first
+		m_ctrl->get.exchange(be_t<u32>::make(pos));
+	}
+
+	DoCmd(cmd, cmd & 0x3ffff, args_addr, count);
+}
+
 void RSXThread::Task()
 {
-	u8 inc;
 	LOG_NOTICE(RSX, "RSX thread started");
 
 	OnInitThread();
@@ -2297,10 +2419,8 @@ void RSXThread::Task()
 		}
 		std::lock_guard<std::mutex> lock(m_cs_main);
 
-		inc=1;
-
-		u32 get = m_ctrl->get.read_sync();
-		u32 put = m_ctrl->put.read_sync();
+		const u32 get = m_ctrl->get.read_sync();
+		const u32 put = m_ctrl->put.read_sync();
 
 		if(put == get || !Emu.IsRunning())
 		{
@@ -2316,74 +2436,8 @@ void RSXThread::Task()
 			continue;
 		}
 
-		//ConLog.Write("addr = 0x%x", m_ioAddress + get);
-		const u32 cmd = ReadIO32(get);
-		const u32 count = (cmd >> 18) & 0x7ff;
-		//if(cmd == 0) continue;
-
-		if (Ini.RSXLogging.GetValue())
-			LOG_NOTICE(Log::RSX, "%s (cmd=0x%x)", GetMethodName(cmd & 0xffff).c_str(), cmd);
-
-		//LOG_NOTICE(Log::RSX, "put=0x%x, get=0x%x, cmd=0x%x (%s)", put, get, cmd, GetMethodName(cmd & 0xffff).c_str());
-
-		if(cmd & CELL_GCM_METHOD_FLAG_JUMP)
-		{
-			u32 offs = cmd & 0x1fffffff;
-			//LOG_WARNING(RSX, "rsx jump(0x%x) #addr=0x%x, cmd=0x%x, get=0x%x, put=0x%x", offs, m_ioAddress + get, cmd, get, put);
-			m_ctrl->get.exchange(be_t<u32>::make(offs));
-			continue;
-		}
-		if(cmd & CELL_GCM_METHOD_FLAG_CALL)
-		{
-			m_call_stack.push(get + 4);
-			u32 offs = cmd & ~3;
-			//u32 addr = offs;
-			//LOG_WARNING(RSX, "rsx call(0x%x) #0x%x - 0x%x", offs, cmd, get);
-			m_ctrl->get.exchange(be_t<u32>::make(offs));
-			continue;
-		}
-		if(cmd == CELL_GCM_METHOD_FLAG_RETURN)
-		{
-			//LOG_WARNING(RSX, "rsx return!");
-			u32 get = m_call_stack.top();
-			m_call_stack.pop();
-			//LOG_WARNING(RSX, "rsx return(0x%x)", get);
-			m_ctrl->get.exchange(be_t<u32>::make(get));
-			continue;
-		}
-		if(cmd & CELL_GCM_METHOD_FLAG_NON_INCREMENT)
-		{
-			//LOG_WARNING(RSX, "non increment cmd! 0x%x", cmd);
-			inc = 0;
-		}
-		else
-		{
-			//LOG_WARNING(RSX, "increment cmd! 0x%x", cmd);
-		}
-
-		if(cmd == 0) //nop
-		{
-			m_ctrl->get.atomic_op([](be_t<u32>& value)
-			{
-				value += 4;
-			});
-			continue;
-		}
-
-		auto args = vm::ptr<u32>::make((u32)Memory.RSXIOMem.RealAddr(get + 4));
-
-		for(u32 i=0; i<count; i++)
-		{
-			methodRegisters[(cmd & 0xffff) + (i * 4 * inc)] = ARGS(i);
-		}
-
-		DoCmd(cmd, cmd & 0x3ffff, args.addr(), count);
-
-		m_ctrl->get.atomic_op([count](be_t<u32>& value)
-		{
-			value += (count + 1) * 4;
-		});
-		//memset(Memory.GetMemFromAddr(p.m_ioAddress + get), 0, (count + 1) * 4);
+		// publish get once per batch
+		m_ctrl->get.exchange(be_t<u32>::make(ExecuteBatch(get, put)));
 	}
 	catch (const std::string& e)
 	{
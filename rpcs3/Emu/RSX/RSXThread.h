@@ -644,6 +644,12 @@ protected:
 
 	virtual void Task();
 
+	// process the packets from get up to put or up to the end of the IO page, returns the new get
+	u32 ExecuteBatch(const u32 get, const u32 put);
+
+	// store the arguments of the method run at pos in methodRegisters and execute it
+	void ExecutePacket(const u32 pos, const u32 cmd, const u32 count, const u32 args_addr);
+
 public:
 	void Init(const u32 ioAddress, const u32 ioSize, const u32 ctrlAddress, const u32 localAddress);
 
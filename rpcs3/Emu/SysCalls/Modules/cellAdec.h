@@ -1101,7 +1101,7 @@ static_assert(sizeof(OMAHeader) == 96, "Wrong OMAHeader size");
 class AudioDecoder
 {
 public:
-	SQueue<AdecTask> job;
+	MPSCQueue<AdecTask> job;
 	u32 id;
 	volatile bool is_closed;
 	volatile bool is_finished;
@@ -1128,7 +1128,7 @@ public:
 
 	} reader;
 
-	SQueue<AdecFrame> frames;
+	SPSCQueue<AdecFrame> frames;
 
 	const AudioCodecType type;
 	const u32 memAddr;
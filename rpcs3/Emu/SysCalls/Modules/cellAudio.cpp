@@ -74,10 +74,10 @@ int cellAudioInit()
 				oal_buffer_float[i] = std::unique_ptr<float[]>(new float[oal_buffer_size] {} );
 			}
 
-			SQueue<s16*, 31> queue;
+			SPSCQueue<s16*, 31> queue;
 			queue.Clear();
 
-			SQueue<float*, 31> queue_float;
+			SPSCQueue<float*, 31> queue_float;
 			queue_float.Clear();
 
 			std::vector<u64> keys;
@@ -987,7 +987,7 @@ s32 cellGcmUnmapEaIoAddress(u64 ea)
 		ea = ea >> 20;
 		io = offsetTable.ioAddress[ea];
 
-		for (u32 i = 0; i<size; i++)
+		for (u32 i = 0; i<(size >> 20); i++)
 		{
 			offsetTable.ioAddress[ea + i] = 0xFFFF;
 			offsetTable.eaAddress[io + i] = 0xFFFF;
@@ -1013,7 +1013,7 @@ s32 cellGcmUnmapIoAddress(u64 io)
 		io = io >> 20;
 		ea = offsetTable.eaAddress[io];
 
-		for (u32 i = 0; i<size; i++)
+		for (u32 i = 0; i<(size >> 20); i++)
 		{
 			offsetTable.ioAddress[ea + i] = 0xFFFF;
 			offsetTable.eaAddress[io + i] = 0xFFFF;
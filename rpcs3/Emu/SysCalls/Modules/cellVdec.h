@@ -693,7 +693,7 @@ int vdecRead(void* opaque, u8* buf, int buf_size);
 class VideoDecoder
 {
 public:
-	SQueue<VdecTask> job;
+	MPSCQueue<VdecTask> job;
 	u32 id;
 	volatile bool is_closed;
 	volatile bool is_finished;
@@ -712,7 +712,7 @@ public:
 		u32 size;
 	} reader;
 
-	SQueue<VdecFrame> frames;
+	SPSCQueue<VdecFrame> frames;
 
 	const CellVdecCodecType type;
 	const u32 profile;
@@ -7,7 +7,10 @@
 #include "Emu/FS/VFS.h"
 #include "Utilities/rFile.h"
 #include "Emu/FS/vfsDir.h"
+#include "Emu/FS/vfsFileBase.h"
+#include "Crypto/key_vault.h"
 #include "Crypto/unedat.h"
+#include "Emu/SysCalls/lv2/lv2Fs.h"
 #include "sceNp.h"
 
 Module *sceNp = nullptr;
@@ -89,7 +92,7 @@ int npDrmIsAvailable(u32 k_licensee_addr, vm::ptr<const char> drm_path)
 	}
 
 	std::string k_licensee_str = "0";
-	u8 k_licensee[0x10];
+	u8 k_licensee[0x10] = {};
 
 	if (k_licensee_addr)
 	{
@@ -104,14 +107,11 @@ int npDrmIsAvailable(u32 k_licensee_addr, vm::ptr<const char> drm_path)
 	sceNp->Warning("npDrmIsAvailable: Using k_licensee 0x%s", k_licensee_str.c_str());
 
 	// Set the necessary file paths.
-	std::string drm_file_name = fmt::AfterLast(drm_path.get_ptr(), '/');
-
 	// TODO: Make more explicit what this actually does (currently it copies "XXXXXXXX" from drm_path (== "/dev_hdd0/game/XXXXXXXXX/*" assumed)
 	std::string titleID(&drm_path[15], 9);
 
 	// TODO: These shouldn't use current dir
 	std::string enc_drm_path = drm_path.get_ptr();
-	std::string dec_drm_path = "/dev_hdd1/cache/" + drm_file_name;
 	std::string pf_str("00000001");  // TODO: Allow multiple profiles. Use default for now.
 	std::string rap_path("/dev_hdd0/home/" + pf_str + "/exdata/");
 
@@ -131,17 +131,27 @@ int npDrmIsAvailable(u32 k_licensee_addr, vm::ptr<const char> drm_path)
 		}
 	}
 
-	// Decrypt this EDAT using the supplied k_licensee and matching RAP file.
-	std::string enc_drm_path_local, dec_drm_path_local, rap_path_local;
+	std::string enc_drm_path_local, rap_path_local;
 	Emu.GetVFS().GetDevice(enc_drm_path, enc_drm_path_local);
-	Emu.GetVFS().GetDevice(dec_drm_path, dec_drm_path_local);
 	Emu.GetVFS().GetDevice(rap_path, rap_path_local);
 
-	if (DecryptEDAT(enc_drm_path_local, dec_drm_path_local, 8, rap_path_local, k_licensee, false) >= 0)
+	// Get the RIF key from the matching RAP file.
+	u8 rifkey[0x10] = {};
+	rFile rap(rap_path_local.c_str());
+	if (rap.IsOpened())
+	{
+		u8 rapkey[0x10] = {};
+		rap.Read(rapkey, 0x10);
+		rap_to_rif(rapkey, rifkey);
+	}
+
+	// Check the keys, the EDAT is then decrypted on the fly when it's opened with cellFsOpen.
+	std::shared_ptr<vfsFileBase> enc_drm(Emu.GetVFS().OpenFile(enc_drm_path, vfsRead));
+	EDATDecrypter edat(enc_drm);
+
+	if (edat.Init(enc_drm_path_local, k_licensee, rifkey))
 	{
-		// If decryption succeeds, replace the encrypted file with it.
-		rRemoveFile(enc_drm_path_local);
-		rRename(dec_drm_path_local, enc_drm_path_local);
+		fsRegisterEdatKeys(enc_drm_path_local, k_licensee, rifkey);
 	}
 
 	return CELL_OK;
@@ -8,134 +8,53 @@
 #include "Emu/FS/VFS.h"
 #include "Emu/FS/vfsFileBase.h"
 #include "Emu/SysCalls/lv2/lv2Fs.h"
+#include "Crypto/unedat.h"
+#include <deque>
 
 Module *sys_fs = nullptr;
 
-bool sdata_check(u32 version, u32 flags, u64 filesizeInput, u64 filesizeTmp)
+int cellFsSdataOpen(vm::ptr<const char> path, int flags, vm::ptr<be_t<u32>> fd, vm::ptr<u32> arg, u64 size)
 {
-	if (version > 4 || flags & 0x7EFFFFC0){
-		printf("ERROR: unknown version");
-		return false;
-	}
-
-	if ((version == 1 && (flags & 0x7FFFFFFE)) ||
-		(version == 2 && (flags & 0x7EFFFFC0))){
-		printf("ERROR: unknown or unsupported type");
-		return false;
-	}
+	sys_fs->Warning("cellFsSdataOpen(path=\"%s\", flags=0x%x, fd_addr=0x%x, arg_addr=0x%x, size=0x%llx)",
+		path.get_ptr(), flags, fd.addr(), arg.addr(), size);
 
-	if (filesizeTmp > filesizeInput){
-		printf("ERROR: input file size is too short.");
-		return false;
-	}
+	if (flags != CELL_O_RDONLY)
+		return CELL_EINVAL;
 
-	if (!(flags & 0x80000000)){
-		printf("ERROR: cannot extract finalized edata.");
-		return false;
-	}
+	LV2_LOCK(0);
 
-	return true;
-}
+	std::shared_ptr<vfsFileBase> packed_stream(Emu.GetVFS().OpenFile(path.get_ptr(), vfsRead));
 
-int sdata_unpack(const std::string& packed_file, const std::string& unpacked_file)
-{
-	std::shared_ptr<vfsFileBase> packed_stream(Emu.GetVFS().OpenFile(packed_file, vfsRead));
-	std::shared_ptr<vfsFileBase> unpacked_stream(Emu.GetVFS().OpenFile(unpacked_file, vfsWrite));
-	
-	if(!packed_stream || !packed_stream->IsOpened())
+	if (!packed_stream || !packed_stream->IsOpened())
 	{
-		sys_fs->Error("'%s' not found! flags: 0x%08x", packed_file.c_str(), vfsRead);
+		sys_fs->Error("'%s' not found! flags: 0x%08x", path.get_ptr(), vfsRead);
 		return CELL_ENOENT;
 	}
 
-	if(!unpacked_stream || !unpacked_stream->IsOpened())
+	u8 magic[4];
+	if (packed_stream->Read(magic, 4) != 4 || re32(*(u32*)magic) != 0x4E504400) // "NPD\x00"
 	{
-		sys_fs->Error("'%s' couldn't be created! flags: 0x%08x", unpacked_file.c_str(), vfsWrite);
-		return CELL_ENOENT;
+		// not packed (e.g. already unpacked by the user)
+		sys_fs->Warning("cellFsSdataOpen: '%s' is not an SDATA file, opening it as a regular file", path.get_ptr());
+		return cellFsOpen(path, flags, fd, arg, size);
 	}
 
-	char buffer [10200];
-	packed_stream->Read(buffer, 256);
-	u32 format = re32(*(u32*)&buffer[0]);
-	if (format != 0x4E504400) // "NPD\x00"
-	{
-		sys_fs->Error("Illegal format. Expected 0x4E504400, but got 0x%08x", format);
-		return CELL_EFSSPECIFIC;
-	}
+	// Blocks are decrypted (and decompressed) when they are read, nothing is unpacked to the disk
+	EDATDecrypter* stream = new EDATDecrypter(packed_stream);
 
-	u32 version	       = re32(*(u32*)&buffer[0x04]);
-	u32 flags          = re32(*(u32*)&buffer[0x80]);
-	u32 blockSize      = re32(*(u32*)&buffer[0x84]);
-	u64 filesizeOutput = re64(*(u64*)&buffer[0x88]);
-	u64 filesizeInput  = packed_stream->GetSize();
-	u32 blockCount     = (u32)((filesizeOutput + blockSize - 1) / blockSize);
-
-	// SDATA file is compressed
-	if (flags & 0x1)
+	if (!stream->Init(path.get_ptr(), nullptr, nullptr) || !stream->IsSdata())
 	{
-		sys_fs->Warning("cellFsSdataOpen: Compressed SDATA files are not supported yet.");
+		delete stream;
+		sys_fs->Error("cellFsSdataOpen: '%s' can't be unpacked", path.get_ptr());
 		return CELL_EFSSPECIFIC;
 	}
 
-	// SDATA file is NOT compressed
-	else 
-	{
-		u32 t1 = (flags & 0x20) ? 0x20 : 0x10;
-		u32 startOffset = (blockCount * t1) + 0x100;
-		u64 filesizeTmp = (filesizeOutput+0xF)&0xFFFFFFF0 + startOffset;
-
-		if (!sdata_check(version, flags, filesizeInput, filesizeTmp))
-		{
-			sys_fs->Error("cellFsSdataOpen: Wrong header information.");
-			return CELL_EFSSPECIFIC;
-		}
-	
-		if (flags & 0x20)
-			packed_stream->Seek(0x100);
-		else
-			packed_stream->Seek(startOffset);
-
-		for (u32 i = 0; i < blockCount; i++)
-		{
-			if (flags & 0x20)
-				packed_stream->Seek(packed_stream->Tell() + t1);
-
-			if (!(blockCount-i-1))
-				blockSize = (u32)(filesizeOutput - i * blockSize);
-
-			packed_stream->Read(buffer+256, blockSize);
-			unpacked_stream->Write(buffer+256, blockSize);
-		}
-	}
+	u32 id = sys_fs->GetNewId(stream, TYPE_FS_FILE);
+	*fd = id;
+	sys_fs->Notice("\"%s\" opened: fd = %d", path.get_ptr(), id);
 
 	return CELL_OK;
 }
-	
-
-int cellFsSdataOpen(vm::ptr<const char> path, int flags, vm::ptr<be_t<u32>> fd, vm::ptr<u32> arg, u64 size)
-{
-	sys_fs->Warning("cellFsSdataOpen(path=\"%s\", flags=0x%x, fd_addr=0x%x, arg_addr=0x%x, size=0x%llx) -> cellFsOpen()",
-		path.get_ptr(), flags, fd.addr(), arg.addr(), size);
-
-	/*if (flags != CELL_O_RDONLY)
-		return CELL_EINVAL;
-
-	std::string suffix = path.substr(path.length() - 5, 5);
-	if (suffix != ".sdat" && suffix != ".SDAT")
-		return CELL_ENOTSDATA;
-
-	std::string::size_type last_slash = path.rfind('/'); //TODO: use a filesystem library to solve this more robustly
-	last_slash = last_slash == std::string::npos ? 0 : last_slash+1;
-	std::string unpacked_path = "/dev_hdd1/"+path.substr(last_slash,path.length()-last_slash)+".unpacked";
-	int ret = sdata_unpack(path, unpacked_path);
-	if (ret) return ret;
-
-	fd = sys_fs->GetNewId(Emu.GetVFS().OpenFile(unpacked_path, vfsRead), TYPE_FS_FILE);
-
-	return CELL_OK;*/
-
-	return cellFsOpen(path, flags, fd, arg, size);
-}
 
 int cellFsSdataOpenByFd(int mself_fd, int flags, vm::ptr<u32> sdata_fd, u64 offset, vm::ptr<u32> arg, u64 size)
 {
@@ -147,69 +66,249 @@ int cellFsSdataOpenByFd(int mself_fd, int flags, vm::ptr<u32> sdata_fd, u64 offs
 	return CELL_OK;
 }
 
-std::atomic<u32> g_FsAioReadID( 0 );
-std::atomic<u32> g_FsAioReadCur( 0 );
-bool aio_init = false;
+typedef vm::ptr<void(*)(vm::ptr<CellFsAio> xaio, int error, int xid, u64 size)> fs_aio_cb_t;
 
-void fsAioRead(u32 fd, vm::ptr<CellFsAio> aio, int xid, vm::ptr<void (*)(vm::ptr<CellFsAio> xaio, int error, int xid, u64 size)> func)
+struct FsAioRequest
+{
+	u32 id;
+	bool write;
+	vm::ptr<CellFsAio> aio;
+	fs_aio_cb_t func;
+};
+
+// Executes cellFsAioRead/cellFsAioWrite requests on a fixed number of worker threads.
+// Requests complete out of order. Files supporting concurrent I/O are accessed without holding the LV2 lock.
+class FsAioManager
 {
-	while (g_FsAioReadCur != xid)
+	static const u32 max_threads = 4;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv; // signaled when some request was queued
+	std::condition_variable m_done_cv; // signaled when some request was finished or stopped accessing a file without the LV2 lock
+	std::deque<FsAioRequest> m_queue;
+	std::vector<u32> m_busy_fds; // files accessed without the LV2 lock
+	std::vector<std::unique_ptr<thread>> m_threads;
+	u32 m_exited; // number of workers which returned
+	u32 m_running; // number of requests being executed
+	u32 m_next_id;
+	bool m_exit;
+
+	void Worker()
 	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
-		if (Emu.IsStopped())
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// Emu.Stop() waits for all threads before the memory is freed, so the workers exit on their own (the wait is interrupted to check the status)
+		while (!m_exit && !Emu.IsStopped())
 		{
-			sys_fs->Warning("fsAioRead() aborted");
-			return;
+			if (m_queue.empty())
+			{
+				m_cv.wait_for(lock, std::chrono::milliseconds(100));
+				continue;
+			}
+
+			const FsAioRequest req = m_queue.front();
+			m_queue.pop_front();
+			m_running++;
+			lock.unlock();
+
+			Execute(req);
+
+			lock.lock();
+			m_running--;
+			m_done_cv.notify_all();
 		}
+
+		m_exited++;
 	}
 
-	u32 error = CELL_OK;
-	u64 res = 0;
+	void Join()
 	{
-		LV2_LOCK(0);
+		for (auto& t : m_threads)
+		{
+			t->join();
+		}
+
+		m_threads.clear();
+		m_exited = 0;
+	}
 
-		vfsFileBase* orig_file;
-		if (!sys_fs->CheckId(fd, orig_file))
+	void Execute(const FsAioRequest& req)
+	{
+		// don't touch the guest memory of the request if the emulation is going down
+		if (Emu.IsStopped())
 		{
-			sys_fs->Error("Wrong fd (%s)", fd);
-			Emu.Pause();
 			return;
 		}
 
-		u64 nbytes = aio->size;
+		const u32 fd = req.aio->fd;
+		const u64 offset = req.aio->offset;
+		const u64 nbytes = req.aio->size;
+		u32 error = CELL_OK;
+		u64 res = 0;
 
-		vfsStream& file = *(vfsStream*)orig_file;
-		const u64 old_pos = file.Tell();
-		file.Seek((u64)aio->offset);
+		std::unique_lock<std::recursive_mutex> lv2_lock(Emu.GetCoreMutex());
 
-		// TODO: use code from cellFsRead or something
-		if (nbytes != (u32)nbytes)
+		vfsFileBase* file;
+		if (!sys_fs->CheckId(fd, file))
+		{
+			error = CELL_EBADF;
+		}
+		else if (nbytes != (u32)nbytes)
 		{
 			error = CELL_ENOMEM;
 		}
-		else
+		else if (req.write && !(file->GetOpenMode() & vfsWrite))
 		{
-			res = nbytes ? file.Read(aio->buf.get_ptr(), nbytes) : 0;
+			error = CELL_EBADF;
+		}
+		else if (nbytes)
+		{
+			const bool concurrent = file->SupportsConcurrentIo();
+
+			if (concurrent)
+			{
+				// cellFsClose waits for the request (it can't run before the fd is marked busy)
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_busy_fds.push_back(fd);
+				lv2_lock.unlock();
+			}
+
+			if (req.write)
+			{
+				res = file->WriteAt(offset, req.aio->buf.get_ptr(), nbytes);
+			}
+			else
+			{
+				res = file->ReadAt(offset, req.aio->buf.get_ptr(), nbytes);
+			}
+
+			if (concurrent)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_busy_fds.erase(std::find(m_busy_fds.begin(), m_busy_fds.end(), fd));
+				m_done_cv.notify_all();
+			}
+		}
+
+		if (lv2_lock.owns_lock())
+		{
+			lv2_lock.unlock();
 		}
 
-		file.Seek(old_pos);
+		sys_fs->Log("*** fsAio%s(fd=%d, offset=0x%llx, buf_addr=0x%x, size=0x%llx, error=0x%x, res=0x%llx, xid=0x%x)",
+			req.write ? "Write" : "Read", fd, offset, req.aio->buf.addr(), nbytes, error, res, req.id);
 
-		sys_fs->Log("*** fsAioRead(fd=%d, offset=0x%llx, buf_addr=0x%x, size=0x%x, error=0x%x, res=0x%x, xid=0x%x [%s])",
-			fd, (u64)aio->offset, aio->buf.addr(), (u64)aio->size, error, res, xid, orig_file->GetPath().c_str());
-	}	
+		if (req.func && !Emu.IsStopped())
+		{
+			const auto func = req.func;
+			const auto aio = req.aio;
+			const u32 xid = req.id;
+
+			Emu.GetCallbackManager().Async([func, aio, error, xid, res]()
+			{
+				func(aio, error, xid, res);
+			});
+		}
+	}
 
-	if (func) // start callback thread
+public:
+	FsAioManager()
+		: m_exited(0)
+		, m_running(0)
+		, m_next_id(0)
+		, m_exit(false)
 	{
-		Emu.GetCallbackManager().Async([func, aio, error, xid, res]()
+	}
+
+	~FsAioManager()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+			m_cv.notify_all();
+		}
+
+		Join();
+	}
+
+	u32 Push(bool write, vm::ptr<CellFsAio> aio, fs_aio_cb_t func)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// the workers of the previous emulation have exited already (Emu.Stop() waits for them)
+		if (m_exited && m_exited == m_threads.size())
+		{
+			Join();
+		}
+
+		// threads are started on demand
+		for (u32 i = (u32)m_threads.size(); i < max_threads; i++)
+		{
+			m_threads.push_back(std::unique_ptr<thread>(new thread(fmt::Format("fsAio[%d]", i), [this]()
+			{
+				Worker();
+			})));
+		}
+
+		const u32 id = m_next_id++;
+		m_queue.push_back({ id, write, aio, func });
+		m_cv.notify_one();
+		return id;
+	}
+
+	// remove the request if it hasn't been started yet
+	bool Cancel(u32 id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (auto it = m_queue.begin(); it != m_queue.end(); it++)
+		{
+			if (it->id == id)
+			{
+				m_queue.erase(it);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// wait for the requests accessing the file without the LV2 lock (the caller must hold the LV2 lock)
+	void WaitForFd(u32 fd)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (std::find(m_busy_fds.begin(), m_busy_fds.end(), fd) != m_busy_fds.end())
+		{
+			m_done_cv.wait(lock);
+		}
+	}
+
+	// drop queued requests and wait for the requests being executed
+	void Reset()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_queue.clear();
+
+		while (m_running)
 		{
-			func(aio, error, xid, res);
-		});
+			m_done_cv.wait(lock);
+		}
+
+		m_next_id = 0;
 	}
+};
+
+FsAioManager g_fs_aio;
+bool aio_init = false;
 
-	g_FsAioReadCur++;
+void fsAioWaitForFd(u32 fd)
+{
+	g_fs_aio.WaitForFd(fd);
 }
 
-int cellFsAioRead(vm::ptr<CellFsAio> aio, vm::ptr<u32> aio_id, vm::ptr<void(*)(vm::ptr<CellFsAio> xaio, int error, int xid, u64 size)> func)
+int cellFsAioRead(vm::ptr<CellFsAio> aio, vm::ptr<u32> aio_id, fs_aio_cb_t func)
 {
 	sys_fs->Warning("cellFsAioRead(aio_addr=0x%x, id_addr=0x%x, func_addr=0x%x)", aio.addr(), aio_id.addr(), func.addr());
 
@@ -228,25 +327,45 @@ int cellFsAioRead(vm::ptr<CellFsAio> aio, vm::ptr<u32> aio_id, vm::ptr<void(*)(v
 		return CELL_EBADF;
 	}
 
-	//get a unique id for the callback (may be used by cellFsAioCancel)
-	const u32 xid = g_FsAioReadID++;
-	*aio_id = xid;
+	// the id may be used by cellFsAioCancel
+	*aio_id = g_fs_aio.Push(false, aio, func);
+
+	return CELL_OK;
+}
+
+int cellFsAioWrite(vm::ptr<CellFsAio> aio, vm::ptr<u32> aio_id, fs_aio_cb_t func)
+{
+	sys_fs->Warning("cellFsAioWrite(aio_addr=0x%x, id_addr=0x%x, func_addr=0x%x)", aio.addr(), aio_id.addr(), func.addr());
+
+	LV2_LOCK(0);
+
+	if (!aio_init)
+	{
+		return CELL_ENXIO;
+	}
+
+	vfsFileBase* orig_file;
+	u32 fd = aio->fd;
 
+	if (!sys_fs->CheckId(fd, orig_file))
 	{
-		thread t("fsAioRead", std::bind(fsAioRead, fd, aio, xid, func));
-		t.detach();
+		return CELL_EBADF;
 	}
 
+	*aio_id = g_fs_aio.Push(true, aio, func);
+
 	return CELL_OK;
 }
 
-int cellFsAioWrite(vm::ptr<CellFsAio> aio, vm::ptr<u32> aio_id, vm::ptr<void(*)(vm::ptr<CellFsAio> xaio, int error, int xid, u64 size)> func)
+int cellFsAioCancel(s32 id)
 {
-	sys_fs->Todo("cellFsAioWrite(aio_addr=0x%x, id_addr=0x%x, func_addr=0x%x)", aio.addr(), aio_id.addr(), func.addr());
-
-	LV2_LOCK(0);
+	sys_fs->Warning("cellFsAioCancel(id=%d)", id);
 
-	// TODO:
+	if (!g_fs_aio.Cancel(id))
+	{
+		// already started or finished
+		return CELL_EINVAL;
+	}
 
 	return CELL_OK;
 }
@@ -321,6 +440,7 @@ void sys_fs_init(Module *pxThis)
 	sys_fs->AddFunc(0x4cef342e, cellFsAioWrite);
 	sys_fs->AddFunc(0xdb869f20, cellFsAioInit);
 	sys_fs->AddFunc(0x9f951810, cellFsAioFinish);
+	sys_fs->AddFunc(0x7f13fc8c, cellFsAioCancel);
 	sys_fs->AddFunc(0x1a108ab7, cellFsGetBlockSize);
 	sys_fs->AddFunc(0xaa3b4bcd, cellFsGetFreeSize);
 	sys_fs->AddFunc(0x0d5b4a14, cellFsReadWithOffset);
@@ -341,7 +461,6 @@ void sys_fs_init(Module *pxThis)
 
 void sys_fs_load()
 {
-	g_FsAioReadID = 0;
-	g_FsAioReadCur = 0;
+	g_fs_aio.Reset();
 	aio_init = false;
 }
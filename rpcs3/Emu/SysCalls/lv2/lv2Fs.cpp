@@ -4,31 +4,247 @@
 //#include "Emu/SysCalls/SysCalls.h"
 
 #include "Emu/SysCalls/Modules.h"
+#include "Emu/SysCalls/Callback.h"
+#include "Emu/SysCalls/CB_FUNC.h"
 #include "Emu/FS/VFS.h"
 #include "Emu/FS/vfsFile.h"
 #include "Emu/FS/vfsDir.h"
+#include "Crypto/unedat.h"
 #include "lv2Fs.h"
 
 extern Module *sys_fs;
 
 struct FsRingBufferConfig
 {
-	CellFsRingBuffer m_ring_buffer; // Currently unused after assignment
+	CellFsRingBuffer m_ring_buffer;
 	u32 m_buffer;
-	u64 m_fs_status;
+	u64 m_fs_status; // protected by m_mutex
 	u64 m_regid;
 	u32 m_alloc_mem_size;
-	u32 m_current_addr;
+
+	// Streaming state (protected by m_mutex). Positions are counted in bytes since cellFsStReadStart.
+	u32 m_fd;
+	u64 m_ringbuf_size;
+	u64 m_offset; // file offset of the next prefetch
+	u64 m_remaining; // bytes left to prefetch
+	u64 m_head; // bytes written to the ring buffer
+	u64 m_tail; // bytes consumed by the game
+	bool m_eof; // the prefetch thread has finished
+	bool m_stop; // the prefetch thread must exit
+	u64 m_cb_size;
+	vm::ptr<void(*)(int xfd, u64 xsize)> m_cb_func;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv; // signaled when data was prefetched or consumed
+	thread m_thread;
 
 	FsRingBufferConfig()
 		: m_fs_status(CELL_FS_ST_NOT_INITIALIZED)
 		, m_regid(0)
 		, m_alloc_mem_size(0)
-		, m_current_addr(0)
-		, m_ring_buffer() { }
+		, m_ring_buffer()
+		, m_fd(0)
+		, m_ringbuf_size(0)
+		, m_offset(0)
+		, m_remaining(0)
+		, m_head(0)
+		, m_tail(0)
+		, m_eof(true)
+		, m_stop(false)
+		, m_cb_size(0)
+		, m_thread("fsStRead")
+	{
+		m_cb_func.set(0);
+	}
+
+	~FsRingBufferConfig()
+	{
+		Stop();
+	}
+
+	u64 Available() const
+	{
+		return m_head - m_tail;
+	}
+
+	// call the callback registered by cellFsStReadWaitCallback if enough data is available (m_mutex must be locked)
+	void CheckCallback()
+	{
+		if (m_cb_func && (Available() >= m_cb_size || m_eof))
+		{
+			const auto func = m_cb_func;
+			const int fd = m_fd;
+			const u64 size = Available();
+			m_cb_func.set(0);
+
+			Emu.GetCallbackManager().Async([func, fd, size]()
+			{
+				func(fd, size);
+			});
+		}
+	}
+
+	void Prefetch()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		const u64 block_size = m_ring_buffer.block_size ? std::min<u64>(m_ring_buffer.block_size, m_ringbuf_size) : m_ringbuf_size;
+
+		// transfer_rate is the bandwidth (bytes per second) the game reserved for the stream, the data isn't delivered faster than the drive would
+		const u64 rate = m_ring_buffer.transfer_rate;
+		const auto start = std::chrono::steady_clock::now();
+		u64 total = 0;
+
+		while (!m_stop && m_remaining && !Emu.IsStopped())
+		{
+			const u64 free = m_ringbuf_size - Available();
+
+			// read whole blocks unless the end of the stream is near, the consumers notify m_cv when they free some space
+			if (free < std::min(block_size, m_remaining))
+			{
+				m_cv.wait_for(lock, std::chrono::milliseconds(100));
+				continue;
+			}
+
+			if (rate)
+			{
+				const auto next = start + std::chrono::microseconds(total * 1000000 / rate);
+				if (std::chrono::steady_clock::now() < next)
+				{
+					// Stop() notifies m_cv, the timeout is only needed to check Emu.IsStopped()
+					m_cv.wait_until(lock, std::min(next, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+					continue;
+				}
+			}
+
+			const u64 pos = m_head % m_ringbuf_size;
+			const u64 size = std::min(std::min(block_size, m_remaining), m_ringbuf_size - pos);
+			const u64 offset = m_offset;
+			lock.unlock();
+
+			u64 res = 0;
+			{
+				LV2_LOCK(0);
+
+				vfsStream* file;
+				if (sys_fs->CheckId(m_fd, file))
+				{
+					res = file->ReadAt(offset, vm::get_ptr<void>(m_buffer + (u32)pos), size);
+				}
+			}
+
+			lock.lock();
+			total += res;
+			m_offset += res;
+			m_head += res;
+			m_remaining = res < size ? 0 : m_remaining - res;
+			m_cv.notify_all();
+			CheckCallback();
+		}
+
+		m_eof = true;
+		m_cv.notify_all();
+		CheckCallback();
+	}
+
+	// returns false if the ring buffer wasn't initialized
+	bool Start(u32 fd, u64 offset, u64 size)
+	{
+		Stop();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_fs_status == CELL_FS_ST_NOT_INITIALIZED)
+		{
+			return false;
+		}
+
+		m_fs_status = CELL_FS_ST_PROGRESS;
+		m_fd = fd;
+		m_offset = offset;
+		m_remaining = size;
+		m_head = 0;
+		m_tail = 0;
+		m_eof = false;
+		m_stop = false;
+		m_thread.start([this]()
+		{
+			Prefetch();
+		});
+
+		return true;
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+			m_cv.notify_all();
+		}
+
+		if (m_thread.joinable())
+		{
+			m_thread.join();
+		}
+	}
 
 } fs_config;
 
+// Keys of the NPDRM EDAT files checked by sceNpDrmIsAvailable, by local path
+struct FsEdatKeys
+{
+	u8 devklic[0x10];
+	u8 rifkey[0x10];
+};
+
+std::mutex g_fs_edat_mutex;
+std::unordered_map<std::string, FsEdatKeys> g_fs_edat_keys;
+
+void fsRegisterEdatKeys(const std::string& local_path, const u8* devklic, const u8* rifkey)
+{
+	std::lock_guard<std::mutex> lock(g_fs_edat_mutex);
+
+	FsEdatKeys& keys = g_fs_edat_keys[local_path];
+	memcpy(keys.devklic, devklic, 0x10);
+	memcpy(keys.rifkey, rifkey, 0x10);
+}
+
+// Replaces the stream of a registered EDAT file with a stream decrypting it on the fly
+static vfsFileBase* fsOpenEdat(const std::string& path, vfsFileBase* stream)
+{
+	std::string local_path;
+	FsEdatKeys keys;
+
+	if (!Emu.GetVFS().GetDevice(path, local_path))
+	{
+		return stream;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(g_fs_edat_mutex);
+
+		auto found = g_fs_edat_keys.find(local_path);
+		if (found == g_fs_edat_keys.end())
+		{
+			return stream;
+		}
+
+		keys = found->second;
+	}
+
+	EDATDecrypter* edat = new EDATDecrypter(std::shared_ptr<vfsFileBase>(stream));
+
+	if (!edat->Init(local_path, keys.devklic, keys.rifkey))
+	{
+		delete edat;
+		sys_fs->Error("\"%s\": EDAT decryption failed", path.c_str());
+		return nullptr;
+	}
+
+	return edat;
+}
+
 
 s32 cellFsOpen(vm::ptr<const char> path, s32 flags, vm::ptr<be_t<u32>> fd, vm::ptr<u32> arg, u64 size)
 {
@@ -109,6 +325,11 @@ s32 cellFsOpen(vm::ptr<const char> path, s32 flags, vm::ptr<be_t<u32>> fd, vm::p
 		return CELL_ENOENT;
 	}
 
+	if (o_mode == vfsRead && !(stream = fsOpenEdat(_path, stream)))
+	{
+		return CELL_EFSSPECIFIC;
+	}
+
 	u32 id = sys_fs->GetNewId(stream, TYPE_FS_FILE);
 	*fd = id;
 	sys_fs->Notice("\"%s\" opened: fd = %d", path.get_ptr(), id);
@@ -166,6 +387,8 @@ s32 cellFsClose(u32 fd)
 
 	LV2_LOCK(0);
 
+	fsAioWaitForFd(fd);
+
 	if (!Emu.GetIdManager().RemoveID(fd))
 		return CELL_ESRCH;
 
@@ -257,11 +480,19 @@ s32 cellFsStat(vm::ptr<const char> path, vm::ptr<CellFsStat> sb)
 	}
 
 	{
-		vfsFile f(_path);
-		if(f.IsOpened())
+		// go through the same lookup as cellFsOpen, so registered EDATs report their decrypted size
+		std::unique_ptr<vfsFileBase> f(Emu.GetVFS().OpenFile(_path, vfsRead));
+		if (f && f->IsOpened())
 		{
+			vfsFileBase* stream = f.release();
+			if (!(stream = fsOpenEdat(_path, stream)))
+			{
+				return CELL_EFSSPECIFIC;
+			}
+			f.reset(stream);
+
 			sb->st_mode |= CELL_FS_S_IFREG;
-			sb->st_size = f.GetSize();
+			sb->st_size = f->GetSize();
 			return CELL_OK;
 		}
 	}
@@ -585,13 +816,26 @@ s32 cellFsStReadInit(u32 fd, vm::ptr<CellFsRingBuffer> ringbuf)
 {
 	sys_fs->Warning("cellFsStReadInit(fd=%d, ringbuf_addr=0x%x)", fd, ringbuf.addr());
 
-	LV2_LOCK(0);
+	{
+		LV2_LOCK(0);
 
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
+
+	if (!ringbuf->ringbuf_size)
+		return CELL_EINVAL;
+
+	fs_config.Stop();
+
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_NOT_INITIALIZED)
+		Memory.Free(fs_config.m_buffer);
 
 	fs_config.m_ring_buffer = *ringbuf;
+	fs_config.m_ringbuf_size = ringbuf->ringbuf_size;
 
     // If the size is less than 1MB
 	if (ringbuf->ringbuf_size < 0x40000000)
@@ -612,13 +856,20 @@ s32 cellFsStReadFinish(u32 fd)
 {
 	sys_fs->Warning("cellFsStReadFinish(fd=%d)", fd);
 
-	LV2_LOCK(0);
+	{
+		LV2_LOCK(0);
 
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
 
-	Memory.Free(fs_config.m_buffer);
+	fs_config.Stop();
+
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_NOT_INITIALIZED)
+		Memory.Free(fs_config.m_buffer);
 	fs_config.m_fs_status = CELL_FS_ST_NOT_INITIALIZED;
 
 	return CELL_OK;
@@ -634,6 +885,8 @@ s32 cellFsStReadGetRingBuf(u32 fd, vm::ptr<CellFsRingBuffer> ringbuf)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
 	*ringbuf = fs_config.m_ring_buffer;
 
 	sys_fs->Warning("*** fs stream config: block_size=0x%llx, copy=%d, ringbuf_size=0x%llx, transfer_rate=0x%llx",
@@ -651,6 +904,8 @@ s32 cellFsStReadGetStatus(u32 fd, vm::ptr<u64> status)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
 	*status = fs_config.m_fs_status;
 
 	return CELL_OK;
@@ -666,6 +921,8 @@ s32 cellFsStReadGetRegid(u32 fd, vm::ptr<u64> regid)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
 	*regid = fs_config.m_regid;
 
 	return CELL_OK;
@@ -673,16 +930,23 @@ s32 cellFsStReadGetRegid(u32 fd, vm::ptr<u64> regid)
 
 s32 cellFsStReadStart(u32 fd, u64 offset, u64 size)
 {
-	sys_fs->Todo("cellFsStReadStart(fd=%d, offset=0x%llx, size=0x%llx)", fd, offset, size);
+	sys_fs->Warning("cellFsStReadStart(fd=%d, offset=0x%llx, size=0x%llx)", fd, offset, size);
 
-	LV2_LOCK(0);
+	u64 file_size;
+	{
+		LV2_LOCK(0);
 
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+
+		file_size = file->GetSize();
+	}
 
-	fs_config.m_current_addr = fs_config.m_buffer + (u32)offset;
-	fs_config.m_fs_status = CELL_FS_ST_PROGRESS;
+	// stream till the end of the file if the size isn't specified
+	const u64 remaining = offset < file_size ? file_size - offset : 0;
+	if (!fs_config.Start(fd, offset, size ? std::min(size, remaining) : remaining))
+		return CELL_EINVAL;
 
 	return CELL_OK;
 }
@@ -691,86 +955,176 @@ s32 cellFsStReadStop(u32 fd)
 {
 	sys_fs->Warning("cellFsStReadStop(fd=%d)", fd);
 
-	LV2_LOCK(0);
+	{
+		LV2_LOCK(0);
 
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
+
+	fs_config.Stop();
 
-	fs_config.m_fs_status = CELL_FS_ST_STOP;
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_NOT_INITIALIZED)
+		fs_config.m_fs_status = CELL_FS_ST_STOP;
 
 	return CELL_OK;
 }
 
 s32 cellFsStRead(u32 fd, u32 buf_addr, u64 size, vm::ptr<u64> rsize)
 {
-	sys_fs->Warning("cellFsStRead(fd=%d, buf_addr=0x%x, size=0x%llx, rsize_addr=0x%x)", fd, buf_addr, size, rsize.addr());
+	sys_fs->Log("cellFsStRead(fd=%d, buf_addr=0x%x, size=0x%llx, rsize_addr=0x%x)", fd, buf_addr, size, rsize.addr());
 
 	LV2_LOCK(0);
-	
+
 	vfsStream* file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	// TODO: use ringbuffer (fs_config)
-	fs_config.m_regid += size;
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	// the stream wasn't started, read the file directly
+	if (fs_config.m_fs_status != CELL_FS_ST_PROGRESS)
+	{
+		fs_config.m_regid += size;
+
+		if (file->Eof())
+			return CELL_FS_ERANGE;
+
+		*rsize = file->Read(vm::get_ptr<void>(buf_addr), size);
 
-	if (file->Eof())
+		return CELL_OK;
+	}
+
+	const u64 count = std::min(size, fs_config.Available());
+	if (!count && fs_config.m_eof)
 		return CELL_FS_ERANGE;
 
-	*rsize = file->Read(vm::get_ptr<void>(buf_addr), size);
+	// copy the data in up to two parts when it wraps around the end of the ring buffer
+	for (u64 done = 0; done < count;)
+	{
+		const u64 pos = (fs_config.m_tail + done) % fs_config.m_ringbuf_size;
+		const u64 part = std::min(count - done, fs_config.m_ringbuf_size - pos);
+		memcpy(vm::get_ptr<u8>(buf_addr + (u32)done), vm::get_ptr<u8>(fs_config.m_buffer + (u32)pos), part);
+		done += part;
+	}
+
+	fs_config.m_tail += count;
+	fs_config.m_regid += count;
+	fs_config.m_cv.notify_all();
+
+	*rsize = count;
 
 	return CELL_OK;
 }
 
 s32 cellFsStReadGetCurrentAddr(u32 fd, vm::ptr<u32> addr, vm::ptr<u64> size)
 {
-	sys_fs->Todo("cellFsStReadGetCurrentAddr(fd=%d, addr_addr=0x%x, size_addr=0x%x)", fd, addr.addr(), size.addr());
+	sys_fs->Log("cellFsStReadGetCurrentAddr(fd=%d, addr_addr=0x%x, size_addr=0x%x)", fd, addr.addr(), size.addr());
 
-	LV2_LOCK(0);
+	{
+		LV2_LOCK(0);
 
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
+
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_PROGRESS)
+		return CELL_EINVAL;
+
+	// return the contiguous part of the data
+	const u64 pos = fs_config.m_tail % fs_config.m_ringbuf_size;
+	const u64 count = std::min(fs_config.Available(), fs_config.m_ringbuf_size - pos);
+	if (!count && fs_config.m_eof)
+		return CELL_FS_ERANGE;
+
+	*addr = fs_config.m_buffer + (u32)pos;
+	*size = count;
 
 	return CELL_OK;
 }
 
 s32 cellFsStReadPutCurrentAddr(u32 fd, u32 addr_addr, u64 size)
 {
-	sys_fs->Todo("cellFsStReadPutCurrentAddr(fd=%d, addr_addr=0x%x, size=0x%llx)", fd, addr_addr, size);
+	sys_fs->Log("cellFsStReadPutCurrentAddr(fd=%d, addr_addr=0x%x, size=0x%llx)", fd, addr_addr, size);
 
-	LV2_LOCK(0);
-	
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
+	{
+		LV2_LOCK(0);
+
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
+
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_PROGRESS)
+		return CELL_EINVAL;
+
+	const u64 count = std::min(size, fs_config.Available());
+	fs_config.m_tail += count;
+	fs_config.m_regid += count;
+	fs_config.m_cv.notify_all();
 
 	return CELL_OK;
 }
 
 s32 cellFsStReadWait(u32 fd, u64 size)
 {
-	sys_fs->Todo("cellFsStReadWait(fd=%d, size=0x%llx)", fd, size);
+	sys_fs->Log("cellFsStReadWait(fd=%d, size=0x%llx)", fd, size);
+
+	{
+		LV2_LOCK(0);
+
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
+
+	std::unique_lock<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_PROGRESS)
+		return CELL_OK;
+
+	while (fs_config.Available() < size && !fs_config.m_eof)
+	{
+		if (Emu.IsStopped())
+		{
+			sys_fs->Warning("cellFsStReadWait(fd=%d) aborted", fd);
+			return CELL_OK;
+		}
+
+		fs_config.m_cv.wait_for(lock, std::chrono::milliseconds(100));
+	}
 
-	LV2_LOCK(0);
-	
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
-	
 	return CELL_OK;
 }
 
 s32 cellFsStReadWaitCallback(u32 fd, u64 size, vm::ptr<void (*)(int xfd, u64 xsize)> func)
 {
-	sys_fs->Todo("cellFsStReadWaitCallback(fd=%d, size=0x%llx, func_addr=0x%x)", fd, size, func.addr());
+	sys_fs->Log("cellFsStReadWaitCallback(fd=%d, size=0x%llx, func_addr=0x%x)", fd, size, func.addr());
 
-	LV2_LOCK(0);
+	{
+		LV2_LOCK(0);
+
+		vfsStream* file;
+		if (!sys_fs->CheckId(fd, file))
+			return CELL_ESRCH;
+	}
+
+	std::lock_guard<std::mutex> lock(fs_config.m_mutex);
+
+	if (fs_config.m_fs_status != CELL_FS_ST_PROGRESS)
+		return CELL_EINVAL;
+
+	fs_config.m_cb_size = size;
+	fs_config.m_cb_func = func;
+	fs_config.CheckCallback();
 
-	vfsStream* file;
-	if (!sys_fs->CheckId(fd, file))
-		return CELL_ESRCH;
-	
 	return CELL_OK;
 }
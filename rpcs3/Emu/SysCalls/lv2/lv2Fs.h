@@ -162,3 +162,9 @@ s32 cellFsStReadGetCurrentAddr(u32 fd, vm::ptr<u32> addr_addr, vm::ptr<u64> size
 s32 cellFsStReadPutCurrentAddr(u32 fd, u32 addr_addr, u64 size);
 s32 cellFsStReadWait(u32 fd, u64 size);
 s32 cellFsStReadWaitCallback(u32 fd, u64 size, vm::ptr<void (*)(int xfd, u64 xsize)> func);
+
+// NPDRM: cellFsOpen decrypts the registered EDAT files on the fly (lv2Fs.cpp)
+void fsRegisterEdatKeys(const std::string& local_path, const u8* devklic, const u8* rifkey);
+
+// AIO (sys_fs.cpp)
+void fsAioWaitForFd(u32 fd);
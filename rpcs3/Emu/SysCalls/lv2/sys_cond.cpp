@@ -5,6 +5,7 @@
 
 #include "Emu/CPU/CPUThreadManager.h"
 #include "Emu/Cell/PPUThread.h"
+#include "sys_time.h"
 #include "sys_cond.h"
 
 SysCallBase sys_cond("sys_cond");
@@ -80,7 +81,7 @@ s32 sys_cond_signal(u32 cond_id)
 
 	if (u32 target = (mutex->protocol == SYS_SYNC_PRIORITY ? cond->m_queue.pop_prio() : cond->m_queue.pop()))
 	{
-		cond->signal.lock(target);
+		cond->signal.lock_for(target);
 
 		if (Emu.IsStopped())
 		{
@@ -106,7 +107,7 @@ s32 sys_cond_signal_all(u32 cond_id)
 	while (u32 target = (mutex->protocol == SYS_SYNC_PRIORITY ? cond->m_queue.pop_prio() : cond->m_queue.pop()))
 	{
 		cond->signaler = GetCurrentPPUThread().GetId();
-		cond->signal.lock(target);
+		cond->signal.lock_for(target);
 
 		if (Emu.IsStopped())
 		{
@@ -143,7 +144,7 @@ s32 sys_cond_signal_to(u32 cond_id, u32 thread_id)
 
 	u32 target = thread_id;
 	{
-		cond->signal.lock(target);
+		cond->signal.lock_for(target);
 	}
 
 	if (Emu.IsStopped())
@@ -182,8 +183,7 @@ s32 sys_cond_wait(u32 cond_id, u64 timeout)
 	mutex->recursive = 0;
 	mutex->m_mutex.unlock(tid, mutex->protocol == SYS_SYNC_PRIORITY ? mutex->m_queue.pop_prio() : mutex->m_queue.pop());
 
-	u64 counter = 0;
-	const u64 max_counter = timeout ? (timeout / 1000) : ~0ull;
+	const u64 start_time = get_system_time();
 
 	while (true)
 	{
@@ -212,9 +212,10 @@ s32 sys_cond_wait(u32 cond_id, u64 timeout)
 			return CELL_OK;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		// sleep until signaled or timed out
+		cond->signal.wait_for(tid, [&]() { return timeout && get_system_time() - start_time > timeout; });
 
-		if (counter++ > max_counter)
+		if (timeout && get_system_time() - start_time > timeout)
 		{
 			cond->m_queue.invalidate(tid);
 			GetCurrentPPUThread().owned_mutexes--; // ???
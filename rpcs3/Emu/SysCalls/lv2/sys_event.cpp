@@ -6,6 +6,7 @@
 #include "Emu/Cell/PPUThread.h"
 #include "Emu/Event.h"
 #include "sys_process.h"
+#include "sys_time.h"
 #include "sys_event.h"
 
 SysCallBase sys_event("sys_event");
@@ -172,8 +173,7 @@ s32 sys_event_queue_receive(u32 equeue_id, vm::ptr<sys_event_data> dummy_event,
 
 	eq->sq.push(tid); // add thread to sleep queue
 
-	timeout = timeout ? (timeout / 1000) : ~0;
-	u64 counter = 0;
+	const u64 start_time = get_system_time();
 	while (true)
 	{
 		switch (eq->owner.trylock(tid))
@@ -212,8 +212,10 @@ s32 sys_event_queue_receive(u32 equeue_id, vm::ptr<sys_event_data> dummy_event,
 		default: eq->sq.invalidate(tid); return CELL_ECANCELED;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
-		if (counter++ > timeout || Emu.IsStopped())
+		// sleep until the queue is passed to this thread or new events arrive
+		eq->owner.wait_for(tid, [&]() { return eq->is_ready() || (timeout && get_system_time() - start_time > timeout); });
+
+		if ((timeout && get_system_time() - start_time > timeout) || Emu.IsStopped())
 		{
 			if (Emu.IsStopped()) sys_event.Warning("sys_event_queue_receive(equeue=%d) aborted", equeue_id);
 			eq->sq.invalidate(tid);
@@ -370,7 +372,7 @@ s32 sys_event_port_send(u32 eport_id, u64 data1, u64 data2, u64 data3)
 		return CELL_ENOTCONN;
 	}
 
-	if (!eq->events.push(eport->name, data1, data2, data3))
+	if (!eq->push(eport->name, data1, data2, data3))
 	{
 		return CELL_EBUSY;
 	}
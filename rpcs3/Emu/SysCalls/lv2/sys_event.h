@@ -214,6 +214,25 @@ struct EventQueue
 	{
 		owner.initialize();
 	}
+
+	bool push(u64 name, u64 d1, u64 d2, u64 d3)
+	{
+		if (!events.push(name, d1, d2, d3))
+		{
+			return false;
+		}
+
+		// wake up receivers
+		owner.notify();
+		return true;
+	}
+
+	// true if a waiting receiver should try to take the queue (new events or the queue has been destroyed)
+	bool is_ready()
+	{
+		const u32 value = owner.GetOwner();
+		return value == owner.GetDeadValue() || (value == owner.GetFreeValue() && events.count());
+	}
 };
 
 // Aux
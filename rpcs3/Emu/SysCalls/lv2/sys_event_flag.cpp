@@ -4,6 +4,7 @@
 #include "Emu/SysCalls/SysCalls.h"
 
 #include "Emu/Cell/PPUThread.h"
+#include "sys_time.h"
 #include "sys_lwmutex.h"
 #include "sys_event_flag.h"
 
@@ -159,8 +160,7 @@ s32 sys_event_flag_wait(u32 eflag_id, u64 bitptn, u32 mode, vm::ptr<u64> result,
 		ef->m_mutex.unlock(tid);
 	}
 
-	u64 counter = 0;
-	const u64 max_counter = timeout ? (timeout / 1000) : ~0;
+	const u64 start_time = get_system_time();
 
 	while (true)
 	{
@@ -207,9 +207,10 @@ s32 sys_event_flag_wait(u32 eflag_id, u64 bitptn, u32 mode, vm::ptr<u64> result,
 			return CELL_ECANCELED;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		// sleep until signaled or timed out
+		ef->signal.wait_for(tid, [&]() { return timeout && get_system_time() - start_time > timeout; });
 
-		if (counter++ > max_counter)
+		if (timeout && get_system_time() - start_time > timeout)
 		{
 			ef->m_mutex.lock(tid);
 
@@ -299,7 +300,7 @@ s32 sys_event_flag_set(u32 eflag_id, u64 bitptn)
 	if (u32 target = ef->check())
 	{
 		// if signal, leave both mutexes locked...
-		ef->signal.lock(target);
+		ef->signal.lock_for(target);
 		ef->m_mutex.unlock(tid, target);
 	}
 	else
@@ -348,7 +349,7 @@ s32 sys_event_flag_cancel(u32 eflag_id, vm::ptr<u32> num)
 
 	for (u32 i = 0; i < tids.size(); i++)
 	{
-		ef->signal.lock(tids[i]);
+		ef->signal.lock_for(tids[i]);
 	}
 
 	if (Emu.IsStopped())
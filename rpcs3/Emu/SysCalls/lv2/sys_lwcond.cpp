@@ -4,6 +4,7 @@
 #include "Emu/SysCalls/SysCalls.h"
 
 #include "Emu/Cell/PPUThread.h"
+#include "sys_time.h"
 #include "sys_lwmutex.h"
 #include "sys_lwcond.h"
 
@@ -74,7 +75,7 @@ s32 sys_lwcond_signal(vm::ptr<sys_lwcond_t> lwcond)
 
 	if (u32 target = (mutex->attribute.ToBE() == se32(SYS_SYNC_PRIORITY) ? lw->m_queue.pop_prio() : lw->m_queue.pop()))
 	{
-		lw->signal.lock(target);
+		lw->signal.lock_for(target);
 
 		if (Emu.IsStopped())
 		{
@@ -100,7 +101,7 @@ s32 sys_lwcond_signal_all(vm::ptr<sys_lwcond_t> lwcond)
 
 	while (u32 target = (mutex->attribute.ToBE() == se32(SYS_SYNC_PRIORITY) ? lw->m_queue.pop_prio() : lw->m_queue.pop()))
 	{
-		lw->signal.lock(target);
+		lw->signal.lock_for(target);
 
 		if (Emu.IsStopped())
 		{
@@ -134,7 +135,7 @@ s32 sys_lwcond_signal_to(vm::ptr<sys_lwcond_t> lwcond, u32 ppu_thread_id)
 
 	u32 target = ppu_thread_id;
 	{
-		lw->signal.lock(target);
+		lw->signal.lock_for(target);
 
 		if (Emu.IsStopped())
 		{
@@ -192,8 +193,7 @@ s32 sys_lwcond_wait(vm::ptr<sys_lwcond_t> lwcond, u64 timeout)
 			(u32)lwcond->lwcond_queue, (u32)mutex->sleep_queue);
 	}
 
-	u64 counter = 0;
-	const u64 max_counter = timeout ? (timeout / 1000) : ~0;
+	const u64 start_time = get_system_time();
 
 	while (true)
 	{
@@ -214,9 +214,10 @@ s32 sys_lwcond_wait(vm::ptr<sys_lwcond_t> lwcond, u64 timeout)
 			return CELL_OK;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		// sleep until signaled or timed out
+		lw->signal.wait_for(tid, [&]() { return timeout && get_system_time() - start_time > timeout; });
 
-		if (counter++ > max_counter)
+		if (timeout && get_system_time() - start_time > timeout)
 		{
 			lw->m_queue.invalidate(tid_le);
 			return CELL_ETIMEDOUT;
@@ -5,6 +5,7 @@
 
 #include "Emu/FS/VFS.h"
 #include "Emu/FS/vfsFile.h"
+#include "Emu/FS/vfsStreamBuffer.h"
 #include "Crypto/unself.h"
 #include "sys_prx.h"
 
@@ -18,15 +19,17 @@ s32 sys_prx_load_module(vm::ptr<const char> path, u64 flags, vm::ptr<sys_prx_loa
 	// Check if the file is SPRX
 	std::string local_path;
 	Emu.GetVFS().GetDevice(_path, local_path);
-	if (IsSelf(local_path)) {
-		if (!DecryptSelf(local_path+".prx", local_path)) {
+
+	vfsStreamBuffer prx_elf;
+	vfsFile prx_file;
+	vfsStream& f = IsSelf(local_path) ? (vfsStream&)prx_elf : (vfsStream&)prx_file;
+
+	if (&f == &prx_elf) {
+		if (!DecryptSelf(prx_elf, local_path)) {
 			return CELL_PRX_ERROR_ILLEGAL_LIBRARY;
 		}
-		_path += ".prx";
 	}
-
-	vfsFile f(_path);
-	if (!f.IsOpened()) {
+	else if (!prx_file.Open(_path)) {
 		return CELL_PRX_ERROR_UNKNOWN_MODULE;
 	}
 
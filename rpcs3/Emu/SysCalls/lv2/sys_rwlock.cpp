@@ -3,12 +3,72 @@
 #include "Emu/System.h"
 #include "Emu/SysCalls/SysCalls.h"
 
+#include "Emu/CPU/CPUThreadManager.h"
 #include "Emu/Cell/PPUThread.h"
+#include "sys_time.h"
 #include "sys_lwmutex.h"
 #include "sys_rwlock.h"
 
 SysCallBase sys_rwlock("sys_rwlock");
 
+waiter_map_t g_rwlock_wm("rwlock_wm"); // signal_id = rwlock id
+
+u32 RWLock::wlock_next() const
+{
+	if (m_protocol == SYS_SYNC_FIFO)
+	{
+		return 0;
+	}
+
+	// SYS_SYNC_PRIORITY: the first of the writers with the highest priority
+	u64 highest_prio = ~0ull;
+	u32 sel = 0;
+	for (u32 i = 0; i < wlock_queue.size(); i++)
+	{
+		CPUThread* t = Emu.GetCPU().GetThread(wlock_queue[i]);
+		if (!t)
+		{
+			// the thread doesn't exist anymore, let its waiters pass it
+			continue;
+		}
+
+		const u64 prio = t->GetPrio();
+		if (prio < highest_prio)
+		{
+			highest_prio = prio;
+			sel = i;
+		}
+	}
+	return sel;
+}
+
+// wake up the threads which can take the lock in its current state
+void rwlock_notify(u32 rw_lock_id, RWLock* rw)
+{
+	u32 target = 0;
+	{
+		std::lock_guard<std::mutex> lock(rw->m_lock);
+
+		if (rw->wlock_thread)
+		{
+			return; // nobody can take the lock until wunlock
+		}
+
+		if (rw->wlock_queue.size())
+		{
+			if (rw->rlock_list.size())
+			{
+				return; // readers don't pass queued writers, the first writer waits for the last runlock
+			}
+
+			target = rw->wlock_queue[rw->wlock_next()]; // only the next writer can take the lock
+		}
+	}
+
+	// all waiting readers can take the lock if no writer is queued (everyone is woken up if the writer isn't found either)
+	g_rwlock_wm.notify(rw_lock_id, target ? Emu.GetCPU().GetThread(target) : nullptr);
+}
+
 s32 sys_rwlock_create(vm::ptr<u32> rw_lock_id, vm::ptr<sys_rwlock_attribute_t> attr)
 {
 	sys_rwlock.Warning("sys_rwlock_create(rw_lock_id_addr=0x%x, attr_addr=0x%x)", rw_lock_id.addr(), attr.addr());
@@ -18,7 +78,7 @@ s32 sys_rwlock_create(vm::ptr<u32> rw_lock_id, vm::ptr<sys_rwlock_attribute_t> a
 
 	switch (attr->attr_protocol.ToBE())
 	{
-	case se32(SYS_SYNC_PRIORITY): sys_rwlock.Todo("SYS_SYNC_PRIORITY"); break;
+	case se32(SYS_SYNC_PRIORITY): break;
 	case se32(SYS_SYNC_RETRY): sys_rwlock.Error("SYS_SYNC_RETRY"); return CELL_EINVAL;
 	case se32(SYS_SYNC_PRIORITY_INHERIT): sys_rwlock.Todo("SYS_SYNC_PRIORITY_INHERIT"); break;
 	case se32(SYS_SYNC_FIFO): break;
@@ -66,31 +126,32 @@ s32 sys_rwlock_rlock(u32 rw_lock_id, u64 timeout)
 
 	if (rw->rlock_trylock(tid)) return CELL_OK;
 
-	u64 counter = 0;
-	const u64 max_counter = timeout ? (timeout / 1000) : 20000;
-	do
+	const u64 start_time = get_system_time();
+	s32 result = CELL_OK;
+
+	g_rwlock_wm.wait_op(rw_lock_id, [&]() -> bool
 	{
-		if (Emu.IsStopped())
+		if (rw->rlock_trylock(tid))
 		{
-			sys_rwlock.Warning("sys_rwlock_rlock(rw_lock_id=%d, ...) aborted", rw_lock_id);
-			return CELL_ETIMEDOUT;
+			return true;
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-		if (rw->rlock_trylock(tid)) return CELL_OK;
 
-		if (counter++ > max_counter)
+		if (timeout && get_system_time() - start_time > timeout)
 		{
-			if (!timeout) 
-			{
-				counter = 0;
-			}
-			else
-			{
-				return CELL_ETIMEDOUT;
-			}
-		}		
-	} while (true);
+			result = CELL_ETIMEDOUT;
+			return true;
+		}
+
+		return false;
+	});
+
+	if (Emu.IsStopped())
+	{
+		sys_rwlock.Warning("sys_rwlock_rlock(rw_lock_id=%d, ...) aborted", rw_lock_id);
+		return CELL_ETIMEDOUT;
+	}
+
+	return result;
 }
 
 s32 sys_rwlock_tryrlock(u32 rw_lock_id)
@@ -114,6 +175,7 @@ s32 sys_rwlock_runlock(u32 rw_lock_id)
 
 	if (!rw->rlock_unlock(GetCurrentPPUThread().GetId())) return CELL_EPERM;
 
+	rwlock_notify(rw_lock_id, rw);
 	return CELL_OK;
 }
 
@@ -129,31 +191,42 @@ s32 sys_rwlock_wlock(u32 rw_lock_id, u64 timeout)
 
 	if (rw->wlock_trylock(tid, true)) return CELL_OK;
 
-	u64 counter = 0;
-	const u64 max_counter = timeout ? (timeout / 1000) : 20000;
-	do
+	const u64 start_time = get_system_time();
+	s32 result = CELL_OK;
+
+	bool locked = false;
+
+	g_rwlock_wm.wait_op(rw_lock_id, [&]() -> bool
 	{
-		if (Emu.IsStopped())
+		if (rw->wlock_trylock(tid, true))
 		{
-			sys_rwlock.Warning("sys_rwlock_wlock(rw_lock_id=%d, ...) aborted", rw_lock_id);
-			return CELL_ETIMEDOUT;
+			locked = true;
+			return true;
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
-		if (rw->wlock_trylock(tid, true)) return CELL_OK;
-
-		if (counter++ > max_counter)
+		if (timeout && get_system_time() - start_time > timeout)
 		{
-			if (!timeout) 
-			{
-				counter = 0;
-			}
-			else
-			{
-				return CELL_ETIMEDOUT;
-			}
-		}		
-	} while (true);
+			result = CELL_ETIMEDOUT;
+			return true;
+		}
+
+		return false;
+	});
+
+	if (!locked)
+	{
+		// the queue would be blocked by this thread, the next writer or the readers may take the lock now
+		rw->wlock_dequeue(tid);
+		rwlock_notify(rw_lock_id, rw);
+	}
+
+	if (Emu.IsStopped())
+	{
+		sys_rwlock.Warning("sys_rwlock_wlock(rw_lock_id=%d, ...) aborted", rw_lock_id);
+		return CELL_ETIMEDOUT;
+	}
+
+	return result;
 }
 
 s32 sys_rwlock_trywlock(u32 rw_lock_id)
@@ -180,5 +253,6 @@ s32 sys_rwlock_wunlock(u32 rw_lock_id)
 
 	if (!rw->wlock_unlock(GetCurrentPPUThread().GetId())) return CELL_EPERM;
 
+	rwlock_notify(rw_lock_id, rw);
 	return CELL_OK;
 }
@@ -20,7 +20,7 @@ struct RWLock
 	u32 wlock_thread; // write lock owner
 	std::vector<u32> wlock_queue; // write lock queue
 	std::vector<u32> rlock_list; // read lock list
-	u32 m_protocol; // TODO
+	u32 m_protocol; // SYS_SYNC_FIFO or SYS_SYNC_PRIORITY (the order of the queued writers, PRIORITY_INHERIT works as PRIORITY)
 
 	union
 	{
@@ -35,6 +35,9 @@ struct RWLock
 	{
 	}
 
+	// position of the queued writer which takes the lock next (m_lock must be locked, the queue must not be empty)
+	u32 wlock_next() const;
+
 	bool rlock_trylock(u32 tid)
 	{
 		std::lock_guard<std::mutex> lock(m_lock);
@@ -104,11 +107,12 @@ struct RWLock
 		{
 			if (wlock_queue.size())
 			{
-				// SYNC_FIFO only yet
-				if (wlock_queue[0] == tid)
+				const u32 next = wlock_next();
+
+				if (wlock_queue[next] == tid)
 				{
 					wlock_thread = tid;
-					wlock_queue.erase(wlock_queue.begin());
+					wlock_queue.erase(wlock_queue.begin() + next);
 					return true;
 				}
 				else
@@ -136,6 +140,21 @@ struct RWLock
 		}
 	}
 
+	// remove the thread which stopped waiting (timeout) from the queue
+	void wlock_dequeue(u32 tid)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		for (u32 i = (u32)wlock_queue.size() - 1; ~i; i--)
+		{
+			if (wlock_queue[i] == tid)
+			{
+				wlock_queue.erase(wlock_queue.begin() + i);
+				return;
+			}
+		}
+	}
+
 	bool wlock_unlock(u32 tid)
 	{
 		std::lock_guard<std::mutex> lock(m_lock);
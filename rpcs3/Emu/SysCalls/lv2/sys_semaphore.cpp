@@ -10,6 +10,8 @@
 
 SysCallBase sys_semaphore("sys_semaphore");
 
+waiter_map_t g_semaphore_wm("semaphore_wm"); // signal_id = semaphore id
+
 u32 semaphore_create(s32 initial_count, s32 max_count, u32 protocol, u64 name_u64)
 {
 	LV2_LOCK(0);
@@ -106,18 +108,15 @@ s32 sys_semaphore_wait(u32 sem_id, u64 timeout)
 		sem->m_queue.push(tid);
 	}
 
-	while (true)
-	{
-		if (Emu.IsStopped())
-		{
-			sys_semaphore.Warning("sys_semaphore_wait(%d) aborted", sem_id);
-			return CELL_OK;
-		}
+	s32 result = CELL_OK;
 
+	g_semaphore_wm.wait_op(sem_id, [&]() -> bool
+	{
 		if (timeout && get_system_time() - start_time > timeout)
 		{
 			sem->m_queue.invalidate(tid);
-			return CELL_ETIMEDOUT;
+			result = CELL_ETIMEDOUT;
+			return true;
 		}
 
 		if (tid == sem->signal)
@@ -126,14 +125,24 @@ s32 sys_semaphore_wait(u32 sem_id, u64 timeout)
 
 			if (tid != sem->signal)
 			{
-				continue;
+				return false;
 			}
 			sem->signal = 0;
-			return CELL_OK;
+			return true;
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return false;
+	});
+
+	if (Emu.IsStopped())
+	{
+		sys_semaphore.Warning("sys_semaphore_wait(%d) aborted", sem_id);
+		return CELL_OK;
 	}
+
+	// the signal has been consumed, wake up threads waiting in sys_semaphore_post()
+	g_semaphore_wm.notify(sem_id);
+	return result;
 }
 
 s32 sys_semaphore_trywait(u32 sem_id)
@@ -181,29 +190,42 @@ s32 sys_semaphore_post(u32 sem_id, s32 count)
 
 	while (count > 0)
 	{
+		// wait until the previous signal is consumed
+		g_semaphore_wm.wait_op(sem_id, [sem]()
+		{
+			return !sem->signal || !sem->m_queue.count();
+		});
+
 		if (Emu.IsStopped())
 		{
 			sys_semaphore.Warning("sys_semaphore_post(%d) aborted", sem_id);
 			return CELL_OK;
 		}
 
-		std::lock_guard<std::mutex> lock(sem->m_mutex);
-
-		if (sem->signal && sem->m_queue.count())
+		u32 target;
 		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
-			continue;
-		}
+			std::lock_guard<std::mutex> lock(sem->m_mutex);
 
-		if (u32 target = (sem->protocol == SYS_SYNC_FIFO) ? sem->m_queue.pop() : sem->m_queue.pop_prio())
-		{
-			count--;
-			sem->signal = target;
+			if (sem->signal && sem->m_queue.count())
+			{
+				continue;
+			}
+
+			if ((target = (sem->protocol == SYS_SYNC_FIFO) ? sem->m_queue.pop() : sem->m_queue.pop_prio()))
+			{
+				count--;
+				sem->signal = target;
+			}
+			else
+			{
+				sem->m_value += count;
+				count = 0;
+			}
 		}
-		else
+
+		if (target)
 		{
-			sem->m_value += count;
-			count = 0;
+			g_semaphore_wm.notify(sem_id, Emu.GetCPU().GetThread(target));
 		}
 	}
 
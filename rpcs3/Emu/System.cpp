@@ -11,6 +11,7 @@
 #include "Emu/Cell/SPUThread.h"
 #include "Emu/Cell/PPUInstrTable.h"
 #include "Emu/FS/vfsFile.h"
+#include "Emu/FS/vfsStreamBuffer.h"
 #include "Emu/FS/vfsDeviceLocalFile.h"
 #include "Emu/DbgCommand.h"
 
@@ -202,7 +203,11 @@ void Emulator::Load()
 
 	if (!rExists(m_path)) return;
 
-	if (IsSelf(m_path))
+	// the decrypted ELF file is loaded from memory
+	vfsStreamBuffer self_elf;
+	const bool is_self = IsSelf(m_path);
+
+	if (is_self)
 	{
 		std::string elf_path = rFileName(m_path).GetPath();
 
@@ -215,7 +220,7 @@ void Emulator::Load()
 			elf_path += "/" + rFileName(m_path).GetName() + ".elf";
 		}
 
-		if (!DecryptSelf(elf_path, m_path))
+		if (!DecryptSelf(self_elf, m_path))
 			return;
 
 		m_path = elf_path;
@@ -263,15 +268,15 @@ void Emulator::Load()
 		GetVFS().GetDeviceLocal(m_path, m_elf_path);
 	}
 
-	vfsFile f(m_elf_path);
+	vfsFile f;
 
-	if(!f.IsOpened())
+	if(!is_self && !f.Open(m_elf_path))
 	{
 		LOG_ERROR(LOADER, "Elf not found! (%s - %s)", m_path.c_str(), m_elf_path.c_str());
 		return;
 	}
 
-	if (!m_loader.load(f))
+	if (!m_loader.load(is_self ? (vfsStream&)self_elf : (vfsStream&)f))
 	{
 		LOG_ERROR(LOADER, "Loading '%s' failed", m_elf_path.c_str());
 		vm::close();
@@ -344,6 +349,7 @@ void Emulator::Pause()
 
 	if (InterlockedCompareExchange((volatile u32*)&m_status, Paused, Running) == Running)
 	{
+		SendCPUEvent(CPU_EVENT_STATE);
 		SendDbgCommand(DID_PAUSED_EMU);
 	}
 }
@@ -355,6 +361,7 @@ void Emulator::Resume()
 	SendDbgCommand(DID_RESUME_EMU);
 
 	m_status = Running;
+	SendCPUEvent(CPU_EVENT_STATE);
 
 	CheckStatus();
 	//if(IsRunning() && Ini.CPUDecoderMode.GetValue() != 1) GetCPU().Exec();
@@ -368,6 +375,7 @@ void Emulator::Stop()
 
 	SendDbgCommand(DID_STOP_EMU);
 	m_status = Stopped;
+	SendCPUEvent(CPU_EVENT_STATE);
 
 	u32 uncounted = 0;
 	u32 counter = 0;
@@ -386,7 +394,7 @@ void Emulator::Stop()
 	// TODO: check finalization order
 
 	SavePoints(BreakPointsDBName);
-	m_break_points.clear();
+	UpdateBreakPoints([](std::unordered_set<u64>& break_points) { break_points.clear(); });
 	m_marked_points.clear();
 
 	GetVFS().UnMountAll();
@@ -411,18 +419,72 @@ void Emulator::Stop()
 	SendDbgCommand(DID_STOPPED_EMU);
 }
 
+void Emulator::UpdateBreakPoints(const std::function<void(std::unordered_set<u64>&)>& update)
+{
+	std::lock_guard<std::mutex> lock(m_break_points_mutex);
+
+	std::unordered_set<u64> break_points;
+
+	if (m_break_points)
+	{
+		break_points = *m_break_points;
+	}
+
+	update(break_points);
+
+	std::shared_ptr<const std::unordered_set<u64>> published;
+
+	if (!break_points.empty())
+	{
+		published = std::make_shared<std::unordered_set<u64>>(std::move(break_points));
+	}
+
+	// the CPU threads load the new set when they handle the event
+	std::atomic_store(&m_break_points, published);
+	SendCPUEvent(CPU_EVENT_BREAKPOINT);
+}
+
+bool Emulator::IsBreakPoint(u64 addr) const
+{
+	const auto break_points = GetBreakPoints();
+	return break_points && break_points->count(addr) != 0;
+}
+
+void Emulator::AddBreakPoint(u64 addr)
+{
+	UpdateBreakPoints([addr](std::unordered_set<u64>& break_points) { break_points.insert(addr); });
+}
+
+void Emulator::RemoveBreakPoint(u64 addr)
+{
+	UpdateBreakPoints([addr](std::unordered_set<u64>& break_points) { break_points.erase(addr); });
+}
+
+void Emulator::SendCPUEvent(u32 event)
+{
+	GetCPU().SendEvent(event);
+}
+
 void Emulator::SavePoints(const std::string& path)
 {
 	std::ofstream f(path, std::ios::binary | std::ios::trunc);
 
-	u32 break_count = (u32)m_break_points.size();
+	const auto break_set = GetBreakPoints();
+	std::vector<u64> break_points;
+
+	if (break_set)
+	{
+		break_points.assign(break_set->begin(), break_set->end());
+	}
+
+	u32 break_count = (u32)break_points.size();
 	u32 marked_count = (u32)m_marked_points.size();
 
 	f << bpdb_version << break_count << marked_count;
 	
 	if(break_count)
 	{
-		f.write(reinterpret_cast<char*>(&m_break_points[0]), sizeof(u64) * break_count);
+		f.write(reinterpret_cast<char*>(&break_points[0]), sizeof(u64) * break_count);
 	}
 
 	if(marked_count)
@@ -455,8 +517,9 @@ void Emulator::LoadPoints(const std::string& path)
 
 	if(break_count > 0)
 	{
-		m_break_points.resize(break_count);
-		f.read(reinterpret_cast<char*>(&m_break_points[0]), sizeof(u64) * break_count);
+		std::vector<u64> break_points(break_count);
+		f.read(reinterpret_cast<char*>(&break_points[0]), sizeof(u64) * break_count);
+		UpdateBreakPoints([&](std::unordered_set<u64>& set) { set.insert(break_points.begin(), break_points.end()); });
 	}
 
 	if(marked_count > 0)
@@ -88,7 +88,10 @@ class Emulator
 	u32 m_cpu_thr_stop;
 	std::vector<std::unique_ptr<ModuleInitializer>> m_modules_init;
 
-	std::vector<u64> m_break_points;
+	// the GUI thread edits the breakpoints while the CPU threads check them, so a published set is never modified:
+	// an edit replaces it with an updated copy (nullptr if there are no breakpoints)
+	std::shared_ptr<const std::unordered_set<u64>> m_break_points;
+	std::mutex m_break_points_mutex; // serializes the edits
 	std::vector<u64> m_marked_points;
 
 	std::recursive_mutex m_core_mutex;
@@ -110,6 +113,8 @@ class Emulator
 	EmuInfo m_info;
 	loader::loader m_loader;
 
+	void UpdateBreakPoints(const std::function<void(std::unordered_set<u64>&)>& update);
+
 public:
 	std::string m_path;
 	std::string m_elf_path;
@@ -162,13 +167,21 @@ public:
 	AudioManager&     GetAudioManager()    { return *m_audio_manager; }
 	CallbackManager&  GetCallbackManager() { return *m_callback_manager; }
 	VFS&              GetVFS()             { return *m_vfs; }
-	std::vector<u64>& GetBreakPoints()     { return m_break_points; }
+	// a snapshot of the breakpoints (nullptr if there are none), the later edits don't change it
+	std::shared_ptr<const std::unordered_set<u64>> GetBreakPoints() const { return std::atomic_load(&m_break_points); }
 	std::vector<u64>& GetMarkedPoints()    { return m_marked_points; }
 	EventManager&     GetEventManager()    { return *m_event_manager; }
 	StaticFuncManager& GetSFuncManager()   { return *m_sfunc_manager; }
 	ModuleManager&    GetModuleManager()   { return *m_module_manager; }
 	SyncPrimManager&  GetSyncPrimManager() { return *m_sync_prim_manager; }
 
+	bool IsBreakPoint(u64 addr) const;
+	void AddBreakPoint(u64 addr);
+	void RemoveBreakPoint(u64 addr);
+
+	// request the status check from all CPU threads
+	void SendCPUEvent(u32 event);
+
 	void AddModuleInit(std::unique_ptr<ModuleInitializer> m)
 	{
 		m_modules_init.push_back(std::move(m));
@@ -559,32 +559,18 @@ void InterpreterDisAsmFrame::MouseWheel(wxMouseEvent& event)
 
 bool InterpreterDisAsmFrame::IsBreakPoint(u64 pc)
 {
-	for(u32 i=0; i<Emu.GetBreakPoints().size(); ++i)
-	{
-		if(Emu.GetBreakPoints()[i] == pc) return true;
-	}
-
-	return false;
+	return Emu.IsBreakPoint(pc);
 }
 
 void InterpreterDisAsmFrame::AddBreakPoint(u64 pc)
 {
-	for(u32 i=0; i<Emu.GetBreakPoints().size(); ++i)
-	{
-		if(Emu.GetBreakPoints()[i] == pc) return;
-	}
-
-	Emu.GetBreakPoints().push_back(pc);
+	Emu.AddBreakPoint(pc);
 }
 
 bool InterpreterDisAsmFrame::RemoveBreakPoint(u64 pc)
 {
-	for(u32 i=0; i<Emu.GetBreakPoints().size(); ++i)
-	{
-		if(Emu.GetBreakPoints()[i] != pc) continue;
-		Emu.GetBreakPoints().erase(Emu.GetBreakPoints().begin() + i);
-		return true;
-	}
+	if(!Emu.IsBreakPoint(pc)) return false;
 
-	return false;
+	Emu.RemoveBreakPoint(pc);
+	return true;
 }
@@ -413,6 +413,8 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	wxComboBox* cbox_hle_loglvl       = new wxComboBox(p_hle, wxID_ANY);
 	wxComboBox* cbox_sys_lang         = new wxComboBox(p_system, wxID_ANY);
 
+	wxCheckBox* chbox_spu_jit_cache       = new wxCheckBox(p_cpu, wxID_ANY, "Cache compiled SPU code");
+	wxCheckBox* chbox_spu_jit_logging     = new wxCheckBox(p_cpu, wxID_ANY, "Log SPU JIT output");
 	wxCheckBox* chbox_gs_log_prog         = new wxCheckBox(p_graphics, wxID_ANY, "Log vertex/fragment programs");
 	wxCheckBox* chbox_gs_dump_depth       = new wxCheckBox(p_graphics, wxID_ANY, "Write Depth Buffer");
 	wxCheckBox* chbox_gs_dump_color       = new wxCheckBox(p_graphics, wxID_ANY, "Write Color Buffers");
@@ -525,6 +527,8 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 
 	cbox_cpu_decoder     ->SetSelection(Ini.CPUDecoderMode.GetValue() ? Ini.CPUDecoderMode.GetValue() - 1 : 0);
 	cbox_spu_decoder     ->SetSelection(Ini.SPUDecoderMode.GetValue() ? Ini.SPUDecoderMode.GetValue() - 1 : 0);
+	chbox_spu_jit_cache  ->SetValue(Ini.SPUJitCache.GetValue());
+	chbox_spu_jit_logging->SetValue(Ini.SPUJitLogging.GetValue());
 	cbox_gs_render       ->SetSelection(Ini.GSRenderMode.GetValue());
 	cbox_gs_resolution   ->SetSelection(ResolutionIdToNum(Ini.GSResolution.GetValue()) - 1);
 	cbox_gs_aspect       ->SetSelection(Ini.GSAspectRatio.GetValue() - 1);
@@ -547,6 +551,8 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 
 	s_round_cpu_decoder->Add(cbox_cpu_decoder, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_spu_decoder->Add(cbox_spu_decoder, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_round_spu_decoder->Add(chbox_spu_jit_cache, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_round_spu_decoder->Add(chbox_spu_jit_logging, wxSizerFlags().Border(wxALL, 5).Expand());
 
 	s_round_gs_render->Add(cbox_gs_render, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_gs_res->Add(cbox_gs_resolution, wxSizerFlags().Border(wxALL, 5).Expand());
@@ -633,6 +639,8 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	{
 		Ini.CPUDecoderMode.SetValue(cbox_cpu_decoder->GetSelection() + 1);
 		Ini.SPUDecoderMode.SetValue(cbox_spu_decoder->GetSelection() + 1);
+		Ini.SPUJitCache.SetValue(chbox_spu_jit_cache->GetValue());
+		Ini.SPUJitLogging.SetValue(chbox_spu_jit_logging->GetValue());
 		Ini.GSRenderMode.SetValue(cbox_gs_render->GetSelection());
 		Ini.GSResolution.SetValue(ResolutionNumToId(cbox_gs_resolution->GetSelection() + 1));
 		Ini.GSAspectRatio.SetValue(cbox_gs_aspect->GetSelection() + 1);
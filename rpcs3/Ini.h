@@ -99,6 +99,11 @@ public:
 	// Core
 	IniEntry<u8> CPUDecoderMode;
 	IniEntry<u8> SPUDecoderMode;
+	IniEntry<bool> SPUJitCache;
+	IniEntry<bool> SPUJitLogging;
+	IniEntry<u8> SPUCompilerThreads;
+	IniEntry<u8> PPULLVMCompilerThreads;
+	IniEntry<int> PPULLVMHitThreshold;
 
 	// Graphics
 	IniEntry<u8> GSRenderMode;
@@ -158,6 +163,8 @@ public:
 	IniEntry<bool> HLESaveTTY;
 	IniEntry<bool> HLEExitOnStop;
 	IniEntry<bool> HLEAlwaysStart;
+	IniEntry<bool> HLEMappedFileReads;
+	IniEntry<bool> HLESelfCache;
 
 	//Auto Pause
 	IniEntry<bool> DBGAutoPauseSystemCall;
@@ -176,6 +183,11 @@ public:
 		// Core
 		CPUDecoderMode.Init("CPU_DecoderMode", path);
 		SPUDecoderMode.Init("CPU_SPUDecoderMode", path);
+		SPUJitCache.Init("CPU_SPUJitCache", path);
+		SPUJitLogging.Init("CPU_SPUJitLogging", path);
+		SPUCompilerThreads.Init("CPU_SPUCompilerThreads", path);
+		PPULLVMCompilerThreads.Init("CPU_PPULLVMCompilerThreads", path);
+		PPULLVMHitThreshold.Init("CPU_PPULLVMHitThreshold", path);
 
 		// Graphics
 		GSRenderMode.Init("GS_RenderMode", path);
@@ -235,6 +247,8 @@ public:
 		HLEExitOnStop.Init("HLE_HLEExitOnStop", path);
 		HLELogLvl.Init("HLE_HLELogLvl", path);
 		HLEAlwaysStart.Init("HLE_HLEAlwaysStart", path);
+		HLEMappedFileReads.Init("HLE_HLEMappedFileReads", path);
+		HLESelfCache.Init("HLE_HLESelfCache", path);
 
 		// Auto Pause
 		DBGAutoPauseFunctionCall.Init("DBG_AutoPauseFunctionCall", path);
@@ -249,6 +263,11 @@ public:
 		// Core
 		CPUDecoderMode.Load(1);
 		SPUDecoderMode.Load(1);
+		SPUJitCache.Load(false);
+		SPUJitLogging.Load(false);
+		SPUCompilerThreads.Load(2);
+		PPULLVMCompilerThreads.Load(2);
+		PPULLVMHitThreshold.Load(1000);
 
 		// Graphics
 		GSRenderMode.Load(1);
@@ -308,6 +327,8 @@ public:
 		HLEExitOnStop.Load(false);
 		HLELogLvl.Load(3);
 		HLEAlwaysStart.Load(true);
+		HLEMappedFileReads.Load(true);
+		HLESelfCache.Load(true);
 
 		//Auto Pause
 		DBGAutoPauseFunctionCall.Load(false);
@@ -323,6 +344,11 @@ public:
 		// CPU/SPU
 		CPUDecoderMode.Save();
 		SPUDecoderMode.Save();
+		SPUJitCache.Save();
+		SPUJitLogging.Save();
+		SPUCompilerThreads.Save();
+		PPULLVMCompilerThreads.Save();
+		PPULLVMHitThreshold.Save();
 
 		// Graphics
 		GSRenderMode.Save();
@@ -382,6 +408,8 @@ public:
 		HLEExitOnStop.Save();
 		HLELogLvl.Save();
 		HLEAlwaysStart.Save();
+		HLEMappedFileReads.Save();
+		HLESelfCache.Save();
 
 		//Auto Pause
 		DBGAutoPauseFunctionCall.Save();
@@ -0,0 +1,290 @@
+#include "stdafx.h"
+#include "Crypto/aesni.h"
+#include "Crypto/sha1.h"
+#include "Tests.h"
+
+static const u32 all_features = POLARSSL_AESNI_AES | POLARSSL_AESNI_SHA;
+
+// FIPS-197 C.1-C.3, the key is 00 01 02 .. (keysize / 8 - 1)
+static const u8 ecb_pt[16] =
+{
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+};
+
+static const u8 ecb_ct[3][16] =
+{
+	{ 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a },
+	{ 0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91 },
+	{ 0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89 },
+};
+
+// NIST SP 800-38A F.2.1 (CBC-AES128) and F.5.1 (CTR-AES128)
+static const u8 sp800_key[16] =
+{
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+static const u8 sp800_pt[64] =
+{
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+	0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+	0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+};
+
+static const u8 cbc_iv[16] =
+{
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+
+static const u8 cbc_ct[64] =
+{
+	0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+	0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+	0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+	0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7,
+};
+
+static const u8 ctr_nonce[16] =
+{
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+};
+
+static const u8 ctr_ct[64] =
+{
+	0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+	0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+	0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+	0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee,
+};
+
+// FIPS 180-1, the third message is one million 'a'
+static const char* const sha1_msg[2] =
+{
+	"abc",
+	"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+};
+
+static const u8 sha1_sum[3][20] =
+{
+	{ 0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e, 0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d },
+	{ 0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae, 0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 },
+	{ 0x34, 0xaa, 0x97, 0x3c, 0xd4, 0xc4, 0xda, 0xa4, 0xf6, 0x1e, 0xeb, 0x2b, 0xdb, 0xad, 0x27, 0x31, 0x65, 0x34, 0x01, 0x6f },
+};
+
+// the known answers, with the CPU features and with the portable code (the features are selected by the caller)
+static void TestVectors(const char* path)
+{
+	aes_context ctx;
+	u8 key[32], buf[64], dec[64], iv[16], stream_block[16], sum[20];
+
+	for (u32 i = 0; i < 32; i++)
+	{
+		key[i] = (u8)i;
+	}
+
+	for (u32 i = 0; i < 3; i++)
+	{
+		const u32 keysize = 128 + i * 64;
+
+		aes_setkey_enc(&ctx, key, keysize);
+		aes_crypt_ecb(&ctx, AES_ENCRYPT, ecb_pt, buf);
+		aes_setkey_dec(&ctx, key, keysize);
+		aes_crypt_ecb(&ctx, AES_DECRYPT, ecb_ct[i], dec);
+
+		TEST_CHECK(!memcmp(buf, ecb_ct[i], 16) && !memcmp(dec, ecb_pt, 16), "%s AES-ECB-%d", path, keysize);
+	}
+
+	// 4 blocks, decrypted at once
+	aes_setkey_enc(&ctx, sp800_key, 128);
+	memcpy(iv, cbc_iv, 16);
+	aes_crypt_cbc(&ctx, AES_ENCRYPT, 64, iv, sp800_pt, buf);
+	TEST_CHECK(!memcmp(buf, cbc_ct, 64) && !memcmp(iv, cbc_ct + 48, 16), "%s AES-CBC-128 encryption", path);
+
+	aes_setkey_dec(&ctx, sp800_key, 128);
+	memcpy(iv, cbc_iv, 16);
+	aes_crypt_cbc(&ctx, AES_DECRYPT, 64, iv, cbc_ct, dec);
+	TEST_CHECK(!memcmp(dec, sp800_pt, 64) && !memcmp(iv, cbc_ct + 48, 16), "%s AES-CBC-128 decryption", path);
+
+	// the second call starts inside a block
+	size_t nc_off = 0;
+	aes_setkey_enc(&ctx, sp800_key, 128);
+	memcpy(iv, ctr_nonce, 16);
+	aes_crypt_ctr(&ctx, 37, &nc_off, iv, stream_block, sp800_pt, buf);
+	aes_crypt_ctr(&ctx, 27, &nc_off, iv, stream_block, sp800_pt + 37, buf + 37);
+	TEST_CHECK(!memcmp(buf, ctr_ct, 64), "%s AES-CTR-128", path);
+
+	for (u32 i = 0; i < 2; i++)
+	{
+		sha1((const u8*)sha1_msg[i], strlen(sha1_msg[i]), sum);
+		TEST_CHECK(!memcmp(sum, sha1_sum[i], 20), "%s SHA-1 #%d", path, i + 1);
+	}
+
+	std::vector<u8> a(1000000, 'a');
+	sha1(a.data(), a.size(), sum);
+	TEST_CHECK(!memcmp(sum, sha1_sum[2], 20), "%s SHA-1 #3", path);
+}
+
+// runs func with the CPU features and with the portable code, the outputs must be the same
+template<typename F>
+static bool SameOutput(std::vector<u8>& out, F func)
+{
+	std::vector<u8> portable(out.size());
+
+	aesni_disable(all_features);
+	func(portable);
+	aesni_disable(0);
+	func(out);
+
+	return out == portable;
+}
+
+// the 8-block CTR path increments the 128-bit big-endian counter itself, here the carry crosses 4 bytes inside a batch
+static void TestCtrCarry()
+{
+	const u8 key[16] = { 1, 2, 3, 4 };
+
+	for (u32 blocks = 1; blocks <= 24; blocks++)
+	{
+		// the key stream followed by the counter after the call
+		std::vector<u8> out(blocks * 16 + 16);
+
+		const bool same = SameOutput(out, [&](std::vector<u8>& o)
+		{
+			u8 counter[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xfb };
+			u8 stream_block[16];
+			size_t nc_off = 0;
+			const std::vector<u8> zero(blocks * 16);
+
+			aes_context ctx;
+			aes_setkey_enc(&ctx, key, 128);
+
+			aes_crypt_ctr(&ctx, zero.size(), &nc_off, counter, stream_block, zero.data(), o.data());
+			memcpy(&o[zero.size()], counter, 16);
+		});
+
+		if (!TEST_CHECK(same && out[blocks * 16 + 11] == (blocks > 4 ? 1 : 0), "AES-CTR of %d blocks", blocks)) break;
+	}
+}
+
+// CBC decryption works on 4 blocks at once, the rest is decrypted one by one
+static void TestCbcTail()
+{
+	aes_context enc;
+	aes_setkey_enc(&enc, sp800_key, 128);
+
+	for (u32 blocks = 1; blocks <= 11; blocks++)
+	{
+		std::vector<u8> pt(blocks * 16), ct(pt.size()), out(pt.size());
+
+		for (u32 i = 0; i < pt.size(); i++)
+		{
+			pt[i] = (u8)(i * 7);
+		}
+
+		u8 iv[16];
+		memcpy(iv, cbc_iv, 16);
+		aes_crypt_cbc(&enc, AES_ENCRYPT, ct.size(), iv, pt.data(), ct.data());
+
+		const bool same = SameOutput(out, [&](std::vector<u8>& o)
+		{
+			aes_context dec;
+			aes_setkey_dec(&dec, sp800_key, 128);
+
+			u8 iv[16];
+			memcpy(iv, cbc_iv, 16);
+			aes_crypt_cbc(&dec, AES_DECRYPT, ct.size(), iv, ct.data(), o.data());
+		});
+
+		if (!TEST_CHECK(same && out == pt, "AES-CBC decryption of %d blocks", blocks)) break;
+	}
+}
+
+// the SHA-1 state is carried between the updates, with partial blocks buffered in between
+static void TestSha1Updates()
+{
+	std::vector<u8> msg(300);
+
+	for (u32 i = 0; i < msg.size(); i++)
+	{
+		msg[i] = (u8)(i * 13);
+	}
+
+	u8 expected[20];
+	aesni_disable(all_features);
+	sha1(msg.data(), msg.size(), expected);
+	aesni_disable(0);
+
+	for (u32 split = 0; split <= 130; split++)
+	{
+		sha1_context ctx;
+		u8 sum[20];
+
+		sha1_starts(&ctx);
+		sha1_update(&ctx, msg.data(), split);
+		sha1_update(&ctx, msg.data() + split, msg.size() - split);
+		sha1_finish(&ctx, sum);
+
+		if (!TEST_CHECK(!memcmp(sum, expected, 20), "split at %d", split)) break;
+	}
+}
+
+// the SELF and NPDRM decryption throughput
+static void BenchThroughput()
+{
+	const size_t size = 16 * 1024 * 1024;
+	std::vector<u8> buf(size);
+	const u8 key[16] = {};
+	u8 iv[16] = {}, stream_block[16], sum[20];
+	aes_context enc, dec;
+
+	static const char* const names[4] = { "AES-CBC-128 encryption", "AES-CBC-128 decryption", "AES-CTR-128", "SHA-1" };
+	double mb_per_s[2][4];
+
+	for (u32 portable = 0; portable < 2; portable++)
+	{
+		aesni_disable(portable ? all_features : 0);
+		aes_setkey_enc(&enc, key, 128);
+		aes_setkey_dec(&dec, key, 128);
+
+		for (u32 t = 0; t < 4; t++)
+		{
+			size_t nc_off = 0;
+			Timer timer;
+			timer.Start();
+
+			switch (t)
+			{
+			case 0: aes_crypt_cbc(&enc, AES_ENCRYPT, size, iv, buf.data(), buf.data()); break;
+			case 1: aes_crypt_cbc(&dec, AES_DECRYPT, size, iv, buf.data(), buf.data()); break;
+			case 2: aes_crypt_ctr(&enc, size, &nc_off, iv, stream_block, buf.data(), buf.data()); break;
+			case 3: sha1(buf.data(), size, sum); break;
+			}
+
+			timer.Stop();
+			mb_per_s[portable][t] = size / timer.GetElapsedTimeInMicroSec();
+		}
+	}
+
+	aesni_disable(0);
+
+	for (u32 t = 0; t < 4; t++)
+	{
+		printf("  %-22s: %6.0f MB/s (CPU), %6.0f MB/s (portable)\n", names[t], mb_per_s[0][t], mb_per_s[1][t]);
+	}
+}
+
+void AesniTests()
+{
+	printf("  AES-NI: %s, SHA extensions: %s\n", aesni_supports(POLARSSL_AESNI_AES) ? "yes" : "no", aesni_supports(POLARSSL_AESNI_SHA) ? "yes" : "no");
+
+	TestVectors("CPU");
+	aesni_disable(all_features);
+	TestVectors("portable");
+	aesni_disable(0);
+
+	TestCtrCarry();
+	TestCbcTail();
+	TestSha1Updates();
+	BenchThroughput();
+}
@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include "Emu/Memory/Memory.h"
+#include "Tests.h"
+
+// unused by the PS3 memory layout
+static const u64 test_start = 0x60000000;
+static const u32 test_size = 0x10000000;
+
+// freed ranges are merged with their neighbours and reused by the best fitting request
+static void TestBestFit(DynamicMemoryBlockBase& block)
+{
+	const u64 a = block.AllocAlign(0x1000);
+	const u64 b = block.AllocAlign(0x2000);
+	const u64 c = block.AllocAlign(0x1000);
+	const u64 d = block.AllocAlign(0x3000);
+
+	TEST_CHECK(a == test_start && b == a + 0x1000 && c == b + 0x2000 && d == c + 0x1000, "a=0x%llx, b=0x%llx, c=0x%llx, d=0x%llx", a, b, c, d);
+	TEST_CHECK(block.GetUsedSize() == 0x7000, "used=0x%x", block.GetUsedSize());
+
+	// the 8 KB hole is the best fit, not the rest of the range
+	block.Free(b);
+	const u64 b2 = block.AllocAlign(0x1800);
+	TEST_CHECK(b2 == b, "0x%llx instead of 0x%llx", b2, b);
+
+	// a and b2 are merged into one 12 KB hole, which is smaller than the rest of the range
+	block.Free(a);
+	block.Free(b2);
+	const u64 ab = block.AllocAlign(0x3000);
+	TEST_CHECK(ab == a, "0x%llx instead of 0x%llx", ab, a);
+
+	// the hole of c is merged with the rest of the range after d is freed too
+	block.Free(c);
+	block.Free(d);
+	const u64 cd = block.AllocAlign(0x4000);
+	TEST_CHECK(cd == c, "0x%llx instead of 0x%llx", cd, c);
+
+	block.Free(ab);
+	block.Free(cd);
+	TEST_CHECK(block.GetUsedSize() == 0, "used=0x%x", block.GetUsedSize());
+}
+
+static void TestAlignment(DynamicMemoryBlockBase& block)
+{
+	const u64 pad = block.AllocAlign(0x1000);
+
+	for (u32 align = 0x2000; align <= 0x100000; align <<= 1)
+	{
+		const u64 addr = block.AllocAlign(0x1000, align);
+		TEST_CHECK(addr && !(addr & (align - 1)), "align=0x%x, addr=0x%llx", align, addr);
+		block.Free(addr);
+	}
+
+	// the gap before the aligned block stays free
+	const u64 aligned = block.AllocAlign(0x1000, 0x10000);
+	const u64 gap = block.AllocAlign(0x1000);
+	TEST_CHECK(gap == pad + 0x1000, "gap=0x%llx", gap);
+
+	block.Free(pad);
+	block.Free(aligned);
+	block.Free(gap);
+}
+
+static void TestFixed(DynamicMemoryBlockBase& block)
+{
+	const u64 addr = test_start + 0x100000;
+
+	TEST_CHECK(block.AllocFixed(addr + 0x10, 0x2000), "unaligned AllocFixed() failed");
+	TEST_CHECK(!block.AllocFixed(addr + 0x2000, 0x1000), "the third page is already allocated");
+	TEST_CHECK(block.AllocFixed(addr + 0x3000, 0x1000), "AllocFixed() after the block failed");
+	TEST_CHECK(block.GetUsedSize() == 0x4000, "used=0x%x", block.GetUsedSize());
+
+	// the allocated pages are committed and zeroed
+	TEST_CHECK(Memory.IsGoodAddr((u32)addr, 0x3000) && vm::read32((u32)addr + 0x2ffc) == 0, "the block isn't usable");
+
+	TEST_CHECK(block.Free(addr), "Free() failed");
+	TEST_CHECK(!block.Free(addr), "the block was freed twice");
+	TEST_CHECK(!Memory.IsGoodAddr((u32)addr), "the pages weren't released");
+	block.Free(addr + 0x3000);
+}
+
+// several threads allocate, write and free their own blocks (the allocator doesn't take the core mutex)
+static void TestThreads(DynamicMemoryBlockBase& block)
+{
+	const u32 thread_count = 4;
+	std::atomic<u32> errors(0);
+	std::vector<std::thread> threads;
+
+	for (u32 t = 0; t < thread_count; t++)
+	{
+		threads.emplace_back([&block, &errors, t]()
+		{
+			std::minstd_rand rng(t + 1);
+			std::vector<u32> live;
+
+			for (u32 i = 0; i < 20000; i++)
+			{
+				if (live.size() > 32 || (live.size() && rng() % 2))
+				{
+					const size_t index = rng() % live.size();
+
+					// another thread would have overwritten the owner's id
+					if (vm::read32(live[index]) != t || !block.Free(live[index]))
+					{
+						errors++;
+					}
+
+					live.erase(live.begin() + index);
+				}
+				else if (const u32 addr = (u32)block.AllocAlign(0x1000 * (1 + rng() % 4)))
+				{
+					vm::write32(addr, t);
+					live.push_back(addr);
+				}
+			}
+
+			for (auto addr : live)
+			{
+				block.Free(addr);
+			}
+		});
+	}
+
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+
+	TEST_CHECK(errors == 0, "%d blocks were shared or lost", errors.load());
+	TEST_CHECK(block.GetUsedSize() == 0, "used=0x%x", block.GetUsedSize());
+}
+
+// the cost of an allocation in a fragmented range (the old first-fit search was linear in the number of blocks)
+static void BenchFragmented(DynamicMemoryBlockBase& block)
+{
+	std::vector<u64> blocks;
+
+	// every second block is freed, 4096 holes of 4 KB stay between the used blocks
+	for (u32 i = 0; i < 8192; i++)
+	{
+		blocks.push_back(block.AllocAlign(0x1000));
+	}
+
+	for (u32 i = 0; i < blocks.size(); i += 2)
+	{
+		block.Free(blocks[i]);
+	}
+
+	const u32 count = 100000;
+	Timer timer;
+	timer.Start();
+
+	for (u32 i = 0; i < count; i++)
+	{
+		// doesn't fit into the holes
+		block.Free(block.AllocAlign(0x2000));
+	}
+
+	timer.Stop();
+
+	printf("  alloc+free of 8 KB with 4096 holes: %.0f ns\n", timer.GetElapsedTimeInNanoSec() / count);
+
+	for (u32 i = 1; i < blocks.size(); i += 2)
+	{
+		block.Free(blocks[i]);
+	}
+}
+
+void DynamicMemoryBlockTests()
+{
+	DynamicMemoryBlockBase block;
+	block.SetRange(test_start, test_size);
+
+	TestBestFit(block);
+	TestAlignment(block);
+	TestFixed(block);
+	TestThreads(block);
+	BenchFragmented(block);
+
+	// all ranges are merged again
+	TEST_CHECK(block.AllocAlign(test_size) == test_start, "the whole range can't be allocated");
+
+	block.Delete();
+}
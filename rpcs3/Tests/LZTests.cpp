@@ -0,0 +1,423 @@
+#include "stdafx.h"
+#include "Crypto/lz.h"
+#include "Tests.h"
+#include <random>
+
+// There are no compressed EDAT blocks in the tree, so the streams are made by a range encoder which mirrors
+// the decoder's model: the generator takes the same decisions as decompress() with random (mostly probable) bits
+// and records the data the decoder must produce.
+
+// range encoder (the reverse of lz_decode_range/lz_decode_bit)
+struct LZEncoder
+{
+	u64 low;
+	u32 range;
+	u8 cache;
+	u64 cache_size;
+	std::vector<u8> out;
+
+	LZEncoder() : low(0), range(0xFFFFFFFF), cache(0), cache_size(1)
+	{
+	}
+
+	void ShiftLow()
+	{
+		if ((u32)low < 0xFF000000u || (low >> 32))
+		{
+			const u8 carry = (u8)(low >> 32);
+			u8 temp = cache;
+			do
+			{
+				out.push_back(temp + carry);
+				temp = 0xFF;
+			} while (--cache_size);
+			cache = (low >> 24) & 0xFF;
+		}
+		cache_size++;
+		low = (low & 0x00FFFFFF) << 8;
+	}
+
+	void Normalize()
+	{
+		if (!(range >> 24))
+		{
+			range <<= 8;
+			ShiftLow();
+		}
+	}
+
+	void EncodeBit(u8* c, int bit)
+	{
+		Normalize();
+
+		const u32 val = (range >> 8) * (*c);
+
+		*c -= ((*c) >> 3);
+		if (bit)
+		{
+			range = val;
+			*c += 31;
+		}
+		else
+		{
+			low += val;
+			range -= val;
+		}
+	}
+
+	void Flush()
+	{
+		for (int i = 0; i < 5; i++) ShiftLow();
+	}
+};
+
+struct LZGenerator
+{
+	std::mt19937& rng;
+	LZEncoder enc;
+	u8 tmp[0xCC8];
+	int offset;
+	u8 prev;
+	u8 head;
+	std::vector<u8> data;
+
+	// copies whose source overlaps the destination (decoded byte by byte) and the others (memcpy)
+	u32 overlapping;
+	u32 separate;
+
+	LZGenerator(std::mt19937& rng, u8 head) : rng(rng), offset(0), prev(0), head(head), overlapping(0), separate(0)
+	{
+		memset(tmp, 0x80, 0xCA8);
+	}
+
+	int RandomBit(u8* c)
+	{
+		const int bit = (int)(rng() % 256) < *c;
+		enc.EncodeBit(c, bit);
+		return bit;
+	}
+
+	int EncodeValue(u8* ptr, int index, int* bit_flag, int high_offset, int low_offset1, int low_offset2)
+	{
+		int i = 1;
+
+		if (index >= 3)
+		{
+			i = (i << 1) | RandomBit(ptr + high_offset);
+			if (index >= 4)
+			{
+				i = (i << 1) | RandomBit(ptr + high_offset);
+				if (index >= 5)
+				{
+					enc.Normalize();
+					for (; index >= 5; index--)
+					{
+						i <<= 1;
+						enc.range >>= 1;
+						if (rng() & 1)
+							i++;
+						else
+							enc.low += enc.range;
+					}
+				}
+			}
+		}
+
+		*bit_flag = RandomBit(ptr);
+		i = (i << 1) | *bit_flag;
+
+		if (index >= 1)
+		{
+			i = (i << 1) | RandomBit(ptr + low_offset1);
+			if (index >= 2)
+			{
+				i = (i << 1) | RandomBit(ptr + low_offset2);
+			}
+		}
+
+		return i;
+	}
+
+	void Literal()
+	{
+		enc.EncodeBit(tmp + offset + 0xB68, 0);
+		if (offset > 0) offset--;
+
+		const int sect = (((((((int)data.size()) & 7) << 8) + prev) >> head) & 7) * 0xFF - 1;
+		int index = 1;
+
+		do
+		{
+			index = (index << 1) | RandomBit(tmp + sect + index);
+		} while ((index >> 8) == 0);
+
+		data.push_back((u8)index);
+		prev = (u8)index;
+	}
+
+	// returns false if the random match doesn't fit (the state must be restored then)
+	bool Match(u32 size)
+	{
+		u8* tmp_sect1 = tmp + offset + 0xB68;
+		enc.EncodeBit(tmp_sect1, 1);
+
+		int index = -1;
+		int bit_flag;
+
+		do
+		{
+			tmp_sect1 += 8;
+			bit_flag = RandomBit(tmp_sect1);
+			index += bit_flag;
+		} while ((bit_flag != 0) && (index < 6));
+
+		int b_size = 0x160;
+		u8* tmp_sect2 = tmp + index + 0x7F1;
+		int data_length, data_offset;
+
+		if ((index >= 0) || (bit_flag != 0))
+		{
+			const int sect = (index << 5) | (((((int)data.size()) << index) & 3) << 3) | (offset & 7);
+			data_length = EncodeValue(tmp + 0xBA8 + sect, index, &bit_flag, 0x18, 0x8, 0x10);
+			if (data_length == 0xFF) return false; // the end of the stream
+		}
+		else
+		{
+			data_length = 1;
+		}
+
+		if (data_length <= 2)
+		{
+			tmp_sect2 += 0xF8;
+			b_size = 0x40;
+		}
+
+		int diff = 0;
+		int shift = 1;
+
+		do
+		{
+			diff = (shift << 4) - b_size;
+			bit_flag = RandomBit(tmp_sect2 + (shift << 3));
+			shift = (shift << 1) | bit_flag;
+		} while (diff < 0);
+
+		if ((diff > 0) || (bit_flag != 0))
+		{
+			if (bit_flag == 0) diff -= 8;
+			data_offset = EncodeValue(tmp + 0x928 + diff, diff / 8, &bit_flag, 4, 1, 2);
+		}
+		else
+		{
+			data_offset = 1;
+		}
+
+		const s64 start = data.size();
+		const s64 buf_start = start - data_offset;
+		const s64 buf_end = start + data_length + 1;
+
+		if (data_offset <= 0 || buf_start < 0 || buf_end > size) return false;
+
+		offset = ((((int)buf_end) + 1) & 1) + 6;
+
+		if (buf_end - start > data_offset)
+			overlapping++;
+		else
+			separate++;
+
+		for (s64 i = start; i < buf_end; i++)
+		{
+			data.push_back(data[(size_t)(buf_start + (i - start))]);
+		}
+
+		prev = data.back();
+		return true;
+	}
+
+	// a stream of size bytes, matches_per_3 of every three symbols are matches if they fit
+	void Run(u32 size, u32 matches_per_3 = 2)
+	{
+		while (data.size() < size)
+		{
+			if (data.size() && rng() % 3 < matches_per_3)
+			{
+				const LZEncoder saved_enc = enc;
+				u8 saved_tmp[0xCC8];
+				memcpy(saved_tmp, tmp, sizeof(tmp));
+				const int saved_offset = offset;
+				const u8 saved_prev = prev;
+				const size_t saved_size = data.size();
+
+				if (Match(size)) continue;
+
+				enc = saved_enc;
+				memcpy(tmp, saved_tmp, sizeof(tmp));
+				offset = saved_offset;
+				prev = saved_prev;
+				data.resize(saved_size);
+			}
+
+			Literal();
+		}
+
+		// a raw char flag at the end of the output stops the decoder
+		enc.EncodeBit(tmp + offset + 0xB68, 0);
+		enc.Flush();
+		enc.out[0] = head;
+		enc.out.resize(enc.out.size() + 64, 0); // the decoder can read a few bytes ahead
+	}
+};
+
+// the output buffer is followed by guard bytes which must stay untouched
+static const u32 guard = 16;
+
+static bool GuardOk(const std::vector<u8>& out, u32 size)
+{
+	for (u32 i = size; i < size + guard; i++)
+	{
+		if (out[i] != 0xAA) return false;
+	}
+
+	return true;
+}
+
+// streams of every size class and every literal context shift (the header byte)
+static void TestRoundTrip(std::mt19937& rng)
+{
+	const u32 sizes[] = { 1, 2, 3, 0x100, 0x1001, 0xFFFF, 0x10000 };
+	u32 overlapping = 0, separate = 0;
+
+	for (u32 head = 0; head < 8; head++)
+	{
+		for (auto size : sizes)
+		{
+			LZGenerator gen(rng, head);
+			gen.Run(size);
+			overlapping += gen.overlapping;
+			separate += gen.separate;
+
+			std::vector<u8> out(size + guard, 0xAA);
+			const int res = decompress(out.data(), gen.enc.out.data(), size);
+
+			if (!TEST_CHECK(res == (int)size && !memcmp(out.data(), gen.data.data(), size) && GuardOk(out, size), "head=%d, size=0x%x: result %d", head, size, res))
+			{
+				return;
+			}
+		}
+	}
+
+	// both copy paths of decompress() were used
+	TEST_CHECK(overlapping && separate, "%d overlapping and %d separate matches", overlapping, separate);
+}
+
+// literals only (no match decoding), and runs of matches (mostly short offsets which overlap)
+static void TestSymbolMix(std::mt19937& rng)
+{
+	for (u32 matches_per_3 : { 0u, 3u })
+	{
+		LZGenerator gen(rng, 3);
+		gen.Run(0x8000, matches_per_3);
+
+		std::vector<u8> out(0x8000 + guard, 0xAA);
+		const int res = decompress(out.data(), gen.enc.out.data(), 0x8000);
+
+		TEST_CHECK(res == 0x8000 && !memcmp(out.data(), gen.data.data(), 0x8000) && GuardOk(out, 0x8000),
+			"matches_per_3=%d: result %d (%d matches)", matches_per_3, res, gen.overlapping + gen.separate);
+	}
+}
+
+// a valid stream decoded to a smaller buffer: the decoder stops at the end of the buffer or fails on a match crossing it
+static void TestShortOutput(std::mt19937& rng)
+{
+	LZGenerator gen(rng, 0);
+	gen.Run(0x4000);
+
+	for (u32 size = 1; size < 0x4000; size += 1 + size / 4)
+	{
+		std::vector<u8> out(size + guard, 0xAA);
+		const int res = decompress(out.data(), gen.enc.out.data(), size);
+
+		// the decoded part is still right
+		const bool ok = res == -1 || (res >= 0 && res <= (int)size && !memcmp(out.data(), gen.data.data(), res));
+
+		if (!TEST_CHECK(ok && GuardOk(out, size), "size=0x%x: result %d", size, res))
+		{
+			break;
+		}
+	}
+}
+
+// corrupted streams may decode to anything but must not write past the output buffer
+static void TestCorrupted(std::mt19937& rng)
+{
+	std::vector<std::vector<u8>> streams;
+
+	for (u32 i = 0; i < 16; i++)
+	{
+		LZGenerator gen(rng, i % 8);
+		gen.Run(1 + rng() % 0x10000);
+		streams.push_back(gen.enc.out);
+	}
+
+	for (u32 n = 0; n < 2000; n++)
+	{
+		std::vector<u8> in = streams[n % streams.size()];
+		const u32 flips = 1 + rng() % 4;
+
+		for (u32 i = 0; i < flips; i++)
+		{
+			// not in the header byte, not in the zero padding
+			in[1 + rng() % (in.size() - 65)] ^= 1 << (rng() % 8);
+		}
+
+		const u32 size = 1 + rng() % 0x10000;
+		std::vector<u8> out(size + guard, 0xAA);
+		const int res = decompress(out.data(), in.data(), size);
+
+		if (!TEST_CHECK(res <= (int)size && GuardOk(out, size), "stream #%d, size=0x%x: result %d", n, size, res))
+		{
+			break;
+		}
+	}
+}
+
+// 64 KB blocks, the size of the EDAT blocks
+static void BenchDecode(std::mt19937& rng)
+{
+	std::vector<std::vector<u8>> blocks;
+
+	for (u32 i = 0; i < 16; i++)
+	{
+		LZGenerator gen(rng, i % 8);
+		gen.Run(0x10000);
+		blocks.push_back(gen.enc.out);
+	}
+
+	std::vector<u8> out(0x10000);
+	const u32 passes = 8;
+	Timer timer;
+	timer.Start();
+
+	for (u32 i = 0; i < passes; i++)
+	{
+		for (auto& block : blocks)
+		{
+			decompress(out.data(), block.data(), 0x10000);
+		}
+	}
+
+	timer.Stop();
+
+	printf("  64 KB blocks: %.1f MB/s\n", passes * blocks.size() * 0x10000 / timer.GetElapsedTimeInMicroSec());
+}
+
+void LZTests()
+{
+	std::mt19937 rng(25);
+
+	TestRoundTrip(rng);
+	TestSymbolMix(rng);
+	TestShortOutput(rng);
+	TestCorrupted(rng);
+	BenchDecode(rng);
+}
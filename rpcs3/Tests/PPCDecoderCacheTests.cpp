@@ -0,0 +1,121 @@
+#include "stdafx.h"
+#include "Emu/Cell/PPUDecoder.h"
+#include "Emu/Cell/PPUDisAsm.h"
+#include "Emu/Cell/SPUDecoder.h"
+#include "Emu/Cell/SPUDisAsm.h"
+#include "Tests.h"
+
+// The decoders run the disassembler, its text shows which handler was called with which operands.
+// Each check compares a decoder using PPCDecoderCache with one walking the decoder tree for every instruction.
+
+template<typename TDis>
+static const std::string& Disasm(TDis& dis, PPCDecoder& decoder, u32 addr, u32 code)
+{
+	dis.dump_pc = addr;
+	decoder.DecodeAt(addr, code);
+	return dis.last_opcode;
+}
+
+// every combination of the upper 16 bits (which select the handler in both instruction sets), 64 pages of code
+template<typename TDis>
+static void TestAllForms(TDis& dis_tree, PPCDecoder& tree, TDis& dis_cache, PPCDecoder& cache)
+{
+	for (u32 i = 0; i < 0x10000; i++)
+	{
+		const u32 code = (i << 16) | ((i * 0x9E3779B1u) >> 16);
+		const u32 addr = 0x10000 + i * 4;
+
+		const std::string& expected = Disasm(dis_tree, tree, addr, code);
+
+		if (!TEST_CHECK(Disasm(dis_cache, cache, addr, code) == expected, "code 0x%08x: '%s' instead of '%s'", code, dis_cache.last_opcode.c_str(), expected.c_str()))
+		{
+			break;
+		}
+	}
+}
+
+// the cached record is only used while the opcode at its address stays the same, nothing invalidates it on writes
+template<typename TDis>
+static void TestModifiedCode(TDis& dis_tree, PPCDecoder& tree, TDis& dis_cache, PPCDecoder& cache, u32 a, u32 b)
+{
+	const u32 addr = 0x80000;
+	const std::string dis_a = Disasm(dis_tree, tree, addr, a);
+	const std::string dis_b = Disasm(dis_tree, tree, addr, b);
+
+	TEST_CHECK(dis_a != dis_b, "0x%08x and 0x%08x are both '%s'", a, b, dis_a.c_str());
+
+	for (u32 i = 0; i < 4; i++)
+	{
+		TEST_CHECK(Disasm(dis_cache, cache, addr, a) == dis_a, "'%s' instead of '%s'", dis_cache.last_opcode.c_str(), dis_a.c_str());
+		TEST_CHECK(Disasm(dis_cache, cache, addr, b) == dis_b, "'%s' instead of '%s'", dis_cache.last_opcode.c_str(), dis_b.c_str());
+	}
+
+	// the same offset in the next page has its own record
+	Disasm(dis_cache, cache, addr, a);
+	TEST_CHECK(Disasm(dis_cache, cache, addr + 0x1000, b) == dis_b, "'%s' instead of '%s'", dis_cache.last_opcode.c_str(), dis_b.c_str());
+	TEST_CHECK(Disasm(dis_cache, cache, addr, a) == dis_a, "'%s' instead of '%s'", dis_cache.last_opcode.c_str(), dis_a.c_str());
+}
+
+// straight-line code executed repeatedly, both times include the disassembler's formatting
+static void BenchLoop(const char* name, PPCDecoder& tree, PPCDecoder& cache)
+{
+	std::vector<u32> code(0x4000);
+
+	for (u32 i = 0; i < code.size(); i++)
+	{
+		code[i] = i * 0x9E3779B1u;
+	}
+
+	const u32 passes = 16;
+	Timer timer;
+	timer.Start();
+
+	for (u32 i = 0; i < passes; i++)
+	{
+		for (u32 j = 0; j < code.size(); j++)
+		{
+			tree.Decode(code[j]);
+		}
+	}
+
+	const double tree_ns = timer.GetElapsedTimeInNanoSec() / (passes * code.size());
+	timer.Start();
+
+	for (u32 i = 0; i < passes; i++)
+	{
+		for (u32 j = 0; j < code.size(); j++)
+		{
+			cache.DecodeAt(0x10000 + j * 4, code[j]);
+		}
+	}
+
+	const double cache_ns = timer.GetElapsedTimeInNanoSec() / (passes * code.size());
+
+	printf("  %s: %.1f ns per instruction (tree), %.1f ns (cache)\n", name, tree_ns, cache_ns);
+}
+
+void PPCDecoderCacheTests()
+{
+	{
+		// the decoders delete the disassemblers
+		auto dis_tree = new PPUDisAsm(CPUDisAsm_CompilerElfMode);
+		auto dis_cache = new PPUDisAsm(CPUDisAsm_CompilerElfMode);
+		PPUDecoder tree(dis_tree);
+		PPUDecoder cache(dis_cache, true);
+
+		TestAllForms(*dis_tree, tree, *dis_cache, cache);
+		TestModifiedCode(*dis_tree, tree, *dis_cache, cache, 0x38600001 /* li r3,1 */, 0x7c0802a6 /* mflr r0 */);
+		BenchLoop("PPU", tree, cache);
+	}
+
+	{
+		auto dis_tree = new SPUDisAsm(CPUDisAsm_CompilerElfMode);
+		auto dis_cache = new SPUDisAsm(CPUDisAsm_CompilerElfMode);
+		SPUDecoder tree(*dis_tree);
+		SPUDecoder cache(*dis_cache, true);
+
+		TestAllForms(*dis_tree, tree, *dis_cache, cache);
+		TestModifiedCode(*dis_tree, tree, *dis_cache, cache, 0x40800083 /* il $3,1 */, 0x18000000 /* a $0,$0,$0 */);
+		BenchLoop("SPU", tree, cache);
+	}
+}
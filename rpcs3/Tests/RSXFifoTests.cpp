@@ -0,0 +1,211 @@
+#include "stdafx.h"
+#include "Emu/Memory/Memory.h"
+#include "Emu/RSX/RSXThread.h"
+#include "Tests.h"
+
+// an RSX thread without a renderer, the packets are processed by calling ExecuteBatch() directly
+class FifoTestThread : public RSXThread
+{
+	virtual void OnInit() {}
+	virtual void OnInitThread() {}
+	virtual void OnExitThread() {}
+	virtual void OnReset() {}
+	virtual void ExecCMD() {}
+	virtual void ExecCMD(u32 cmd) {}
+	virtual void Flip() {}
+
+public:
+	using RSXThread::ExecuteBatch;
+	using RSXThread::m_call_stack;
+	using RSXThread::m_surface_clip_x;
+	using RSXThread::m_surface_clip_y;
+	using RSXThread::m_surface_clip_w;
+	using RSXThread::m_surface_clip_h;
+};
+
+// the command buffer: two IO pages backed by real memory which isn't contiguous
+static const u32 io_page = 0x100000;
+static const u32 io_buffer = 0x100000;
+
+static u32 g_real;
+
+static u32 Method(u32 method, u32 count, u32 flags = 0)
+{
+	return (count << 18) | flags | method;
+}
+
+// writes the words at the IO offset
+static void Put(u32 io, std::initializer_list<u32> words)
+{
+	for (auto word : words)
+	{
+		vm::write32((u32)Memory.RSXIOMem.RealAddr(io), word);
+		io += 4;
+	}
+}
+
+// the arguments are stored in methodRegisters and passed to the method handler
+static void TestMethods(FifoTestThread& rsx)
+{
+	const u32 io = io_buffer;
+
+	methodRegisters[NV4097_NO_OPERATION + 4] = 0xdead;
+
+	Put(io, {
+		0, // nop
+		Method(NV4097_SET_SURFACE_CLIP_HORIZONTAL, 2), 0x00100002, 0x00200003,
+		Method(NV4097_NO_OPERATION, 3, CELL_GCM_METHOD_FLAG_NON_INCREMENT), 0x21, 0x22, 0x23,
+	});
+
+	const u32 get = rsx.ExecuteBatch(io, io + 0x20);
+
+	TEST_CHECK(get == io + 0x20, "get=0x%x", get);
+	TEST_CHECK(methodRegisters[NV4097_SET_SURFACE_CLIP_HORIZONTAL] == 0x00100002 && methodRegisters[NV4097_SET_SURFACE_CLIP_VERTICAL] == 0x00200003,
+		"0x%x, 0x%x", methodRegisters[NV4097_SET_SURFACE_CLIP_HORIZONTAL], methodRegisters[NV4097_SET_SURFACE_CLIP_VERTICAL]);
+	TEST_CHECK(rsx.m_surface_clip_x == 2 && rsx.m_surface_clip_w == 0x10 && rsx.m_surface_clip_y == 3 && rsx.m_surface_clip_h == 0x20,
+		"x=%d, w=%d, y=%d, h=%d", rsx.m_surface_clip_x, rsx.m_surface_clip_w, rsx.m_surface_clip_y, rsx.m_surface_clip_h);
+
+	// a non-incrementing run leaves the last argument in its register
+	TEST_CHECK(methodRegisters[NV4097_NO_OPERATION] == 0x23 && methodRegisters[NV4097_NO_OPERATION + 4] == 0xdead,
+		"0x%x, 0x%x", methodRegisters[NV4097_NO_OPERATION], methodRegisters[NV4097_NO_OPERATION + 4]);
+}
+
+// a batch ends at put and after every jump, call and return
+static void TestFlowControl(FifoTestThread& rsx)
+{
+	const u32 io = io_buffer;
+
+	Put(io, {
+		Method(NV4097_NO_OPERATION, 1), 1,
+		(io + 0x100) | CELL_GCM_METHOD_FLAG_CALL,
+		Method(NV4097_NO_OPERATION, 1), 3,
+		(io + 0x200) | CELL_GCM_METHOD_FLAG_JUMP,
+	});
+
+	Put(io + 0x100, { Method(NV4097_NO_OPERATION, 1), 2, CELL_GCM_METHOD_FLAG_RETURN });
+	Put(io + 0x200, { Method(NV4097_NO_OPERATION, 1), 4 });
+
+	const struct { u32 put, get, value; } batches[] =
+	{
+		{ io + 0x008, io + 0x008, 1 },
+		{ io + 0x208, io + 0x100, 1 },
+		{ io + 0x208, io + 0x00c, 2 },
+		{ io + 0x208, io + 0x200, 3 },
+		{ io + 0x208, io + 0x208, 4 },
+	};
+
+	u32 get = io;
+
+	for (auto& batch : batches)
+	{
+		get = rsx.ExecuteBatch(get, batch.put);
+
+		if (!TEST_CHECK(get == batch.get && methodRegisters[NV4097_NO_OPERATION] == batch.value, "get=0x%x (0x%x), value=%d (%d)",
+			get, batch.get, methodRegisters[NV4097_NO_OPERATION], batch.value))
+		{
+			break;
+		}
+
+		// the return address stays on the stack while the subroutine runs
+		TEST_CHECK(rsx.m_call_stack.size() == (get == io + 0x100 ? 1u : 0u), "call stack size: %d", (u32)rsx.m_call_stack.size());
+	}
+}
+
+// a batch is translated once, so it ends at the IO page boundary even if put is further
+static void TestPageEnd(FifoTestThread& rsx)
+{
+	const u32 io = io_buffer + io_page - 0x10;
+
+	Put(io, { 0, Method(NV4097_NO_OPERATION, 1), 5, 0, Method(NV4097_NO_OPERATION, 1), 6 });
+
+	const u32 get = rsx.ExecuteBatch(io, io + 0x18);
+	TEST_CHECK(get == io_buffer + io_page && methodRegisters[NV4097_NO_OPERATION] == 5, "get=0x%x, value=%d", get, methodRegisters[NV4097_NO_OPERATION]);
+
+	// the rest is read from the real memory of the second page
+	const u32 end = rsx.ExecuteBatch(get, io + 0x18);
+	TEST_CHECK(end == io + 0x18 && methodRegisters[NV4097_NO_OPERATION] == 6, "get=0x%x, value=%d", end, methodRegisters[NV4097_NO_OPERATION]);
+	TEST_CHECK(vm::read32(g_real + 2 * io_page) == Method(NV4097_NO_OPERATION, 1), "the second IO page isn't backed by the third real page");
+}
+
+// the arguments of a method run which crosses the IO page end are read from both pages
+static void TestSplitPacket(FifoTestThread& rsx)
+{
+	const u32 io = io_buffer + io_page - 0x10;
+
+	Put(io, {
+		Method(NV4097_NO_OPERATION, 1), 7,
+		Method(NV4097_SET_SURFACE_CLIP_HORIZONTAL, 2), 0x00300004, 0x00400005,
+		Method(NV4097_NO_OPERATION, 1), 8,
+	});
+
+	// the real memory right after the first page doesn't belong to the command buffer
+	vm::write32(g_real + io_page, 0xffffffff);
+
+	u32 get = rsx.ExecuteBatch(io, io + 0x1c);
+	TEST_CHECK(get == io + 8 && methodRegisters[NV4097_NO_OPERATION] == 7, "get=0x%x, value=%d", get, methodRegisters[NV4097_NO_OPERATION]);
+
+	get = rsx.ExecuteBatch(get, io + 0x1c);
+	TEST_CHECK(get == io + 0x14, "get=0x%x", get);
+	TEST_CHECK(methodRegisters[NV4097_SET_SURFACE_CLIP_VERTICAL] == 0x00400005 && rsx.m_surface_clip_y == 5 && rsx.m_surface_clip_h == 0x40,
+		"0x%x, y=%d, h=%d", methodRegisters[NV4097_SET_SURFACE_CLIP_VERTICAL], rsx.m_surface_clip_y, rsx.m_surface_clip_h);
+
+	get = rsx.ExecuteBatch(get, io + 0x1c);
+	TEST_CHECK(get == io + 0x1c && methodRegisters[NV4097_NO_OPERATION] == 8, "get=0x%x, value=%d", get, methodRegisters[NV4097_NO_OPERATION]);
+}
+
+// the method rate of a command buffer of single methods (every packet used to translate its IO address twice)
+static void BenchMethods(FifoTestThread& rsx)
+{
+	for (u32 i = 0; i < io_page; i += 8)
+	{
+		Put(io_buffer + i, { Method(NV4097_NO_OPERATION, 1), i });
+	}
+
+	const u32 passes = 16;
+	Timer timer;
+	timer.Start();
+
+	for (u32 i = 0; i < passes; i++)
+	{
+		for (u32 get = io_buffer; get != io_buffer + io_page;)
+		{
+			get = rsx.ExecuteBatch(get, io_buffer + io_page);
+		}
+	}
+
+	timer.Stop();
+
+	printf("  %.1f M methods/s\n", passes * (io_page / 8) / timer.GetElapsedTimeInMicroSec());
+}
+
+void RSXFifoTests()
+{
+	// the IO pages are mapped to the first and the third page of the buffer
+	g_real = (u32)Memory.Alloc(3 * io_page, io_page);
+
+	Memory.RSXIOMem.SetRange(0, 0x10000000);
+
+	if (!TEST_CHECK(g_real && Memory.RSXIOMem.Map(g_real, io_page, io_buffer) && Memory.RSXIOMem.Map(g_real + 2 * io_page, io_page, io_buffer + io_page),
+		"can't map the command buffer"))
+	{
+		return;
+	}
+
+	const u32 saved[2] = { methodRegisters[NV4097_NO_OPERATION], methodRegisters[NV4097_NO_OPERATION + 4] };
+
+	{
+		FifoTestThread rsx;
+
+		TestMethods(rsx);
+		TestFlowControl(rsx);
+		TestPageEnd(rsx);
+		TestSplitPacket(rsx);
+		BenchMethods(rsx);
+	}
+
+	methodRegisters[NV4097_NO_OPERATION] = saved[0];
+	methodRegisters[NV4097_NO_OPERATION + 4] = saved[1];
+
+	Memory.RSXIOMem.Delete();
+	Memory.Free(g_real);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "Utilities/Timer.h"
+
+// Checks and benchmarks of the emulator core, built as rpcs3_tests (see main.cpp).
+// A test reports failed conditions with TEST_CHECK() and prints its measurements itself.
+
+namespace tests
+{
+	void fail(const char* file, int line, const char* cond, const std::string& info);
+}
+
+// evaluates to the condition, so loops can stop at the first failure
+#define TEST_CHECK(cond, ...) ((cond) || (tests::fail(__FILE__, __LINE__, #cond, fmt::Format(__VA_ARGS__)), false))
+
+void DynamicMemoryBlockTests();
+void VirtualMemoryBlockTests();
+void RSXFifoTests();
+void PPCDecoderCacheTests();
+void vfsLocalFileTests();
+void VarArenaTests();
+void AesniTests();
+void LZTests();
@@ -0,0 +1,150 @@
+#include "stdafx.h"
+#include "Emu/Memory/Memory.h"
+#include "Tests.h"
+
+// vars are released in reverse order, the space is reused at once
+static void TestNested(vm::var_arena& arena)
+{
+	const u32 a = arena.alloc(8, 8);
+	const u32 b = arena.alloc(0x100, 16);
+	const u32 c = arena.alloc(4, 4);
+
+	TEST_CHECK(Memory.StackMem.IsMyAddress(a) && b == a + 0x10 && c == b + 0x100, "a=0x%x, b=0x%x, c=0x%x", a, b, c);
+
+	vm::write32(a, 1);
+	vm::write32(b, 2);
+	vm::write32(c, 3);
+	TEST_CHECK(vm::read32(a) == 1 && vm::read32(b) == 2 && vm::read32(c) == 3, "the vars overlap");
+
+	arena.dealloc(c);
+	arena.dealloc(b);
+	TEST_CHECK(arena.alloc(0x20, 16) == b, "the space of b isn't reused");
+
+	arena.dealloc(b);
+	arena.dealloc(a);
+	TEST_CHECK(arena.alloc(4, 4) == a, "the arena isn't empty");
+	arena.dealloc(a);
+}
+
+// a var released before the vars allocated after it keeps its space until they are released too
+static void TestOutOfOrder(vm::var_arena& arena)
+{
+	const u32 a = arena.alloc(0x40, 16);
+	const u32 b = arena.alloc(0x40, 16);
+	const u32 c = arena.alloc(0x40, 16);
+
+	arena.dealloc(a);
+	const u32 d = arena.alloc(0x40, 16);
+	TEST_CHECK(d == c + 0x40, "d=0x%x (a=0x%x)", d, a);
+
+	arena.dealloc(c);
+	arena.dealloc(d);
+	TEST_CHECK(arena.alloc(0x40, 16) == c, "the space of c and d isn't reused");
+
+	// releasing b frees everything
+	arena.dealloc(c);
+	arena.dealloc(b);
+	TEST_CHECK(arena.alloc(0x40, 16) == a, "the arena isn't empty");
+	arena.dealloc(a);
+}
+
+static void TestAlignment(vm::var_arena& arena)
+{
+	const u32 pad = arena.alloc(1, 1);
+
+	for (u32 align = 1; align <= 4096; align <<= 1)
+	{
+		const u32 addr = arena.alloc(4, align);
+		TEST_CHECK(addr > pad && !(addr % std::max<u32>(align, 16)), "align=%d: 0x%x", align, addr);
+		arena.dealloc(addr);
+	}
+
+	// not a power of two (sizeof of a structure)
+	const u32 addr = arena.alloc(24, 24);
+	TEST_CHECK(addr == pad + 0x10, "0x%x", addr);
+	arena.dealloc(addr);
+
+	TEST_CHECK(!arena.alloc(4, 8192), "aligned to 8 KB");
+	arena.dealloc(pad);
+}
+
+// the caller falls back to Memory.Alloc when the arena is full
+static void TestFull(vm::var_arena& arena)
+{
+	const u32 all = arena.alloc(vm::var_arena::size, 16);
+	TEST_CHECK(all && !arena.alloc(4, 4), "the arena isn't full");
+	arena.dealloc(all);
+
+	const u32 half = arena.alloc(vm::var_arena::size / 2, 16);
+	TEST_CHECK(!arena.alloc(vm::var_arena::size / 2 + 1, 16), "more than the arena size was allocated");
+	TEST_CHECK(!arena.alloc(0xffffffff, 16), "the size overflowed");
+	arena.dealloc(half);
+}
+
+// the guest memory is released when the thread exits, but vars still alive keep it until they are released
+static void TestClose()
+{
+	vm::var_arena* arena = new vm::var_arena();
+
+	const u32 addr = arena->alloc(16, 16);
+	arena->close();
+	TEST_CHECK(Memory.IsGoodAddr(addr), "the memory was released with a live var");
+
+	arena->dealloc(addr);
+	TEST_CHECK(!Memory.IsGoodAddr(addr), "the memory wasn't released with the last var");
+
+	// the next var allocates the memory again
+	const u32 next = arena->alloc(16, 16);
+	TEST_CHECK(next && Memory.IsGoodAddr(next), "0x%x", next);
+
+	// the arena is deleted with the last var (a leak or a crash otherwise)
+	arena->destroy();
+	TEST_CHECK(Memory.IsGoodAddr(next), "the memory was released with a live var");
+	arena->dealloc(next);
+	TEST_CHECK(!Memory.IsGoodAddr(next), "the memory wasn't released with the last var");
+}
+
+// a function with two vm::var temporaries, through the arena and through Memory.Alloc
+static void BenchVarPair(vm::var_arena& arena)
+{
+	const u32 count = 100000;
+	Timer timer;
+	timer.Start();
+
+	for (u32 i = 0; i < count; i++)
+	{
+		const u32 a = arena.alloc(8, 8);
+		const u32 b = arena.alloc(0x100, 16);
+		arena.dealloc(b);
+		arena.dealloc(a);
+	}
+
+	const double arena_ns = timer.GetElapsedTimeInNanoSec() / count;
+	timer.Start();
+
+	for (u32 i = 0; i < count; i++)
+	{
+		const u32 a = (u32)Memory.Alloc(8, 8);
+		const u32 b = (u32)Memory.Alloc(0x100, 16);
+		Memory.Free(b);
+		Memory.Free(a);
+	}
+
+	const double alloc_ns = timer.GetElapsedTimeInNanoSec() / count;
+
+	printf("  two vars: %.0f ns (arena), %.0f ns (Memory.Alloc)\n", arena_ns, alloc_ns);
+}
+
+void VarArenaTests()
+{
+	vm::var_arena* arena = new vm::var_arena();
+
+	TestNested(*arena);
+	TestOutOfOrder(*arena);
+	TestAlignment(*arena);
+	TestFull(*arena);
+	BenchVarPair(*arena);
+	arena->destroy();
+
+	TestClose();
+}
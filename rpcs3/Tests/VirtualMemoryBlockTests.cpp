@@ -0,0 +1,210 @@
+#include "stdafx.h"
+#include "Emu/Memory/Memory.h"
+#include "Tests.h"
+
+// an IO address space which doesn't start at 0, Map() returns 0 on failure
+static const u64 io_start = 0x40000000;
+static const u32 io_size = 0x10000000;
+
+// the mappings in the order of their creation, the first one containing an address wins (as with the old linear search)
+struct IoMapping
+{
+	u64 addr;
+	u64 real;
+	u32 size;
+};
+
+static bool ModelRealAddr(const std::vector<IoMapping>& model, u64 addr, u64& result)
+{
+	for (auto& m : model)
+	{
+		if (addr >= m.addr && addr < m.addr + m.size)
+		{
+			result = m.real + (addr - m.addr);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static u64 ModelMappedAddr(const std::vector<IoMapping>& model, u64 real)
+{
+	for (auto& m : model)
+	{
+		if (real >= m.real && real < m.real + m.size)
+		{
+			return m.addr + (real - m.real);
+		}
+	}
+
+	return 0;
+}
+
+// 1 MB aligned mappings are translated through the page tables, in both directions
+static void TestAligned(VirtualMemoryBlock& block)
+{
+	const u64 a = block.Map(0x20000000, 0x200000);
+	const u64 b = block.Map(0x30100000, 0x100000);
+
+	TEST_CHECK(a == io_start && b == a + 0x200000, "a=0x%llx, b=0x%llx", a, b);
+	TEST_CHECK(block.RealAddr(a + 0x1fffff) == 0x201fffff, "0x%llx", block.RealAddr(a + 0x1fffff));
+	TEST_CHECK(block.RealAddr(b + 0x1234) == 0x30101234, "0x%llx", block.RealAddr(b + 0x1234));
+	TEST_CHECK(block.getMappedAddress(0x30100010) == b + 0x10, "0x%llx", block.getMappedAddress(0x30100010));
+
+	u64 real;
+	TEST_CHECK(!block.getRealAddr(b + 0x100000, real), "the address after the last mapping is translated to 0x%llx", real);
+	TEST_CHECK(!block.getMappedAddress(0x20200000), "the real address after the first mapping is mapped");
+
+	u32 size = 0;
+	TEST_CHECK(block.UnmapAddress(a, size) && size == 0x200000, "size=0x%x", size);
+	TEST_CHECK(!block.getRealAddr(a, real) && !block.getMappedAddress(0x20000000), "the unmapped pages are still translated");
+	TEST_CHECK(block.UnmapRealAddress(0x30100000, size) && size == 0x100000, "size=0x%x", size);
+	TEST_CHECK(!block.IsMyAddress(b), "the unmapped pages are still translated");
+}
+
+// a real page mapped twice is found at its first IO address until that one is unmapped
+static void TestAliased(VirtualMemoryBlock& block)
+{
+	const u64 a = block.Map(0x20000000, 0x200000);
+	const u64 b = block.Map(0x20100000, 0x200000);
+
+	TEST_CHECK(block.getMappedAddress(0x20180000) == a + 0x180000, "0x%llx", block.getMappedAddress(0x20180000));
+
+	u32 size;
+	block.UnmapAddress(a, size);
+
+	TEST_CHECK(block.getMappedAddress(0x20180000) == b + 0x80000, "0x%llx", block.getMappedAddress(0x20180000));
+	TEST_CHECK(!block.getMappedAddress(0x20000000), "the real page isn't mapped any more");
+	TEST_CHECK(block.RealAddr(b + 0x100000) == 0x20200000, "0x%llx", block.RealAddr(b + 0x100000));
+
+	block.UnmapAddress(b, size);
+}
+
+// mappings which don't fit the page granularity are still found
+static void TestUnaligned(VirtualMemoryBlock& block)
+{
+	const u64 a = block.Map(0x20001000, 0x100000);
+	const u64 b = block.Map(0x20200000, 0x1000);
+
+	TEST_CHECK(block.RealAddr(a + 0xfff) == 0x20001fff, "0x%llx", block.RealAddr(a + 0xfff));
+	TEST_CHECK(block.getMappedAddress(0x20000fff) == 0, "0x%llx", block.getMappedAddress(0x20000fff));
+	TEST_CHECK(block.RealAddr(b + 0x10) == 0x20200010, "0x%llx", block.RealAddr(b + 0x10));
+	TEST_CHECK(!block.IsMyAddress(b + 0x1000), "the address after the small mapping is translated");
+
+	const u64 c = block.Map(0x20400000, 0x100000);
+
+	// c starts right after b, so it isn't page aligned either
+	TEST_CHECK(c == b + 0x1000 && block.getMappedAddress(0x204fffff) == c + 0xfffff, "c=0x%llx", c);
+
+	u32 size;
+	block.UnmapAddress(a, size);
+	block.UnmapAddress(b, size);
+	block.UnmapAddress(c, size);
+
+	TEST_CHECK(!block.IsMyAddress(a) && !block.IsMyAddress(c) && !block.getMappedAddress(0x20400000), "the unmapped ranges are still translated");
+}
+
+// random sequences of maps and unmaps, compared with the model
+static void TestRandom(VirtualMemoryBlock& block)
+{
+	std::minstd_rand rng(7);
+	std::vector<IoMapping> model;
+
+	for (u32 i = 0; i < 2000; i++)
+	{
+		if (model.size() > 48 || (model.size() && rng() % 3 == 0))
+		{
+			const size_t index = rng() % model.size();
+			u32 size = 0;
+
+			TEST_CHECK(block.UnmapAddress(model[index].addr, size) && size == model[index].size, "addr=0x%llx", model[index].addr);
+			model.erase(model.begin() + index);
+		}
+		else
+		{
+			// the real ranges of the aligned mappings overlap often, the unaligned ones are placed above them so that the page
+			// tables and the fallback search never disagree about the first match (the sizes keep the IO addresses aligned)
+			const u32 size = (1 + rng() % 3) << 20;
+			const u64 real = rng() % 8 ? (u64)(rng() % 64) << 20 : 0x80000000 + (rng() % 0x1000) * 0x1000;
+			const u64 addr = block.Map(real, size);
+
+			if (addr)
+			{
+				model.push_back({ addr, real, size });
+			}
+		}
+
+		for (u32 j = 0; j < 8; j++)
+		{
+			const u64 addr = io_start + rng() % io_size;
+			const u64 real = j % 2 ? (u64)(rng() % (64 << 20)) : 0x80000000 + rng() % 0x1400000;
+			u64 expected = 0, result = 0;
+
+			if (!TEST_CHECK(block.getRealAddr(addr, result) == ModelRealAddr(model, addr, expected) && result == expected, "addr=0x%llx: 0x%llx instead of 0x%llx", addr, result, expected) ||
+				!TEST_CHECK(block.getMappedAddress(real) == ModelMappedAddr(model, real), "real=0x%llx: 0x%llx", real, block.getMappedAddress(real)))
+			{
+				return;
+			}
+		}
+	}
+}
+
+// RSX command and texture addresses are translated for every access, with the 128 mappings of a typical game
+static void BenchLookup(VirtualMemoryBlock& block)
+{
+	std::vector<IoMapping> model;
+
+	for (u32 i = 0; i < 128; i++)
+	{
+		const u64 real = (u64)((i * 37) % 0x400) << 20;
+		model.push_back({ block.Map(real, 0x100000), real, 0x100000 });
+	}
+
+	const u32 count = 1000000;
+	u64 sum = 0, result = 0;
+
+	Timer timer;
+	timer.Start();
+
+	for (u32 i = 0; i < count; i++)
+	{
+		if (block.getRealAddr(io_start + (i * 0x9E3779B1u) % 0x8000000, result)) sum += result;
+	}
+
+	const double table_ns = timer.GetElapsedTimeInNanoSec() / count;
+	timer.Start();
+
+	for (u32 i = 0; i < count; i++)
+	{
+		if (ModelRealAddr(model, io_start + (i * 0x9E3779B1u) % 0x8000000, result)) sum -= result;
+	}
+
+	const double linear_ns = timer.GetElapsedTimeInNanoSec() / count;
+
+	TEST_CHECK(sum == 0, "the lookups disagree");
+	printf("  IO address lookup with 128 mappings: %.1f ns (page table), %.1f ns (linear search)\n", table_ns, linear_ns);
+
+	for (auto& m : model)
+	{
+		u32 size;
+		block.UnmapAddress(m.addr, size);
+	}
+}
+
+void VirtualMemoryBlockTests()
+{
+	// too big for the stack
+	std::unique_ptr<VirtualMemoryBlock> block(new VirtualMemoryBlock());
+	block->SetRange(io_start, io_size);
+
+	TestAligned(*block);
+	TestAliased(*block);
+	TestUnaligned(*block);
+	TestRandom(*block);
+	block->Delete();
+	block->SetRange(io_start, io_size);
+	BenchLookup(*block);
+
+	block->Delete();
+}
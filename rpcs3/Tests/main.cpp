@@ -0,0 +1,74 @@
+#include "stdafx.h"
+#include "Emu/Memory/Memory.h"
+#include "Tests.h"
+
+static u32 g_failures = 0;
+
+void tests::fail(const char* file, int line, const char* cond, const std::string& info)
+{
+	printf("  %s:%d: %s failed (%s)\n", file, line, cond, info.c_str());
+	g_failures++;
+}
+
+static const struct
+{
+	const char* name;
+	void(*func)();
+}
+g_tests[] =
+{
+	{ "DynamicMemoryBlock", DynamicMemoryBlockTests },
+	{ "VirtualMemoryBlock", VirtualMemoryBlockTests },
+	{ "RSXFifo", RSXFifoTests },
+	{ "PPCDecoderCache", PPCDecoderCacheTests },
+	{ "vfsLocalFile", vfsLocalFileTests },
+	{ "VarArena", VarArenaTests },
+	{ "Aesni", AesniTests },
+	{ "LZ", LZTests },
+};
+
+int main(int argc, char** argv)
+{
+	// Usage:
+	//   rpcs3_tests               Runs all tests
+	//   rpcs3_tests [name...]     Runs the tests whose names start with one of the arguments
+
+	// the tests use the PS3 memory layout
+	Memory.Init(Memory_PS3);
+
+	u32 failed = 0;
+
+	for (auto& test : g_tests)
+	{
+		bool selected = argc < 2;
+
+		for (int i = 1; i < argc; i++)
+		{
+			selected = selected || !strncmp(test.name, argv[i], strlen(argv[i]));
+		}
+
+		if (!selected) continue;
+
+		printf("%s\n", test.name);
+
+		const u32 failures = g_failures;
+		test.func();
+
+		if (g_failures != failures)
+		{
+			printf("%s: FAILED\n", test.name);
+			failed++;
+		}
+	}
+
+	Memory.Close();
+
+	if (failed)
+	{
+		printf("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	printf("All tests passed\n");
+	return 0;
+}
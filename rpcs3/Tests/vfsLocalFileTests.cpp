@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "Ini.h"
+#include "Emu/FS/vfsLocalFile.h"
+#include "Tests.h"
+
+// created in the working directory
+static const char* const test_path = "vfsLocalFileTests.tmp";
+
+static std::vector<u8> MakeFile(u32 size, u32 seed)
+{
+	std::vector<u8> data(size);
+
+	for (u32 i = 0; i < size; i++)
+	{
+		data[i] = (u8)((i * 0x9E3779B1u + seed) >> 24);
+	}
+
+	rFile f;
+	TEST_CHECK(f.Create(test_path, true) && f.Write(data.data(), size) == size, "can't create %s", test_path);
+	return data;
+}
+
+// the bytes at offset and the count the file must return
+static bool Matches(const std::vector<u8>& data, u64 offset, u64 count, const std::vector<u8>& buf, u64 res)
+{
+	const u64 expected = offset < data.size() ? std::min<u64>(count, data.size() - offset) : 0;
+	return res == expected && (!res || !memcmp(buf.data(), &data[(size_t)offset], (size_t)res));
+}
+
+// reads at the interesting offsets (both for a mapped file and for one too small to be mapped)
+static void TestReadAt(vfsLocalFile& f, const std::vector<u8>& data)
+{
+	const u64 size = data.size();
+	const u64 offsets[] = { 0, 1, 0xfff, 0x1000, size / 2, size - 0x10, size - 1, size, size + 0x1000 };
+	std::vector<u8> buf(0x2000);
+
+	for (auto offset : offsets)
+	{
+		const u64 res = f.ReadAt(offset, buf.data(), buf.size());
+		TEST_CHECK(Matches(data, offset, buf.size(), buf, res), "size=0x%llx, ReadAt(0x%llx) returned 0x%llx", size, offset, res);
+	}
+
+	TEST_CHECK(f.GetSize() == size, "GetSize() returned 0x%llx instead of 0x%llx", f.GetSize(), size);
+}
+
+// Read() continues at the position set by Seek(), in every seek mode
+static void TestSeekRead(vfsLocalFile& f, const std::vector<u8>& data)
+{
+	const u64 size = data.size();
+	std::vector<u8> buf(0x3000);
+
+	TEST_CHECK(f.Seek(0x100) == 0x100 && f.Tell() == 0x100, "Tell()=0x%llx", f.Tell());
+	TEST_CHECK(f.Read(buf.data(), 0x1000) == 0x1000 && !memcmp(buf.data(), &data[0x100], 0x1000), "Read() after Seek(vfsSeekSet)");
+	TEST_CHECK(f.Tell() == 0x1100, "Tell()=0x%llx after Read()", f.Tell());
+
+	TEST_CHECK(f.Seek(-0x200, vfsSeekCur) == 0xf00, "Tell()=0x%llx", f.Tell());
+	TEST_CHECK(f.Read(buf.data(), 0x10) == 0x10 && !memcmp(buf.data(), &data[0xf00], 0x10), "Read() after Seek(vfsSeekCur)");
+
+	// reading past the end returns the rest and moves to the end
+	TEST_CHECK(f.Seek(-0x800, vfsSeekEnd) == size - 0x800, "Tell()=0x%llx", f.Tell());
+	TEST_CHECK(f.Read(buf.data(), buf.size()) == 0x800 && !memcmp(buf.data(), &data[size - 0x800], 0x800), "Read() at the end");
+	TEST_CHECK(f.Tell() == size && f.Read(buf.data(), 0x10) == 0, "Tell()=0x%llx at the end", f.Tell());
+}
+
+// the mapping covers the original size, the data appended later is read from the file
+static void TestGrowth(vfsLocalFile& f, std::vector<u8>& data)
+{
+	const u64 size = data.size();
+	std::vector<u8> tail(0x1000, 0x5a);
+
+	{
+		rFile w;
+		TEST_CHECK(w.Open(test_path, rFile::read_write) && w.WriteAt(size, tail.data(), tail.size()) == tail.size(), "can't append to %s", test_path);
+	}
+
+	data.insert(data.end(), tail.begin(), tail.end());
+
+	std::vector<u8> buf(0x2000);
+	const u64 res = f.ReadAt(size - 0x800, buf.data(), buf.size());
+	TEST_CHECK(Matches(data, size - 0x800, buf.size(), buf, res), "ReadAt() across the old end returned 0x%llx", res);
+	TEST_CHECK(f.GetSize() == data.size(), "GetSize() returned 0x%llx", f.GetSize());
+}
+
+static void BenchSequential(const std::vector<u8>& data)
+{
+	std::vector<u8> buf(0x40000);
+	const u32 passes = 8;
+	double mb_per_s[2];
+
+	for (u32 mapped = 0; mapped < 2; mapped++)
+	{
+		Ini.HLEMappedFileReads.SetValue(mapped != 0);
+
+		vfsLocalFile f(nullptr);
+		f.Open(test_path, vfsRead);
+
+		Timer timer;
+		timer.Start();
+
+		for (u32 i = 0; i < passes; i++)
+		{
+			for (u64 offset = 0; offset < data.size(); offset += buf.size())
+			{
+				f.ReadAt(offset, buf.data(), buf.size());
+			}
+		}
+
+		timer.Stop();
+		mb_per_s[mapped] = passes * data.size() / timer.GetElapsedTimeInMicroSec();
+	}
+
+	printf("  256 KB reads: %.0f MB/s (rFile), %.0f MB/s (mapped)\n", mb_per_s[0], mb_per_s[1]);
+}
+
+void vfsLocalFileTests()
+{
+	const bool mapped_reads = Ini.HLEMappedFileReads.GetValue();
+	Ini.HLEMappedFileReads.SetValue(true);
+
+	// too small to be mapped, and mapped
+	for (u32 size : { 0x8000u, 0x800000u })
+	{
+		std::vector<u8> data = MakeFile(size, size);
+
+		vfsLocalFile f(nullptr);
+
+		if (!TEST_CHECK(f.Open(test_path, vfsRead), "can't open %s", test_path))
+		{
+			break;
+		}
+
+		TestReadAt(f, data);
+		TestSeekRead(f, data);
+		TestGrowth(f, data);
+		f.Close();
+
+		// files opened for writing aren't mapped, but read the same
+		TEST_CHECK(f.Open(test_path, vfsReadWrite), "can't open %s for writing", test_path);
+		TestReadAt(f, data);
+		f.Close();
+	}
+
+	BenchSequential(MakeFile(0x2000000, 0));
+
+	Ini.HLEMappedFileReads.SetValue(mapped_reads);
+	rRemoveFile(test_path);
+}